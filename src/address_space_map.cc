@@ -0,0 +1,182 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <errno.h>
+#include "utils.h"
+#include "address_space_map.h"
+
+//
+// static member
+//
+pthread_mutex_t address_space_map::m_mutex = PTHREAD_MUTEX_INITIALIZER;
+bool address_space_map::m_loaded = false;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+mapped_region_map_t &address_space_map::get_region_map(void)
+{
+	static mapped_region_map_t region_map;
+	return region_map;
+}
+
+void address_space_map::_parse_maps_line(const char *line, void *arg)
+{
+	// start-end perm offset dev inode [path]
+	mapped_region region;
+	char perm[5];
+	int path_pos = 0;
+	if (sscanf(line, "%lx-%lx %4s %*s %*s %*s %n", &region.start_addr,
+	           &region.end_addr, perm, &path_pos) != 3)
+		return;
+	region.executable = (strlen(perm) > 2 && perm[2] == 'x');
+	if (path_pos > 0) {
+		region.path = line + path_pos;
+		size_t len = region.path.find_first_of("\r\n");
+		if (len != string::npos)
+			region.path.erase(len);
+	}
+	mapped_region_map_t *region_map =
+	  static_cast<mapped_region_map_t *>(arg);
+	(*region_map)[region.start_addr] = region;
+}
+
+void address_space_map::load(void)
+{
+	if (m_loaded)
+		return;
+	static const char *map_file_path = "/proc/self/maps";
+	mapped_region_map_t &region_map = get_region_map();
+	region_map.clear();
+	if (!utils::read_one_line_loop(map_file_path, _parse_maps_line,
+	                               &region_map)) {
+		ROACH_ERR("Failed to read: %s (%d)\n", map_file_path, errno);
+		ROACH_ABORT();
+	}
+	m_loaded = true;
+}
+
+unsigned long
+address_space_map::find_free_region_upward(unsigned long near_addr,
+                                           unsigned long upper, size_t size)
+{
+	mapped_region_map_t &region_map = get_region_map();
+	unsigned long gap_start = near_addr;
+	mapped_region_map_itr it = region_map.upper_bound(near_addr);
+	if (it != region_map.begin()) {
+		mapped_region_map_itr prev = it;
+		--prev;
+		gap_start = max(gap_start, prev->second.end_addr);
+	}
+	while (gap_start < upper) {
+		unsigned long gap_end = upper;
+		if (it != region_map.end())
+			gap_end = min(gap_end, it->second.start_addr);
+		if (gap_end > gap_start && gap_end - gap_start >= size)
+			return gap_start;
+		if (it == region_map.end())
+			break;
+		gap_start = max(gap_start, it->second.end_addr);
+		++it;
+	}
+	return NOT_FOUND;
+}
+
+unsigned long
+address_space_map::find_free_region_downward(unsigned long near_addr,
+                                             unsigned long lower, size_t size)
+{
+	mapped_region_map_t &region_map = get_region_map();
+	unsigned long gap_end = near_addr;
+	mapped_region_map_itr it = region_map.upper_bound(near_addr);
+	while (gap_end > lower) {
+		if (it == region_map.begin()) {
+			if (gap_end - lower >= size)
+				return gap_end - size;
+			break;
+		}
+		--it;
+		const mapped_region &region = it->second;
+		if (region.end_addr < gap_end) {
+			unsigned long gap_start = max(region.end_addr, lower);
+			if (gap_end > gap_start && gap_end - gap_start >= size)
+				return gap_end - size;
+		}
+		gap_end = min(gap_end, region.start_addr);
+	}
+	return NOT_FOUND;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+void address_space_map::invalidate(void)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_loaded = false;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void address_space_map::add(unsigned long addr, size_t length,
+                            bool executable)
+{
+	pthread_mutex_lock(&m_mutex);
+	// The region will be read from /proc/self/maps if it isn't loaded.
+	if (m_loaded) {
+		mapped_region region;
+		region.start_addr = addr;
+		region.end_addr = addr + length;
+		region.executable = executable;
+		get_region_map()[addr] = region;
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool address_space_map::find_region(unsigned long addr, mapped_region *region)
+{
+	bool found = false;
+	pthread_mutex_lock(&m_mutex);
+	load();
+	mapped_region_map_t &region_map = get_region_map();
+	mapped_region_map_itr it = region_map.upper_bound(addr);
+	if (it != region_map.begin()) {
+		--it;
+		if (addr < it->second.end_addr) {
+			*region = it->second;
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return found;
+}
+
+void address_space_map::get_regions(mapped_region_list_t &region_list)
+{
+	pthread_mutex_lock(&m_mutex);
+	load();
+	mapped_region_map_t &region_map = get_region_map();
+	mapped_region_map_itr it = region_map.begin();
+	for (; it != region_map.end(); ++it)
+		region_list.push_back(it->second);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+unsigned long address_space_map::find_free_region(unsigned long lower,
+                                                  unsigned long upper,
+                                                  unsigned long near_addr,
+                                                  size_t size)
+{
+	// The region below is preferred, because the heap of the executable
+	// grows upward just after it.
+	pthread_mutex_lock(&m_mutex);
+	load();
+	unsigned long addr = NOT_FOUND;
+	if (near_addr > lower)
+		addr = find_free_region_downward(min(near_addr, upper), lower,
+		                                 size);
+	if (addr == NOT_FOUND && near_addr < upper)
+		addr = find_free_region_upward(max(near_addr, lower), upper,
+		                               size);
+	pthread_mutex_unlock(&m_mutex);
+	return addr;
+}
@@ -0,0 +1,57 @@
+#ifndef address_space_map_h
+#define address_space_map_h
+
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include <pthread.h>
+
+struct mapped_region {
+	unsigned long start_addr;
+	unsigned long end_addr;
+	bool          executable;
+	string        path; // empty for an anonymous region
+};
+
+typedef map<unsigned long, mapped_region> mapped_region_map_t; // key: start
+typedef mapped_region_map_t::iterator mapped_region_map_itr;
+typedef vector<mapped_region> mapped_region_list_t;
+
+/**
+ * Mapped regions of the process.
+ *
+ * /proc/self/maps is read only at the first query after the layout is
+ * changed by others, i.e. dlopen() and dlclose(). The regions mapped by
+ * cockroach itself are added without reading it. Lookups are done with
+ * the regions sorted by the address.
+ */
+class address_space_map {
+	static pthread_mutex_t m_mutex;
+	static bool m_loaded;
+
+	static mapped_region_map_t &get_region_map(void);
+	static void _parse_maps_line(const char *line, void *arg);
+	static void load(void);
+	static unsigned long find_free_region_upward(unsigned long near_addr,
+	                                             unsigned long upper,
+	                                             size_t size);
+	static unsigned long find_free_region_downward(unsigned long near_addr,
+	                                               unsigned long lower,
+	                                               size_t size);
+public:
+	static const unsigned long NOT_FOUND = 0;
+
+	static void invalidate(void);
+	static void add(unsigned long addr, size_t length,
+	                bool executable = true);
+	static bool find_region(unsigned long addr, mapped_region *region);
+	static void get_regions(mapped_region_list_t &region_list);
+	static unsigned long find_free_region(unsigned long lower,
+	                                      unsigned long upper,
+	                                      unsigned long near_addr,
+	                                      size_t size);
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+using namespace std;
+
+#include <errno.h>
+#include <unistd.h>
+#include <semaphore.h>
+
+#include "utils.h"
+#include "arg_capture_probe.h"
+#include "cockroach-arg-capture.h"
+#include "data_on_shm.h"
+
+struct arg_capture_data {
+	const arg_capture_program *program;
+	unsigned long target_addr;
+};
+
+static __thread uint8_t g_record_buf[ARG_CAPTURE_MAX_RECORD_SIZE];
+
+static bool parse_long(const string &word, long *value)
+{
+	if (word.empty())
+		return false;
+	char *endptr;
+	errno = 0;
+	*value = strtol(word.c_str(), &endptr, 0);
+	return errno == 0 && *endptr == '\0';
+}
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+bool arg_capture_program::parse_spec(const string &spec)
+{
+	vector<string> fields = utils::split(spec.c_str(), ':');
+	if (fields.size() < 2 || fields[0].size() != 1) {
+		ROACH_ERR("Invalid capture spec: %s\n", spec.c_str());
+		return false;
+	}
+	size_t num_fields = 0;
+	arg_capture_op op;
+	op.type = fields[0][0];
+	op.offset = 0;
+	op.size = 0;
+	if (op.type == ARG_CAPTURE_TYPE_INT)
+		num_fields = 2;
+	else if (op.type == ARG_CAPTURE_TYPE_MEM)
+		num_fields = 4;
+	else if (op.type == ARG_CAPTURE_TYPE_STR)
+		num_fields = 3;
+	if (fields.size() != num_fields) {
+		ROACH_ERR("Invalid capture spec: %s\n", spec.c_str());
+		return false;
+	}
+
+	long nth_arg;
+	if (!parse_long(fields[1], &nth_arg) || nth_arg < 1 || nth_arg > 255) {
+		ROACH_ERR("Invalid argument number: %s\n", spec.c_str());
+		return false;
+	}
+	op.nth_arg = nth_arg;
+
+	long size = sizeof(uint64_t);
+	if (op.type == ARG_CAPTURE_TYPE_MEM) {
+		long offset;
+		if (!parse_long(fields[2], &offset) ||
+		    offset < INT_MIN || offset > INT_MAX) {
+			ROACH_ERR("Invalid offset: %s\n", spec.c_str());
+			return false;
+		}
+		op.offset = offset;
+	}
+	if (op.type != ARG_CAPTURE_TYPE_INT) {
+		const string &size_def = fields[num_fields - 1];
+		if (!parse_long(size_def, &size) || size < 1 ||
+		    size > ARG_CAPTURE_MAX_RECORD_SIZE) {
+			ROACH_ERR("Invalid size: %s\n", spec.c_str());
+			return false;
+		}
+		op.size = size;
+	}
+
+	m_ops.push_back(op);
+	m_max_record_size += sizeof(arg_capture_item_header) + size;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+arg_capture_program::arg_capture_program(void)
+: m_max_record_size(sizeof(arg_capture_record_header))
+{
+}
+
+bool arg_capture_program::compile(const vector<string> &specs)
+{
+	if (specs.empty()) {
+		ROACH_ERR("No capture spec.\n");
+		return false;
+	}
+	for (size_t i = 0; i < specs.size(); i++) {
+		if (!parse_spec(specs[i]))
+			return false;
+	}
+	if (m_max_record_size > ARG_CAPTURE_MAX_RECORD_SIZE) {
+		ROACH_ERR("Too large record: %zd (max: %d)\n",
+		          m_max_record_size, ARG_CAPTURE_MAX_RECORD_SIZE);
+		return false;
+	}
+	return true;
+}
+
+size_t arg_capture_program::run(probe_arg_t *arg, unsigned long target_addr,
+                                uint8_t *buf) const
+{
+	arg_capture_record_header record_header;
+	record_header.target_addr = target_addr;
+	record_header.tid = utils::get_tid();
+	record_header.num_items = m_ops.size();
+	memcpy(buf, &record_header, sizeof(record_header));
+	uint8_t *ptr = buf + sizeof(record_header);
+
+	for (size_t i = 0; i < m_ops.size(); i++) {
+		const arg_capture_op &op = m_ops[i];
+		arg_capture_item_header item_header;
+		item_header.type = op.type;
+		item_header.nth_arg = op.nth_arg;
+		item_header.flags = 0;
+		item_header.reserved = 0;
+		item_header.offset = op.offset;
+		uint8_t *data = ptr + sizeof(item_header);
+
+		unsigned long value =
+		  cockroach_get_target_func_arg(arg, op.nth_arg);
+		if (op.type == ARG_CAPTURE_TYPE_INT) {
+			uint64_t value64 = value;
+			memcpy(data, &value64, sizeof(value64));
+			item_header.size = sizeof(value64);
+		} else if (op.type == ARG_CAPTURE_TYPE_MEM) {
+			size_t len = utils::read_memory(value + op.offset,
+			                                data, op.size);
+			if (len != op.size) {
+				item_header.flags |= ARG_CAPTURE_FLAG_FAULT;
+				len = 0;
+			}
+			item_header.size = len;
+		} else { // ARG_CAPTURE_TYPE_STR
+			size_t len = utils::read_memory(value, data, op.size);
+			if (len == 0)
+				item_header.flags |= ARG_CAPTURE_FLAG_FAULT;
+			item_header.size = strnlen((const char *)data, len);
+		}
+		memcpy(ptr, &item_header, sizeof(item_header));
+		ptr = data + item_header.size;
+	}
+	return ptr - buf;
+}
+
+// --------------------------------------------------------------------------
+// probes
+// --------------------------------------------------------------------------
+extern "C"
+void roach_arg_capture_probe_init(probe_init_arg_t *arg)
+{
+	arg_capture_data *data = new arg_capture_data();
+	data->program = static_cast<arg_capture_program *>(arg->priv_data);
+	data->target_addr = arg->target_addr;
+	arg->priv_data = data;
+}
+
+static void copy_record(size_t size, void *buf, void *priv)
+{
+	memcpy(buf, priv, size);
+}
+
+extern "C"
+void roach_arg_capture_probe(probe_arg_t *arg)
+{
+	arg_capture_data *data = static_cast<arg_capture_data *>(arg->priv_data);
+	size_t size = data->program->run(arg, data->target_addr, g_record_buf);
+	record_built_in_data_on_shm(COCKROACH_RECORD_ID_ARG_CAPTURE, size,
+	                            copy_record, g_record_buf);
+}
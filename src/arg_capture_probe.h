@@ -0,0 +1,50 @@
+#ifndef arg_capture_probe_h
+#define arg_capture_probe_h
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include "cockroach-probe.h"
+
+// One step of the capture program
+struct arg_capture_op {
+	uint8_t  type;    // ARG_CAPTURE_TYPE_*
+	uint8_t  nth_arg; // begins from one
+	int32_t  offset;
+	uint32_t size;    // max. size for ARG_CAPTURE_TYPE_STR
+};
+
+typedef vector<arg_capture_op> arg_capture_op_list_t;
+
+/**
+ * What the built-in argument capture probe records.
+ *
+ * The capture specs in the recipe are compiled into a list of ops when
+ * the recipe is parsed. The probe only walks the list, so no parsing is
+ * done in the target function.
+ *
+ *   i:N         the N-th argument as an integer
+ *   m:N:OFF:K   K bytes at (the N-th argument + OFF)
+ *   s:N:K       the string at the N-th argument (up to K bytes)
+ */
+class arg_capture_program {
+	arg_capture_op_list_t m_ops;
+	size_t                m_max_record_size;
+
+	bool parse_spec(const string &spec);
+public:
+	arg_capture_program(void);
+	bool compile(const vector<string> &specs);
+	size_t run(probe_arg_t *arg, unsigned long target_addr,
+	           uint8_t *buf) const;
+};
+
+extern "C"
+void roach_arg_capture_probe_init(probe_init_arg_t *arg);
+
+extern "C"
+void roach_arg_capture_probe(probe_arg_t *arg);
+
+#endif
@@ -0,0 +1,63 @@
+#include <cstdio>
+using namespace std;
+
+#include <errno.h>
+
+#include "utils.h"
+#include "call_frame_stack.h"
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW 4
+#endif // CLOCK_MONOTONIC_RAW
+
+static __thread call_frame g_frames[CALL_FRAME_STACK_DEPTH];
+static __thread int g_num_frames = 0;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+bool call_frame_stack::pop_frame(unsigned long stack_addr, struct timespec *t0)
+{
+	// Frames of deeper calls that have not exited normally (ex. longjmp()
+	// or an exception) are discarded. The stack grows downward.
+	while (g_num_frames > 0 &&
+	       g_frames[g_num_frames - 1].stack_addr < stack_addr)
+		g_num_frames--;
+	if (g_num_frames == 0 ||
+	    g_frames[g_num_frames - 1].stack_addr != stack_addr)
+		return false;
+	g_num_frames--;
+	*t0 = g_frames[g_num_frames].t0;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+bool call_frame_stack::push(probe_arg_t *arg)
+{
+	// Too deep recursion is not measured. The exit probe doesn't find
+	// the frame and just ignores it.
+	if (g_num_frames >= CALL_FRAME_STACK_DEPTH)
+		return false;
+	call_frame *frame = &g_frames[g_num_frames];
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &frame->t0) == -1) {
+		ROACH_ERR("Failed: clock_gettime: %d\n", errno);
+		return false;
+	}
+	frame->stack_addr = (unsigned long)&arg->func_ret_addr;
+	g_num_frames++;
+	return true;
+}
+
+bool call_frame_stack::pop(probe_arg_t *arg, struct timespec *t0)
+{
+	return pop_frame((unsigned long)&arg->func_ret_addr, t0);
+}
+
+bool call_frame_stack::pop_ret(probe_arg_t *arg, struct timespec *t0)
+{
+	// The return probe bridge pushes the original return address where
+	// the replaced one was, that is, at probe_ret_addr of the argument.
+	return pop_frame((unsigned long)&arg->probe_ret_addr, t0);
+}
@@ -0,0 +1,29 @@
+#ifndef call_frame_stack_h
+#define call_frame_stack_h
+
+#include <time.h>
+#include "cockroach-probe.h"
+
+#define CALL_FRAME_STACK_DEPTH 128
+
+struct call_frame {
+	unsigned long   stack_addr;
+	struct timespec t0;
+};
+
+/**
+ * Entry times of the functions being executed by the thread.
+ *
+ * They are pushed by the entry probe and popped by the exit probe (or the
+ * return probe). The stack address of the return address identifies the
+ * call, because it is the same at the entry and at the exit.
+ */
+class call_frame_stack {
+	static bool pop_frame(unsigned long stack_addr, struct timespec *t0);
+public:
+	static bool push(probe_arg_t *arg);
+	static bool pop(probe_arg_t *arg, struct timespec *t0);
+	static bool pop_ret(probe_arg_t *arg, struct timespec *t0);
+};
+
+#endif
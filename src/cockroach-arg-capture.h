@@ -0,0 +1,45 @@
+#ifndef cockroach_arg_capture_h
+#define cockroach_arg_capture_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Format of the data recorded by the built-in argument capture probe
+ * (COCKROACH_RECORD_ID_ARG_CAPTURE). A record consists of the header
+ * and 'num_items' items. Each item is an arg_capture_item_header followed
+ * by 'size' bytes. Items are not aligned, so they should be read with
+ * memcpy().
+ */
+#define ARG_CAPTURE_TYPE_INT 'i' /* the value of the argument */
+#define ARG_CAPTURE_TYPE_MEM 'm' /* the memory at the argument + offset */
+#define ARG_CAPTURE_TYPE_STR 's' /* the string at the argument */
+
+/* The item couldn't be read (ex. the pointer is invalid). */
+#define ARG_CAPTURE_FLAG_FAULT 0x01
+
+#define ARG_CAPTURE_MAX_RECORD_SIZE 4096
+
+struct arg_capture_record_header {
+	uint64_t target_addr;
+	uint32_t tid;
+	uint32_t num_items;
+};
+
+struct arg_capture_item_header {
+	uint8_t  type;
+	uint8_t  nth_arg;
+	uint8_t  flags;
+	uint8_t  reserved;
+	int32_t  offset; /* only for ARG_CAPTURE_TYPE_MEM */
+	uint32_t size;   /* the size of the captured data */
+};
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <map>
+using namespace std;
+
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "control_shm.h"
+
+typedef bool (*command_func_t)(vector<string> &args);
+typedef map<string, command_func_t> command_map_t;
+typedef command_map_t::iterator command_map_itr;
+
+static const int RELOAD_TIMEOUT_MS = 10 * 1000;
+
+static bool command_reload(vector<string> &args)
+{
+	if (args.empty()) {
+		printf("pid is not given.\n");
+		return false;
+	}
+	char *end;
+	pid_t pid = strtol(args[0].c_str(), &end, 10);
+	if (*end != '\0' || pid <= 0) {
+		printf("Invalid pid: %s\n", args[0].c_str());
+		return false;
+	}
+
+	// The target may be running in another directory.
+	string recipe_path;
+	if (args.size() >= 2) {
+		char path[PATH_MAX];
+		if (!realpath(args[1].c_str(), path)) {
+			printf("Failed to get the path: %s (%d)\n",
+			       args[1].c_str(), errno);
+			return false;
+		}
+		recipe_path = path;
+	}
+
+	control_shm shm;
+	if (!shm.open(pid)) {
+		printf("Failed to open the control shm of %d. "
+		       "Is COCKROACH_RELOAD_INTERVAL_MS set?\n", pid);
+		return false;
+	}
+	uint32_t generation = shm.request_reload(recipe_path);
+	int result, num_added, num_removed;
+	if (!shm.wait_done(generation, RELOAD_TIMEOUT_MS, &result,
+	                   &num_added, &num_removed)) {
+		printf("Timed out: the request (%u) is still pending.\n",
+		       generation);
+		return false;
+	}
+	if (result != 0) {
+		printf("Failed to reload the recipe. See the log of %d.\n",
+		       pid);
+		return false;
+	}
+	printf("reloaded: added: %d, removed: %d\n", num_added, num_removed);
+	return true;
+}
+
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("$ cockroach-control-tool command args\n");
+	printf("\n");
+	printf("*** Commands ***\n");
+	printf("reload pid [recipe_file]\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		print_usage();
+		return EXIT_SUCCESS;
+	}
+	command_map_t command_map;
+	command_map["reload"] = command_reload;
+
+	string command = argv[1];
+	command_map_itr it = command_map.find(command);
+	if (it == command_map.end()) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	vector<string> args;
+	for (int i = 2; i < argc; i++)
+		args.push_back(argv[i]);
+	if (!(*it->second)(args))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <map>
+using namespace std;
+
+#include <time.h>
+#include <errno.h>
+
+#include "disassembler.h"
+#include "decode_cache.h"
+#include "elf_reader.h"
+#include "probe.h"
+
+typedef map<string, size_t> opcode_count_map_t;
+typedef opcode_count_map_t::iterator opcode_count_map_itr;
+
+static const int DECODE_LOOPS = 10;
+static const int DEFAULT_SWEEP_LOOPS = 10;
+
+struct coverage_result {
+	size_t num_funcs;
+	size_t num_no_code;      // no size or not in an executable section
+	size_t num_rel32;        // can be probed with REL32
+	size_t num_abs64;        // can be probed with ABS64
+	size_t num_unsupported;  // has an instruction that can't be decoded
+	opcode_count_map_t unsupported_opcodes;
+	size_t code_size;        // total size of the decoded functions
+	double decode_elapsed;
+	double dry_run_elapsed;
+
+	// constructor
+	coverage_result(void);
+};
+
+coverage_result::coverage_result(void)
+: num_funcs(0),
+  num_no_code(0),
+  num_rel32(0),
+  num_abs64(0),
+  num_unsupported(0),
+  code_size(0),
+  decode_elapsed(0),
+  dry_run_elapsed(0)
+{
+}
+
+struct sweep_result {
+	size_t num_instr;
+	size_t num_bad_bytes;
+	double elapsed;
+};
+
+static double get_time(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		printf("Failed: clock_gettime: %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool is_prefix(uint8_t byte)
+{
+	switch (byte) {
+	case 0x26: case 0x2e: case 0x36: case 0x3e:
+	case 0x64: case 0x65: case 0x66: case 0x67:
+	case 0xf0: case 0xf2: case 0xf3:
+		return true;
+	}
+#ifdef __x86_64__
+	if (byte >= 0x40 && byte <= 0x4f) // REX
+		return true;
+#endif // __x86_64__
+	return false;
+}
+
+/**
+ * The opcode bytes (escape bytes included) of an instruction that cannot
+ * be decoded. Prefixes are skipped, so the same opcode is counted together.
+ */
+static string get_opcode_name(const uint8_t *code)
+{
+	int idx = 0;
+	while (idx < OPECODE_MAX_LENGTH - 1 && is_prefix(code[idx]))
+		idx++;
+	int length = 1;
+	if (code[idx] == 0x0f) {
+		length = 2;
+		if (code[idx + 1] == 0x38 || code[idx + 1] == 0x3a)
+			length = 3;
+	}
+	string name;
+	for (int i = 0; i < length; i++) {
+		char buf[4];
+		sprintf(buf, i == 0 ? "%02x" : " %02x", code[idx + i]);
+		name += buf;
+	}
+	return name;
+}
+
+/**
+ * Decode a whole function. Returns false when it has an instruction that
+ * cannot be decoded.
+ */
+static bool decode_func(const uint8_t *code, size_t size,
+                        coverage_result *result)
+{
+	size_t offset = 0;
+	while (offset < size) {
+		decoded_instr instr;
+		if (!disassembler::decode((uint8_t *)code + offset, &instr)) {
+			if (result)
+				result->unsupported_opcodes[
+				  get_opcode_name(code + offset)]++;
+			return false;
+		}
+		offset += instr.length;
+	}
+	return true;
+}
+
+static void measure(elf_reader *reader, coverage_result *result)
+{
+	elf_symbol_list_t sym_list;
+	reader->get_func_symbols(sym_list);
+
+	opecode_arena arena;
+	decode_cache cache;
+	decode_context ctx = {&arena, &cache};
+	double decode_elapsed = 0;
+	double dry_run_elapsed = 0;
+	elf_symbol_list_itr sym = sym_list.begin();
+	for (; sym != sym_list.end(); ++sym) {
+		result->num_funcs++;
+		const uint8_t *code = NULL;
+		if (sym->size)
+			code = reader->get_code(sym->value, sym->size);
+		if (!code) {
+			result->num_no_code++;
+			continue;
+		}
+		result->code_size += sym->size;
+
+		double t0 = get_time();
+		bool decoded = decode_func(code, sym->size, result);
+		for (int i = 1; i < DECODE_LOOPS; i++)
+			decode_func(code, sym->size, NULL);
+		decode_elapsed += get_time() - t0;
+		if (!decoded)
+			result->num_unsupported++;
+
+		// The same checks as the installation except the side code.
+		t0 = get_time();
+		probe rel32_probe(PROBE_TYPE_USER,
+		                  INSTALL_TYPE_OVERWRITE_REL32_JUMP);
+		if (rel32_probe.dry_run(sym->name, (uint8_t *)code,
+		                        sym->size, &ctx))
+			result->num_rel32++;
+		probe abs64_probe(PROBE_TYPE_USER,
+		                  INSTALL_TYPE_OVERWRITE_ABS64_JUMP);
+		if (abs64_probe.dry_run(sym->name, (uint8_t *)code,
+		                        sym->size, &ctx))
+			result->num_abs64++;
+		dry_run_elapsed += get_time() - t0;
+	}
+	result->decode_elapsed = decode_elapsed;
+	result->dry_run_elapsed = dry_run_elapsed;
+}
+
+static int decode_one(uint8_t *code)
+{
+	decoded_instr instr;
+	if (!disassembler::decode(code, &instr))
+		return 0;
+	return instr.length;
+}
+
+static int parse_one(uint8_t *code)
+{
+	opecode *op = disassembler::try_parse(code);
+	if (!op)
+		return 0;
+	int length = op->get_length();
+	delete op;
+	return length;
+}
+
+/**
+ * Decode the section from the top to the end (linear sweep). A byte that
+ * cannot be decoded is skipped.
+ */
+static void sweep(uint8_t *code, size_t size, int (*func)(uint8_t *),
+                  int loops, sweep_result *result)
+{
+	memset(result, 0, sizeof(*result));
+	double t0 = get_time();
+	for (int i = 0; i < loops; i++) {
+		size_t offset = 0;
+		while (offset < size) {
+			int length = (*func)(code + offset);
+			if (length == 0) {
+				result->num_bad_bytes++;
+				length = 1;
+			} else
+				result->num_instr++;
+			offset += length;
+		}
+	}
+	result->elapsed = get_time() - t0;
+}
+
+static void print_sweep_result(const char *name, size_t size, int loops,
+                               const sweep_result &result)
+{
+	double elapsed = result.elapsed > 0 ? result.elapsed : 1e-9;
+	printf("%-8s instr: %zd, bad bytes: %zd, time: %.3f s, "
+	       "%.1f Minstr/s, %.1f MB/s\n",
+	       name, result.num_instr / loops, result.num_bad_bytes / loops,
+	       result.elapsed, result.num_instr / elapsed / 1e6,
+	       (double)size * loops / elapsed / 1e6);
+}
+
+static bool measure_sweep(elf_reader *reader, const char *section_name,
+                          int loops)
+{
+	const uint8_t *data;
+	size_t size;
+	unsigned long addr;
+	if (!reader->get_section(section_name, &data, &size, &addr)) {
+		printf("Not found: %s\n", section_name);
+		return false;
+	}
+
+	// The decoder may read ahead a max. instruction length, so the code
+	// is copied to a buffer with padding.
+	static const size_t PADDING = 16;
+	uint8_t *code = new uint8_t[size + PADDING];
+	memcpy(code, data, size);
+	memset(code + size, 0x90, PADDING);
+	printf("%s: %s (addr: %lx, size: %zd), loops: %d\n",
+	       reader->get_path(), section_name, addr, size, loops);
+
+	sweep_result result;
+	sweep(code, size, decode_one, loops, &result);
+	print_sweep_result("decode", size, loops, result);
+	sweep(code, size, parse_one, loops, &result);
+	print_sweep_result("parse", size, loops, result);
+
+	delete [] code;
+	return true;
+}
+
+static double calc_percent(size_t num, size_t total)
+{
+	return total ? 100.0 * num / total : 0;
+}
+
+static void print_result(coverage_result &result)
+{
+	size_t num_funcs = result.num_funcs - result.num_no_code;
+	printf("functions: %zd (no code: %zd)\n",
+	       result.num_funcs, result.num_no_code);
+	printf("REL32: %zd / %zd (%.1f%%)\n", result.num_rel32, num_funcs,
+	       calc_percent(result.num_rel32, num_funcs));
+	printf("ABS64: %zd / %zd (%.1f%%)\n", result.num_abs64, num_funcs,
+	       calc_percent(result.num_abs64, num_funcs));
+	printf("unsupported: %zd / %zd (%.1f%%)\n",
+	       result.num_unsupported, num_funcs,
+	       calc_percent(result.num_unsupported, num_funcs));
+	opcode_count_map_itr it = result.unsupported_opcodes.begin();
+	for (; it != result.unsupported_opcodes.end(); ++it)
+		printf("  %-8s : %zd\n", it->first.c_str(), it->second);
+
+	double decode_elapsed =
+	  result.decode_elapsed > 0 ? result.decode_elapsed : 1e-9;
+	double dry_run_elapsed =
+	  result.dry_run_elapsed > 0 ? result.dry_run_elapsed : 1e-9;
+	printf("decode : %.1f MB/s, %.1f functions/s (size: %zd, loops: %d)\n",
+	       (double)result.code_size * DECODE_LOOPS / decode_elapsed / 1e6,
+	       num_funcs * DECODE_LOOPS / decode_elapsed,
+	       result.code_size, DECODE_LOOPS);
+	printf("dry run: %.1f functions/s\n", num_funcs / dry_run_elapsed);
+}
+
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("$ cockroach-coverage-tool elf_file [min_rel32_percent]\n");
+	printf("$ cockroach-coverage-tool --sweep elf_file [loops] [section]\n");
+	printf("\n");
+	printf("The exit status is failure when the percentage of the "
+	       "functions that can be\n"
+	       "probed with REL32 is less than min_rel32_percent.\n");
+	printf("\n");
+	printf("--sweep decodes the whole section (default: .text) from the "
+	       "top to the end\n"
+	       "loops times (default: %d) and shows the decoder throughput.\n",
+	       DEFAULT_SWEEP_LOOPS);
+	printf("\n");
+}
+
+static int command_sweep(int argc, char *argv[])
+{
+	if (argc < 3) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	int loops = DEFAULT_SWEEP_LOOPS;
+	if (argc >= 4) {
+		loops = strtol(argv[3], NULL, 10);
+		if (loops <= 0) {
+			printf("Invalid loops: %s\n", argv[3]);
+			return EXIT_FAILURE;
+		}
+	}
+	const char *section_name = (argc >= 5) ? argv[4] : ".text";
+
+	elf_reader *reader = elf_reader::get(argv[2]);
+	if (!reader) {
+		printf("Failed to read: %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	if (!measure_sweep(reader, section_name, loops))
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		print_usage();
+		return EXIT_SUCCESS;
+	}
+	if (strcmp(argv[1], "--sweep") == 0)
+		return command_sweep(argc, argv);
+
+	double min_percent = 0;
+	if (argc >= 3) {
+		char *end;
+		min_percent = strtod(argv[2], &end);
+		if (*end != '\0' || min_percent < 0 || min_percent > 100) {
+			printf("Invalid percentage: %s\n", argv[2]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	elf_reader *reader = elf_reader::get(argv[1]);
+	if (!reader) {
+		printf("Failed to read: %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	printf("%s\n", argv[1]);
+	coverage_result result;
+	measure(reader, &result);
+	print_result(result);
+
+	size_t num_funcs = result.num_funcs - result.num_no_code;
+	if (calc_percent(result.num_rel32, num_funcs) < min_percent) {
+		printf("REL32 coverage is less than %.1f%%\n", min_percent);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,4 +1,10 @@
+#include <dlfcn.h>
+#include <errno.h>
+
+#include "utils.h"
 #include "cockroach.h"
+#include "thread_filter.h"
+#include "dl_debug_hook.h"
 
 static cockroach roach_obj;
 
@@ -15,17 +21,53 @@ static cockroach roach_obj;
 extern "C"
 void *dlopen(const char *filename, int flag)
 {
+	sigset_t old_mask;
+	bool unblocked = dl_debug_hook::begin_loader_call(&old_mask);
 	void *handle = (*roach_obj.m_orig_dlopen)(filename, flag);
+	if (unblocked)
+		dl_debug_hook::end_loader_call(&old_mask);
 	if (handle == NULL)
 		return NULL;
 	return roach_obj.dlopen_hook(filename, flag, handle);
 }
 
 /**
- * just calling glibc dlclose().
+ * dlclose() wrapper to uninstall the probes in the unloaded library.
  */
 extern "C"
 int dlclose(void *handle) __THROW
 {
-	return (*roach_obj.m_orig_dlclose)(handle);
+	sigset_t old_mask;
+	bool unblocked = dl_debug_hook::begin_loader_call(&old_mask);
+	int ret = (*roach_obj.m_orig_dlclose)(handle);
+	if (unblocked)
+		dl_debug_hook::end_loader_call(&old_mask);
+	roach_obj.dlclose_hook();
+	return ret;
+}
+
+/**
+ * pthread_setname_np() wrapper to evaluate the thread filters again.
+ *
+ * The original function is resolved here if it isn't yet, because the
+ * constructors of the other libraries, which may name a thread, can run
+ * before that of roach_obj.
+ */
+extern "C"
+int pthread_setname_np(pthread_t thread, const char *name)
+{
+	pthread_setname_np_func_t orig = roach_obj.m_orig_pthread_setname_np;
+	if (!orig) {
+		orig = (pthread_setname_np_func_t)
+		  dlsym(RTLD_NEXT, "pthread_setname_np");
+		if (!orig) {
+			ROACH_ERR("Failed to call dlsym() for "
+			          "pthread_setname_np.\n");
+			return ENOSYS;
+		}
+		roach_obj.m_orig_pthread_setname_np = orig;
+	}
+	int ret = (*orig)(thread, name);
+	thread_filter::invalidate();
+	return ret;
 }
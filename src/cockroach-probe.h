@@ -9,6 +9,9 @@ extern "C" {
 #endif /* __cplusplus */
 
 #define COCKROACH_RECORD_ID_STRING 0xffff0000
+#define COCKROACH_RECORD_ID_ARG_CAPTURE 0xffff0001
+#define COCKROACH_RECORD_ID_STACK_CAPTURE 0xffff0002
+#define COCKROACH_RECORD_ID_STACK_MAP 0xffff0003
 #define COCKROACH_RECORD_ID_RESERVED_BEGIN COCKROACH_RECORD_ID_STRING
 
 #ifdef __x86_64__
@@ -59,7 +62,9 @@ struct probe_arg_t {
 
 struct probe_init_arg_t {
 	unsigned long target_addr;
-	void *priv_data; // set in init probe if needed.
+	// The data given with the probe (NULL for user probes) when the init
+	// probe is called. It can be replaced in init probe if needed.
+	void *priv_data;
 };
 
 typedef void (*probe_init_func_t)(probe_init_arg_t *t);
@@ -67,12 +72,91 @@ typedef void (*probe_func_t)(probe_arg_t *t);
 
 typedef void (*record_data_func_t)(size_t size, void *buf, void *priv);
 
+// filled by cockroach_reserve_record(s)(). The members are internal.
+struct cockroach_record_handle_t {
+	void *priv;
+	void *data;
+	size_t stride;
+	size_t num;
+};
+
 void cockroach_set_return_probe(probe_func_t probe, probe_arg_t *arg);
 void cockroach_record_data_on_shm(uint32_t id, size_t size, void *data);
 void
 cockroach_record_data_on_shm_with_func(uint32_t id, size_t size,
                                        record_data_func_t record_data_func,
                                        void *priv);
+
+/**
+ * Reserve a record on the data SHM to write the data in place.
+ *
+ * The data is written directly to the returned area instead of copying it
+ * from a buffer. The area is valid until cockroach_commit_record() is
+ * called with the handle. The record is counted when it is reserved, so it
+ * has to be written even if the probe has nothing to record.
+ *
+ * @param id A record ID. The reserved IDs can't be used.
+ * @param size The size of the data.
+ * @param handle A handle given to cockroach_commit_record().
+ * @return The address of the data or NULL for a reserved ID.
+ */
+void *cockroach_reserve_record(uint32_t id, size_t size,
+                               cockroach_record_handle_t *handle);
+
+/**
+ * Reserve num records of the same ID and size at once.
+ *
+ * The SHM is locked only once for all of them. The data of the n-th record
+ * is given by cockroach_get_reserved_record(). All of them have to be
+ * written before cockroach_commit_record() is called.
+ *
+ * @return The address of the data of the first record or NULL on error.
+ */
+void *cockroach_reserve_records(uint32_t id, size_t size, size_t num,
+                                cockroach_record_handle_t *handle);
+
+/**
+ * Get the address of the data of the n-th (from zero) reserved record.
+ */
+void *cockroach_get_reserved_record(cockroach_record_handle_t *handle,
+                                    size_t nth);
+
+/**
+ * Finish writing the reserved records. The data must not be touched after
+ * this.
+ */
+void cockroach_commit_record(cockroach_record_handle_t *handle);
+
+/**
+ * Allocate a slot of the per-thread scratch area.
+ *
+ * Each thread gets its own area of the slot, which is aligned to the cache
+ * line and zero-filled at the first access. It is typically called in the
+ * init probe and the slot is kept in the private data of the probe.
+ *
+ * The call is idempotent in the init probe: the init probe runs again for
+ * each function a pattern is expanded to and at each reinstall, and the
+ * n-th call in it returns the same slot for the same recipe line. So the
+ * functions of a pattern share the areas, while the other lines using the
+ * same probe get their own.
+ * A call outside of the init probe always allocates a new slot.
+ *
+ * @param size The size of the area (4096B or less).
+ * @return The slot or -1 on error.
+ */
+int cockroach_alloc_thread_scratch(size_t size);
+
+/**
+ * Get the scratch area of the calling thread for the slot.
+ *
+ * It is an index to a thread-local table except the first access in the
+ * thread, which carves the area from the thread-local arena.
+ *
+ * @param slot A slot given by cockroach_alloc_thread_scratch().
+ * @return The area or NULL on error.
+ */
+void *cockroach_get_thread_scratch(int slot);
+
 /**
  * Get the argumet of the hooked function.
  *
@@ -99,6 +183,35 @@ unsigned long cockroach_get_target_func_arg(probe_arg_t *arg, size_t nth);
  */
 unsigned long *cockroach_get_stack_addr_of_target_caller(probe_arg_t *arg);
 
+/**
+ * Get the return addresses of the call stack by walking the frame pointers.
+ *
+ * The first one is the return address of the target function, so the
+ * probe has to be installed at the top or at an exit of the function. Each
+ * frame is checked against the stack of the thread (or read without a
+ * fault when the stack is unknown), so a broken chain only ends the walk.
+ * Functions compiled without the frame pointer are skipped or end the walk.
+ *
+ * @param arg A probe_arg_t pointer
+ * @param addrs The buffer for the return addresses.
+ * @param max_depth The number of the elements of addrs.
+ * @return The number of the return addresses.
+ */
+int cockroach_capture_stack(probe_arg_t *arg, unsigned long *addrs,
+                            int max_depth);
+
+/**
+ * Copy the stack from the return address of the target function upward
+ * without a fault. It is used to unwind the stack offline when the frame
+ * pointers are missing.
+ *
+ * @param arg A probe_arg_t pointer
+ * @param buf The buffer for the stack.
+ * @param size The size of buf.
+ * @return The number of the copied bytes.
+ */
+size_t cockroach_copy_stack(probe_arg_t *arg, void *buf, size_t size);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
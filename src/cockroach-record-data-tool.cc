@@ -1,8 +1,11 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 using namespace std;
 
 #include <semaphore.h> 
@@ -12,17 +15,70 @@ using namespace std;
 #include <errno.h>
 #include <unistd.h> 
 #include <sys/types.h>
+#include <cxxabi.h>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
 #include "cockroach-probe.h"
+#include "cockroach-arg-capture.h"
+#include "cockroach-stack-capture.h"
 #include "data_on_shm.h"
+#include "elf_reader.h"
+#include "utils.h"
 
 typedef bool (*command_func_t)(vector<string> &args);
 typedef map<string, command_func_t> command_map_t;
 typedef command_map_t::iterator command_map_itr;
 
+typedef void (*item_func_t)(item_header_t *item, void *arg);
+
+struct list_option {
+	bool is_dump;
+	bool is_decode;
+};
+
+// an object of the target given by COCKROACH_RECORD_ID_STACK_MAP
+struct stack_map_entry {
+	uint32_t pid;
+	uint64_t addr;
+	uint64_t text_addr;
+	uint64_t text_length;
+	string   path;
+};
+
+typedef vector<stack_map_entry> stack_map_list_t;
+
+// the symbolized frames (the target first) and the count
+typedef map<vector<string>, size_t> stack_count_map_t;
+typedef stack_count_map_t::iterator stack_count_map_itr;
+typedef pair<size_t, const vector<string> *> stack_count_t;
+
+typedef map<pair<string, uint64_t>, string> symbol_cache_t;
+typedef symbol_cache_t::iterator symbol_cache_itr;
+
+// the function symbols of an object sorted by the address
+typedef map<string, elf_symbol_list_t> func_symbols_map_t;
+typedef func_symbols_map_t::iterator func_symbols_map_itr;
+
+struct stack_aggregator {
+	stack_map_list_t  maps;
+	symbol_cache_t    symbol_cache;
+	func_symbols_map_t func_symbols;
+	stack_count_map_t counts;
+	size_t            num_stacks;
+	size_t            num_broken;
+
+	// constructor
+	stack_aggregator(void);
+};
+
+stack_aggregator::stack_aggregator(void)
+: num_stacks(0),
+  num_broken(0)
+{
+}
+
 static bool command_reset(vector<string> &args)
 {
 	static const int FIRST_ALLOC_SHM_SIZE = sizeof(primary_header_t);
@@ -83,9 +139,9 @@ static bool command_info(vector<string> &args)
 	}
 
 	printf("ver. : %d\n", format_version);
-	printf("size : %"PRIu64"\n", shm_size);
-	printf("count: %"PRIu64"\n", count);
-	printf("index: %"PRIu64"\n", head_index);
+	printf("size : %" PRIu64 "\n", shm_size);
+	printf("count: %" PRIu64 "\n", count);
+	printf("index: %" PRIu64 "\n", head_index);
 
 	return true;
 }
@@ -102,9 +158,9 @@ check_data_size_consistency(primary_header_t *header_all_map,
 	item_header_tail_index = item_index + sizeof(item_header_t);
 	if (item_header_tail_index > shm_size) {
 		printf("Inconsitency data size: SHM may be broken: "
-		       "count: %"PRIu64"/%"PRIu64", "
+		       "count: %" PRIu64 "/%" PRIu64 ", "
 		       "item_header_tail_index: %ld, "
-		       "item_index: %ld, shm_size: %"PRIu64"\n",
+		       "item_index: %ld, shm_size: %" PRIu64 "\n",
 		       i, count, item_header_tail_index, item_index, shm_size);
 		return false;
 	}
@@ -113,9 +169,9 @@ check_data_size_consistency(primary_header_t *header_all_map,
 	item_data_tail_index = item_header_tail_index + item->size;
 	if (item_data_tail_index > shm_size) {
 		printf("Inconsitency data size: SHM may be broken: "
-		       "count: %"PRIu64"/%"PRIu64", "
+		       "count: %" PRIu64 "/%" PRIu64 ", "
 		       "item_data_tail_index: %ld, "
-		       "item_heder_index: %ld, shm_size: %"PRIu64"\n",
+		       "item_heder_index: %ld, shm_size: %" PRIu64 "\n",
 		       i, count, item_data_tail_index, item_index, shm_size);
 		return false;
 	}
@@ -130,19 +186,131 @@ static void dump_data(item_header_t *item)
 	printf("\n");
 }
 
-static bool command_list(vector<string> &args)
+static void decode_arg_capture_item(const arg_capture_item_header &item,
+                                    const uint8_t *data)
 {
-	bool is_dump = false;
-	for (size_t i = 0; i < args.size(); i++) {
-		string &arg = args[i];
-		if (arg == "--dump")
-			is_dump = true;
-		else {
-			printf("unknwon option: %s\n", arg.c_str());
-			return false;
+	if (item.type == ARG_CAPTURE_TYPE_MEM)
+		printf(" m%d%+d=", item.nth_arg, item.offset);
+	else
+		printf(" %c%d=", item.type, item.nth_arg);
+	if (item.flags & ARG_CAPTURE_FLAG_FAULT) {
+		printf("(fault)");
+		return;
+	}
+
+	if (item.type == ARG_CAPTURE_TYPE_INT) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		printf("0x%" PRIx64, value);
+	} else if (item.type == ARG_CAPTURE_TYPE_STR) {
+		printf("\"");
+		for (size_t i = 0; i < item.size; i++) {
+			if (isprint(data[i]) && data[i] != '"' && data[i] != '\\')
+				printf("%c", data[i]);
+			else
+				printf("\\x%02x", data[i]);
 		}
+		printf("\"");
+	} else {
+		for (size_t i = 0; i < item.size; i++)
+			printf("%s%02x", i == 0 ? "" : ":", data[i]);
+	}
+}
+
+static void decode_arg_capture(item_header_t *item)
+{
+	const uint8_t *data = (const uint8_t *)(item + 1);
+	const uint8_t *tail = data + item->size;
+	arg_capture_record_header header;
+	if (item->size < sizeof(header)) {
+		printf("(broken)\n");
+		return;
+	}
+	memcpy(&header, data, sizeof(header));
+	printf("%016" PRIx64 " %d", header.target_addr, header.tid);
+	const uint8_t *ptr = data + sizeof(header);
+	for (uint32_t i = 0; i < header.num_items; i++) {
+		arg_capture_item_header item_header;
+		if (ptr + sizeof(item_header) > tail)
+			break;
+		memcpy(&item_header, ptr, sizeof(item_header));
+		ptr += sizeof(item_header);
+		if (ptr + item_header.size > tail)
+			break;
+		decode_arg_capture_item(item_header, ptr);
+		ptr += item_header.size;
 	}
+	printf("\n");
+}
+
+static bool
+read_stack_capture(item_header_t *item, stack_capture_record_header *header,
+                   vector<uint64_t> &addrs)
+{
+	const uint8_t *data = (const uint8_t *)(item + 1);
+	if (item->size < sizeof(*header))
+		return false;
+	memcpy(header, data, sizeof(*header));
+	size_t addrs_size = header->depth * sizeof(uint64_t);
+	if (sizeof(*header) + addrs_size + header->raw_size > item->size)
+		return false;
+	addrs.resize(header->depth);
+	if (header->depth > 0)
+		memcpy(&addrs[0], data + sizeof(*header), addrs_size);
+	return true;
+}
+
+static bool read_stack_map(item_header_t *item, stack_map_entry *entry)
+{
+	const uint8_t *data = (const uint8_t *)(item + 1);
+	stack_map_record_header header;
+	if (item->size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (sizeof(header) + header.path_length > item->size)
+		return false;
+	entry->pid = header.pid;
+	entry->addr = header.addr;
+	entry->text_addr = header.text_addr;
+	entry->text_length = header.text_length;
+	entry->path.assign((const char *)data + sizeof(header),
+	                   header.path_length);
+	return true;
+}
 
+static void decode_stack_capture(item_header_t *item)
+{
+	stack_capture_record_header header;
+	vector<uint64_t> addrs;
+	if (!read_stack_capture(item, &header, addrs)) {
+		printf("(broken)\n");
+		return;
+	}
+	printf("%016" PRIx64 " %d %d", header.target_addr, header.pid,
+	       header.tid);
+	for (size_t i = 0; i < addrs.size(); i++)
+		printf(" %016" PRIx64, addrs[i]);
+	if (header.flags & STACK_CAPTURE_FLAG_TRUNCATED)
+		printf(" (truncated)");
+	if (header.flags & STACK_CAPTURE_FLAG_FAULT)
+		printf(" (fault)");
+	printf(" raw: %d\n", header.raw_size);
+}
+
+static void decode_stack_map(item_header_t *item)
+{
+	stack_map_entry entry;
+	if (!read_stack_map(item, &entry)) {
+		printf("(broken)\n");
+		return;
+	}
+	printf("%d %016" PRIx64 " %016" PRIx64 "-%016" PRIx64 " %s\n",
+	       entry.pid, entry.addr, entry.text_addr,
+	       entry.text_addr + entry.text_length, entry.path.c_str());
+}
+
+static bool for_each_item(item_func_t func, void *arg)
+{
 	int shm_fd;
 	primary_header_t *header = get_primary_header(&shm_fd);
 	if (header == NULL) {
@@ -168,7 +336,6 @@ static bool command_list(vector<string> &args)
 		return false;
 	}
 
-	// print data
 	primary_header_t *header_all_map = (primary_header_t *)ptr;
 	item_header_t *item = (item_header_t *)(header_all_map + 1);
 	for (uint64_t i = 0; i < count; i++) {
@@ -177,10 +344,7 @@ static bool command_list(vector<string> &args)
 		                                       shm_size, i, count);
 		if (!chk)
 			return false;
-		// print data
-		printf("%08x %zd\n", item->id, item->size);
-		if (is_dump)
-			dump_data(item);
+		(*func)(item, arg);
 		item = (item_header_t *)
 		       ((uint8_t *)item + sizeof(item_header_t) + item->size);
 	}
@@ -188,6 +352,202 @@ static bool command_list(vector<string> &args)
 	return true;
 }
 
+static void print_item(item_header_t *item, void *arg)
+{
+	list_option *option = static_cast<list_option *>(arg);
+	printf("%08x %zd\n", item->id, item->size);
+	if (option->is_decode && item->id == COCKROACH_RECORD_ID_ARG_CAPTURE)
+		decode_arg_capture(item);
+	else if (option->is_decode &&
+	         item->id == COCKROACH_RECORD_ID_STACK_CAPTURE)
+		decode_stack_capture(item);
+	else if (option->is_decode &&
+	         item->id == COCKROACH_RECORD_ID_STACK_MAP)
+		decode_stack_map(item);
+	else if (option->is_dump)
+		dump_data(item);
+}
+
+static bool command_list(vector<string> &args)
+{
+	list_option option;
+	option.is_dump = false;
+	option.is_decode = false;
+	for (size_t i = 0; i < args.size(); i++) {
+		string &arg = args[i];
+		if (arg == "--dump")
+			option.is_dump = true;
+		else if (arg == "--decode")
+			option.is_decode = true;
+		else {
+			printf("unknwon option: %s\n", arg.c_str());
+			return false;
+		}
+	}
+	return for_each_item(print_item, &option);
+}
+
+/**
+ * The latest object that has the address in the process. An address can be
+ * reused after dlclose(). The objects of another process are used if none
+ * is found, because a child process has the objects of the parent.
+ */
+static const stack_map_entry *
+find_stack_map(const stack_map_list_t &maps, uint32_t pid, uint64_t addr)
+{
+	const stack_map_entry *found = NULL;
+	for (size_t i = maps.size(); i > 0; i--) {
+		const stack_map_entry &entry = maps[i - 1];
+		if (addr < entry.text_addr ||
+		    addr >= entry.text_addr + entry.text_length)
+			continue;
+		if (entry.pid == pid)
+			return &entry;
+		if (!found)
+			found = &entry;
+	}
+	return found;
+}
+
+static const elf_symbol_list_t &
+get_func_symbols(stack_aggregator *aggr, const string &path)
+{
+	func_symbols_map_itr it = aggr->func_symbols.find(path);
+	if (it != aggr->func_symbols.end())
+		return it->second;
+
+	// A pseudo object such as [vdso] has no file.
+	elf_symbol_list_t &sym_list = aggr->func_symbols[path];
+	if (!utils::is_absolute_path(path.c_str()))
+		return sym_list;
+	elf_reader *reader = elf_reader::get(path.c_str());
+	if (reader)
+		reader->get_func_symbols(sym_list);
+	return sym_list;
+}
+
+static bool cmp_symbol_value(const elf_symbol &a, const elf_symbol &b)
+{
+	return a.value < b.value;
+}
+
+static string lookup_symbol(stack_aggregator *aggr, const string &path,
+                            uint64_t offset)
+{
+	const elf_symbol_list_t &sym_list = get_func_symbols(aggr, path);
+	elf_symbol key;
+	key.value = offset;
+	elf_symbol_list_t::const_iterator it =
+	  upper_bound(sym_list.begin(), sym_list.end(), key, cmp_symbol_value);
+	if (it == sym_list.begin())
+		return "";
+	const elf_symbol &sym = *(--it);
+	if (offset >= sym.value + sym.size)
+		return "";
+	int status;
+	char *demangled = abi::__cxa_demangle(sym.name, NULL, NULL, &status);
+	string name = demangled ? demangled : sym.name;
+	free(demangled);
+	char buf[32];
+	sprintf(buf, "+0x%" PRIx64, offset - sym.value);
+	return name + buf;
+}
+
+static string symbolize(stack_aggregator *aggr, uint32_t pid, uint64_t addr,
+                        bool is_ret_addr)
+{
+	char buf[32];
+	const stack_map_entry *entry = find_stack_map(aggr->maps, pid, addr);
+	if (!entry) {
+		sprintf(buf, "0x%016" PRIx64, addr);
+		return buf;
+	}
+
+	// A return address is the next of the call, which can be the head
+	// of another function when the call is the last instruction.
+	uint64_t offset = addr - entry->addr;
+	uint64_t lookup_offset = is_ret_addr ? offset - 1 : offset;
+	pair<string, uint64_t> key(entry->path, lookup_offset);
+	symbol_cache_itr it = aggr->symbol_cache.find(key);
+	if (it == aggr->symbol_cache.end()) {
+		string name = lookup_symbol(aggr, entry->path, lookup_offset);
+		if (!name.empty() && is_ret_addr) {
+			// The offset is of the return address.
+			size_t pos = name.rfind("+0x");
+			uint64_t sym_offset =
+			  strtoull(name.c_str() + pos + 3, NULL, 16);
+			sprintf(buf, "+0x%" PRIx64, sym_offset + 1);
+			name = name.substr(0, pos) + buf;
+		}
+		if (name.empty()) {
+			sprintf(buf, "+0x%" PRIx64, offset);
+			name = buf;
+		}
+		name += " (" + utils::get_basename(entry->path.c_str()) + ")";
+		it = aggr->symbol_cache.insert(make_pair(key, name)).first;
+	}
+	return it->second;
+}
+
+static void aggregate_item(item_header_t *item, void *arg)
+{
+	stack_aggregator *aggr = static_cast<stack_aggregator *>(arg);
+	if (item->id == COCKROACH_RECORD_ID_STACK_MAP) {
+		stack_map_entry entry;
+		if (read_stack_map(item, &entry))
+			aggr->maps.push_back(entry);
+		return;
+	}
+	if (item->id != COCKROACH_RECORD_ID_STACK_CAPTURE)
+		return;
+
+	stack_capture_record_header header;
+	vector<uint64_t> addrs;
+	if (!read_stack_capture(item, &header, addrs)) {
+		aggr->num_broken++;
+		return;
+	}
+	vector<string> frames;
+	frames.push_back(symbolize(aggr, header.pid, header.target_addr,
+	                           false));
+	for (size_t i = 0; i < addrs.size(); i++)
+		frames.push_back(symbolize(aggr, header.pid, addrs[i], true));
+	if (header.flags & STACK_CAPTURE_FLAG_TRUNCATED)
+		frames.push_back("(truncated)");
+	aggr->counts[frames]++;
+	aggr->num_stacks++;
+}
+
+static bool cmp_stack_count(const stack_count_t &a, const stack_count_t &b)
+{
+	return a.first > b.first;
+}
+
+static bool command_stacks(vector<string> &args)
+{
+	stack_aggregator aggr;
+	if (!for_each_item(aggregate_item, &aggr))
+		return false;
+
+	// The most frequent stack first
+	vector<stack_count_t> stacks;
+	stack_count_map_itr it = aggr.counts.begin();
+	for (; it != aggr.counts.end(); ++it)
+		stacks.push_back(stack_count_t(it->second, &it->first));
+	stable_sort(stacks.begin(), stacks.end(), cmp_stack_count);
+
+	printf("stacks: %zd (distinct: %zd, broken: %zd)\n",
+	       aggr.num_stacks, stacks.size(), aggr.num_broken);
+	for (size_t i = 0; i < stacks.size(); i++) {
+		const vector<string> &frames = *stacks[i].second;
+		printf("\ncount: %zd\n", stacks[i].first);
+		for (size_t j = 0; j < frames.size(); j++)
+			printf("  %s%s\n", j == 0 ? "" : "<- ",
+			       frames[j].c_str());
+	}
+	return true;
+}
+
 static void print_usage(void)
 {
 	printf("Usage:\n");
@@ -198,7 +558,8 @@ static void print_usage(void)
 	printf("reset\n");
 	printf("remove\n");
 	printf("info\n");
-	printf("list [--dump]\n");
+	printf("list [--dump] [--decode]\n");
+	printf("stacks\n");
 	printf("\n");
 }
 
@@ -213,6 +574,7 @@ int main(int argc, char *argv[])
 	command_map["info"] = command_info;
 	command_map["list"] = command_list;
 	command_map["remove"] = command_remove;
+	command_map["stacks"] = command_stacks;
 
 	string command = argv[1];
 	command_map_itr it = command_map.find(command);
@@ -0,0 +1,231 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <map>
+using namespace std;
+
+#include <semaphore.h> 
+#include <sys/mman.h> 
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h> 
+#include <sys/types.h>
+
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#include "cockroach-ret-value.h"
+
+typedef bool (*command_func_t)(vector<string> &args);
+typedef map<string, command_func_t> command_map_t;
+typedef command_map_t::iterator command_map_itr;
+
+static const char *class_names[] = {"neg", "zero", "pos"};
+
+static bool command_reset(vector<string> &args)
+{
+	uint32_t max_tables = RET_VALUE_SHM_DEFAULT_MAX_TABLES;
+	if (!args.empty()) {
+		max_tables = strtoul(args[0].c_str(), NULL, 10);
+		if (max_tables == 0) {
+			printf("Invalid number of tables: %s\n",
+			       args[0].c_str());
+			return false;
+		}
+	}
+	size_t shm_size = cockroach_calc_ret_value_shm_size(max_tables);
+
+	int shm_fd = shm_open(COCKROACH_RET_VALUE_SHM_NAME,
+	                      O_RDWR|O_CREAT, 0666);
+	if (shm_fd == -1) {
+		printf("Failed to open shm: %d\n", errno);
+		return false;
+	}
+	// The tables are cleared when they are allocated.
+	if (ftruncate(shm_fd, shm_size) == -1) {
+		printf("Failed to truncate shm: %d\n", errno);
+		return false;
+	}
+
+	void *ptr = mmap(NULL, sizeof(ret_value_shm_header),
+	                 PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (ptr == MAP_FAILED) {
+		printf("Failed to map shm: %d\n", errno);
+		return false;
+	}
+	ret_value_shm_header *header = (ret_value_shm_header *)ptr;
+	static const int shared = 1;
+	sem_init(&header->sem, shared, 1);
+	header->format_version = RET_VALUE_SHM_FORMAT_VERSION;
+	header->max_tables = max_tables;
+	header->num_tables = 0;
+
+	printf("reset shm: success\n");
+	return true;
+}
+
+static bool command_remove(vector<string> &args)
+{
+	if (shm_unlink(COCKROACH_RET_VALUE_SHM_NAME) == -1) {
+		printf("Failed to unlink shm: %d\n", errno);
+		return false;
+	}
+	printf("remove shm: success\n");
+	return true;
+}
+
+static ret_value_shm_header *map_and_get_num_tables(uint32_t *num_tables)
+{
+	int shm_fd;
+	ret_value_shm_header *header = cockroach_map_ret_value_shm(&shm_fd);
+	if (header == NULL) {
+		printf("Failed to map shm: %d\n", errno);
+		return NULL;
+	}
+
+	if (cockroach_lock_ret_value_shm(header) == -1) {
+		printf("Failed to lock shm: %d\n", errno);
+		return NULL;
+	}
+	*num_tables = header->num_tables;
+	if (cockroach_unlock_ret_value_shm(header) == -1) {
+		printf("Failed to unlock shm: %d\n", errno);
+		return NULL;
+	}
+	return header;
+}
+
+static bool command_info(vector<string> &args)
+{
+	uint32_t num_tables;
+	ret_value_shm_header *header = map_and_get_num_tables(&num_tables);
+	if (!header)
+		return false;
+
+	printf("ver.  : %d\n", header->format_version);
+	printf("tables: %u/%u\n", num_tables, header->max_tables);
+	return true;
+}
+
+static void print_bucket(const ret_value_table *table,
+                         const ret_value_bucket *bucket, const char *label)
+{
+	uint64_t count = bucket->count;
+	if (count == 0)
+		return;
+	printf("%016" PRIx64 " %d %s %" PRIu64 " %" PRIu64 " %" PRIu64
+	       " %" PRIu64 "\n",
+	       table->target_addr, table->pid, label, count,
+	       bucket->sum_ns / count, bucket->min_ns, bucket->max_ns);
+}
+
+/**
+ * Merge the buckets of the same value. A value can get more than one
+ * bucket when a bucket is being claimed by another thread.
+ * @return false if the bucket has been merged into a preceding one.
+ */
+static bool merge_value_buckets(const ret_value_table *table, int idx,
+                                ret_value_bucket *merged)
+{
+	const ret_value_bucket *bucket = &table->buckets[idx];
+	for (int i = 0; i < idx; i++) {
+		const ret_value_bucket *other = &table->buckets[i];
+		if (other->state == RET_VALUE_BUCKET_USED &&
+		    other->value == bucket->value)
+			return false;
+	}
+	*merged = *bucket;
+	for (int i = idx + 1; i < RET_VALUE_NUM_BUCKETS; i++) {
+		const ret_value_bucket *other = &table->buckets[i];
+		if (other->state != RET_VALUE_BUCKET_USED ||
+		    other->value != bucket->value || other->count == 0)
+			continue;
+		if (merged->count == 0 || other->min_ns < merged->min_ns)
+			merged->min_ns = other->min_ns;
+		if (other->max_ns > merged->max_ns)
+			merged->max_ns = other->max_ns;
+		merged->count += other->count;
+		merged->sum_ns += other->sum_ns;
+	}
+	return true;
+}
+
+static bool command_list(vector<string> &args)
+{
+	uint32_t num_tables;
+	ret_value_shm_header *header = map_and_get_num_tables(&num_tables);
+	if (!header)
+		return false;
+
+	// target_addr pid value count avg_ns min_ns max_ns
+	for (uint32_t i = 0; i < num_tables; i++) {
+		const ret_value_table *table =
+		  cockroach_get_ret_value_table(header, i);
+		for (int j = 0; j < RET_VALUE_NUM_BUCKETS; j++) {
+			const ret_value_bucket *bucket = &table->buckets[j];
+			if (bucket->state != RET_VALUE_BUCKET_USED)
+				continue;
+			char label[32];
+			ret_value_bucket merged;
+			if (table->mode == RET_VALUE_MODE_CLASS) {
+				if (j >= 3)
+					break;
+				strcpy(label, class_names[j]);
+			} else {
+				if (!merge_value_buckets(table, j, &merged))
+					continue;
+				bucket = &merged;
+				snprintf(label, sizeof(label), "%" PRId64,
+				         bucket->value);
+			}
+			print_bucket(table, bucket, label);
+		}
+		print_bucket(table, &table->other, "other");
+	}
+	return true;
+}
+
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("$ cockroach-ret-value-tool command args\n");
+	printf("\n");
+	printf("*** Commands ***\n");
+	printf("reset [max_tables]\n");
+	printf("remove\n");
+	printf("info\n");
+	printf("list\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		print_usage();
+		return EXIT_SUCCESS;
+	}
+	command_map_t command_map;
+	command_map["reset"] = command_reset;
+	command_map["info"] = command_info;
+	command_map["list"] = command_list;
+	command_map["remove"] = command_remove;
+
+	string command = argv[1];
+	command_map_itr it = command_map.find(command);
+	if (it == command_map.end()) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	vector<string> args;
+	for (int i = 2; i < argc; i++)
+		args.push_back(argv[i]);
+	if (!(*it->second)(args))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "cockroach-ret-value.h"
+
+extern "C"
+size_t cockroach_calc_ret_value_shm_size(uint32_t max_tables)
+{
+	return sizeof(ret_value_shm_header) +
+	       sizeof(ret_value_table) * max_tables;
+}
+
+extern "C"
+ret_value_table *
+cockroach_get_ret_value_table(ret_value_shm_header *header, uint32_t idx)
+{
+	ret_value_table *tables = (ret_value_table *)(header + 1);
+	return &tables[idx];
+}
+
+extern "C"
+int cockroach_lock_ret_value_shm(ret_value_shm_header *header)
+{
+top:
+	int ret = sem_wait(&header->sem);
+	if (ret == 0)
+		return 0;
+	if (errno == EINTR)
+		goto top;
+	return -1;
+}
+
+extern "C"
+int cockroach_unlock_ret_value_shm(ret_value_shm_header *header)
+{
+	int ret = sem_post(&header->sem);
+	if (ret == 0)
+		return 0;
+	return -1;
+}
+
+/**
+ * Map the entire shm that has been initialized by the tool.
+ */
+extern "C"
+ret_value_shm_header *cockroach_map_ret_value_shm(int *fd)
+{
+	*fd = shm_open(COCKROACH_RET_VALUE_SHM_NAME, O_RDWR, 0666);
+	if (*fd == -1)
+		return NULL;
+
+	struct stat st;
+	if (fstat(*fd, &st) == -1)
+		return NULL;
+	if ((size_t)st.st_size < sizeof(ret_value_shm_header)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	void *ptr = mmap(NULL, st.st_size,
+	                 PROT_READ|PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+	ret_value_shm_header *header = (ret_value_shm_header *)ptr;
+	if (cockroach_calc_ret_value_shm_size(header->max_tables) >
+	    (size_t)st.st_size) {
+		munmap(ptr, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	return header;
+}
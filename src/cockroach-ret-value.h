@@ -0,0 +1,75 @@
+#ifndef cockroach_ret_value_h
+#define cockroach_ret_value_h
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * The return values are aggregated in a table per probe (and process).
+ * In the CLASS mode, buckets[0], [1] and [2] are for negative, zero and
+ * positive values respectively. In the VALUE mode, a bucket is assigned to
+ * each distinct value in order of appearance. The values that don't get
+ * a bucket are counted in 'other'.
+ */
+#define RET_VALUE_MODE_CLASS 1
+#define RET_VALUE_MODE_VALUE 2
+
+#define RET_VALUE_NUM_BUCKETS 32
+
+#define RET_VALUE_BUCKET_FREE     0
+#define RET_VALUE_BUCKET_CLAIMING 1
+#define RET_VALUE_BUCKET_USED     2
+
+struct ret_value_bucket
+{
+	volatile uint32_t state;
+	uint32_t reserved;
+	int64_t  value;
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+};
+
+struct ret_value_table
+{
+	uint64_t target_addr;
+	pid_t    pid;
+	uint32_t mode;
+	uint32_t value_bits; /* the width of the return value: 32 or 64 */
+	uint32_t reserved;
+	struct ret_value_bucket buckets[RET_VALUE_NUM_BUCKETS];
+	struct ret_value_bucket other;
+};
+
+struct ret_value_shm_header
+{
+	int format_version;
+	sem_t sem;
+	uint32_t max_tables;
+	uint32_t num_tables;
+};
+
+#define RET_VALUE_SHM_FORMAT_VERSION 1
+#define RET_VALUE_SHM_DEFAULT_MAX_TABLES 1024
+
+#define COCKROACH_RET_VALUE_SHM_NAME "/cockroach_ret_value"
+
+size_t cockroach_calc_ret_value_shm_size(uint32_t max_tables);
+struct ret_value_table *
+cockroach_get_ret_value_table(struct ret_value_shm_header *header,
+                              uint32_t idx);
+int cockroach_lock_ret_value_shm(struct ret_value_shm_header *header);
+int cockroach_unlock_ret_value_shm(struct ret_value_shm_header *header);
+struct ret_value_shm_header *cockroach_map_ret_value_shm(int *fd);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef cockroach_stack_capture_h
+#define cockroach_stack_capture_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Format of the data recorded by the built-in stack capture probe
+ * (COCKROACH_RECORD_ID_STACK_CAPTURE). A record consists of the header,
+ * 'depth' return addresses (uint64_t) and 'raw_size' bytes of the stack
+ * from 'stack_addr'. The first address is the return address of the
+ * target function. The record is not padded, so it should be read with
+ * memcpy().
+ */
+#define STACK_CAPTURE_MAX_DEPTH    128
+#define STACK_CAPTURE_MAX_RAW_SIZE (64 * 1024)
+
+/* The walk was stopped at the max. depth. */
+#define STACK_CAPTURE_FLAG_TRUNCATED 0x01
+/* A frame couldn't be read. */
+#define STACK_CAPTURE_FLAG_FAULT     0x02
+
+struct stack_capture_record_header {
+	uint64_t target_addr;
+	uint64_t stack_addr;  /* the address of the return address */
+	uint64_t frame_addr;  /* the frame pointer at the probe */
+	uint32_t pid;
+	uint32_t tid;
+	uint16_t depth;
+	uint16_t flags;
+	uint32_t raw_size;
+};
+
+/*
+ * A loaded object of the process (COCKROACH_RECORD_ID_STACK_MAP). It is
+ * recorded for each object loaded while the stack capture is used, so the
+ * records given before a stack record tell where the addresses are. The
+ * header is followed by 'path_length' bytes of the path without '\0'.
+ */
+struct stack_map_record_header {
+	uint64_t addr;        /* the load bias */
+	uint64_t text_addr;
+	uint64_t text_length;
+	uint32_t pid;
+	uint32_t path_length;
+};
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -1,10 +1,15 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
+#include <set>
+#include <sstream>
+#include <algorithm>
 using namespace std;
 
 #include <unistd.h>
+#include <time.h>
 #include <pthread.h>
 #include <errno.h>
 #include <dlfcn.h>
@@ -12,6 +17,16 @@ using namespace std;
 #include "cockroach.h"
 #include "utils.h"
 #include "time_measure_probe.h"
+#include "arg_capture_probe.h"
+#include "ret_value_probe.h"
+#include "cockroach-ret-value.h"
+#include "probe_installer.h"
+#include "symbol_pattern.h"
+#include "address_space_map.h"
+#include "dl_debug_hook.h"
+#include "side_code_area_manager.h"
+#include "thread_filter.h"
+#include "cockroach-stack-capture.h"
 
 
 // probe type, install type, target lib, and address
@@ -21,13 +36,87 @@ static const size_t NUM_RECIPE_MIN_USER_PROBE_TOKENS = 2; // probe_lib and symbo
 class not_target_exe_exception {
 };
 
+class recipe_error_exception {
+};
+
+// deletes the probes of a line when an error is thrown while it's parsed
+struct line_probes_guard {
+	probe        *a_probe;
+	probe_list_t &line_probes;
+	bool          released;
+
+	// constructor
+	line_probes_guard(probe *_a_probe, probe_list_t &_line_probes);
+	~line_probes_guard();
+	void release(void);
+};
+
+struct recipe_parse_arg {
+	cockroach          *obj;
+	recipe_line_list_t *line_list;
+};
+
+static bool is_pre_init_hook_requested(void)
+{
+	const char *env = getenv("COCKROACH_DLOPEN_PRE_INIT");
+	return env && atoi(env);
+}
+
+static int get_reload_interval_ms(void)
+{
+	const char *env = getenv("COCKROACH_RELOAD_INTERVAL_MS");
+	return env ? atoi(env) : 0;
+}
+
+static void delete_probes(probe_list_t &probe_list)
+{
+	probe_list_itr it = probe_list.begin();
+	for (; it != probe_list.end(); ++it)
+		delete *it;
+	probe_list.clear();
+}
+
+static void delete_recipe_lines(recipe_line_list_t &line_list)
+{
+	for (size_t i = 0; i < line_list.size(); i++)
+		delete_probes(line_list[i].second);
+	line_list.clear();
+}
+
+line_probes_guard::line_probes_guard(probe *_a_probe,
+                                     probe_list_t &_line_probes)
+: a_probe(_a_probe),
+  line_probes(_line_probes),
+  released(false)
+{
+}
+
+line_probes_guard::~line_probes_guard()
+{
+	if (released)
+		return;
+	delete_probes(line_probes);
+	delete a_probe;
+}
+
+void line_probes_guard::release(void)
+{
+	released = true;
+}
+
 dlopen_func_t  cockroach::m_orig_dlopen = NULL;
 dlclose_func_t cockroach::m_orig_dlclose = NULL;
+pthread_setname_np_func_t cockroach::m_orig_pthread_setname_np = NULL;
 
 pthread_mutex_t cockroach::m_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 cockroach::cockroach(void)
-: m_flag_not_target(false)
+: m_flag_not_target(false),
+  m_reloading(false),
+  m_in_pre_init_hook(false),
+  m_reload_interval_ms(get_reload_interval_ms()),
+  m_reload_thread_pid(0),
+  m_reload_thread_stop(false)
 {
 	// Init original funcs
 	//utils::init_original_func_addr_table();
@@ -46,6 +135,13 @@ cockroach::cockroach(void)
 		exit(EXIT_FAILURE);
 	}
 
+	m_orig_pthread_setname_np = (pthread_setname_np_func_t)
+	  dlsym(RTLD_NEXT, "pthread_setname_np");
+	if (!m_orig_pthread_setname_np) {
+		ROACH_ERR("Failed to call dlsym() for pthread_setname_np.\n");
+		exit(EXIT_FAILURE);
+	}
+
 	// parse recipe file
 	const char *recipe_file = getenv("COCKROACH_RECIPE");
 	if (!recipe_file)
@@ -55,18 +151,58 @@ cockroach::cockroach(void)
 		exit(EXIT_FAILURE);
 	}
 
+	recipe_line_list_t line_list;
 	try {
 		if (!recipe_file)
 			recipe_file = m_shm_param_note.get_recipe_file_path().c_str();
-		parse_recipe(recipe_file);
+		m_recipe_path = recipe_file;
+		parse_recipe(recipe_file, line_list);
 	} catch (not_target_exe_exception e) {
+		delete_recipe_lines(line_list);
 		m_flag_not_target = true;
 		return;
 	}
 
+	// All the lines are new.
+	int num_added, num_removed;
+	apply_recipe(line_list, &num_added, &num_removed);
+
+	// The probes for a library loaded by dlopen() are installed before
+	// its initializers run if it is requested.
+	if (is_pre_init_hook_requested())
+		dl_debug_hook::install(_dlopen_pre_init_hook, this);
+
+	if (m_reload_interval_ms > 0)
+		start_reload_thread();
+}
+
+cockroach::~cockroach()
+{
+	stop_reload_thread();
+	dl_debug_hook::uninstall();
+	probe_vector_itr it = m_probe_list.begin();
+	for (; it != m_probe_list.end(); ++it)
+		delete *it;
+	it = m_retired_probes.begin();
+	for (; it != m_retired_probes.end(); ++it)
+		delete *it;
+}
+
+user_probe_lib_handle_map_t &cockroach::get_user_probe_lib_handle_map(void)
+{
+	static user_probe_lib_handle_map_t map;
+	return map;
+}
+
+void cockroach::install_recipe_probes(probe_list_t &probe_list)
+{
+	// The objects are recorded before the first stack is captured.
+	stack_capture::record_lib_maps(m_mapped_lib_mgr, NULL);
+
 	// install probes for libraries that have already been mapped.
-	probe_list_itr it = m_probe_list.begin();
-	for (; it != m_probe_list.end(); ++it) {
+	map<const mapped_lib_info *, probe_list_t> lib_probe_list_map;
+	probe_list_itr it = probe_list.begin();
+	for (; it != probe_list.end(); ++it) {
 		probe *aprobe = *it;
 		const char *target_name = aprobe->get_target_lib_path();
 		const mapped_lib_info* lib_info;
@@ -75,43 +211,422 @@ cockroach::cockroach(void)
 			add_probe_to_waiting_probe_map(aprobe);
 			continue;
 		}
-		aprobe->install(lib_info);
+		lib_probe_list_map[lib_info].push_back(aprobe);
 	}
+	map<const mapped_lib_info *, probe_list_t>::iterator lib_it;
+	lib_it = lib_probe_list_map.begin();
+	for (; lib_it != lib_probe_list_map.end(); ++lib_it)
+		install_probes(lib_it->second, lib_it->first);
 }
 
-cockroach::~cockroach()
+void cockroach::apply_recipe(recipe_line_list_t &line_list,
+                             int *num_added, int *num_removed)
 {
-	probe_list_itr it = m_probe_list.begin();
-	for (; it != m_probe_list.end(); ++it)
-		delete *it;
+	set<string> new_keys;
+	recipe_line_list_t added_lines;
+	for (size_t i = 0; i < line_list.size(); i++) {
+		recipe_line_probes_t &line = line_list[i];
+		new_keys.insert(line.first);
+		if (m_recipe_line_map.count(line.first)) {
+			// The installed probes are kept as they are.
+			delete_probes(line.second);
+			continue;
+		}
+		added_lines.push_back(line);
+	}
+	line_list.clear();
+
+	// The probes of the removed lines are uninstalled before the new
+	// ones are installed, because they may be on the same functions.
+	*num_removed = 0;
+	set<probe *> retired_set;
+	recipe_line_probe_map_itr line_it = m_recipe_line_map.begin();
+	while (line_it != m_recipe_line_map.end()) {
+		if (new_keys.count(line_it->first)) {
+			++line_it;
+			continue;
+		}
+		probe_list_itr probe_it = line_it->second.begin();
+		for (; probe_it != line_it->second.end(); ++probe_it)
+			remove_probe(*probe_it, retired_set);
+		ROACH_INFO("removed: %s\n", line_it->first.c_str());
+		m_recipe_line_map.erase(line_it++);
+		(*num_removed)++;
+	}
+	retire_probes(retired_set);
+
+	probe_list_t probe_list;
+	for (size_t i = 0; i < added_lines.size(); i++) {
+		probe_list_t &line_probes = added_lines[i].second;
+		m_recipe_line_map[added_lines[i].first] = line_probes;
+		probe_list.insert(probe_list.end(), line_probes.begin(),
+		                  line_probes.end());
+	}
+	m_probe_list.insert(m_probe_list.end(),
+	                    probe_list.begin(), probe_list.end());
+	*num_added = added_lines.size();
+	install_recipe_probes(probe_list);
 }
 
-user_probe_lib_handle_map_t &cockroach::get_user_probe_lib_handle_map(void)
+bool cockroach::remove_waiting_probe(libpath_probe_list_map_t &waiting_map,
+                                     probe *aprobe)
 {
-	static user_probe_lib_handle_map_t map;
-	return map;
+	libpath_probe_list_map_itr it = waiting_map.begin();
+	for (; it != waiting_map.end(); ++it) {
+		probe_list_t &probe_list = it->second;
+		probe_list_itr probe_it =
+		  find(probe_list.begin(), probe_list.end(), aprobe);
+		if (probe_it == probe_list.end())
+			continue;
+		probe_list.erase(probe_it);
+		if (probe_list.empty())
+			waiting_map.erase(it);
+		return true;
+	}
+	return false;
 }
 
-void cockroach::add_probe_to_waiting_probe_map(probe *aprobe)
+void cockroach::remove_probe(probe *aprobe, set<probe *> &retired_set)
 {
-	const char *target_name = aprobe->get_target_lib_path();
-	const string basename = utils::get_basename(target_name);
-	libpath_probe_list_map_itr it = m_waiting_probe_map.find(basename);
-	if (it == m_waiting_probe_map.end()) {
-		pair<libpath_probe_list_map_itr, bool> ret;
-		ret = m_waiting_probe_map.insert(pair<string, probe_list_t>
-		                                   (basename, probe_list_t()));
-		if (!ret.second) {
-			ROACH_ERR("Failed to insert: %s\n", basename.c_str());
-			ROACH_ABORT();
+	retired_set.insert(aprobe);
+	if (remove_waiting_probe(m_waiting_path_map, aprobe) ||
+	    remove_waiting_probe(m_waiting_filename_map, aprobe))
+		return;
+
+	installed_probes_map_itr it = m_installed_probes_map.begin();
+	for (; it != m_installed_probes_map.end(); ++it) {
+		installed_probes &installed = it->second;
+		probe_list_itr probe_it = find(installed.probe_list.begin(),
+		                               installed.probe_list.end(),
+		                               aprobe);
+		if (probe_it == installed.probe_list.end())
+			continue;
+		installed.probe_list.erase(probe_it);
+
+		// The functions expanded from the pattern are restored, too.
+		probe_it = installed.expanded_list.begin();
+		while (probe_it != installed.expanded_list.end()) {
+			probe *expanded = *probe_it;
+			if (expanded->get_pattern_probe() != aprobe) {
+				++probe_it;
+				continue;
+			}
+			expanded->restore_code();
+			retired_set.insert(expanded);
+			probe_it = installed.expanded_list.erase(probe_it);
+		}
+		aprobe->restore_code();
+		if (installed.probe_list.empty() &&
+		    installed.expanded_list.empty())
+			m_installed_probes_map.erase(it);
+		return;
+	}
+}
+
+static bool has_abs64_probe(const probe_list_t &probe_list)
+{
+	probe_list_t::const_iterator it = probe_list.begin();
+	for (; it != probe_list.end(); ++it) {
+		install_type_t install_type = (*it)->get_install_type();
+		if (install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP ||
+		    install_type == INSTALL_TYPE_EXIT_ABS64_JUMP)
+			return true;
+	}
+	return false;
+}
+
+bool cockroach::changes_abs64_probes(const recipe_line_list_t &line_list)
+{
+	// The ABS64 jump is three instructions. A thread preempted in the
+	// middle of them would run a half-written one if it's put or removed
+	// while the process is running.
+	set<string> new_keys;
+	for (size_t i = 0; i < line_list.size(); i++) {
+		const recipe_line_probes_t &line = line_list[i];
+		new_keys.insert(line.first);
+		if (!m_recipe_line_map.count(line.first) &&
+		    has_abs64_probe(line.second)) {
+			ROACH_ERR("An ABS64 probe can't be added: %s\n",
+			          line.first.c_str());
+			return true;
+		}
+	}
+	recipe_line_probe_map_itr it = m_recipe_line_map.begin();
+	for (; it != m_recipe_line_map.end(); ++it) {
+		if (!new_keys.count(it->first) && has_abs64_probe(it->second)) {
+			ROACH_ERR("An ABS64 probe can't be removed: %s\n",
+			          it->first.c_str());
+			return true;
 		}
-		it = ret.first;
 	}
-	probe_list_t &probe_list = it->second;;
-	probe_list.push_back(aprobe);
+	return false;
 }
 
-void cockroach::parse_one_recipe(const char *line)
+void cockroach::retire_probes(set<probe *> &retired_set)
+{
+	// The probes are not deleted, because other threads may be running
+	// in their side code, which refers to them.
+	probe_vector_itr dest = m_probe_list.begin();
+	probe_vector_itr src = m_probe_list.begin();
+	for (; src != m_probe_list.end(); ++src) {
+		if (retired_set.count(*src))
+			m_retired_probes.push_back(*src);
+		else
+			*dest++ = *src;
+	}
+	m_probe_list.erase(dest, m_probe_list.end());
+}
+
+bool cockroach::reload_recipe(const string &recipe_path,
+                              int *num_added, int *num_removed)
+{
+	// The recipe is parsed without the mutex, because dlopen() for
+	// the user probes calls the hook that takes it.
+	recipe_line_list_t line_list;
+	m_reloading = true;
+	try {
+		parse_recipe(recipe_path.c_str(), line_list);
+	} catch (not_target_exe_exception e) {
+		// All the probes are removed.
+		ROACH_INFO("This isn't the target of the new recipe: %s\n",
+		           recipe_path.c_str());
+		delete_recipe_lines(line_list);
+	} catch (recipe_error_exception e) {
+		ROACH_ERR("The new recipe is ignored: %s\n",
+		          recipe_path.c_str());
+		delete_recipe_lines(line_list);
+		m_reloading = false;
+		return false;
+	}
+	m_reloading = false;
+
+	pthread_mutex_lock(&m_mutex);
+	if (changes_abs64_probes(line_list)) {
+		pthread_mutex_unlock(&m_mutex);
+		ROACH_ERR("The new recipe is ignored: %s\n",
+		          recipe_path.c_str());
+		delete_recipe_lines(line_list);
+		return false;
+	}
+	apply_recipe(line_list, num_added, num_removed);
+	m_recipe_path = recipe_path;
+	pthread_mutex_unlock(&m_mutex);
+	ROACH_INFO("reloaded: %s: added: %d, removed: %d\n",
+	           recipe_path.c_str(), *num_added, *num_removed);
+	return true;
+}
+
+void cockroach::start_reload_thread(void)
+{
+	if (!m_control_shm.create()) {
+		ROACH_ERR("The recipe can't be reloaded.\n");
+		return;
+	}
+	int ret = pthread_create(&m_reload_thread, NULL, _reload_thread, this);
+	if (ret != 0) {
+		ROACH_ERR("Failed to create the reload thread: %d\n", ret);
+		m_control_shm.release();
+		return;
+	}
+	m_reload_thread_pid = getpid();
+}
+
+void cockroach::stop_reload_thread(void)
+{
+	// The thread isn't copied to a child process.
+	if (m_reload_thread_pid != getpid())
+		return;
+	m_reload_thread_stop = true;
+	pthread_join(m_reload_thread, NULL);
+	m_reload_thread_pid = 0;
+	m_control_shm.release();
+}
+
+void *cockroach::_reload_thread(void *arg)
+{
+	cockroach *obj = static_cast<cockroach *>(arg);
+	obj->reload_thread();
+	return NULL;
+}
+
+void cockroach::reload_thread(void)
+{
+	pthread_setname_np(pthread_self(), "cockroach-ctl");
+	struct timespec interval;
+	interval.tv_sec = m_reload_interval_ms / 1000;
+	interval.tv_nsec = (m_reload_interval_ms % 1000) * 1000 * 1000;
+	uint32_t handled_generation = m_control_shm.get_generation();
+	while (!m_reload_thread_stop) {
+		nanosleep(&interval, NULL);
+		uint32_t generation = m_control_shm.get_generation();
+		if (generation == handled_generation)
+			continue;
+		string recipe_path = m_control_shm.get_recipe_path();
+		if (recipe_path.empty())
+			recipe_path = m_recipe_path;
+		int num_added = 0, num_removed = 0;
+		bool ok = reload_recipe(recipe_path, &num_added, &num_removed);
+		m_control_shm.set_done(generation, ok ? 0 : -1,
+		                       num_added, num_removed);
+		handled_generation = generation;
+	}
+}
+
+void cockroach::install_probes(probe_list_t &probe_list,
+                               const mapped_lib_info *lib_info)
+{
+	// Probes expanded from a pattern are owned by this object like
+	// the ones written in the recipe.
+	probe_list_t expanded_list;
+	// No thread is created in the SIGTRAP handler of the pre-init hook.
+	probe_installer installer(!m_in_pre_init_hook);
+	installer.install(probe_list, lib_info, expanded_list);
+
+	// remember the probes to uninstall them when the object is unloaded
+	installed_probes &installed =
+	  m_installed_probes_map[lib_info->get_text_addr()];
+	installed.probe_list.insert(installed.probe_list.end(),
+	                            probe_list.begin(), probe_list.end());
+	installed.expanded_list.insert(installed.expanded_list.end(),
+	                               expanded_list.begin(),
+	                               expanded_list.end());
+	m_probe_list.insert(m_probe_list.end(),
+	                    expanded_list.begin(), expanded_list.end());
+}
+
+void cockroach::uninstall_probes(unsigned long text_addr)
+{
+	installed_probes_map_itr it = m_installed_probes_map.find(text_addr);
+	if (it == m_installed_probes_map.end())
+		return;
+	installed_probes &installed = it->second;
+
+	// The probes expanded from a pattern are deleted. They are expanded
+	// again from the pattern when the library is loaded.
+	set<probe *> expanded_set;
+	probe_list_itr probe_it = installed.expanded_list.begin();
+	for (; probe_it != installed.expanded_list.end(); ++probe_it) {
+		(*probe_it)->release_side_code();
+		expanded_set.insert(*probe_it);
+	}
+	probe_vector_itr dest = m_probe_list.begin();
+	probe_vector_itr src = m_probe_list.begin();
+	for (; src != m_probe_list.end(); ++src) {
+		if (expanded_set.count(*src))
+			delete *src;
+		else
+			*dest++ = *src;
+	}
+	m_probe_list.erase(dest, m_probe_list.end());
+
+	// The others wait for the library to be loaded again.
+	probe_it = installed.probe_list.begin();
+	for (; probe_it != installed.probe_list.end(); ++probe_it) {
+		(*probe_it)->release_side_code();
+		add_probe_to_waiting_probe_map(*probe_it);
+	}
+	ROACH_INFO("uninstalled: %zd probes (%zd expanded) at %lx\n",
+	           installed.probe_list.size(), expanded_set.size(),
+	           text_addr);
+	m_installed_probes_map.erase(it);
+}
+
+void cockroach::update_mapped_libs(
+  vector<const mapped_lib_info *> *loaded_libs)
+{
+	vector<unsigned long> unloaded_text_addrs;
+	m_mapped_lib_mgr.update(&unloaded_text_addrs, loaded_libs);
+	for (size_t i = 0; i < unloaded_text_addrs.size(); i++)
+		uninstall_probes(unloaded_text_addrs[i]);
+}
+
+void cockroach::install_probes_for_loaded_libs(void)
+{
+	// Only the newly loaded objects are checked. The waiting probes for
+	// each of them are looked up by its path and its file name.
+	vector<const mapped_lib_info *> loaded_libs;
+	update_mapped_libs(&loaded_libs);
+	stack_capture::record_lib_maps(m_mapped_lib_mgr, &loaded_libs);
+	for (size_t i = 0; i < loaded_libs.size(); i++)
+		install_waiting_probes(loaded_libs[i]);
+}
+
+void cockroach::_dlopen_pre_init_hook(void *arg)
+{
+	cockroach *obj = static_cast<cockroach *>(arg);
+	obj->dlopen_pre_init_hook();
+}
+
+void cockroach::dlopen_pre_init_hook(void)
+{
+	if (m_flag_not_target)
+		return;
+
+	// This is called in dlopen() with the lock of the dynamic linker.
+	// When the mutex is held (e.g. dlopen() in a probe initializer),
+	// the probes are installed after dlopen() returns instead.
+	if (pthread_mutex_trylock(&m_mutex) != 0) {
+		ROACH_DBG("pre-init hook is skipped: mutex is busy.\n");
+		return;
+	}
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	address_space_map::invalidate();
+	m_in_pre_init_hook = true;
+	install_probes_for_loaded_libs();
+	m_in_pre_init_hook = false;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pthread_mutex_unlock(&m_mutex);
+	ROACH_DBG("pre-init hook: %ld us\n",
+	          (t1.tv_sec - t0.tv_sec) * 1000000L +
+	          (t1.tv_nsec - t0.tv_nsec) / 1000);
+}
+
+void cockroach::add_probe_to_waiting_probe_map(probe *aprobe)
+{
+	// The probes are indexed by the absolute path or by the file name
+	// as they are written in the recipe, so the probes for a loaded
+	// object are found without looking at the others.
+	const char *target_name = aprobe->get_target_lib_path();
+	if (utils::is_absolute_path(target_name))
+		m_waiting_path_map[target_name].push_back(aprobe);
+	else
+		m_waiting_filename_map[target_name].push_back(aprobe);
+}
+
+void cockroach::take_waiting_probes(libpath_probe_list_map_t &waiting_map,
+                                    const string &name,
+                                    probe_list_t &probe_list)
+{
+	libpath_probe_list_map_itr it = waiting_map.find(name);
+	if (it == waiting_map.end())
+		return;
+	probe_list.splice(probe_list.end(), it->second);
+	waiting_map.erase(it);
+}
+
+void cockroach::install_waiting_probes(const mapped_lib_info *lib_info)
+{
+	// An object is looked up with its real path and with the name
+	// given to the loader, which can be a symbolic link.
+	probe_list_t probe_list;
+	take_waiting_probes(m_waiting_path_map, lib_info->get_path(),
+	                    probe_list);
+	take_waiting_probes(m_waiting_filename_map, lib_info->get_filename(),
+	                    probe_list);
+	const char *loader_name = lib_info->get_loader_name();
+	if (utils::is_absolute_path(loader_name))
+		take_waiting_probes(m_waiting_path_map, loader_name,
+		                    probe_list);
+	take_waiting_probes(m_waiting_filename_map,
+	                    utils::get_basename(loader_name), probe_list);
+	if (probe_list.empty())
+		return;
+	dlopen_hook_each(probe_list, lib_info);
+}
+
+void cockroach::parse_one_recipe(const char *line,
+                                 recipe_line_list_t &line_list)
 {
 	size_t idx = 0;
 	// strip head spaces
@@ -133,9 +648,17 @@ void cockroach::parse_one_recipe(const char *line)
 	if (tokens.size() < NUM_RECIPE_MIN_TOKENS) {
 		ROACH_ERR("Number of tokens is too small: %zd: %s\n",
 		          tokens.size(), line);
-		ROACH_ABORT();
+		recipe_error();
 	}
 
+	// The line is identified with the tokens when it is reloaded.
+	string key = tokens[0];
+	for (size_t i = 1; i < tokens.size(); i++)
+		key += " " + tokens[i];
+
+	// The options can be put anywhere after the target.
+	thread_filter *filter = parse_thread_filter(tokens);
+
 	// probe type
 	probe_type_t probe_type = PROBE_TYPE_UNKNOWN;
 	string &probe_type_def = tokens[idx];
@@ -143,11 +666,17 @@ void cockroach::parse_one_recipe(const char *line)
 		probe_type = PROBE_TYPE_BUILT_IN_TIME_MEASURE;
 	} else if (probe_type_def == "P") {
 		probe_type = PROBE_TYPE_USER;
+	} else if (probe_type_def == "A") {
+		probe_type = PROBE_TYPE_BUILT_IN_ARG_CAPTURE;
+	} else if (probe_type_def == "R") {
+		probe_type = PROBE_TYPE_BUILT_IN_RET_VALUE;
+	} else if (probe_type_def == "S") {
+		probe_type = PROBE_TYPE_BUILT_IN_STACK_CAPTURE;
 	}
 	else {
 		ROACH_ERR("Unknown probe_type: '%s' : %s\n",
 		          probe_type_def.c_str(), line);
-		ROACH_ABORT();
+		recipe_error();
 	}
 	idx++;
 
@@ -158,10 +687,14 @@ void cockroach::parse_one_recipe(const char *line)
 		install_type = INSTALL_TYPE_OVERWRITE_ABS64_JUMP;
 	else if (install_type_def == "REL32")
 		install_type = INSTALL_TYPE_OVERWRITE_REL32_JUMP;
+	else if (install_type_def == "EXIT_ABS64")
+		install_type = INSTALL_TYPE_EXIT_ABS64_JUMP;
+	else if (install_type_def == "EXIT_REL32")
+		install_type = INSTALL_TYPE_EXIT_REL32_JUMP;
 	else {
 		ROACH_ERR("Unknown command: '%s' : %s\n",
 		          tokens[0].c_str(), line);
-		ROACH_ABORT();
+		recipe_error();
 	}
 	idx++;
 
@@ -171,17 +704,12 @@ void cockroach::parse_one_recipe(const char *line)
 	string &sym_or_addr = tokens[idx];
 	idx++;
 	unsigned long target_addr = 0;
-	if (utils::is_hex_number(sym_or_addr.c_str())) {
-		if (sscanf(sym_or_addr.c_str(), "%lx", &target_addr) != 1) {
-			ROACH_ERR("Failed to parse address: %s: %s", 
-			          target_lib.c_str(), sym_or_addr.c_str());
-			exit(EXIT_FAILURE);
-		}
-	} else {
-		ROACH_ERR("Currently symbol is not implemented. "
-		          "Please specify address. %s: %s\n",
-		       target_lib.c_str(), sym_or_addr.c_str());
-		exit(EXIT_FAILURE);
+	bool is_symbol = !utils::is_hex_number(sym_or_addr.c_str());
+	if (!is_symbol &&
+	    sscanf(sym_or_addr.c_str(), "%lx", &target_addr) != 1) {
+		ROACH_ERR("Failed to parse address: %s: %s", 
+		          target_lib.c_str(), sym_or_addr.c_str());
+		recipe_error();
 	}
 
 	// target address
@@ -193,29 +721,212 @@ void cockroach::parse_one_recipe(const char *line)
 	}
 
 	// register probe
+	probe_list_t line_probes;
 	probe *a_probe = new probe(probe_type, install_type);
-	a_probe->set_target_address(target_lib.c_str(), target_addr,
-	                            overwrite_length);
+	// The probes are deleted when the line is rejected, so that they
+	// aren't leaked by a recipe rejected in the reload.
+	line_probes_guard guard(a_probe, line_probes);
+	set_probe_target(a_probe, target_lib, sym_or_addr, is_symbol,
+	                 target_addr, overwrite_length);
 
-	if (probe_type == PROBE_TYPE_BUILT_IN_TIME_MEASURE) {
+	if (probe_type == PROBE_TYPE_BUILT_IN_TIME_MEASURE &&
+	    a_probe->is_exit_probe()) {
+		// The time is measured by the pair of the entry probe and
+		// the exit probes.
+		probe *entry_probe = create_entry_probe_for_exit(a_probe);
+		set_probe_target(entry_probe, target_lib, sym_or_addr,
+		                 is_symbol, target_addr, 0);
+		entry_probe->set_probe(NULL, roach_time_measure_entry_probe,
+		                       roach_time_measure_probe_init);
+		line_probes.push_back(entry_probe);
+		a_probe->set_probe(NULL, roach_time_measure_exit_probe,
+		                   roach_time_measure_probe_init);
+	} else if (probe_type == PROBE_TYPE_BUILT_IN_TIME_MEASURE) {
 		a_probe->set_probe(NULL, roach_time_measure_probe,
 		                   roach_time_measure_probe_init);
 	}
 	else if (probe_type == PROBE_TYPE_USER) {
 		if (tokens.size() - idx < NUM_RECIPE_MIN_USER_PROBE_TOKENS) {
 			ROACH_ERR("Token is too short: %s: %d\n", line, errno);
-			ROACH_ABORT();
+			recipe_error();
 		}
 		add_user_probe(a_probe, tokens, idx);
 	}
+	else if (probe_type == PROBE_TYPE_BUILT_IN_ARG_CAPTURE) {
+		if (a_probe->is_exit_probe()) {
+			ROACH_ERR("Arguments can't be captured at exits: %s\n",
+			          line);
+			recipe_error();
+		}
+		add_arg_capture_probe(a_probe, tokens, idx);
+	}
+	else if (probe_type == PROBE_TYPE_BUILT_IN_RET_VALUE) {
+		ret_value_config *config = parse_ret_value_config(tokens, idx);
+		if (a_probe->is_exit_probe()) {
+			probe *entry_probe = create_entry_probe_for_exit(a_probe);
+			set_probe_target(entry_probe, target_lib, sym_or_addr,
+			                 is_symbol, target_addr, 0);
+			entry_probe->set_probe(NULL,
+			                       roach_ret_value_entry_probe);
+			line_probes.push_back(entry_probe);
+			a_probe->set_probe(NULL, roach_ret_value_exit_probe,
+			                   roach_ret_value_probe_init, config);
+		} else {
+			a_probe->set_probe(NULL, roach_ret_value_probe,
+			                   roach_ret_value_probe_init, config);
+		}
+	}
+	else if (probe_type == PROBE_TYPE_BUILT_IN_STACK_CAPTURE) {
+		stack_capture_config *config =
+		  parse_stack_capture_config(tokens, idx);
+		a_probe->set_probe(NULL, roach_stack_capture_probe,
+		                   roach_stack_capture_probe_init, config);
+	}
 
-	m_probe_list.push_back(a_probe);
+	guard.release();
+	line_probes.push_back(a_probe);
+	probe_list_itr probe_it = line_probes.begin();
+	for (; probe_it != line_probes.end(); ++probe_it)
+		(*probe_it)->set_thread_filter(filter);
+	line_list.push_back(recipe_line_probes_t(key, line_probes));
+}
+
+void cockroach::set_probe_target(probe *a_probe, const string &target_lib,
+                                 const string &sym_or_addr, bool is_symbol,
+                                 unsigned long target_addr,
+                                 int overwrite_length)
+{
+	if (is_symbol && symbol_pattern::is_pattern(sym_or_addr)) {
+		// expanded to each function when the target library is mapped.
+		a_probe->set_target_pattern(target_lib.c_str(),
+		                            sym_or_addr.c_str(), overwrite_length);
+	} else if (is_symbol) {
+		// resolved when the target library is mapped.
+		a_probe->set_target_symbol(target_lib.c_str(),
+		                           sym_or_addr.c_str(), overwrite_length);
+	} else {
+		a_probe->set_target_address(target_lib.c_str(), target_addr,
+		                            overwrite_length);
+	}
+}
+
+thread_filter *cockroach::parse_thread_filter(vector<string> &tokens)
+{
+	vector<string> options;
+	vector<string>::iterator it = tokens.begin() + NUM_RECIPE_MIN_TOKENS;
+	while (it != tokens.end()) {
+		if (!thread_filter::is_option(*it)) {
+			++it;
+			continue;
+		}
+		options.push_back(*it);
+		it = tokens.erase(it);
+	}
+	if (options.empty())
+		return NULL;
+	thread_filter *filter = thread_filter::get(options);
+	if (!filter)
+		recipe_error();
+	return filter;
+}
+
+probe *cockroach::create_entry_probe_for_exit(probe *exit_probe)
+{
+	// The entry probe is installed in the same way as the exit probes.
+	install_type_t entry_install_type =
+	  (exit_probe->get_install_type() == INSTALL_TYPE_EXIT_ABS64_JUMP) ?
+	    INSTALL_TYPE_OVERWRITE_ABS64_JUMP :
+	    INSTALL_TYPE_OVERWRITE_REL32_JUMP;
+	return new probe(exit_probe->get_probe_type(), entry_install_type);
+}
+
+ret_value_config *
+cockroach::parse_ret_value_config(vector<string> &tokens, size_t &idx)
+{
+	// It is allocated after the line is validated, so that nothing is
+	// leaked when the reloaded recipe is rejected.
+	ret_value_config config;
+	config.mode = RET_VALUE_MODE_CLASS;
+	config.value_bits = sizeof(long) * 8;
+	if (tokens.size() <= idx)
+		return new ret_value_config(config);
+
+	string &mode_def = tokens[idx++];
+	if (mode_def == "CLASS")
+		config.mode = RET_VALUE_MODE_CLASS;
+	else if (mode_def == "CLASS32") {
+		config.mode = RET_VALUE_MODE_CLASS;
+		config.value_bits = 32;
+	} else if (mode_def == "VALUE")
+		config.mode = RET_VALUE_MODE_VALUE;
+	else if (mode_def == "VALUE32") {
+		config.mode = RET_VALUE_MODE_VALUE;
+		config.value_bits = 32;
+	} else {
+		ROACH_ERR("Unknown return value mode: %s\n", mode_def.c_str());
+		recipe_error();
+	}
+	return new ret_value_config(config);
+}
+
+stack_capture_config *
+cockroach::parse_stack_capture_config(vector<string> &tokens, size_t &idx)
+{
+	static const char *OPTION_DEPTH = "DEPTH=";
+	static const char *OPTION_RAW = "RAW=";
+	static const uint32_t DEFAULT_DEPTH = 16;
+
+	// The config is shared by the probes expanded from a pattern and is
+	// used until the process exits. It is allocated after the options
+	// are validated.
+	stack_capture_config config;
+	config.max_depth = DEFAULT_DEPTH;
+	config.raw_size = 0;
+	for (; idx < tokens.size(); idx++) {
+		string &option = tokens[idx];
+		const char *value = NULL;
+		uint32_t *param = NULL;
+		long max_value = 0;
+		if (option.compare(0, strlen(OPTION_DEPTH), OPTION_DEPTH) == 0) {
+			value = option.c_str() + strlen(OPTION_DEPTH);
+			param = &config.max_depth;
+			max_value = STACK_CAPTURE_MAX_DEPTH;
+		} else if (option.compare(0, strlen(OPTION_RAW),
+		                          OPTION_RAW) == 0) {
+			value = option.c_str() + strlen(OPTION_RAW);
+			param = &config.raw_size;
+			max_value = STACK_CAPTURE_MAX_RAW_SIZE;
+		} else {
+			ROACH_ERR("Unknown stack capture option: %s\n",
+			          option.c_str());
+			recipe_error();
+		}
+		char *endptr;
+		long num = strtol(value, &endptr, 0);
+		if (*value == '\0' || *endptr != '\0' ||
+		    num < 0 || num > max_value) {
+			ROACH_ERR("Invalid stack capture option: %s (max: %ld)\n",
+			          option.c_str(), max_value);
+			recipe_error();
+		}
+		*param = num;
+	}
+	stack_capture::set_used();
+	return new stack_capture_config(config);
 }
 
 void cockroach::_parse_one_recipe(const char *line, void *arg)
 {
-	cockroach *obj = static_cast<cockroach *>(arg);
-	obj->parse_one_recipe(line);
+	recipe_parse_arg *parse_arg = static_cast<recipe_parse_arg *>(arg);
+	parse_arg->obj->parse_one_recipe(line, *parse_arg->line_list);
+}
+
+void cockroach::recipe_error(void)
+{
+	// The recipe given to the running process is ignored instead.
+	if (m_reloading)
+		throw recipe_error_exception();
+	ROACH_ABORT();
 }
 
 void cockroach::parse_target_exe(vector<string> &target_exe_line)
@@ -223,7 +934,7 @@ void cockroach::parse_target_exe(vector<string> &target_exe_line)
 	if (target_exe_line.size() != 2) {
 		ROACH_ERR("target_exe_line.size() != 2: actual: %zd\n",
 		          target_exe_line.size());
-		ROACH_ABORT();
+		recipe_error();
 	}
 	string &target_exe = target_exe_line[1];
 	string my_name = utils::get_self_exe_name();
@@ -240,17 +951,33 @@ void cockroach::parse_target_exe(vector<string> &target_exe_line)
 		throw not_target_exe_exception();
 }
 
-void cockroach::parse_recipe(const char *recipe_file)
+void cockroach::parse_recipe(const char *recipe_file,
+                             recipe_line_list_t &line_list)
 {
+	recipe_parse_arg arg = {this, &line_list};
 	bool ret = utils::read_one_line_loop(recipe_file,
 	                                     cockroach::_parse_one_recipe,
-	                                     this);
+	                                     &arg);
 	if (!ret) {
 		char *cwd = get_current_dir_name();
 		ROACH_ERR("Failed to parse recipe file: %s (%d), cwd: %s\n",
 		          recipe_file, errno, cwd);
 		free(cwd);
-		ROACH_ABORT();
+		recipe_error();
+	}
+
+	// A line written more than once gets a suffix, so that each of them
+	// is compared with the one at the same position in a reload.
+	set<string> keys;
+	for (size_t i = 0; i < line_list.size(); i++) {
+		string &key = line_list[i].first;
+		string base_key = key;
+		for (int n = 2; keys.count(key); n++) {
+			stringstream ss;
+			ss << base_key << " #" << n;
+			key = ss.str();
+		}
+		keys.insert(key);
 	}
 }
 
@@ -272,7 +999,7 @@ cockroach::add_user_probe(probe *user_probe, vector<string> &tokens, size_t &idx
 		if (handle == NULL) {
 			ROACH_ERR("Failed to call dlopen(): %s: %s\n",
 			          probe_lib_name.c_str(), dlerror());
-			ROACH_ABORT();
+			recipe_error();
 		}
 		user_probe_map[probe_lib_name] = handle;
 	} else
@@ -284,7 +1011,7 @@ cockroach::add_user_probe(probe *user_probe, vector<string> &tokens, size_t &idx
 	if (probe_func == NULL) {
 		ROACH_ERR("Failed to call dlsym(): %s: %s\n",
 		          probe_func_name.c_str(), dlerror());
-		ROACH_ABORT();
+		recipe_error();
 	}
 
 	// probe initializer
@@ -296,53 +1023,61 @@ cockroach::add_user_probe(probe *user_probe, vector<string> &tokens, size_t &idx
 		if (probe_func == NULL) {
 			ROACH_ERR("Failed to call dlsym(): %s: %s\n",
 			          probe_init_func_name.c_str(), dlerror());
-			ROACH_ABORT();
+			recipe_error();
 		}
 	}
 
 	user_probe->set_probe(NULL, probe_func, probe_init_func);
 }
 
+void cockroach::add_arg_capture_probe(probe *a_probe, vector<string> &tokens,
+                                      size_t &idx)
+{
+	// The program is shared by the probes expanded from a pattern and
+	// is used until the process exits.
+	vector<string> specs(tokens.begin() + idx, tokens.end());
+	idx = tokens.size();
+	arg_capture_program *program = new arg_capture_program();
+	if (!program->compile(specs)) {
+		ROACH_ERR("Failed to compile capture specs.\n");
+		delete program;
+		recipe_error();
+	}
+	a_probe->set_probe(NULL, roach_arg_capture_probe,
+	                   roach_arg_capture_probe_init, program);
+}
+
 void *cockroach::dlopen_hook(const char *filename, int flag, void *handle)
 {
 	if (m_flag_not_target)
 		return handle;
 
-	m_mapped_lib_mgr.update();
+	address_space_map::invalidate();
 
-	// check if the mapped library is one of the targets
-	vector<string> matched_names;
+	// Usually the probes have been installed by the pre-init hook and
+	// nothing is done here.
 	pthread_mutex_lock(&m_mutex);
-	libpath_probe_list_map_itr it = m_waiting_probe_map.begin();
-	for (; it != m_waiting_probe_map.end(); ++it) {
-		const string &target_name = it->first;
-		const mapped_lib_info* lib_info;
-		lib_info = m_mapped_lib_mgr.get_lib_info(target_name.c_str());
-		if (!lib_info)
-			continue;
-		dlopen_hook_each(it->second, handle, lib_info);
-		matched_names.push_back(target_name);
-	}
-	for (size_t i = 0; i < matched_names.size(); i++) {
-		string &target_name = matched_names[i];
-		m_waiting_probe_map.erase(target_name);
-	}
+	install_probes_for_loaded_libs();
 	pthread_mutex_unlock(&m_mutex);
 	return handle;
 }
 
-void cockroach::dlopen_hook_each(probe_list_t &probe_list, void *handle,
-                                 const mapped_lib_info *lib_info)
+void cockroach::dlclose_hook(void)
 {
-	// get the base address at which the shared library is mapped
-	void *addr_init = dlsym(handle, "_init");
-	if (addr_init == NULL) {
-		ROACH_ERR("Failed to call dlsym(\"_init\"): %s\n", dlerror());
-		ROACH_ABORT();
-	}
+	address_space_map::invalidate();
+	if (m_flag_not_target)
+		return;
 
+	// The probes in the unloaded library are put back to the waiting
+	// map for the next dlopen().
+	pthread_mutex_lock(&m_mutex);
+	update_mapped_libs();
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void cockroach::dlopen_hook_each(probe_list_t &probe_list,
+                                 const mapped_lib_info *lib_info)
+{
 	// install probes in the list
-	probe_list_itr probe_ptr_itr = probe_list.begin();
-	for (; probe_ptr_itr != probe_list.end(); ++probe_ptr_itr)
-		(*probe_ptr_itr)->install(lib_info);
+	install_probes(probe_list, lib_info);
 }
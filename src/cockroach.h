@@ -3,52 +3,126 @@
 
 #include <list>
 #include <vector>
+#include <set>
 using namespace std;
 
 #include "mapped_lib_manager.h"
 #include "probe.h"
 #include "shm_param_note.h"
+#include "control_shm.h"
+#include "ret_value_probe.h"
+#include "stack_capture.h"
 
-typedef list<probe *> probe_list_t;
-typedef probe_list_t::iterator  probe_list_itr;
-
+// the target path or file name and the probes waiting for it
 typedef map<string, probe_list_t> libpath_probe_list_map_t;
 typedef libpath_probe_list_map_t::iterator libpath_probe_list_map_itr;
 
+// probes installed in a loaded object
+struct installed_probes {
+	probe_list_t probe_list;    // given to install_probes()
+	probe_list_t expanded_list; // expanded from a pattern
+};
+
+// the head address of the text and the probes
+typedef map<unsigned long, installed_probes> installed_probes_map_t;
+typedef installed_probes_map_t::iterator installed_probes_map_itr;
+
+// the probes created from a line of the recipe in the order of the lines
+typedef pair<string, probe_list_t> recipe_line_probes_t;
+typedef vector<recipe_line_probes_t> recipe_line_list_t;
+
+// the line (tokens joined with a space) and the probes for it
+typedef map<string, probe_list_t> recipe_line_probe_map_t;
+typedef recipe_line_probe_map_t::iterator recipe_line_probe_map_itr;
+
 typedef map<string, void *> user_probe_lib_handle_map_t;
 typedef user_probe_lib_handle_map_t::iterator user_probe_lib_handle_map_itr;
 
 typedef void *(*dlopen_func_t)(const char *, int);
 typedef int (*dlclose_func_t)(void *);
+typedef int (*pthread_setname_np_func_t)(pthread_t, const char *);
 
 class cockroach {
 	bool m_flag_not_target;
 	shm_param_note m_shm_param_note;
 	mapped_lib_manager m_mapped_lib_mgr;
-	probe_list_t m_probe_list;
-	libpath_probe_list_map_t m_waiting_probe_map;
+	probe_vector_t m_probe_list;
+	libpath_probe_list_map_t m_waiting_path_map;
+	libpath_probe_list_map_t m_waiting_filename_map;
+	installed_probes_map_t m_installed_probes_map;
+	recipe_line_probe_map_t m_recipe_line_map;
+	probe_vector_t m_retired_probes; // removed while running
+	string m_recipe_path;
+	bool m_reloading;
+	bool m_in_pre_init_hook;
+	control_shm m_control_shm;
+	int m_reload_interval_ms;
+	pthread_t m_reload_thread;
+	pid_t m_reload_thread_pid;
+	volatile bool m_reload_thread_stop;
 	static pthread_mutex_t m_mutex;
 
 	static user_probe_lib_handle_map_t &get_user_probe_lib_handle_map(void);
 	static void _parse_one_recipe(const char *line, void *arg);
+	void install_probes(probe_list_t &probe_list,
+	                    const mapped_lib_info *lib_info);
+	void uninstall_probes(unsigned long text_addr);
+	void update_mapped_libs(
+	  vector<const mapped_lib_info *> *loaded_libs = NULL);
+	void install_probes_for_loaded_libs(void);
+	static void _dlopen_pre_init_hook(void *arg);
+	void dlopen_pre_init_hook(void);
 	void add_probe_to_waiting_probe_map(probe *aprobe);
+	void take_waiting_probes(libpath_probe_list_map_t &waiting_map,
+	                         const string &name, probe_list_t &probe_list);
+	void install_waiting_probes(const mapped_lib_info *lib_info);
+	void install_recipe_probes(probe_list_t &probe_list);
+	void apply_recipe(recipe_line_list_t &line_list,
+	                  int *num_added, int *num_removed);
+	bool remove_waiting_probe(libpath_probe_list_map_t &waiting_map,
+	                          probe *aprobe);
+	void remove_probe(probe *aprobe, set<probe *> &retired_set);
+	void retire_probes(set<probe *> &retired_set);
+	bool changes_abs64_probes(const recipe_line_list_t &line_list);
+	bool reload_recipe(const string &recipe_path,
+	                   int *num_added, int *num_removed);
+	void start_reload_thread(void);
+	void stop_reload_thread(void);
+	static void *_reload_thread(void *arg);
+	void reload_thread(void);
 	bool open_shm_param_note(void);
-	void parse_recipe(const char *recipe_file);
-	void parse_one_recipe(const char *line);
+	void recipe_error(void);
+	void parse_recipe(const char *recipe_file,
+	                  recipe_line_list_t &line_list);
+	void parse_one_recipe(const char *line,
+	                      recipe_line_list_t &line_list);
 	void parse_target_exe(vector<string> &target_exe_line);
+	void set_probe_target(probe *a_probe, const string &target_lib,
+	                      const string &sym_or_addr, bool is_symbol,
+	                      unsigned long target_addr, int overwrite_length);
 	void add_user_probe(probe *user_probe, vector<string> &tokens,
 	                    size_t &idx);
-	void dlopen_hook_each(probe_list_t &probe_list, void *handle,
+	void add_arg_capture_probe(probe *a_probe, vector<string> &tokens,
+	                           size_t &idx);
+	thread_filter *parse_thread_filter(vector<string> &tokens);
+	probe *create_entry_probe_for_exit(probe *exit_probe);
+	ret_value_config *parse_ret_value_config(vector<string> &tokens,
+	                                         size_t &idx);
+	stack_capture_config *parse_stack_capture_config(vector<string> &tokens,
+	                                                 size_t &idx);
+	void dlopen_hook_each(probe_list_t &probe_list,
 	                      const mapped_lib_info *lib_info);
 public:
 	// public members
 	static dlopen_func_t  m_orig_dlopen;
 	static dlclose_func_t m_orig_dlclose;
+	static pthread_setname_np_func_t m_orig_pthread_setname_np;
 
 	// methods
 	cockroach(void);
 	virtual ~cockroach();
 	void *dlopen_hook(const char *filename, int flag, void *handle);
+	void dlclose_hook(void);
 };
 
 #endif // cockroach_h
@@ -0,0 +1,162 @@
+#include <cstring>
+#include <sstream>
+using namespace std;
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "control_shm.h"
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+string control_shm::get_shm_name(pid_t pid)
+{
+	stringstream ss;
+	ss << "cockroach-control-";
+	ss << pid;
+	return ss.str();
+}
+
+bool control_shm::map(pid_t pid, int flags)
+{
+	string shm_name = get_shm_name(pid);
+	int fd = shm_open(shm_name.c_str(), flags, 0600);
+	if (fd == -1) {
+		ROACH_ERR("Failed to call shm_open: %s: %s\n",
+		          shm_name.c_str(), strerror(errno));
+		return false;
+	}
+	if ((flags & O_CREAT) &&
+	    ftruncate(fd, sizeof(control_shm_data)) == -1) {
+		ROACH_ERR("Failed to ftruncate: %s: %s\n",
+		          shm_name.c_str(), strerror(errno));
+		close(fd);
+		shm_unlink(shm_name.c_str());
+		return false;
+	}
+	void *ptr = mmap(NULL, sizeof(control_shm_data),
+	                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		ROACH_ERR("Failed to mmap: %s: %s\n",
+		          shm_name.c_str(), strerror(errno));
+		if (flags & O_CREAT)
+			shm_unlink(shm_name.c_str());
+		return false;
+	}
+	m_shm_name = shm_name;
+	m_data = (control_shm_data *)ptr;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+control_shm::control_shm(void)
+: m_data(NULL),
+  m_owner_pid(0)
+{
+}
+
+control_shm::~control_shm()
+{
+	release();
+}
+
+bool control_shm::create(void)
+{
+	// The shm left by an old process with the same PID is truncated.
+	if (!map(getpid(), O_RDWR | O_CREAT | O_TRUNC))
+		return false;
+	memcpy(m_data->magic, CONTROL_SHM_MAGIC, sizeof(CONTROL_SHM_MAGIC));
+	m_owner_pid = getpid();
+	return true;
+}
+
+bool control_shm::open(pid_t target_pid)
+{
+	if (!map(target_pid, O_RDWR))
+		return false;
+	if (memcmp(m_data->magic, CONTROL_SHM_MAGIC,
+	           sizeof(CONTROL_SHM_MAGIC)) != 0) {
+		ROACH_ERR("Invalid control shm: %s\n", m_shm_name.c_str());
+		release();
+		return false;
+	}
+	return true;
+}
+
+void control_shm::release(void)
+{
+	if (!m_data)
+		return;
+	munmap(m_data, sizeof(control_shm_data));
+	m_data = NULL;
+
+	// A child process doesn't remove the parent's one.
+	if (m_owner_pid == getpid())
+		shm_unlink(m_shm_name.c_str());
+	m_owner_pid = 0;
+}
+
+uint32_t control_shm::get_generation(void) const
+{
+	return *((volatile uint32_t *)&m_data->generation);
+}
+
+string control_shm::get_recipe_path(void) const
+{
+	// The path is written before the generation is incremented.
+	__sync_synchronize();
+	char path[sizeof(m_data->recipe_path)];
+	memcpy(path, m_data->recipe_path, sizeof(path));
+	path[sizeof(path) - 1] = '\0';
+	return path;
+}
+
+void control_shm::set_done(uint32_t generation, int result,
+                           int num_added, int num_removed)
+{
+	m_data->result = result;
+	m_data->num_added = num_added;
+	m_data->num_removed = num_removed;
+	__sync_synchronize();
+	*((volatile uint32_t *)&m_data->done_generation) = generation;
+}
+
+uint32_t control_shm::request_reload(const string &recipe_path)
+{
+	size_t len = recipe_path.size();
+	if (len >= sizeof(m_data->recipe_path))
+		len = sizeof(m_data->recipe_path) - 1;
+	memcpy(m_data->recipe_path, recipe_path.c_str(), len);
+	m_data->recipe_path[len] = '\0';
+	return __sync_add_and_fetch(&m_data->generation, 1);
+}
+
+bool control_shm::wait_done(uint32_t generation, int timeout_ms, int *result,
+                            int *num_added, int *num_removed)
+{
+	static const int POLL_INTERVAL_MS = 10;
+	struct timespec interval = {0, POLL_INTERVAL_MS * 1000 * 1000};
+	for (int waited = 0; waited < timeout_ms; waited += POLL_INTERVAL_MS) {
+		uint32_t done =
+		  *((volatile uint32_t *)&m_data->done_generation);
+		if ((int32_t)(done - generation) >= 0) {
+			__sync_synchronize();
+			*result = m_data->result;
+			*num_added = m_data->num_added;
+			*num_removed = m_data->num_removed;
+			return true;
+		}
+		nanosleep(&interval, NULL);
+	}
+	return false;
+}
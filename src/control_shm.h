@@ -0,0 +1,60 @@
+#ifndef control_shm_h
+#define control_shm_h
+
+#include <string>
+using namespace std;
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#define CONTROL_SHM_MAGIC "ROACHCT"
+
+// A tool writes the recipe path and increments the generation. The target
+// reloads the recipe and writes the results with the done generation.
+struct control_shm_data {
+	char     magic[8];
+	uint32_t generation;
+	uint32_t done_generation;
+	int32_t  result;      // 0: reloaded, -1: failed
+	int32_t  num_added;   // recipe lines
+	int32_t  num_removed;
+	char     recipe_path[PATH_MAX]; // empty: the current recipe
+};
+
+/**
+ * The shared memory to control a running target process.
+ *
+ * It is created by the target (cockroach-control-<pid>) and polled by
+ * a thread of cockroach. The generation is compared with the one that was
+ * handled last time, so a request isn't lost even if the tool runs while
+ * the target is busy.
+ */
+class control_shm {
+	string m_shm_name;
+	control_shm_data *m_data;
+	pid_t m_owner_pid;
+
+	static string get_shm_name(pid_t pid);
+	bool map(pid_t pid, int flags);
+public:
+	control_shm(void);
+	virtual ~control_shm();
+
+	bool create(void);
+	bool open(pid_t target_pid);
+	void release(void);
+
+	// called by the target
+	uint32_t get_generation(void) const;
+	string get_recipe_path(void) const;
+	void set_done(uint32_t generation, int result,
+	              int num_added, int num_removed);
+
+	// called by a tool
+	uint32_t request_reload(const string &recipe_path);
+	bool wait_done(uint32_t generation, int timeout_ms, int *result,
+	               int *num_added, int *num_removed);
+};
+
+#endif
@@ -175,26 +175,28 @@ map_info_t *create_new_map_info(uint64_t shm_head_index, uint64_t shm_size)
 }
 
 /**
+ * Reserve the contiguous region for num items of the same size. The headers
+ * of the items are not written.
+ *
  * When this function returns, item_slot->map_info->used_count is incremented.
  * The caller must call dec_used_count() when the map_info is no longer needed.
  */
-static void alloc_item_slot(size_t size, item_slot_t *item_slot)
+static void alloc_item_slots(size_t size, size_t num, item_slot_t *item_slot)
 {
 	open_shm_if_needed();
 
+	uint64_t region_size = (sizeof(item_header_t) + size) * num;
 	lock_shm();
 	uint64_t head_index = g_primary_header->head_index;
-	uint64_t new_index = head_index + (sizeof(item_header_t) + size);
+	uint64_t new_index = head_index + region_size;
 
 	// extend shm size if it is smaller than the size with the requested.
+	// A batch of items can be larger than the unit.
 	if (new_index > g_primary_header->size) {
 		uint64_t new_size = g_primary_header->size
 		                    + g_shm_add_unit_size;
-		if (new_size < new_index) {
-			ROACH_BUG("new_size: %"PRIu64" < "
-			          "new_index: %"PRIu64"\n",
-			          new_size, new_index);
-		}
+		while (new_size < new_index)
+			new_size += g_shm_add_unit_size;
 		if (ftruncate(g_shm_fd, new_size) == -1) {
 			ROACH_ERR("Failed: ftrancate: %d\n", errno);
 			ROACH_ABORT();
@@ -204,7 +206,7 @@ static void alloc_item_slot(size_t size, item_slot_t *item_slot)
 
 	// just reserve region. Writing data is performed later w/o the lock.
 	g_primary_header->head_index = new_index;
-	g_primary_header->count++;
+	g_primary_header->count += num;
 
 	uint64_t shm_size = g_primary_header->size;
 	uint64_t shm_head_index = head_index;
@@ -212,7 +214,8 @@ static void alloc_item_slot(size_t size, item_slot_t *item_slot)
 
 	// map window
 	map_info_t *map_info;
-	map_info = reuse_latest_map_info_if_possible(shm_head_index, size);
+	map_info = reuse_latest_map_info_if_possible(shm_head_index,
+	                                             region_size);
 	if (!map_info)
 		map_info = create_new_map_info(shm_head_index, shm_size);
 
@@ -288,6 +291,19 @@ int unlock_data_shm(primary_header_t *header)
 	return -1;
 }
 
+void record_built_in_data_on_shm(uint32_t id, size_t size,
+                                 record_data_func_t record_data_func,
+                                 void *priv)
+{
+	item_slot_t item_slot;
+	alloc_item_slots(size, 1, &item_slot);
+	item_header_t *item_header = item_slot.header;
+	item_header->id = id;
+	item_header->size = size;
+	(*record_data_func)(size, item_slot.data, priv);
+	dec_used_count(item_slot.map_info);
+}
+
 void cockroach_record_data_on_shm_with_func(uint32_t id, size_t size,
                                             record_data_func_t record_data_func,
                                             void *priv)
@@ -296,14 +312,7 @@ void cockroach_record_data_on_shm_with_func(uint32_t id, size_t size,
 		ROACH_ERR("id: %d is RESERVED. IGNORED.\n", id);
 		return;
 	}
-
-	item_slot_t item_slot;
-	alloc_item_slot(size, &item_slot);
-	item_header_t *item_header = item_slot.header;
-	item_header->id = id;
-	item_header->size = size;
-	(*record_data_func)(size, item_slot.data, priv);
-	dec_used_count(item_slot.map_info);
+	record_built_in_data_on_shm(id, size, record_data_func, priv);
 }
 
 void cockroach_record_data_on_shm(uint32_t id, size_t size, void *data)
@@ -311,3 +320,63 @@ void cockroach_record_data_on_shm(uint32_t id, size_t size, void *data)
 	cockroach_record_data_on_shm_with_func(id, size,
 	                                       basic_record_data_func, data);
 }
+
+void *reserve_built_in_records(uint32_t id, size_t size, size_t num,
+                               cockroach_record_handle_t *handle)
+{
+	item_slot_t item_slot;
+	alloc_item_slots(size, num, &item_slot);
+
+	// The headers are written here, so the user writes only the data.
+	size_t stride = sizeof(item_header_t) + size;
+	uint8_t *ptr = (uint8_t *)item_slot.header;
+	for (size_t i = 0; i < num; i++, ptr += stride) {
+		item_header_t *item_header = (item_header_t *)ptr;
+		item_header->id = id;
+		item_header->size = size;
+	}
+	handle->priv = item_slot.map_info;
+	handle->data = item_slot.data;
+	handle->stride = stride;
+	handle->num = num;
+	return item_slot.data;
+}
+
+void *cockroach_reserve_records(uint32_t id, size_t size, size_t num,
+                                cockroach_record_handle_t *handle)
+{
+	if (id >= COCKROACH_RECORD_ID_RESERVED_BEGIN) {
+		ROACH_ERR("id: %d is RESERVED. IGNORED.\n", id);
+		return NULL;
+	}
+	if (num == 0) {
+		ROACH_ERR("No records are reserved: id: %d\n", id);
+		return NULL;
+	}
+	return reserve_built_in_records(id, size, num, handle);
+}
+
+void *cockroach_reserve_record(uint32_t id, size_t size,
+                               cockroach_record_handle_t *handle)
+{
+	return cockroach_reserve_records(id, size, 1, handle);
+}
+
+void *cockroach_get_reserved_record(cockroach_record_handle_t *handle,
+                                    size_t nth)
+{
+	if (nth >= handle->num) {
+		ROACH_ERR("Out of the reserved records: %zd (num: %zd)\n",
+		          nth, handle->num);
+		return NULL;
+	}
+	return (uint8_t *)handle->data + handle->stride * nth;
+}
+
+void cockroach_commit_record(cockroach_record_handle_t *handle)
+{
+	dec_used_count((map_info_t *)handle->priv);
+	handle->priv = NULL;
+	handle->data = NULL;
+	handle->num = 0;
+}
@@ -26,4 +26,17 @@ void init_primary_header(primary_header_t *header, size_t shm_size);
 int lock_data_shm(primary_header_t *header);
 int unlock_data_shm(primary_header_t *header);
 
+/**
+ * Record data with a reserved ID. This is used by the built-in probes.
+ */
+void record_built_in_data_on_shm(uint32_t id, size_t size,
+                                 record_data_func_t record_data_func,
+                                 void *priv);
+
+/**
+ * Reserve records with a reserved ID (see cockroach_reserve_records()).
+ */
+void *reserve_built_in_records(uint32_t id, size_t size, size_t num,
+                               cockroach_record_handle_t *handle);
+
 #endif // data_on_shm_h
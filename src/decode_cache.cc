@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <cstring>
+#include "decode_cache.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+decode_cache::shard &decode_cache::get_shard(unsigned long addr)
+{
+	// Instructions are at least a few bytes apart, so the lower bits
+	// are skipped a little.
+	return m_shards[(addr >> 2) % NUM_SHARDS];
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+decode_cache::decode_cache(void)
+: m_num_hits(0),
+  m_num_misses(0)
+{
+	for (int i = 0; i < NUM_SHARDS; i++)
+		pthread_mutex_init(&m_shards[i].mutex, NULL);
+}
+
+decode_cache::~decode_cache()
+{
+	for (int i = 0; i < NUM_SHARDS; i++)
+		pthread_mutex_destroy(&m_shards[i].mutex);
+}
+
+const decode_cache_entry *decode_cache::lookup(uint8_t *addr)
+{
+	shard &s = get_shard((unsigned long)addr);
+	pthread_mutex_lock(&s.mutex);
+	decode_cache_map_itr it = s.entry_map.find((unsigned long)addr);
+	if (it != s.entry_map.end()) {
+		const decode_cache_entry *entry = it->second;
+		pthread_mutex_unlock(&s.mutex);
+		__sync_fetch_and_add(&m_num_hits, 1);
+		return entry;
+	}
+
+	// An instruction that cannot be decoded is also cached.
+	decode_cache_entry *entry = static_cast<decode_cache_entry *>(
+	  s.arena.alloc(sizeof(decode_cache_entry)));
+	entry->valid = disassembler::decode(addr, &entry->instr);
+	if (entry->valid)
+		memcpy(entry->code, addr, entry->instr.length);
+	s.entry_map[(unsigned long)addr] = entry;
+	pthread_mutex_unlock(&s.mutex);
+	__sync_fetch_and_add(&m_num_misses, 1);
+	return entry;
+}
+
+opecode *decode_cache::parse(uint8_t *addr, opecode_arena *arena,
+                             bool abort_on_error)
+{
+	const decode_cache_entry *entry = lookup(addr);
+	if (!entry->valid) {
+		if (!abort_on_error)
+			return NULL;
+		ROACH_ERR("Failed to decode: %p: %02x %02x %02x %02x\n",
+		          addr, addr[0], addr[1], addr[2], addr[3]);
+		ROACH_ABORT();
+	}
+	return disassembler::create_opecode(addr, entry->code, entry->instr,
+	                                    arena);
+}
+
+size_t decode_cache::get_num_hits(void) const
+{
+	return m_num_hits;
+}
+
+size_t decode_cache::get_num_misses(void) const
+{
+	return m_num_misses;
+}
+
+#endif // defined(__x86_64__) || defined(__i386__)
@@ -0,0 +1,65 @@
+#ifndef decode_cache_h
+#define decode_cache_h
+
+#include <map>
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "disassembler.h"
+#include "opecode_arena.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+struct decode_cache_entry {
+	decoded_instr instr;
+	uint8_t       code[OPECODE_MAX_LENGTH];
+	bool          valid;
+};
+
+typedef map<unsigned long, const decode_cache_entry *> decode_cache_map_t;
+typedef decode_cache_map_t::iterator decode_cache_map_itr;
+
+/**
+ * Results of disassembler::decode() keyed by the address.
+ *
+ * The same instructions are decoded more than once while probes are
+ * prepared, e.g. the head of a function for an entry probe and the whole
+ * function for the exit probes. The code is also copied, so the opecode
+ * can be created after the code is overwritten by another probe.
+ * This is shared by the threads that prepare probes.
+ */
+class decode_cache {
+	static const int NUM_SHARDS = 16;
+
+	struct shard {
+		pthread_mutex_t    mutex;
+		decode_cache_map_t entry_map;
+		opecode_arena      arena;
+	};
+	shard m_shards[NUM_SHARDS];
+	volatile size_t m_num_hits;
+	volatile size_t m_num_misses;
+
+	shard &get_shard(unsigned long addr);
+public:
+	decode_cache(void);
+	virtual ~decode_cache();
+	const decode_cache_entry *lookup(uint8_t *addr);
+	opecode *parse(uint8_t *addr, opecode_arena *arena,
+	               bool abort_on_error = true);
+	size_t get_num_hits(void) const;
+	size_t get_num_misses(void) const;
+};
+
+/**
+ * The allocator and the cache used to decode instructions while probes
+ * are prepared.
+ */
+struct decode_context {
+	opecode_arena *arena;
+	decode_cache  *cache;
+};
+
+#endif // defined(__x86_64__) || defined(__i386__)
+#endif
@@ -1,1103 +1,524 @@
 #include <cstdio>
 #include <cstring>
+#include <new>
 #include "disassembler.h"
 #include "utils.h"
 #include "opecode.h"
+#include "opecode_arena.h"
 
 #if defined(__x86_64__) || defined(__i386__)
 
-#define INSTR_2BYTE_0F 0x0f
+#define MAX_INSTR_LENGTH OPECODE_MAX_LENGTH
 
-//
-// type definitions
-//
-typedef void (*code_parser_t)(opecode *op, uint8_t *code);
-
-struct mod_rm_info_t {
-	const bool sib;
-	const opecode_disp_t disp_type;
-	const bool direct_addressing;
-};
-
-struct instr_info {
-	int length;
-	code_parser_t parser;
-	int prefix;
-	int instr_2byte;
-};
+#ifdef __x86_64__
+static const bool MODE_64 = true;
+#else
+static const bool MODE_64 = false;
+#endif
 
 //
-// static const instances definitions
+// attributes of the opcode (see gen_instr_table.py)
 //
-static const mod_rm_info_t mod_rm_sib = {
-	true,
-	DISP_NONE,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_disp32 = {
-	false,
-	DISP32,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_esi = {
-	false,
-	DISP_NONE,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_ecx_disp8 = {
-	false,
-	DISP8,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_sib_disp8 = {
-	true,
-	DISP8,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_ebp_disp8 = {
-	false,
-	DISP8,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_esi_disp8 = {
-	false,
-	DISP8,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_esi_disp32 = {
-	false,
-	DISP32,
-	false,
-};
-
-static const mod_rm_info_t mod_rm_direct_eax = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_ecx = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_edx = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_ebx = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_esp = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_ebp = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_esi = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t mod_rm_direct_edi = {
-	false,
-	DISP_NONE,
-	true,
-};
-
-static const mod_rm_info_t *mod_rm_matrix[4][8] = 
-{
-	{NULL, NULL, NULL, NULL,
-	 &mod_rm_sib, &mod_rm_disp32, &mod_rm_esi, NULL},
-
-	{NULL, &mod_rm_ecx_disp8, NULL, NULL,
-	 &mod_rm_sib_disp8, &mod_rm_ebp_disp8, &mod_rm_esi_disp8, NULL},
-
-	{NULL, NULL, NULL, NULL,
-	 NULL, NULL, &mod_rm_esi_disp32, NULL},
-
-	{&mod_rm_direct_eax, &mod_rm_direct_ecx,
-	 &mod_rm_direct_edx, &mod_rm_direct_ebx,
-	 &mod_rm_direct_esp, &mod_rm_direct_ebp,
-	 &mod_rm_direct_esi, &mod_rm_direct_edi},
-};
+enum imm_kind_t {
+	IMM_KIND_NONE,
+	IMM_KIND_B,     // 8bit
+	IMM_KIND_W,     // 16bit
+	IMM_KIND_Z,     // 16 or 32bit by the operand size
+	IMM_KIND_V,     // 16, 32 or 64bit by the operand size
+	IMM_KIND_D,     // 32bit
+	IMM_KIND_WB,    // 16bit + 8bit
+	IMM_KIND_P,     // 16bit segment + 16 or 32bit offset
+	IMM_KIND_MOFFS, // address size
+};
+
+enum rel_kind_t {
+	REL_KIND_NONE,
+	REL_KIND_B,     // 8bit
+	REL_KIND_Z,     // 16 or 32bit by the operand size (32bit in x86_64)
+};
+
+#define IA_MODRM      (1 << 0)
+#define IA_MODRM_REG  (1 << 1)
+#define IA_IMM_SHIFT  2
+#define IA_IMM_MASK   (0xf << IA_IMM_SHIFT)
+#define IA_IMM(kind)  ((kind) << IA_IMM_SHIFT)
+#define IA_REL_SHIFT  6
+#define IA_REL_MASK   (0x3 << IA_REL_SHIFT)
+#define IA_REL(kind)  ((kind) << IA_REL_SHIFT)
+#define IA_FLOW_SHIFT 8
+#define IA_FLOW_MASK  (0x7 << IA_FLOW_SHIFT)
+#define IA_FLOW(flow) ((flow) << IA_FLOW_SHIFT)
+#define IA_PREFIX     (1 << 11)
+#define IA_REX        (1 << 12)
+#define IA_INVALID64  (1 << 13)
+#define IA_INVALID    (1 << 14)
+#define IA_OPREG      (1 << 15)
+#define IA_GROUP      (1 << 16)
+
+#include "instr_table.inc"
 
 //
 // private functions
 //
-static uint8_t parse_immediate8(uint8_t *code, opecode *op)
-{
-	op->inc_length(1);
-	return *code;
-}
-
-static uint32_t parse_immediate32(uint8_t *code, opecode *op)
-{
-	op->inc_length(4);
-	return *((uint32_t *)code);
-}
-
-
-static void parse_sib(uint8_t sib, opecode *op)
-{
-	int ss    = (sib & 0xc0) >> 6;
-	int index = (sib & 0x38) >> 3;
-	int base  = (sib & 0x07);
-	op->set_sib_param(ss, index, base);
-	op->inc_length();
-}
-
-static int parse_disp(opecode_disp_t disp_type, uint8_t *addr, opecode *op)
-{
-	int length = 0;
-	if (disp_type == DISP8) {
-		op->set_disp(disp_type, *addr, addr);
-		length = 1;
-	} else if (disp_type == DISP32) {
-		op->set_disp(disp_type, *((uint32_t*)addr), addr);
-		length = 4;
+static int get_legacy_prefix(uint8_t code)
+{
+	switch (code) {
+	case 0x66:
+		return PREFIX_OPERAND_SIZE;
+	case 0x67:
+		return PREFIX_ADDRESS_SIZE;
+	case 0xf0:
+		return PREFIX_LOCK;
+	case 0xf2:
+		return PREFIX_REPNE;
+	case 0xf3:
+		return PREFIX_REP;
 	}
-	else
-		ROACH_BUG("Unknown disp type: %d\n", disp_type);
-	op->inc_length(length);
-	return length;
+	return PREFIX_SEGMENT;
 }
 
-static const mod_rm_info_t *parse_mod_rm(uint8_t mod_rm, opecode *op)
-{
-	mod_type mod = (mod_type)((mod_rm & 0xc0) >> 6);
-	register_type reg = (register_type)((mod_rm & 0x38) >> 3);
-	register_type r_m = (register_type)(mod_rm & 0x07);
-	const mod_rm_info_t *mod_rm_info = mod_rm_matrix[mod][r_m];
-	if (mod_rm_info == NULL)
-		ROACH_BUG("mod_rm: mod: %d, r_m: %d, NULL (not implemented)\n",
-		          mod, r_m);
-	op->set_mod_rm(mod, reg, r_m);
-	op->inc_length();
-	return mod_rm_info;
+static int get_rex_prefix(uint8_t rex)
+{
+	int prefix = 0;
+	if (rex & 0x01)
+		prefix |= PREFIX_REX_B;
+	if (rex & 0x02)
+		prefix |= PREFIX_REX_X;
+	if (rex & 0x04)
+		prefix |= PREFIX_REX_R;
+	if (rex & 0x08)
+		prefix |= PREFIX_REX_W;
+	return prefix;
 }
 
-static uint8_t *parse_operand(opecode *op, uint8_t *code)
-{
-	const mod_rm_info_t *mod_rm_info = parse_mod_rm(*code, op);
-	code++;
-	if (mod_rm_info->sib) {
-		parse_sib(*code, op);
-		code++;
-	}
-	if (mod_rm_info->disp_type != DISP_NONE)
-		code += parse_disp(mod_rm_info->disp_type, code, op);
-	return code;
+// The R, X and B bits are inverted in VEX, EVEX and XOP.
+static int get_vex_rex_prefix(uint8_t rxb_byte, uint8_t w_byte)
+{
+	int prefix = 0;
+	if (!(rxb_byte & 0x80))
+		prefix |= PREFIX_REX_R;
+	if (!(rxb_byte & 0x40))
+		prefix |= PREFIX_REX_X;
+	if (!(rxb_byte & 0x20))
+		prefix |= PREFIX_REX_B;
+	if (w_byte & 0x80)
+		prefix |= PREFIX_REX_W;
+	return prefix;
 }
 
-// 0x01 ADD (MR)
-static void parser_add_Ev_Gv(opecode *op, uint8_t *code)
-{
-	parse_operand(op, code);
-}
-
-static const instr_info instr_info_add_Ev_Gv = {
-	1,
-	parser_add_Ev_Gv,
-};
-
-// 0x0f 2byte escape
-static const instr_info instr_info_2byte_escape = {
-	1,
-	NULL,
-	0,
-	INSTR_2BYTE_0F,
-};
-
-// 0x31 XOR (MR)
-static void parser_xor_Eb_Gb(opecode *op, uint8_t *code)
+static bool is_vex_escape(const uint8_t *code)
 {
-	parse_operand(op, code);
+	// LES, LDS and BOUND in i386 have the same first byte. They cannot
+	// have a register operand, i.e. mod = 11b means VEX or EVEX.
+	if (*code != 0xc4 && *code != 0xc5 && *code != 0x62)
+		return false;
+	return MODE_64 || (code[1] & 0xc0) == 0xc0;
 }
 
-static const instr_info instr_info_xor_Eb_Gb = {
-	1,
-	parser_xor_Eb_Gb,
-};
-
-// 0x41 REX.B Preifx
-static const instr_info instr_info_rex_b = {
-	1,
-	NULL,
-	PREFIX_REX_B,
-};
-
-// 0x48 REX.W Prefix
-static const instr_info instr_info_rex_w = {
-	1,
-	NULL,
-	PREFIX_REX_W,
-};
-
-// 0x48 REX.W Prefix
-static const instr_info instr_info_rex_wb = {
-	1,
-	NULL,
-	PREFIX_REX_WB,
-};
-
-// 0x50 PUSH
-static void parser_push_rAXr8(opecode *op, uint8_t *code)
-{
-	// no operand
-}
-
-static const instr_info instr_info_push_rAXr8 = {
-	1,
-	parser_push_rAXr8,
-};
-
-// 0x53 PUSH
-static void parser_push_rBXr11(opecode *op, uint8_t *code)
-{
-	// no operand
-}
-
-static const instr_info instr_info_push_rBXr11 = {
-	1,
-	parser_push_rBXr11,
-};
-
-// 0x54 PUSH
-static void parser_push_rSPr12(opecode *op, uint8_t *code)
+static bool is_xop_escape(const uint8_t *code)
 {
-	// no operand
+	// POP Ev (8f /0) has reg = 0, i.e. mmmmm < 8.
+	return *code == 0x8f && (code[1] & 0x1f) >= 8;
 }
 
-static const instr_info instr_info_push_rSPr12 = {
-	1,
-	parser_push_rSPr12,
-};
-
-// 0x55 PUSH
-static void parser_push_rBPr13(opecode *op, uint8_t *code)
+static bool is_operand_size_16(int prefix)
 {
-	// no operand
+	return (prefix & PREFIX_OPERAND_SIZE) && !(prefix & PREFIX_REX_W);
 }
 
-static const instr_info instr_info_push_rBPr13 = {
-	1,
-	parser_push_rBPr13,
-};
-
-// 0x56 PUSH
-static void parser_push_rSIr14(opecode *op, uint8_t *code)
+static int get_address_size(int prefix)
 {
-	// no operand
+	if (MODE_64)
+		return (prefix & PREFIX_ADDRESS_SIZE) ? 4 : 8;
+	return (prefix & PREFIX_ADDRESS_SIZE) ? 2 : 4;
 }
 
-static const instr_info instr_info_push_rSIr14 = {
-	1,
-	parser_push_rSIr14,
-};
-
-// 0x57 PUSH
-static void parser_push_rDIr15(opecode *op, uint8_t *code)
-{
-	// no operand
+static int get_imm_size(int imm_kind, int prefix)
+{
+	bool opsize16 = is_operand_size_16(prefix);
+	switch (imm_kind) {
+	case IMM_KIND_B:
+		return 1;
+	case IMM_KIND_W:
+		return 2;
+	case IMM_KIND_Z:
+		return opsize16 ? 2 : 4;
+	case IMM_KIND_V:
+		if (prefix & PREFIX_REX_W)
+			return 8;
+		return opsize16 ? 2 : 4;
+	case IMM_KIND_D:
+		return 4;
+	case IMM_KIND_WB:
+		return 3;
+	case IMM_KIND_P:
+		return opsize16 ? 4 : 6;
+	case IMM_KIND_MOFFS:
+		return get_address_size(prefix);
+	}
+	return 0;
 }
 
-static const instr_info instr_info_push_rDIr15 = {
-	1,
-	parser_push_rDIr15,
-};
-
-// 0x58 POP
-static void parser_pop_rAXr8(opecode *op, uint8_t *code)
+static bool has_sib(uint8_t modrm, int prefix)
 {
-	op->set_mod_rm(MOD_REG_NONE, REG_AX, REG_NONE);
+	return (modrm >> 6) != 3 && (modrm & 0x07) == 4 &&
+	       get_address_size(prefix) != 2;
 }
 
-static const instr_info instr_info_pop_rAXr8 = {
-	1,
-	parser_pop_rAXr8,
-};
-
-// 0x5d POP
-static void parser_pop_rBPr13(opecode *op, uint8_t *code)
-{
-	op->set_mod_rm(MOD_REG_NONE, REG_BP, REG_NONE);
+static int get_disp_size(uint8_t modrm, const uint8_t *sib, int prefix)
+{
+	int mod = modrm >> 6;
+	int r_m = modrm & 0x07;
+	if (mod == 3)
+		return 0;
+	if (mod == 1)
+		return 1;
+	if (get_address_size(prefix) == 2) {
+		if (mod == 2 || r_m == 6)
+			return 2;
+		return 0;
+	}
+	if (mod == 2)
+		return 4;
+	// mod == 0
+	if (r_m == 5)
+		return 4;
+	if (sib && (*sib & 0x07) == 5)
+		return 4;
+	return 0;
 }
 
-static const instr_info instr_info_pop_rBPr13 = {
-	1,
-	parser_pop_rBPr13,
-};
+static void resolve_group(opcode_map_t map, uint8_t opcode, uint8_t modrm,
+                          int prefix, int *imm_kind, int *rel_kind,
+                          opecode_flow_t *flow_type)
+{
+	int reg = (modrm >> 3) & 0x07;
+	if (map == OPCODE_MAP_0F) {
+		// 0f 78: EXTRQ and INSERTQ (SSE4a) take two imm8.
+		if (opcode == 0x78 &&
+		    (prefix & (PREFIX_OPERAND_SIZE|PREFIX_REPNE)))
+			*imm_kind = IMM_KIND_W;
+		return;
+	}
 
-// 0x7e Jcc, jb- Short displacement jump on condition
-static void parser_jcc_LE_NG(opecode *op, uint8_t *code)
-{
-	op->set_rel_jump_addr(REL8, *code);
-	op->inc_length(1);
+	switch (opcode) {
+	case 0xc7: // XBEGIN
+		if (modrm == 0xf8) {
+			*imm_kind = IMM_KIND_NONE;
+			*rel_kind = REL_KIND_Z;
+			*flow_type = FLOW_COND_JUMP;
+		}
+		break;
+	case 0xf6: // TEST Eb,Ib
+		if (reg <= 1)
+			*imm_kind = IMM_KIND_B;
+		break;
+	case 0xf7: // TEST Ev,Iz
+		if (reg <= 1)
+			*imm_kind = IMM_KIND_Z;
+		break;
+	case 0xff:
+		if (reg == 2 || reg == 3)
+			*flow_type = FLOW_CALL;
+		else if (reg == 4 || reg == 5)
+			*flow_type = FLOW_JUMP_INDIRECT;
+		break;
+	}
 }
 
-static const instr_info instr_info_jcc_LE_NG  = {
-	1,
-	parser_jcc_LE_NG,
-};
-
-// 0x80 Immediate Group 1 (MI): sub, cmp
-static void parser_imm_grp1_Eb_Ib(opecode *op, uint8_t *code)
-{
-	code = parse_operand(op, code);
-	uint8_t imm = parse_immediate8(code, op);
-	op->set_immediate(IMM8, imm);
-	code++;
+static uint32_t get_attr(opcode_map_t map, uint8_t opcode, bool vex)
+{
+	switch (map) {
+	case OPCODE_MAP_1BYTE:
+		return instr_attr_1byte[opcode];
+	case OPCODE_MAP_0F:
+		return vex ? instr_attr_vex_0f[opcode] : instr_attr_0f[opcode];
+	case OPCODE_MAP_0F38:
+		return instr_attr_0f38;
+	case OPCODE_MAP_0F3A:
+		return instr_attr_0f3a;
+	case OPCODE_MAP_EVEX5:
+		return instr_attr_evex_map5;
+	case OPCODE_MAP_EVEX6:
+		return instr_attr_evex_map6;
+	case OPCODE_MAP_XOP8:
+		return instr_attr_xop8;
+	case OPCODE_MAP_XOP9:
+		return instr_attr_xop9;
+	case OPCODE_MAP_XOPA:
+		return instr_attr_xopa;
+	}
+	return IA_INVALID;
 }
 
-static const instr_info instr_info_imm_grp1_Eb_Ib = {
-	1,
-	parser_imm_grp1_Eb_Ib,
-};
-
-// 0x81 Immediate Group 1 (MI): sub, cmp
-static void parser_imm_grp1_Ev_Iz(opecode *op, uint8_t *code)
-{
-	code = parse_operand(op, code);
-	uint8_t imm = parse_immediate32(code, op);
-	op->set_immediate(IMM32, imm);
-	code += 4;
+/**
+ * Parse VEX, EVEX or XOP prefix.
+ *
+ * @return The number of bytes of the prefix. 0 if invalid.
+ */
+static int parse_vex(const uint8_t *code, opcode_map_t *map, int *prefix)
+{
+	int map_select = code[1] & 0x1f;
+	switch (*code) {
+	case 0xc5:
+		*map = OPCODE_MAP_0F;
+		*prefix |= PREFIX_VEX | get_vex_rex_prefix(code[1] | 0x60, 0);
+		return 2;
+	case 0xc4:
+		if (map_select < 1 || map_select > 3)
+			return 0;
+		*map = (opcode_map_t)(OPCODE_MAP_0F + map_select - 1);
+		*prefix |= PREFIX_VEX | get_vex_rex_prefix(code[1], code[2]);
+		return 3;
+	case 0x62:
+		map_select = code[1] & 0x07;
+		if (map_select >= 1 && map_select <= 3)
+			*map = (opcode_map_t)(OPCODE_MAP_0F + map_select - 1);
+		else if (map_select == 5)
+			*map = OPCODE_MAP_EVEX5;
+		else if (map_select == 6)
+			*map = OPCODE_MAP_EVEX6;
+		else
+			return 0;
+		*prefix |= PREFIX_VEX | PREFIX_EVEX |
+		           get_vex_rex_prefix(code[1], code[2]);
+		return 4;
+	case 0x8f:
+		if (map_select < 8 || map_select > 10)
+			return 0;
+		*map = (opcode_map_t)(OPCODE_MAP_XOP8 + map_select - 8);
+		*prefix |= PREFIX_VEX | PREFIX_XOP |
+		           get_vex_rex_prefix(code[1], code[2]);
+		return 3;
+	}
+	return 0;
 }
 
-static const instr_info instr_info_imm_grp1_Ev_Iz = {
-	1,
-	parser_imm_grp1_Ev_Iz,
-};
-
-// 0x83 Immediate Group 1 (MI): sub, cmp
-static void parser_imm_grp1_Ev_Ib(opecode *op, uint8_t *code)
+static uint64_t read_le(const uint8_t *code, int size)
 {
-	code = parse_operand(op, code);
-	uint8_t imm = parse_immediate8(code, op);
-	op->set_immediate(IMM8, imm);
-	code++;
+	uint64_t value = 0;
+	for (int i = size - 1; i >= 0; i--)
+		value = (value << 8) | code[i];
+	return value;
 }
 
-static const instr_info instr_info_imm_grp1_Ev_Ib = {
-	1,
-	parser_imm_grp1_Ev_Ib,
-};
-
-// 0x85 TEST (MR)
-static void parser_test_Ev_Gv(opecode *op, uint8_t *code)
+static int32_t read_rel(const uint8_t *code, int size)
 {
-	parse_operand(op, code);
+	if (size == 1)
+		return (int8_t)code[0];
+	if (size == 2)
+		return (int16_t)read_le(code, 2);
+	return (int32_t)read_le(code, 4);
 }
 
-static const instr_info instr_info_test_Ev_Gv = {
-	1,
-	parser_test_Ev_Gv,
-};
-
-// 0x89 MOV (MR)
-static void parser_mov_Ev_Gv(opecode *op, uint8_t *code)
+static opecode_imm_t get_imm_type(int size)
 {
-	parse_operand(op, code);
+	if (size <= 1)
+		return IMM8;
+	if (size <= 2)
+		return IMM16;
+	if (size <= 4)
+		return IMM32;
+	return IMM64;
 }
 
-static const instr_info instr_info_mov_Ev_Gv = {
-	1,
-	parser_mov_Ev_Gv,
-};
-
-// 0x8b MOV (RM)
-static void parser_mov_Gv_Ev(opecode *op, uint8_t *code)
-{
-	parse_operand(op, code);
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+opecode *disassembler::parse_core(uint8_t *code_start, bool abort_on_error)
+{
+	decoded_instr instr;
+	if (!decode(code_start, &instr)) {
+		if (!abort_on_error)
+			return NULL;
+		ROACH_ERR("Failed to decode: %p: %02x %02x %02x %02x\n",
+		          code_start, code_start[0], code_start[1],
+		          code_start[2], code_start[3]);
+		ROACH_ABORT();
+	}
+	return create_opecode(code_start, code_start, instr);
 }
 
-static const instr_info instr_info_mov_Gv_Ev = {
-	1,
-	parser_mov_Gv_Ev,
-};
-
-// 0x8d LEA (RM)
-static void parser_lea_Gv_M(opecode *op, uint8_t *code)
-{
-	code = parse_operand(op, code);
+void disassembler::set_operands(opecode *op, const uint8_t *code,
+                                const decoded_instr &instr)
+{
+	if (instr.modrm_offset >= 0) {
+		uint8_t modrm = code[instr.modrm_offset];
+		op->set_mod_rm((mod_type)(modrm >> 6),
+		               (register_type)((modrm >> 3) & 0x07),
+		               (register_type)(modrm & 0x07));
+	} else if (instr.opcode_reg >= 0) {
+		op->set_mod_rm(MOD_REG_NONE, (register_type)instr.opcode_reg,
+		               REG_NONE);
+	}
+	if (instr.sib_offset >= 0) {
+		uint8_t sib = code[instr.sib_offset];
+		op->set_sib_param(sib >> 6, (sib >> 3) & 0x07, sib & 0x07);
+	}
+	if (instr.disp_size > 0) {
+		const uint8_t *disp = code + instr.disp_offset;
+		opecode_disp_t disp_type = DISP32;
+		if (instr.disp_size == 1)
+			disp_type = DISP8;
+		else if (instr.disp_size == 2)
+			disp_type = DISP16;
+		op->set_disp(disp_type, read_le(disp, instr.disp_size),
+		             op->get_original_addr() + instr.disp_offset);
+	}
+	if (instr.rel_jump_type != REL_INVALID) {
+		op->set_rel_jump_addr(instr.rel_jump_type,
+		  read_rel(code + instr.imm_offset, instr.imm_size));
+	} else if (instr.imm_size > 0) {
+		op->set_immediate(get_imm_type(instr.imm_size),
+		                  read_le(code + instr.imm_offset,
+		                          instr.imm_size));
+	}
+	op->set_flow_type(instr.flow_type);
 }
 
-static const instr_info instr_info_lea_Gv_M = {
-	1,
-	parser_lea_Gv_M,
-};
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+bool disassembler::decode(const uint8_t *code, decoded_instr *instr)
+{
+	// Instructions are decoded with only the attributes of the opcode
+	// maps generated from gen_instr_table.py and the handful of rules of
+	// the encoding. No memory is allocated, so this can be used for
+	// scanning a large amount of code.
+	const uint8_t *ptr = code;
+	int prefix = 0;
+	uint8_t rex = 0;
+	instr->rex_offset = -1;
+	instr->vex_offset = -1;
+	while (true) {
+		if (ptr - code >= MAX_INSTR_LENGTH)
+			return false;
+		uint32_t attr = instr_attr_1byte[*ptr];
+		if (attr & IA_PREFIX) {
+			// REX is ignored unless it is just before the opcode.
+			prefix |= get_legacy_prefix(*ptr);
+			if (*ptr == 0xf2)
+				prefix &= ~PREFIX_REP;
+			else if (*ptr == 0xf3)
+				prefix &= ~PREFIX_REPNE;
+			rex = 0;
+			instr->rex_offset = -1;
+		} else if (MODE_64 && (attr & IA_REX)) {
+			rex = *ptr;
+			instr->rex_offset = ptr - code;
+		} else
+			break;
+		ptr++;
+	}
+	prefix |= get_rex_prefix(rex);
+
+	opcode_map_t map = OPCODE_MAP_1BYTE;
+	bool vex = is_vex_escape(ptr) || is_xop_escape(ptr);
+	if (vex) {
+		// Legacy SIMD prefixes and REX cannot be used with VEX.
+		if (rex || (prefix & (PREFIX_OPERAND_SIZE|PREFIX_REP|
+		                      PREFIX_REPNE|PREFIX_LOCK)))
+			return false;
+		int vex_len = parse_vex(ptr, &map, &prefix);
+		if (vex_len == 0)
+			return false;
+		instr->vex_offset = ptr - code;
+		ptr += vex_len;
+	} else if (*ptr == 0x0f) {
+		ptr++;
+		map = OPCODE_MAP_0F;
+		if (*ptr == 0x38 || *ptr == 0x3a) {
+			map = (*ptr == 0x38) ? OPCODE_MAP_0F38 : OPCODE_MAP_0F3A;
+			ptr++;
+		}
+	}
+	uint8_t opcode = *ptr++;
+	uint32_t attr = get_attr(map, opcode, vex);
+	if ((attr & IA_INVALID) || (MODE_64 && (attr & IA_INVALID64)))
+		return false;
+
+	int imm_kind = (attr & IA_IMM_MASK) >> IA_IMM_SHIFT;
+	int rel_kind = (attr & IA_REL_MASK) >> IA_REL_SHIFT;
+	opecode_flow_t flow_type =
+	  (opecode_flow_t)((attr & IA_FLOW_MASK) >> IA_FLOW_SHIFT);
+	instr->opcode_reg = (attr & IA_OPREG) ? (opcode & 0x07) : -1;
+	instr->modrm_offset = -1;
+	instr->sib_offset = -1;
+	instr->disp_offset = -1;
+	instr->disp_size = 0;
+	if (attr & IA_MODRM) {
+		uint8_t modrm = *ptr;
+		instr->modrm_offset = ptr - code;
+		ptr++;
+		if (attr & IA_MODRM_REG)
+			modrm |= 0xc0;
+		const uint8_t *sib = NULL;
+		if (has_sib(modrm, prefix)) {
+			sib = ptr;
+			instr->sib_offset = ptr - code;
+			ptr++;
+		}
+		instr->disp_size = get_disp_size(modrm, sib, prefix);
+		if (instr->disp_size > 0) {
+			instr->disp_offset = ptr - code;
+			ptr += instr->disp_size;
+		}
+		if (attr & IA_GROUP) {
+			resolve_group(map, opcode, modrm, prefix,
+			              &imm_kind, &rel_kind, &flow_type);
+		}
+	}
 
-// 0xbe MOV
-static void parser_mov_rSIr14_Iv(opecode *op, uint8_t *code)
-{
-	uint32_t imm = parse_immediate32(code, op);
-	op->set_immediate(IMM32, imm);
+	instr->imm_offset = ptr - code;
+	instr->imm_size = get_imm_size(imm_kind, prefix);
+	instr->rel_jump_type = REL_INVALID;
+	if (rel_kind == REL_KIND_B) {
+		instr->imm_size = 1;
+		instr->rel_jump_type = REL8;
+	} else if (rel_kind == REL_KIND_Z) {
+		bool rel16 = !MODE_64 && is_operand_size_16(prefix);
+		instr->imm_size = rel16 ? 2 : 4;
+		instr->rel_jump_type = rel16 ? REL16 : REL32;
+	}
+	ptr += instr->imm_size;
+
+	instr->length = ptr - code;
+	if (instr->length > MAX_INSTR_LENGTH)
+		return false;
+	instr->prefix = prefix;
+	instr->map = map;
+	instr->opcode = opcode;
+	instr->flow_type = flow_type;
+	return true;
 }
 
-static const instr_info instr_info_mov_rSIr14_Iv = {
-	1,
-	parser_mov_rSIr14_Iv,
-};
-
-// 0xc3 RET
-static void parser_not_impl(opecode *op, uint8_t *code)
-{
-	// nothing to do
+opecode *disassembler::create_opecode(uint8_t *orig_addr, const uint8_t *code,
+                                      const decoded_instr &instr,
+                                      opecode_arena *arena)
+{
+	// The code may be a copy of the original one (ex. in decode_cache).
+	void *ptr = arena ? arena->alloc(sizeof(opecode))
+	                  : ::operator new(sizeof(opecode));
+	opecode *op = new (ptr) opecode(orig_addr, arena);
+	op->inc_length(instr.length);
+	op->add_prefix(instr.prefix);
+	set_operands(op, code, instr);
+	op->copy_code(code);
+	return op;
 }
 
-static const instr_info instr_info_ret = {
-	1,
-	parser_not_impl,
-};
-
-// 0xc7 MOV (MI)
-static void parser_mov_Ev_Iz(opecode *op, uint8_t *code)
+opecode *disassembler::parse(uint8_t *code_start)
 {
-	code = parse_operand(op, code);
-	uint8_t imm = parse_immediate32(code, op);
-	op->set_immediate(IMM32, imm);
-	code += 4;
+	return parse_core(code_start, true);
 }
 
-static const instr_info instr_info_mov_Ev_Iz = {
-	1,
-	parser_mov_Ev_Iz,
-};
-
-
-static const instr_info *first_byte_instr_array[0x100] = 
+opecode *disassembler::try_parse(uint8_t *code_start)
 {
-	NULL,                         // 0x00
-	&instr_info_add_Ev_Gv,        // 0x01
-	NULL,                         // 0x02
-	NULL,                         // 0x03
-	NULL,                         // 0x04
-	NULL,                         // 0x05
-	NULL,                         // 0x06
-	NULL,                         // 0x07
-	NULL,                         // 0x08
-	NULL,                         // 0x09
-	NULL,                         // 0x0a
-	NULL,                         // 0x0b
-	NULL,                         // 0x0c
-	NULL,                         // 0x0d
-	NULL,                         // 0x0e
-	&instr_info_2byte_escape,     // 0x0f
-
-	NULL,                         // 0x10
-	NULL,                         // 0x11
-	NULL,                         // 0x12
-	NULL,                         // 0x13
-	NULL,                         // 0x14
-	NULL,                         // 0x15
-	NULL,                         // 0x16
-	NULL,                         // 0x17
-	NULL,                         // 0x18
-	NULL,                         // 0x19
-	NULL,                         // 0x1a
-	NULL,                         // 0x1b
-	NULL,                         // 0x1c
-	NULL,                         // 0x1d
-	NULL,                         // 0x1e
-	NULL,                         // 0x1f
-
-	NULL,                         // 0x20
-	NULL,                         // 0x21
-	NULL,                         // 0x22
-	NULL,                         // 0x23
-	NULL,                         // 0x24
-	NULL,                         // 0x25
-	NULL,                         // 0x26
-	NULL,                         // 0x27
-	NULL,                         // 0x28
-	NULL,                         // 0x29
-	NULL,                         // 0x2a
-	NULL,                         // 0x2b
-	NULL,                         // 0x2c
-	NULL,                         // 0x2d
-	NULL,                         // 0x2e
-	NULL,                         // 0x2f
-
-	NULL,                         // 0x30
-	&instr_info_xor_Eb_Gb,        // 0x31
-	NULL,                         // 0x32
-	NULL,                         // 0x33
-	NULL,                         // 0x34
-	NULL,                         // 0x35
-	NULL,                         // 0x36
-	NULL,                         // 0x37
-	NULL,                         // 0x38
-	NULL,                         // 0x39
-	NULL,                         // 0x3a
-	NULL,                         // 0x3b
-	NULL,                         // 0x3c
-	NULL,                         // 0x3d
-	NULL,                         // 0x3e
-	NULL,                         // 0x3f
-
-	NULL,                         // 0x40
-	&instr_info_rex_b,            // 0x41
-	NULL,                         // 0x42
-	NULL,                         // 0x43
-	NULL,                         // 0x44
-	NULL,                         // 0x45
-	NULL,                         // 0x46
-	NULL,                         // 0x47
-	&instr_info_rex_w,            // 0x48
-	&instr_info_rex_wb,           // 0x49
-	NULL,                         // 0x4a
-	NULL,                         // 0x4b
-	NULL,                         // 0x4c
-	NULL,                         // 0x4d
-	NULL,                         // 0x4e
-	NULL,                         // 0x4f
-
-	&instr_info_push_rAXr8,       // 0x50
-	NULL,                         // 0x51
-	NULL,                         // 0x52
-	&instr_info_push_rBXr11,      // 0x53
-	&instr_info_push_rSPr12,      // 0x54
-	&instr_info_push_rBPr13,      // 0x55
-	&instr_info_push_rSIr14,      // 0x56
-	&instr_info_push_rDIr15,      // 0x57
-	&instr_info_pop_rAXr8,        // 0x58
-	NULL,                         // 0x59
-	NULL,                         // 0x5a
-	NULL,                         // 0x5b
-	NULL,                         // 0x5c
-	&instr_info_pop_rBPr13,       // 0x5d
-	NULL,                         // 0x5e
-	NULL,                         // 0x5f
-
-	NULL,                         // 0x60
-	NULL,                         // 0x61
-	NULL,                         // 0x62
-	NULL,                         // 0x63
-	NULL,                         // 0x64
-	NULL,                         // 0x65
-	NULL,                         // 0x66
-	NULL,                         // 0x67
-	NULL,                         // 0x68
-	NULL,                         // 0x69
-	NULL,                         // 0x6a
-	NULL,                         // 0x6b
-	NULL,                         // 0x6c
-	NULL,                         // 0x6d
-	NULL,                         // 0x6e
-	NULL,                         // 0x6f
-
-	NULL,                         // 0x70
-	NULL,                         // 0x71
-	NULL,                         // 0x72
-	NULL,                         // 0x73
-	NULL,                         // 0x74
-	NULL,                         // 0x75
-	NULL,                         // 0x76
-	NULL,                         // 0x77
-	NULL,                         // 0x78
-	NULL,                         // 0x79
-	NULL,                         // 0x7a
-	NULL,                         // 0x7b
-	NULL,                         // 0x7c
-	NULL,                         // 0x7d
-	&instr_info_jcc_LE_NG,        // 0x7e
-	NULL,                         // 0x7f
-
-	&instr_info_imm_grp1_Eb_Ib,   // 0x80
-	&instr_info_imm_grp1_Ev_Iz,   // 0x81
-	NULL,                         // 0x82
-	&instr_info_imm_grp1_Ev_Ib,   // 0x83
-	NULL,                         // 0x84
-	&instr_info_test_Ev_Gv,       // 0x85
-	NULL,                         // 0x86
-	NULL,                         // 0x87
-	NULL,                         // 0x88
-	&instr_info_mov_Ev_Gv,        // 0x89
-	NULL,                         // 0x8a
-	&instr_info_mov_Gv_Ev,        // 0x8b
-	NULL,                         // 0x8c
-	&instr_info_lea_Gv_M,         // 0x8d
-	NULL,                         // 0x8e
-	NULL,                         // 0x8f
-
-	NULL,                         // 0x90
-	NULL,                         // 0x91
-	NULL,                         // 0x92
-	NULL,                         // 0x93
-	NULL,                         // 0x94
-	NULL,                         // 0x95
-	NULL,                         // 0x96
-	NULL,                         // 0x97
-	NULL,                         // 0x98
-	NULL,                         // 0x99
-	NULL,                         // 0x9a
-	NULL,                         // 0x9b
-	NULL,                         // 0x9c
-	NULL,                         // 0x9d
-	NULL,                         // 0x9e
-	NULL,                         // 0x9f
-/*
-	&instr_info_pushf,            // 0x9c
-	&instr_info_popf,             // 0x9d
-*/
-	NULL,                         // 0xa0
-	NULL,                         // 0xa1
-	NULL,                         // 0xa2
-	NULL,                         // 0xa3
-	NULL,                         // 0xa4
-	NULL,                         // 0xa5
-	NULL,                         // 0xa6
-	NULL,                         // 0xa7
-	NULL,                         // 0xa8
-	NULL,                         // 0xa9
-	NULL,                         // 0xaa
-	NULL,                         // 0xab
-	NULL,                         // 0xac
-	NULL,                         // 0xad
-	NULL,                         // 0xae
-	NULL,                         // 0xaf
-
-	NULL,                         // 0xb0
-	NULL,                         // 0xb1
-	NULL,                         // 0xb2
-	NULL,                         // 0xb3
-	NULL,                         // 0xb4
-	NULL,                         // 0xb5
-	NULL,                         // 0xb6
-	NULL,                         // 0xb7
-	NULL,                         // 0xb8
-	NULL,                         // 0xb9
-	NULL,                         // 0xba
-	NULL,                         // 0xbb
-	NULL,                         // 0xbc
-	NULL,                         // 0xbd
-	&instr_info_mov_rSIr14_Iv,    // 0xbe
-	NULL,                         // 0xbf
-
-	NULL,                         // 0xc0
-	NULL,                         // 0xc1
-	NULL,                         // 0xc2
-	&instr_info_ret,              // 0xc3
-	NULL,                         // 0xc4
-	NULL,                         // 0xc5
-	NULL,                         // 0xc6
-	&instr_info_mov_Ev_Iz,        // 0xc7
-	NULL,                         // 0xc8
-	NULL,                         // 0xc9
-	NULL,                         // 0xca
-	NULL,                         // 0xcb
-	NULL,                         // 0xcc
-	NULL,                         // 0xcd
-	NULL,                         // 0xce
-	NULL,                         // 0xcf
-
-	NULL,                         // 0xd1
-	NULL,                         // 0xd2
-	NULL,                         // 0xd3
-	NULL,                         // 0xd4
-	NULL,                         // 0xd5
-	NULL,                         // 0xd6
-	NULL,                         // 0xd7
-	NULL,                         // 0xd8
-	NULL,                         // 0xd9
-	NULL,                         // 0xda
-	NULL,                         // 0xdb
-	NULL,                         // 0xdc
-	NULL,                         // 0xdd
-	NULL,                         // 0xde
-	NULL,                         // 0xdf
-
-	NULL,                         // 0xe0
-	NULL,                         // 0xe0
-	NULL,                         // 0xe0
-	NULL,                         // 0xe1
-	NULL,                         // 0xe2
-	NULL,                         // 0xe3
-	NULL,                         // 0xe4
-	NULL,                         // 0xe5
-	NULL,                         // 0xe6
-	NULL,                         // 0xe7
-	NULL,                         // 0xe8
-	NULL,                         // 0xe9
-	NULL,                         // 0xea
-	NULL,                         // 0xeb
-	NULL,                         // 0xec
-	NULL,                         // 0xed
-	NULL,                         // 0xee
-	NULL,                         // 0xef
-
-	NULL,                         // 0xf1
-	NULL,                         // 0xf2
-	NULL,                         // 0xf3
-	NULL,                         // 0xf4
-	NULL,                         // 0xf5
-	NULL,                         // 0xf6
-	NULL,                         // 0xf7
-	NULL,                         // 0xf8
-	NULL,                         // 0xf9
-	NULL,                         // 0xfa
-	NULL,                         // 0xfb
-	NULL,                         // 0xfc
-	NULL,                         // 0xfd
-	NULL,                         // 0xfe
-	NULL,                         // 0xff
-};
-
-//
-// 2byte instructions
-//
-
-// 0xaf IMUL
-static void parser_imul_Gv_Ev(opecode *op, uint8_t *code)
-{
-	code = parse_operand(op, code);
+	// Same as parse() except that NULL is returned for an instruction
+	// that is not supported. This is used for the code that was not
+	// explicitly specified by the user, such as functions matched with
+	// a pattern.
+	return parse_core(code_start, false);
 }
 
-static const instr_info instr_info_imul_Gv_Ev = {
-	1,
-	parser_imul_Gv_Ev,
-};
-
-static const instr_info *second_byte_instr_array_0f[0x100] = 
-{
-	NULL,                         // 0x00
-	NULL,                         // 0x01
-	NULL,                         // 0x02
-	NULL,                         // 0x03
-	NULL,                         // 0x04
-	NULL,                         // 0x05
-	NULL,                         // 0x06
-	NULL,                         // 0x07
-	NULL,                         // 0x08
-	NULL,                         // 0x09
-	NULL,                         // 0x0a
-	NULL,                         // 0x0b
-	NULL,                         // 0x0c
-	NULL,                         // 0x0d
-	NULL,                         // 0x0e
-	NULL,                         // 0x0f
-
-	NULL,                         // 0x10
-	NULL,                         // 0x11
-	NULL,                         // 0x12
-	NULL,                         // 0x13
-	NULL,                         // 0x14
-	NULL,                         // 0x15
-	NULL,                         // 0x16
-	NULL,                         // 0x17
-	NULL,                         // 0x18
-	NULL,                         // 0x19
-	NULL,                         // 0x1a
-	NULL,                         // 0x1b
-	NULL,                         // 0x1c
-	NULL,                         // 0x1d
-	NULL,                         // 0x1e
-	NULL,                         // 0x1f
-
-	NULL,                         // 0x20
-	NULL,                         // 0x21
-	NULL,                         // 0x22
-	NULL,                         // 0x23
-	NULL,                         // 0x24
-	NULL,                         // 0x25
-	NULL,                         // 0x26
-	NULL,                         // 0x27
-	NULL,                         // 0x28
-	NULL,                         // 0x29
-	NULL,                         // 0x2a
-	NULL,                         // 0x2b
-	NULL,                         // 0x2c
-	NULL,                         // 0x2d
-	NULL,                         // 0x2e
-	NULL,                         // 0x2f
-
-	NULL,                         // 0x30
-	NULL,                         // 0x31
-	NULL,                         // 0x32
-	NULL,                         // 0x33
-	NULL,                         // 0x34
-	NULL,                         // 0x35
-	NULL,                         // 0x36
-	NULL,                         // 0x37
-	NULL,                         // 0x38
-	NULL,                         // 0x39
-	NULL,                         // 0x3a
-	NULL,                         // 0x3b
-	NULL,                         // 0x3c
-	NULL,                         // 0x3d
-	NULL,                         // 0x3e
-	NULL,                         // 0x3f
-
-	NULL,                         // 0x40
-	NULL,                         // 0x41
-	NULL,                         // 0x42
-	NULL,                         // 0x43
-	NULL,                         // 0x44
-	NULL,                         // 0x45
-	NULL,                         // 0x46
-	NULL,                         // 0x47
-	NULL,                         // 0x48
-	NULL,                         // 0x49
-	NULL,                         // 0x4a
-	NULL,                         // 0x4b
-	NULL,                         // 0x4c
-	NULL,                         // 0x4d
-	NULL,                         // 0x4e
-	NULL,                         // 0x4f
-
-	NULL,                         // 0x50
-	NULL,                         // 0x51
-	NULL,                         // 0x52
-	NULL,                         // 0x53
-	NULL,                         // 0x54
-	NULL,                         // 0x55
-	NULL,                         // 0x56
-	NULL,                         // 0x57
-	NULL,                         // 0x58
-	NULL,                         // 0x59
-	NULL,                         // 0x5a
-	NULL,                         // 0x5b
-	NULL,                         // 0x5c
-	NULL,                         // 0x5d
-	NULL,                         // 0x5e
-	NULL,                         // 0x5f
-
-	NULL,                         // 0x60
-	NULL,                         // 0x61
-	NULL,                         // 0x62
-	NULL,                         // 0x63
-	NULL,                         // 0x64
-	NULL,                         // 0x65
-	NULL,                         // 0x66
-	NULL,                         // 0x67
-	NULL,                         // 0x68
-	NULL,                         // 0x69
-	NULL,                         // 0x6a
-	NULL,                         // 0x6b
-	NULL,                         // 0x6c
-	NULL,                         // 0x6d
-	NULL,                         // 0x6e
-	NULL,                         // 0x6f
-
-	NULL,                         // 0x70
-	NULL,                         // 0x71
-	NULL,                         // 0x72
-	NULL,                         // 0x73
-	NULL,                         // 0x74
-	NULL,                         // 0x75
-	NULL,                         // 0x76
-	NULL,                         // 0x77
-	NULL,                         // 0x78
-	NULL,                         // 0x79
-	NULL,                         // 0x7a
-	NULL,                         // 0x7b
-	NULL,                         // 0x7c
-	NULL,                         // 0x7d
-	NULL,                         // 0x7e
-	NULL,                         // 0x7f
-
-	NULL,                         // 0x80
-	NULL,                         // 0x81
-	NULL,                         // 0x82
-	NULL,                         // 0x83
-	NULL,                         // 0x84
-	NULL,                         // 0x85
-	NULL,                         // 0x86
-	NULL,                         // 0x87
-	NULL,                         // 0x88
-	NULL,                         // 0x89
-	NULL,                         // 0x8a
-	NULL,                         // 0x8b
-	NULL,                         // 0x8c
-	NULL,                         // 0x8d
-	NULL,                         // 0x8e
-	NULL,                         // 0x8f
-
-	NULL,                         // 0x90
-	NULL,                         // 0x91
-	NULL,                         // 0x92
-	NULL,                         // 0x93
-	NULL,                         // 0x94
-	NULL,                         // 0x95
-	NULL,                         // 0x96
-	NULL,                         // 0x97
-	NULL,                         // 0x98
-	NULL,                         // 0x99
-	NULL,                         // 0x9a
-	NULL,                         // 0x9b
-	NULL,                         // 0x9c
-	NULL,                         // 0x9d
-	NULL,                         // 0x9e
-	NULL,                         // 0x9f
-
-	NULL,                         // 0xa0
-	NULL,                         // 0xa1
-	NULL,                         // 0xa2
-	NULL,                         // 0xa3
-	NULL,                         // 0xa4
-	NULL,                         // 0xa5
-	NULL,                         // 0xa6
-	NULL,                         // 0xa7
-	NULL,                         // 0xa8
-	NULL,                         // 0xa9
-	NULL,                         // 0xaa
-	NULL,                         // 0xab
-	NULL,                         // 0xac
-	NULL,                         // 0xad
-	NULL,                         // 0xae
-	&instr_info_imul_Gv_Ev,       // 0xaf
-
-	NULL,                         // 0xb0
-	NULL,                         // 0xb1
-	NULL,                         // 0xb2
-	NULL,                         // 0xb3
-	NULL,                         // 0xb4
-	NULL,                         // 0xb5
-	NULL,                         // 0xb6
-	NULL,                         // 0xb7
-	NULL,                         // 0xb8
-	NULL,                         // 0xb9
-	NULL,                         // 0xba
-	NULL,                         // 0xbb
-	NULL,                         // 0xbc
-	NULL,                         // 0xbd
-	NULL,                         // 0xbe
-	NULL,                         // 0xbf
-
-	NULL,                         // 0xc0
-	NULL,                         // 0xc1
-	NULL,                         // 0xc2
-	NULL,                         // 0xc3
-	NULL,                         // 0xc4
-	NULL,                         // 0xc5
-	NULL,                         // 0xc6
-	NULL,                         // 0xc7
-	NULL,                         // 0xc8
-	NULL,                         // 0xc9
-	NULL,                         // 0xca
-	NULL,                         // 0xcb
-	NULL,                         // 0xcc
-	NULL,                         // 0xcd
-	NULL,                         // 0xce
-	NULL,                         // 0xcf
-
-	NULL,                         // 0xd1
-	NULL,                         // 0xd2
-	NULL,                         // 0xd3
-	NULL,                         // 0xd4
-	NULL,                         // 0xd5
-	NULL,                         // 0xd6
-	NULL,                         // 0xd7
-	NULL,                         // 0xd8
-	NULL,                         // 0xd9
-	NULL,                         // 0xda
-	NULL,                         // 0xdb
-	NULL,                         // 0xdc
-	NULL,                         // 0xdd
-	NULL,                         // 0xde
-	NULL,                         // 0xdf
-
-	NULL,                         // 0xe0
-	NULL,                         // 0xe0
-	NULL,                         // 0xe0
-	NULL,                         // 0xe1
-	NULL,                         // 0xe2
-	NULL,                         // 0xe3
-	NULL,                         // 0xe4
-	NULL,                         // 0xe5
-	NULL,                         // 0xe6
-	NULL,                         // 0xe7
-	NULL,                         // 0xe8
-	NULL,                         // 0xe9
-	NULL,                         // 0xea
-	NULL,                         // 0xeb
-	NULL,                         // 0xec
-	NULL,                         // 0xed
-	NULL,                         // 0xee
-	NULL,                         // 0xef
-
-	NULL,                         // 0xf1
-	NULL,                         // 0xf2
-	NULL,                         // 0xf3
-	NULL,                         // 0xf4
-	NULL,                         // 0xf5
-	NULL,                         // 0xf6
-	NULL,                         // 0xf7
-	NULL,                         // 0xf8
-	NULL,                         // 0xf9
-	NULL,                         // 0xfa
-	NULL,                         // 0xfb
-	NULL,                         // 0xfc
-	NULL,                         // 0xfd
-	NULL,                         // 0xfe
-	NULL,                         // 0xff
-};
-
 #endif // defined(__x86_64__) || defined(__i386__)
-
-// --------------------------------------------------------------------------
-// private functions
-// --------------------------------------------------------------------------
-
-// --------------------------------------------------------------------------
-// public functions
-// --------------------------------------------------------------------------
-opecode *disassembler::parse(uint8_t *code_start)
-{
-	uint8_t *code = code_start;
-	ROACH_DBG("BEGIN: %p\n", code_start);
-	opecode *op = new opecode(code_start);
-	int instr_2byte = 0;
-	while (true) {
-		const instr_info *instr = first_byte_instr_array[*code];
-		if (instr_2byte == INSTR_2BYTE_0F)
-			instr = second_byte_instr_array_0f[*code];
-		if (instr == NULL) {
-			ROACH_ERR("Failed to parse code byte: %p: %02x, "
-			          "instr_2byte: %02x\n",
-			          code, *code, instr_2byte);
-			ROACH_ABORT();
-		}
-		instr_2byte = 0;
-		code += instr->length;
-		op->inc_length(instr->length);
-
-		if (instr->parser)
-			(*instr->parser)(op, code);
-		if (instr->instr_2byte) {
-			instr_2byte = instr->instr_2byte;
-			continue;
-		}
-
-		// If the first byte is prefix, we parse again
-		if (instr->prefix) {
-			op->add_prefix(instr->prefix);
-			continue;
-		}
-		break;
-	}
-	op->copy_code(code_start);
-	ROACH_DBG("END: length: %d\n", op->get_length());
-	return op;
-}
-
@@ -4,11 +4,55 @@
 #include <stdint.h>
 #include "opecode.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+enum opcode_map_t {
+	OPCODE_MAP_1BYTE,
+	OPCODE_MAP_0F,
+	OPCODE_MAP_0F38,
+	OPCODE_MAP_0F3A,
+	OPCODE_MAP_EVEX5,
+	OPCODE_MAP_EVEX6,
+	OPCODE_MAP_XOP8,
+	OPCODE_MAP_XOP9,
+	OPCODE_MAP_XOPA,
+};
+
+/**
+ * The layout of an instruction. The offsets are from the top of the
+ * instruction and -1 means that the part doesn't exist.
+ */
+struct decoded_instr {
+	int            length;
+	int            prefix;       // PREFIX_*
+	int            rex_offset;
+	int            vex_offset;   // also used for EVEX and XOP
+	opcode_map_t   map;
+	uint8_t        opcode;
+	int            opcode_reg;   // register in the low 3 bits of the opcode
+	int            modrm_offset;
+	int            sib_offset;
+	int            disp_offset;
+	int            disp_size;
+	int            imm_offset;   // also used for the rel. jump
+	int            imm_size;
+	rel_jump_t     rel_jump_type;
+	opecode_flow_t flow_type;
+};
+#endif // defined(__x86_64__) || defined(__i386__)
+
+class opecode_arena;
+
 class disassembler {
-	
+	static opecode *parse_core(uint8_t *code_start, bool abort_on_error);
+	static void set_operands(opecode *op, const uint8_t *code,
+	                         const decoded_instr &instr);
 public:
+	static bool decode(const uint8_t *code, decoded_instr *instr);
+	static opecode *create_opecode(uint8_t *orig_addr, const uint8_t *code,
+	                               const decoded_instr &instr,
+	                               opecode_arena *arena = NULL);
 	static opecode *parse(uint8_t *code_start);
+	static opecode *try_parse(uint8_t *code_start);
 };
 
 #endif
-
@@ -0,0 +1,227 @@
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <elf.h>
+
+#include "utils.h"
+#include "probe.h"
+#include "side_code_area_manager.h"
+#include "dl_debug_hook.h"
+
+#define OPCODE_RET  0xc3
+#define OPCODE_INT3 0xcc
+
+#if defined(__x86_64__)
+#define TRAP_REG_PC REG_RIP
+#define TRAP_REG_SP REG_RSP
+static const uint8_t OPCODES_ENDBR[] = {0xf3, 0x0f, 0x1e, 0xfa};
+#elif defined(__i386__)
+#define TRAP_REG_PC REG_EIP
+#define TRAP_REG_SP REG_ESP
+static const uint8_t OPCODES_ENDBR[] = {0xf3, 0x0f, 0x1e, 0xfb};
+#endif
+
+// set while the hook function is called in the thread
+static __thread bool g_in_hook = false;
+
+//
+// static member
+//
+struct r_debug *dl_debug_hook::m_r_debug = NULL;
+uint8_t *dl_debug_hook::m_trap_addr = NULL;
+dl_debug_hook_func_t dl_debug_hook::m_func = NULL;
+void *dl_debug_hook::m_arg = NULL;
+struct sigaction dl_debug_hook::m_old_action;
+volatile bool dl_debug_hook::m_trap_removed = false;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+int dl_debug_hook::_find_r_debug_cb(struct dl_phdr_info *info, size_t size,
+                                    void *data)
+{
+	// The first object is the executable, whose DT_DEBUG is set to the
+	// r_debug of the dynamic linker. _r_debug can't be used because
+	// the executable may have a copy of it.
+	struct r_debug **r_debug_ptr = static_cast<struct r_debug **>(data);
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+		if (phdr.p_type != PT_DYNAMIC)
+			continue;
+		ElfW(Dyn) *dyn = (ElfW(Dyn) *)(info->dlpi_addr + phdr.p_vaddr);
+		for (; dyn->d_tag != DT_NULL; dyn++) {
+			if (dyn->d_tag == DT_DEBUG)
+				*r_debug_ptr = (struct r_debug *)dyn->d_un.d_ptr;
+		}
+	}
+	return 1;
+}
+
+struct r_debug *dl_debug_hook::find_r_debug(void)
+{
+	struct r_debug *r_debug_ptr = NULL;
+	dl_iterate_phdr(_find_r_debug_cb, &r_debug_ptr);
+	if (!r_debug_ptr)
+		r_debug_ptr = &_r_debug;
+	return r_debug_ptr;
+}
+
+uint8_t *dl_debug_hook::find_ret_addr(uint8_t *func_addr)
+{
+	// The function does nothing but return.
+	uint8_t *addr = func_addr;
+	if (memcmp(addr, OPCODES_ENDBR, sizeof(OPCODES_ENDBR)) == 0)
+		addr += sizeof(OPCODES_ENDBR);
+	if (*addr != OPCODE_RET)
+		return NULL;
+	return addr;
+}
+
+bool dl_debug_hook::write_code(uint8_t *addr, uint8_t code)
+{
+	// The page of ld.so isn't made writable in W^X mode.
+	if (side_code_area_manager::is_wx_enabled()) {
+		probe::write_text(addr, &code, 1);
+		return true;
+	}
+	int page_size = utils::get_page_size();
+	void *page = (void *)((unsigned long)addr & ~(page_size - 1));
+	if (mprotect(page, page_size,
+	             PROT_READ|PROT_WRITE|PROT_EXEC) == -1) {
+		ROACH_ERR("Failed to mprotect: %p (%d)\n", page, errno);
+		return false;
+	}
+	*addr = code;
+	if (mprotect(page, page_size, PROT_READ|PROT_EXEC) == -1) {
+		ROACH_ERR("Failed to mprotect: %p (%d)\n", page, errno);
+		ROACH_ABORT();
+	}
+	return true;
+}
+
+void dl_debug_hook::chain_signal(int signo, siginfo_t *info, void *uc)
+{
+	if (m_old_action.sa_flags & SA_SIGINFO) {
+		(*m_old_action.sa_sigaction)(signo, info, uc);
+		return;
+	}
+	if (m_old_action.sa_handler == SIG_IGN)
+		return;
+	if (m_old_action.sa_handler == SIG_DFL) {
+		signal(signo, SIG_DFL);
+		raise(signo);
+		return;
+	}
+	(*m_old_action.sa_handler)(signo);
+}
+
+void dl_debug_hook::signal_handler(int signo, siginfo_t *info, void *uc)
+{
+	ucontext_t *context = static_cast<ucontext_t *>(uc);
+	greg_t *regs = context->uc_mcontext.gregs;
+
+	// The program counter is next to the int3.
+	if ((uint8_t *)regs[TRAP_REG_PC] - 1 != m_trap_addr) {
+		chain_signal(signo, info, uc);
+		return;
+	}
+
+	// The hook isn't called recursively when the hook function calls
+	// dlopen().
+	int saved_errno = errno;
+	if (!g_in_hook && m_r_debug->r_state == r_debug::RT_CONSISTENT) {
+		g_in_hook = true;
+		(*m_func)(m_arg);
+		g_in_hook = false;
+	}
+	errno = saved_errno;
+
+	// perform 'ret'
+	unsigned long *sp = (unsigned long *)regs[TRAP_REG_SP];
+	regs[TRAP_REG_PC] = *sp;
+	regs[TRAP_REG_SP] += sizeof(unsigned long);
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+bool dl_debug_hook::install(dl_debug_hook_func_t func, void *arg)
+{
+	if (m_trap_addr) {
+		ROACH_ERR("dl_debug_hook has already been installed.\n");
+		return false;
+	}
+	m_r_debug = find_r_debug();
+	uint8_t *brk_addr = (uint8_t *)m_r_debug->r_brk;
+	uint8_t *trap_addr = brk_addr ? find_ret_addr(brk_addr) : NULL;
+	if (!trap_addr) {
+		ROACH_INFO("Unknown code at r_brk: %p\n", brk_addr);
+		return false;
+	}
+	m_func = func;
+	m_arg = arg;
+
+	// SA_NODEFER lets the trap in the hook function (i.e. dlopen() in
+	// it) come to the handler. Otherwise the process is killed.
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = signal_handler;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGTRAP, &action, &m_old_action) == -1) {
+		ROACH_ERR("Failed to call sigaction: %d\n", errno);
+		return false;
+	}
+	m_trap_addr = trap_addr;
+	if (!write_code(m_trap_addr, OPCODE_INT3)) {
+		sigaction(SIGTRAP, &m_old_action, NULL);
+		m_trap_addr = NULL;
+		return false;
+	}
+	ROACH_DBG("dl_debug_hook: r_brk: %p, trap: %p\n", brk_addr, trap_addr);
+	return true;
+}
+
+void dl_debug_hook::uninstall(void)
+{
+	if (!m_trap_addr)
+		return;
+	write_code(m_trap_addr, OPCODE_RET);
+	if (!m_trap_removed)
+		sigaction(SIGTRAP, &m_old_action, NULL);
+	m_trap_addr = NULL;
+	m_trap_removed = false;
+}
+
+bool dl_debug_hook::begin_loader_call(sigset_t *old_mask)
+{
+	if (!m_trap_addr || m_trap_removed)
+		return false;
+
+	// m_trap_addr is kept, so that a trap in another thread that has
+	// already hit the int3 is still handled.
+	struct sigaction action;
+	if (sigaction(SIGTRAP, NULL, &action) == 0 &&
+	    (!(action.sa_flags & SA_SIGINFO) ||
+	     action.sa_sigaction != signal_handler)) {
+		ROACH_INFO("SIGTRAP handler has been replaced. The probes are "
+		           "installed after dlopen() returns.\n");
+		m_trap_removed = true;
+		write_code(m_trap_addr, OPCODE_RET);
+		return false;
+	}
+	sigset_t trap_mask;
+	sigemptyset(&trap_mask);
+	sigaddset(&trap_mask, SIGTRAP);
+	if (pthread_sigmask(SIG_UNBLOCK, &trap_mask, old_mask) != 0)
+		return false;
+	return true;
+}
+
+void dl_debug_hook::end_loader_call(const sigset_t *old_mask)
+{
+	pthread_sigmask(SIG_SETMASK, old_mask, NULL);
+}
@@ -0,0 +1,48 @@
+#ifndef dl_debug_hook_h
+#define dl_debug_hook_h
+
+#include <stdint.h>
+#include <signal.h>
+#include <link.h>
+
+typedef void (*dl_debug_hook_func_t)(void *arg);
+
+/**
+ * Hook of the dynamic linker's debugger interface (r_debug.r_brk).
+ *
+ * The dynamic linker calls the function at r_brk (_dl_debug_state) when
+ * the list of the loaded objects is changed, the same as a debugger is
+ * notified. It is called with RT_CONSISTENT after the new objects of a
+ * dlopen() are mapped and before they are relocated and their
+ * initializers run. The 'ret' of the function is replaced with int3 and
+ * the given function is called from the SIGTRAP handler at that point.
+ * The handler then performs the 'ret' itself.
+ *
+ * The trap kills the process when SIGTRAP is blocked in the thread and
+ * goes to another handler set by the program later. So dlopen() and
+ * dlclose() via the wrappers unblock it during the call and the int3 is
+ * removed when the handler has been replaced.
+ */
+class dl_debug_hook {
+	static struct r_debug *m_r_debug;
+	static uint8_t *m_trap_addr;
+	static dl_debug_hook_func_t m_func;
+	static void *m_arg;
+	static struct sigaction m_old_action;
+	static volatile bool m_trap_removed;
+
+	static int _find_r_debug_cb(struct dl_phdr_info *info, size_t size,
+	                            void *data);
+	static struct r_debug *find_r_debug(void);
+	static uint8_t *find_ret_addr(uint8_t *func_addr);
+	static bool write_code(uint8_t *addr, uint8_t code);
+	static void chain_signal(int signo, siginfo_t *info, void *uc);
+	static void signal_handler(int signo, siginfo_t *info, void *uc);
+public:
+	static bool install(dl_debug_hook_func_t func, void *arg);
+	static void uninstall(void);
+	static bool begin_loader_call(sigset_t *old_mask);
+	static void end_loader_call(const sigset_t *old_mask);
+};
+
+#endif
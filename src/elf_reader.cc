@@ -0,0 +1,596 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <elf.h>
+#include <cxxabi.h>
+
+#include "utils.h"
+#include "elf_reader.h"
+
+#if __WORDSIZE == 64
+#define ELF_CLASS_NATIVE ELFCLASS64
+#else
+#define ELF_CLASS_NATIVE ELFCLASS32
+#endif
+
+static bool operator<(const elf_sym_index_entry &a,
+                      const elf_sym_index_entry &b)
+{
+	return a.hash < b.hash;
+}
+
+static bool cmp_elf_symbol_value(const elf_symbol &a, const elf_symbol &b)
+{
+	return a.value < b.value;
+}
+
+static bool eq_elf_symbol_value(const elf_symbol &a, const elf_symbol &b)
+{
+	return a.value == b.value;
+}
+
+elf_symbol::elf_symbol(void)
+: name(NULL),
+  value(0),
+  size(0),
+  type(STT_NOTYPE)
+{
+}
+
+elf_sym_table::elf_sym_table(void)
+: syms(NULL),
+  num(0),
+  strtab(NULL),
+  strtab_size(0)
+{
+}
+
+//
+// static member
+//
+pthread_mutex_t elf_reader::m_reader_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+elf_reader_map_t &elf_reader::get_reader_map(void)
+{
+	static elf_reader_map_t reader_map;
+	return reader_map;
+}
+
+bool elf_reader::map_file(void)
+{
+	int fd = open(m_path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		ROACH_ERR("Failed to open: %s (%d)\n", m_path.c_str(), errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		ROACH_ERR("Failed to stat: %s (%d)\n", m_path.c_str(), errno);
+		close(fd);
+		return false;
+	}
+	if ((size_t)st.st_size < sizeof(ElfW(Ehdr))) {
+		ROACH_ERR("Too small to be ELF: %s\n", m_path.c_str());
+		close(fd);
+		return false;
+	}
+	void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		ROACH_ERR("Failed to mmap: %s (%d)\n", m_path.c_str(), errno);
+		return false;
+	}
+	m_image = (uint8_t *)ptr;
+	m_image_size = st.st_size;
+	return true;
+}
+
+bool elf_reader::is_in_image(const void *ptr, size_t size) const
+{
+	const uint8_t *p = (const uint8_t *)ptr;
+	if (p < m_image)
+		return false;
+	if (size > m_image_size)
+		return false;
+	return (size_t)(p - m_image) <= m_image_size - size;
+}
+
+bool elf_reader::set_sym_table(const ElfW(Shdr) *shdr, elf_sym_table *table)
+{
+	if (shdr->sh_link >= m_ehdr->e_shnum)
+		return false;
+	const ElfW(Shdr) *str_shdr = &m_shdrs[shdr->sh_link];
+	const uint8_t *syms = m_image + shdr->sh_offset;
+	const uint8_t *strtab = m_image + str_shdr->sh_offset;
+	if (!is_in_image(syms, shdr->sh_size) ||
+	    !is_in_image(strtab, str_shdr->sh_size))
+		return false;
+	table->syms = (const ElfW(Sym) *)syms;
+	table->num = shdr->sh_size / sizeof(ElfW(Sym));
+	table->strtab = (const char *)strtab;
+	table->strtab_size = str_shdr->sh_size;
+	return true;
+}
+
+bool elf_reader::parse_sections(void)
+{
+	m_ehdr = (const ElfW(Ehdr) *)m_image;
+	if (memcmp(m_ehdr->e_ident, ELFMAG, SELFMAG) != 0) {
+		ROACH_ERR("Not ELF: %s\n", m_path.c_str());
+		return false;
+	}
+	if (m_ehdr->e_ident[EI_CLASS] != ELF_CLASS_NATIVE) {
+		ROACH_ERR("Unexpected ELF class: %s: %d\n",
+		          m_path.c_str(), m_ehdr->e_ident[EI_CLASS]);
+		return false;
+	}
+	m_shdrs = (const ElfW(Shdr) *)(m_image + m_ehdr->e_shoff);
+	if (!is_in_image(m_shdrs, sizeof(ElfW(Shdr)) * m_ehdr->e_shnum)) {
+		ROACH_ERR("Broken section headers: %s\n", m_path.c_str());
+		return false;
+	}
+
+	const ElfW(Shdr) *gnu_hash_shdr = NULL;
+	for (int i = 0; i < m_ehdr->e_shnum; i++) {
+		const ElfW(Shdr) *shdr = &m_shdrs[i];
+		if (shdr->sh_type == SHT_DYNSYM)
+			set_sym_table(shdr, &m_dynsym);
+		else if (shdr->sh_type == SHT_SYMTAB)
+			set_sym_table(shdr, &m_symtab);
+		else if (shdr->sh_type == SHT_GNU_HASH)
+			gnu_hash_shdr = shdr;
+	}
+
+	// The GNU hash table is only usable with the table it is linked to.
+	if (gnu_hash_shdr && m_dynsym.syms &&
+	    is_in_image(m_image + gnu_hash_shdr->sh_offset,
+	                gnu_hash_shdr->sh_size) &&
+	    gnu_hash_shdr->sh_link < m_ehdr->e_shnum &&
+	    m_image + m_shdrs[gnu_hash_shdr->sh_link].sh_offset ==
+	      (const uint8_t *)m_dynsym.syms) {
+		m_gnu_hash = (const uint32_t *)
+		             (m_image + gnu_hash_shdr->sh_offset);
+	}
+	return true;
+}
+
+bool elf_reader::is_defined(const ElfW(Sym) *sym)
+{
+	if (sym->st_shndx == SHN_UNDEF)
+		return false;
+	int type = ELF32_ST_TYPE(sym->st_info);
+	return (type == STT_FUNC || type == STT_OBJECT ||
+	        type == STT_GNU_IFUNC || type == STT_NOTYPE);
+}
+
+void elf_reader::set_symbol(const elf_sym_table &table, uint32_t idx,
+                            elf_symbol *sym)
+{
+	const ElfW(Sym) *esym = &table.syms[idx];
+	sym->name = table.strtab + esym->st_name;
+	sym->value = esym->st_value;
+	sym->size = esym->st_size;
+	sym->type = ELF32_ST_TYPE(esym->st_info);
+}
+
+bool elf_reader::lookup_gnu_hash(const char *name, elf_symbol *sym) const
+{
+	static const uint32_t BLOOM_BITS = sizeof(ElfW(Addr)) * 8;
+	const uint32_t nbuckets    = m_gnu_hash[0];
+	const uint32_t symoffset   = m_gnu_hash[1];
+	const uint32_t bloom_size  = m_gnu_hash[2];
+	const uint32_t bloom_shift = m_gnu_hash[3];
+	const ElfW(Addr) *bloom = (const ElfW(Addr) *)&m_gnu_hash[4];
+	const uint32_t *buckets = (const uint32_t *)&bloom[bloom_size];
+	const uint32_t *chain = &buckets[nbuckets];
+	if (nbuckets == 0 || bloom_size == 0)
+		return false;
+
+	uint32_t hash = calc_gnu_hash(name);
+	ElfW(Addr) word = bloom[(hash / BLOOM_BITS) % bloom_size];
+	ElfW(Addr) mask = ((ElfW(Addr))1 << (hash % BLOOM_BITS)) |
+	                  ((ElfW(Addr))1 << ((hash >> bloom_shift) % BLOOM_BITS));
+	if ((word & mask) != mask)
+		return false;
+
+	uint32_t idx = buckets[hash % nbuckets];
+	if (idx < symoffset)
+		return false;
+	for (; idx < m_dynsym.num; idx++) {
+		uint32_t chain_hash = chain[idx - symoffset];
+		const ElfW(Sym) *esym = &m_dynsym.syms[idx];
+		if ((hash | 1) == (chain_hash | 1) && is_defined(esym) &&
+		    strcmp(name, m_dynsym.strtab + esym->st_name) == 0) {
+			set_symbol(m_dynsym, idx, sym);
+			return true;
+		}
+		if (chain_hash & 1)
+			break;
+	}
+	return false;
+}
+
+bool elf_reader::lookup_index(const elf_sym_index_t &index,
+                              const elf_sym_table &table,
+                              const char *name, uint32_t hash,
+                              elf_symbol *sym) const
+{
+	elf_sym_index_entry key;
+	key.hash = hash;
+	key.idx = 0;
+	elf_sym_index_t::const_iterator it =
+	  lower_bound(index.begin(), index.end(), key);
+	for (; it != index.end() && it->hash == hash; ++it) {
+		const ElfW(Sym) *esym = &table.syms[it->idx];
+		if (strcmp(name, table.strtab + esym->st_name) != 0)
+			continue;
+		set_symbol(table, it->idx, sym);
+		return true;
+	}
+	return false;
+}
+
+void elf_reader::build_symtab_index(void)
+{
+	pthread_mutex_lock(&m_index_mutex);
+	if (m_symtab_indexed) {
+		pthread_mutex_unlock(&m_index_mutex);
+		return;
+	}
+	m_symtab_index.reserve(m_symtab.num);
+	for (size_t i = 0; i < m_symtab.num; i++) {
+		const ElfW(Sym) *esym = &m_symtab.syms[i];
+		if (!is_defined(esym) || esym->st_name >= m_symtab.strtab_size)
+			continue;
+		elf_sym_index_entry entry;
+		entry.hash = calc_gnu_hash(m_symtab.strtab + esym->st_name);
+		entry.idx = i;
+		m_symtab_index.push_back(entry);
+	}
+	// stable: the first symbol of the same name in the table wins
+	stable_sort(m_symtab_index.begin(), m_symtab_index.end());
+	m_symtab_indexed = true;
+	pthread_mutex_unlock(&m_index_mutex);
+}
+
+void elf_reader::add_demangled_entries(const elf_sym_table &table)
+{
+	for (size_t i = 0; i < table.num; i++) {
+		const ElfW(Sym) *esym = &table.syms[i];
+		if (!is_defined(esym) || esym->st_name >= table.strtab_size)
+			continue;
+		const char *mangled = table.strtab + esym->st_name;
+		if (mangled[0] != '_' || mangled[1] != 'Z')
+			continue;
+		int status;
+		char *demangled =
+		  abi::__cxa_demangle(mangled, NULL, NULL, &status);
+		if (!demangled)
+			continue;
+
+		// 'ns::func(int, char)' can be written both as it is and as
+		// 'ns::func' in a recipe. Spaces are removed because the
+		// recipe uses a space as a separator.
+		elf_demangled_entry entry;
+		entry.table = &table;
+		entry.idx = i;
+		entry.key = strip_spaces(demangled);
+		m_demangled_entries.push_back(entry);
+		size_t pos = entry.key.find('(');
+		if (pos != string::npos && pos > 0) {
+			entry.key = entry.key.substr(0, pos);
+			m_demangled_entries.push_back(entry);
+		}
+		free(demangled);
+	}
+}
+
+void elf_reader::build_demangled_index(void)
+{
+	pthread_mutex_lock(&m_index_mutex);
+	if (m_demangled_indexed) {
+		pthread_mutex_unlock(&m_index_mutex);
+		return;
+	}
+	add_demangled_entries(m_dynsym);
+	add_demangled_entries(m_symtab);
+	m_demangled_index.reserve(m_demangled_entries.size());
+	for (size_t i = 0; i < m_demangled_entries.size(); i++) {
+		elf_sym_index_entry entry;
+		entry.hash = calc_gnu_hash(m_demangled_entries[i].key.c_str());
+		entry.idx = i;
+		m_demangled_index.push_back(entry);
+	}
+	stable_sort(m_demangled_index.begin(), m_demangled_index.end());
+	m_demangled_indexed = true;
+	pthread_mutex_unlock(&m_index_mutex);
+}
+
+void elf_reader::build_func_symbols(void)
+{
+	pthread_mutex_lock(&m_index_mutex);
+	if (m_func_symbols_sorted) {
+		pthread_mutex_unlock(&m_index_mutex);
+		return;
+	}
+	// .symtab is a superset of .dynsym when the file is not stripped.
+	if (m_symtab.syms)
+		add_func_symbols(m_symtab, m_func_symbols);
+	else if (m_dynsym.syms)
+		add_func_symbols(m_dynsym, m_func_symbols);
+
+	// Aliases (ex. a weak and a global symbol) point to the same code.
+	// They are merged so that the code is not patched twice.
+	stable_sort(m_func_symbols.begin(), m_func_symbols.end(),
+	            cmp_elf_symbol_value);
+	elf_symbol_list_itr end = unique(m_func_symbols.begin(),
+	                                 m_func_symbols.end(),
+	                                 eq_elf_symbol_value);
+	m_func_symbols.erase(end, m_func_symbols.end());
+	m_func_symbols_sorted = true;
+	pthread_mutex_unlock(&m_index_mutex);
+}
+
+bool elf_reader::lookup_demangled(const char *name, elf_symbol *sym)
+{
+	build_demangled_index();
+	string key = strip_spaces(name);
+	uint32_t hash = calc_gnu_hash(key.c_str());
+	elf_sym_index_entry key_entry;
+	key_entry.hash = hash;
+	key_entry.idx = 0;
+	elf_sym_index_t::const_iterator it =
+	  lower_bound(m_demangled_index.begin(), m_demangled_index.end(),
+	              key_entry);
+	for (; it != m_demangled_index.end() && it->hash == hash; ++it) {
+		elf_demangled_entry &entry = m_demangled_entries[it->idx];
+		if (entry.key != key)
+			continue;
+		set_symbol(*entry.table, entry.idx, sym);
+		return true;
+	}
+	return false;
+}
+
+void elf_reader::add_func_symbols(const elf_sym_table &table,
+                                  elf_symbol_list_t &sym_list) const
+{
+	for (size_t i = 0; i < table.num; i++) {
+		const ElfW(Sym) *esym = &table.syms[i];
+		// The value of STT_GNU_IFUNC is the resolver, not the function.
+		if (ELF32_ST_TYPE(esym->st_info) != STT_FUNC)
+			continue;
+		if (esym->st_shndx == SHN_UNDEF || esym->st_value == 0)
+			continue;
+		if (esym->st_name >= table.strtab_size)
+			continue;
+		elf_symbol sym;
+		set_symbol(table, i, &sym);
+		sym_list.push_back(sym);
+	}
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+uint32_t elf_reader::calc_gnu_hash(const char *name)
+{
+	uint32_t h = 5381;
+	for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+		h = (h << 5) + h + *p;
+	return h;
+}
+
+string elf_reader::strip_spaces(const char *name)
+{
+	string str;
+	for (const char *p = name; *p; p++) {
+		if (*p != ' ')
+			str += *p;
+	}
+	return str;
+}
+
+elf_reader *elf_reader::get(const char *path)
+{
+	elf_reader *reader = NULL;
+	elf_reader_map_t &reader_map = get_reader_map();
+	pthread_mutex_lock(&m_reader_map_mutex);
+	elf_reader_map_itr it = reader_map.find(path);
+	if (it != reader_map.end())
+		reader = it->second;
+	else {
+		reader = new elf_reader(path);
+		reader_map[path] = reader;
+	}
+	pthread_mutex_unlock(&m_reader_map_mutex);
+	if (reader->has_error())
+		return NULL;
+	return reader;
+}
+
+elf_reader::elf_reader(const char *path)
+: m_path(path),
+  m_has_error(true),
+  m_image(NULL),
+  m_image_size(0),
+  m_ehdr(NULL),
+  m_shdrs(NULL),
+  m_gnu_hash(NULL),
+  m_symtab_indexed(false),
+  m_demangled_indexed(false),
+  m_func_symbols_sorted(false)
+{
+	pthread_mutex_init(&m_index_mutex, NULL);
+	if (!map_file())
+		return;
+	if (!parse_sections())
+		return;
+	m_has_error = false;
+}
+
+elf_reader::~elf_reader()
+{
+	if (m_image)
+		munmap(m_image, m_image_size);
+	pthread_mutex_destroy(&m_index_mutex);
+}
+
+bool elf_reader::has_error(void) const
+{
+	return m_has_error;
+}
+
+const char *elf_reader::get_path(void) const
+{
+	return m_path.c_str();
+}
+
+bool elf_reader::lookup_symbol(const char *name, elf_symbol *sym)
+{
+	if (m_gnu_hash && lookup_gnu_hash(name, sym))
+		return true;
+
+	// .dynsym without the GNU hash (old toolchains) and .symtab
+	if (!m_gnu_hash && m_dynsym.syms) {
+		for (size_t i = 0; i < m_dynsym.num; i++) {
+			const ElfW(Sym) *esym = &m_dynsym.syms[i];
+			if (!is_defined(esym))
+				continue;
+			if (strcmp(name, m_dynsym.strtab + esym->st_name) != 0)
+				continue;
+			set_symbol(m_dynsym, i, sym);
+			return true;
+		}
+	}
+	if (m_symtab.syms) {
+		build_symtab_index();
+		uint32_t hash = calc_gnu_hash(name);
+		if (lookup_index(m_symtab_index, m_symtab, name, hash, sym))
+			return true;
+	}
+
+	// 'ns::func', 'ns::func(int)' and also 'func' for 'func(int)'
+	return lookup_demangled(name, sym);
+}
+
+void elf_reader::get_func_symbols(elf_symbol_list_t &sym_list)
+{
+	build_func_symbols();
+	sym_list = m_func_symbols;
+}
+
+bool elf_reader::lookup_func_by_addr(unsigned long addr, elf_symbol *sym)
+{
+	build_func_symbols();
+	elf_symbol key;
+	key.value = addr;
+	elf_symbol_list_itr it = upper_bound(m_func_symbols.begin(),
+	                                     m_func_symbols.end(),
+	                                     key, cmp_elf_symbol_value);
+	if (it == m_func_symbols.begin())
+		return false;
+	--it;
+	if (addr >= it->value + it->size)
+		return false;
+	*sym = *it;
+	return true;
+}
+
+bool elf_reader::get_section(const char *name, const uint8_t **data,
+                             size_t *size, unsigned long *addr) const
+{
+	if (m_ehdr->e_shstrndx == SHN_UNDEF ||
+	    m_ehdr->e_shstrndx >= m_ehdr->e_shnum)
+		return false;
+	const ElfW(Shdr) *str_shdr = &m_shdrs[m_ehdr->e_shstrndx];
+	const char *strtab = (const char *)(m_image + str_shdr->sh_offset);
+	if (!is_in_image(strtab, str_shdr->sh_size))
+		return false;
+	for (int i = 0; i < m_ehdr->e_shnum; i++) {
+		const ElfW(Shdr) *shdr = &m_shdrs[i];
+		if (shdr->sh_name >= str_shdr->sh_size)
+			continue;
+		if (strncmp(name, strtab + shdr->sh_name,
+		            str_shdr->sh_size - shdr->sh_name) != 0)
+			continue;
+		// SHT_NOBITS such as .bss has no data in the file.
+		if (shdr->sh_type == SHT_NOBITS)
+			return false;
+		if (!is_in_image(m_image + shdr->sh_offset, shdr->sh_size))
+			return false;
+		*data = m_image + shdr->sh_offset;
+		*size = shdr->sh_size;
+		*addr = shdr->sh_addr;
+		return true;
+	}
+	return false;
+}
+
+bool elf_reader::get_build_id(string &build_id) const
+{
+	const uint8_t *data;
+	size_t size;
+	unsigned long addr;
+	if (!get_section(".note.gnu.build-id", &data, &size, &addr))
+		return false;
+	return parse_build_id(data, size, build_id);
+}
+
+bool elf_reader::parse_build_id(const uint8_t *data, size_t size,
+                                string &build_id)
+{
+	// Elf_Nhdr, the name ("GNU") and the descriptor (build-id) aligned
+	// to 4 bytes.
+	const uint8_t *end = data + size;
+	while (data + sizeof(ElfW(Nhdr)) <= end) {
+		const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)data;
+		const uint8_t *name = data + sizeof(ElfW(Nhdr));
+		const uint8_t *desc = name + ((nhdr->n_namesz + 3) & ~3);
+		data = desc + ((nhdr->n_descsz + 3) & ~3);
+		if (data > end)
+			return false;
+		if (nhdr->n_type != NT_GNU_BUILD_ID || nhdr->n_namesz != 4 ||
+		    memcmp(name, "GNU", 4) != 0)
+			continue;
+		static const char hex[] = "0123456789abcdef";
+		build_id.clear();
+		for (size_t i = 0; i < nhdr->n_descsz; i++) {
+			build_id += hex[desc[i] >> 4];
+			build_id += hex[desc[i] & 0x0f];
+		}
+		return !build_id.empty();
+	}
+	return false;
+}
+
+const uint8_t *elf_reader::get_code(unsigned long addr, size_t size) const
+{
+	for (int i = 0; i < m_ehdr->e_shnum; i++) {
+		const ElfW(Shdr) *shdr = &m_shdrs[i];
+		if (shdr->sh_type != SHT_PROGBITS ||
+		    !(shdr->sh_flags & SHF_EXECINSTR))
+			continue;
+		if (addr < shdr->sh_addr ||
+		    addr + size > shdr->sh_addr + shdr->sh_size)
+			continue;
+		const uint8_t *code =
+		  m_image + shdr->sh_offset + (addr - shdr->sh_addr);
+		if (!is_in_image(code, size))
+			return NULL;
+		return code;
+	}
+	return NULL;
+}
@@ -0,0 +1,126 @@
+#ifndef elf_reader_h
+#define elf_reader_h
+
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <link.h>
+
+struct elf_symbol {
+	const char   *name;  // points into the mapped string table
+	unsigned long value;
+	unsigned long size;
+	int           type;  // STT_FUNC, STT_OBJECT, ...
+
+	// constructor
+	elf_symbol(void);
+};
+
+typedef vector<elf_symbol> elf_symbol_list_t;
+typedef elf_symbol_list_t::iterator elf_symbol_list_itr;
+
+struct elf_sym_index_entry {
+	uint32_t hash;
+	uint32_t idx;
+};
+
+typedef vector<elf_sym_index_entry> elf_sym_index_t;
+
+struct elf_sym_table;
+struct elf_demangled_entry {
+	string               key; // demangled name without spaces
+	const elf_sym_table *table;
+	uint32_t             idx;
+};
+
+struct elf_sym_table {
+	const ElfW(Sym) *syms;
+	size_t           num;
+	const char      *strtab;
+	size_t           strtab_size;
+
+	// constructor
+	elf_sym_table(void);
+};
+
+class elf_reader;
+typedef map<string, elf_reader *> elf_reader_map_t;
+typedef elf_reader_map_t::iterator elf_reader_map_itr;
+
+/**
+ * Read-only view of an ELF file used to resolve symbols given in a recipe.
+ *
+ * The file is mapped once and the instance is cached per path, so a
+ * library is never parsed twice. Lookups in .dynsym use the GNU hash
+ * table (if any). The .symtab and the demangled names have no hash
+ * table in the file, so sorted hash indexes for them are built lazily
+ * at the first lookup that needs them. The functions sorted by the
+ * address are also built once and shared by the lookups by address.
+ */
+class elf_reader {
+	string          m_path;
+	bool            m_has_error;
+	uint8_t        *m_image;
+	size_t          m_image_size;
+	const ElfW(Ehdr) *m_ehdr;
+	const ElfW(Shdr) *m_shdrs;
+
+	elf_sym_table   m_dynsym;
+	elf_sym_table   m_symtab;
+	const uint32_t *m_gnu_hash;
+
+	pthread_mutex_t m_index_mutex;
+	bool            m_symtab_indexed;
+	elf_sym_index_t m_symtab_index;
+	bool            m_demangled_indexed;
+	elf_sym_index_t m_demangled_index;
+	vector<elf_demangled_entry> m_demangled_entries;
+	bool            m_func_symbols_sorted;
+	elf_symbol_list_t m_func_symbols;
+
+	static pthread_mutex_t m_reader_map_mutex;
+	static elf_reader_map_t &get_reader_map(void);
+
+	bool map_file(void);
+	bool parse_sections(void);
+	bool is_in_image(const void *ptr, size_t size) const;
+	bool set_sym_table(const ElfW(Shdr) *shdr, elf_sym_table *table);
+	bool lookup_gnu_hash(const char *name, elf_symbol *sym) const;
+	bool lookup_index(const elf_sym_index_t &index, const elf_sym_table &table,
+	                  const char *name, uint32_t hash,
+	                  elf_symbol *sym) const;
+	bool lookup_demangled(const char *name, elf_symbol *sym);
+	void build_symtab_index(void);
+	void build_demangled_index(void);
+	void build_func_symbols(void);
+	void add_demangled_entries(const elf_sym_table &table);
+	void add_func_symbols(const elf_sym_table &table,
+	                      elf_symbol_list_t &sym_list) const;
+	static bool is_defined(const ElfW(Sym) *sym);
+	static void set_symbol(const elf_sym_table &table, uint32_t idx,
+	                       elf_symbol *sym);
+public:
+	static uint32_t calc_gnu_hash(const char *name);
+	static string strip_spaces(const char *name);
+	static bool parse_build_id(const uint8_t *data, size_t size,
+	                           string &build_id);
+	static elf_reader *get(const char *path);
+
+	elf_reader(const char *path);
+	virtual ~elf_reader();
+	bool has_error(void) const;
+	const char *get_path(void) const;
+	bool lookup_symbol(const char *name, elf_symbol *sym);
+	void get_func_symbols(elf_symbol_list_t &sym_list);
+	bool lookup_func_by_addr(unsigned long addr, elf_symbol *sym);
+	bool get_section(const char *name, const uint8_t **data, size_t *size,
+	                 unsigned long *addr) const;
+	bool get_build_id(string &build_id) const;
+	const uint8_t *get_code(unsigned long addr, size_t size) const;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <cstdio>
+using namespace std;
+
+#include "utils.h"
+#include "disassembler.h"
+#include "func_analyzer.h"
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+bool func_analyzer::is_inside(unsigned long addr) const
+{
+	unsigned long start = (unsigned long)m_start;
+	return start <= addr && addr < start + m_size;
+}
+
+bool func_analyzer::is_tail_call(const opecode *op) const
+{
+	if (op->get_flow_type() != FLOW_JUMP)
+		return false;
+	if (op->get_rel_jump_type() == REL_INVALID)
+		return false;
+	return !is_inside(op->get_rel_jump_dest());
+}
+
+bool func_analyzer::find_exit_site(size_t exit_idx, size_t min_idx,
+                                   int min_length,
+                                   func_exit_site *site) const
+{
+	// The exit instruction (typically 'ret') is shorter than the jump.
+	// So the preceding instructions are also overwritten and executed
+	// in the side code.
+	if (exit_idx < min_idx)
+		return false;
+	size_t first_idx = exit_idx;
+	int length = m_opecodes[exit_idx]->get_length();
+	while (length < min_length) {
+		if (first_idx <= min_idx)
+			return false;
+		first_idx--;
+		const opecode *op = m_opecodes[first_idx];
+		if (op->get_flow_type() != FLOW_NEXT)
+			return false;
+		if (op->get_rel_jump_type() != REL_INVALID)
+			return false;
+		length += op->get_length();
+	}
+
+	// A jump into the middle of the overwritten code breaks it.
+	for (size_t i = first_idx + 1; i <= exit_idx; i++) {
+		unsigned long addr =
+		  (unsigned long)m_opecodes[i]->get_original_addr();
+		if (is_branch_target(addr))
+			return false;
+	}
+	site->first_idx = first_idx;
+	site->exit_idx = exit_idx;
+	site->length = length;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+func_analyzer::func_analyzer(uint8_t *start, size_t size,
+                             decode_context *ctx)
+: m_start(start),
+  m_size(size),
+  m_ctx(ctx),
+  m_has_indirect_jump(false),
+  m_has_cond_tail_call(false)
+{
+}
+
+func_analyzer::~func_analyzer()
+{
+}
+
+bool func_analyzer::analyze(void)
+{
+	uint8_t *code = m_start;
+	uint8_t *end = m_start + m_size;
+	while (code < end) {
+		opecode *op = m_ctx->cache->parse(code, m_ctx->arena, false);
+		if (!op) {
+			ROACH_ERR("Failed to parse: %p (func: %p, offset: %zd)\n",
+			          code, m_start, code - m_start);
+			return false;
+		}
+		m_opecodes.push_back(op);
+		code += op->get_length();
+
+		// The destination of an indirect jump (ex. a jump table) is
+		// unknown. So we cannot tell if it jumps into a patched site.
+		if (op->get_flow_type() == FLOW_JUMP_INDIRECT) {
+			ROACH_DBG("Indirect jump: %p (func: %p)\n",
+			          op->get_original_addr(), m_start);
+			m_has_indirect_jump = true;
+		}
+		if (op->get_rel_jump_type() == REL_INVALID)
+			continue;
+		unsigned long dest = op->get_rel_jump_dest();
+		if (is_inside(dest))
+			m_branch_targets.insert(dest);
+		else if (op->get_flow_type() == FLOW_COND_JUMP) {
+			// A conditional tail call (ex. 'jne other_func') is
+			// also an exit, but can't be patched.
+			ROACH_DBG("Conditional tail call: %p (func: %p)\n",
+			          op->get_original_addr(), m_start);
+			m_has_cond_tail_call = true;
+		}
+	}
+	if (code != end) {
+		ROACH_ERR("The last instruction exceeds the end: %p (%zd)\n",
+		          m_start, m_size);
+		return false;
+	}
+	return true;
+}
+
+const opecode_vector_t &func_analyzer::get_opecodes(void) const
+{
+	return m_opecodes;
+}
+
+bool func_analyzer::has_indirect_jump(void) const
+{
+	return m_has_indirect_jump;
+}
+
+bool func_analyzer::has_cond_tail_call(void) const
+{
+	return m_has_cond_tail_call;
+}
+
+const set<unsigned long> &func_analyzer::get_branch_targets(void) const
+{
+	return m_branch_targets;
+}
+
+bool func_analyzer::is_branch_target(unsigned long addr) const
+{
+	return m_branch_targets.find(addr) != m_branch_targets.end();
+}
+
+size_t func_analyzer::get_head_opecode_count(int min_length) const
+{
+	int length = 0;
+	size_t count = 0;
+	while (count < m_opecodes.size() && length < min_length) {
+		length += m_opecodes[count]->get_length();
+		count++;
+	}
+	return count;
+}
+
+bool func_analyzer::find_exit_sites(int min_length,
+                                    func_exit_site_list_t &site_list)
+{
+	// The return via a conditional tail call would be missed.
+	if (m_has_cond_tail_call) {
+		ROACH_ERR("Cannot patch the conditional tail call (func: %p)\n",
+		          m_start);
+		return false;
+	}
+
+	// The head of the function is reserved for an entry probe.
+	size_t min_idx = get_head_opecode_count(min_length);
+	for (size_t i = 0; i < m_opecodes.size(); i++) {
+		const opecode *op = m_opecodes[i];
+		if (op->get_flow_type() != FLOW_RET && !is_tail_call(op))
+			continue;
+		func_exit_site site;
+		if (!find_exit_site(i, min_idx, min_length, &site)) {
+			ROACH_ERR("Cannot patch the exit: %p (func: %p)\n",
+			          op->get_original_addr(), m_start);
+			return false;
+		}
+		site_list.push_back(site);
+	}
+	if (site_list.empty()) {
+		ROACH_ERR("Not found exits: %p\n", m_start);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,56 @@
+#ifndef func_analyzer_h
+#define func_analyzer_h
+
+#include <vector>
+#include <set>
+using namespace std;
+
+#include <stdint.h>
+#include "opecode.h"
+#include "decode_cache.h"
+
+typedef vector<opecode *> opecode_vector_t;
+
+struct func_exit_site {
+	size_t first_idx; // index of the first overwritten instruction
+	size_t exit_idx;  // index of 'ret' or the jump of a tail call
+	int    length;    // overwritten length
+};
+
+typedef vector<func_exit_site> func_exit_site_list_t;
+
+/**
+ * Disassemble a whole function and find the sites to be patched.
+ *
+ * The range of the function is given by the caller (typically from the
+ * symbol size in the ELF file), because the code itself doesn't tell
+ * where the function ends. The opecodes are allocated in the arena of
+ * the given context.
+ */
+class func_analyzer {
+	uint8_t          *m_start;
+	size_t            m_size;
+	decode_context   *m_ctx;
+	opecode_vector_t  m_opecodes;
+	set<unsigned long> m_branch_targets;
+	bool              m_has_indirect_jump;
+	bool              m_has_cond_tail_call;
+
+	bool is_inside(unsigned long addr) const;
+	bool is_tail_call(const opecode *op) const;
+	bool find_exit_site(size_t exit_idx, size_t min_idx, int min_length,
+	                    func_exit_site *site) const;
+public:
+	func_analyzer(uint8_t *start, size_t size, decode_context *ctx);
+	virtual ~func_analyzer();
+	bool analyze(void);
+	const opecode_vector_t &get_opecodes(void) const;
+	bool has_indirect_jump(void) const;
+	bool has_cond_tail_call(void) const;
+	const set<unsigned long> &get_branch_targets(void) const;
+	bool is_branch_target(unsigned long addr) const;
+	size_t get_head_opecode_count(int min_length) const;
+	bool find_exit_sites(int min_length, func_exit_site_list_t &site_list);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <cstdio>
+#include "func_cfg_cache.h"
+#include "func_analyzer.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+//
+// static member
+//
+pthread_mutex_t func_cfg_cache::m_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+build_id_cfg_map_t &func_cfg_cache::get_cfg_map(void)
+{
+	static build_id_cfg_map_t cfg_map;
+	return cfg_map;
+}
+
+void func_cfg_cache::analyze(uint8_t *func_addr, size_t func_size,
+                             decode_context *ctx, func_cfg *cfg)
+{
+	func_analyzer analyzer(func_addr, func_size, ctx);
+	cfg->analyzed = analyzer.analyze();
+	cfg->has_indirect_jump = analyzer.has_indirect_jump();
+	cfg->branch_targets.clear();
+	if (!cfg->analyzed)
+		return;
+	const set<unsigned long> &targets = analyzer.get_branch_targets();
+	set<unsigned long>::const_iterator it = targets.begin();
+	for (; it != targets.end(); ++it)
+		cfg->branch_targets.push_back(*it - (unsigned long)func_addr);
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+void func_cfg_cache::get(const string &build_id, unsigned long func_offset,
+                         uint8_t *func_addr, size_t func_size,
+                         decode_context *ctx, func_cfg *cfg)
+{
+	if (build_id.empty()) {
+		analyze(func_addr, func_size, ctx, cfg);
+		return;
+	}
+
+	build_id_cfg_map_t &cfg_map = get_cfg_map();
+	pthread_mutex_lock(&m_mutex);
+	func_cfg_map_t &func_map = cfg_map[build_id];
+	func_cfg_map_itr it = func_map.find(func_offset);
+	if (it != func_map.end()) {
+		*cfg = it->second;
+		pthread_mutex_unlock(&m_mutex);
+		return;
+	}
+	pthread_mutex_unlock(&m_mutex);
+
+	// The function is scanned without the lock, because probes are
+	// prepared in parallel. When two threads scan the same function,
+	// the results are the same.
+	analyze(func_addr, func_size, ctx, cfg);
+	pthread_mutex_lock(&m_mutex);
+	cfg_map[build_id][func_offset] = *cfg;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+#endif // defined(__x86_64__) || defined(__i386__)
@@ -0,0 +1,51 @@
+#ifndef func_cfg_cache_h
+#define func_cfg_cache_h
+
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "decode_cache.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * The result of the control-flow scan of a function.
+ */
+struct func_cfg {
+	bool analyzed;          // false when the function cannot be decoded
+	bool has_indirect_jump; // destinations of such jumps are unknown
+	vector<unsigned long> branch_targets; // offsets from the function top
+};
+
+typedef map<unsigned long, func_cfg> func_cfg_map_t;
+typedef func_cfg_map_t::iterator func_cfg_map_itr;
+typedef map<string, func_cfg_map_t> build_id_cfg_map_t;
+typedef build_id_cfg_map_t::iterator build_id_cfg_map_itr;
+
+/**
+ * Control-flow scans of functions keyed by the build-id of the library
+ * and the offset of the function.
+ *
+ * The code of a library doesn't change as long as the build-id is the
+ * same. So a function is scanned only once even when the library is
+ * mapped again or many probes are installed in it. The result is not
+ * kept for a library without the build-id.
+ */
+class func_cfg_cache {
+	static pthread_mutex_t m_mutex;
+
+	static build_id_cfg_map_t &get_cfg_map(void);
+	static void analyze(uint8_t *func_addr, size_t func_size,
+	                    decode_context *ctx, func_cfg *cfg);
+public:
+	static void get(const string &build_id, unsigned long func_offset,
+	                uint8_t *func_addr, size_t func_size,
+	                decode_context *ctx, func_cfg *cfg);
+};
+
+#endif // defined(__x86_64__) || defined(__i386__)
+#endif
@@ -0,0 +1,273 @@
+#!/usr/bin/env python
+#
+# Generate instr_table.inc: the attribute tables of the x86 opcode maps
+# used by the length and operand decoder in disassembler.cc.
+#
+# Usage: ./gen_instr_table.py > instr_table.inc
+#
+# Each entry is a combination of IA_* macros defined in disassembler.cc.
+# Only what is needed to know the length and the control flow of an
+# instruction is described here, i.e. not the operand types.
+#
+#   m    has a ModR/M byte
+#   mr   has a ModR/M byte whose mod field is ignored (always a register)
+#   ib iw iz iv   immediate: 8bit, 16bit, 16/32bit, 16/32/64bit
+#   id   32bit immediate regardless of the operand size
+#   iwb  16bit + 8bit immediate (ENTER)
+#   ap   far pointer (16:16 or 16:32)
+#   mo   memory offset (MOV moffs), the size of which is the address size
+#   jb jz         relative jump: 8bit, 16/32bit
+#   jmp jcc call ret jind   control flow
+#   pfx  legacy prefix
+#   rex  REX prefix (x86_64 only, INC/DEC with a register in i386)
+#   i64  invalid in 64bit mode
+#   inv  undefined (#UD)
+#   o    the register is encoded in the low 3 bits of the opcode
+#   grp  the attributes also depend on the ModR/M byte (see disassembler.cc)
+#
+from __future__ import print_function
+import sys
+
+ATTR_MAP = {
+  "m": "IA_MODRM", "mr": "IA_MODRM|IA_MODRM_REG",
+  "ib": "IA_IMM(IMM_KIND_B)", "iw": "IA_IMM(IMM_KIND_W)",
+  "iz": "IA_IMM(IMM_KIND_Z)", "iv": "IA_IMM(IMM_KIND_V)",
+  "id": "IA_IMM(IMM_KIND_D)",
+  "iwb": "IA_IMM(IMM_KIND_WB)", "ap": "IA_IMM(IMM_KIND_P)",
+  "mo": "IA_IMM(IMM_KIND_MOFFS)",
+  "jb": "IA_REL(REL_KIND_B)", "jz": "IA_REL(REL_KIND_Z)",
+  "jmp": "IA_FLOW(FLOW_JUMP)", "jcc": "IA_FLOW(FLOW_COND_JUMP)",
+  "call": "IA_FLOW(FLOW_CALL)", "ret": "IA_FLOW(FLOW_RET)",
+  "jind": "IA_FLOW(FLOW_JUMP_INDIRECT)",
+  "pfx": "IA_PREFIX", "rex": "IA_REX", "i64": "IA_INVALID64",
+  "inv": "IA_INVALID", "o": "IA_OPREG", "grp": "IA_GROUP",
+}
+
+#
+# one-byte opcode map
+#
+def alu(base, name):
+  return [(base + 0, base + 3, "m", name),
+          (base + 4, base + 4, "ib", name + " AL,Ib"),
+          (base + 5, base + 5, "iz", name + " rAX,Iz")]
+
+MAP_1BYTE = \
+  alu(0x00, "add") + \
+  [(0x06, 0x07, "i64", "push/pop es")] + \
+  alu(0x08, "or") + \
+  [(0x0e, 0x0e, "i64", "push cs"),
+   (0x0f, 0x0f, "", "2-byte escape")] + \
+  alu(0x10, "adc") + \
+  [(0x16, 0x17, "i64", "push/pop ss")] + \
+  alu(0x18, "sbb") + \
+  [(0x1e, 0x1f, "i64", "push/pop ds")] + \
+  alu(0x20, "and") + \
+  [(0x26, 0x26, "pfx", "seg es"),
+   (0x27, 0x27, "i64", "daa")] + \
+  alu(0x28, "sub") + \
+  [(0x2e, 0x2e, "pfx", "seg cs"),
+   (0x2f, 0x2f, "i64", "das")] + \
+  alu(0x30, "xor") + \
+  [(0x36, 0x36, "pfx", "seg ss"),
+   (0x37, 0x37, "i64", "aaa")] + \
+  alu(0x38, "cmp") + \
+  [(0x3e, 0x3e, "pfx", "seg ds"),
+   (0x3f, 0x3f, "i64", "aas"),
+   (0x40, 0x4f, "rex o", "REX / inc,dec"),
+   (0x50, 0x57, "o", "push"),
+   (0x58, 0x5f, "o", "pop"),
+   (0x60, 0x61, "i64", "pusha/popa"),
+   (0x62, 0x62, "m i64", "bound / EVEX"),
+   (0x63, 0x63, "m", "arpl / movsxd"),
+   (0x64, 0x65, "pfx", "seg fs/gs"),
+   (0x66, 0x66, "pfx", "operand size"),
+   (0x67, 0x67, "pfx", "address size"),
+   (0x68, 0x68, "iz", "push Iz"),
+   (0x69, 0x69, "m iz", "imul Gv,Ev,Iz"),
+   (0x6a, 0x6a, "ib", "push Ib"),
+   (0x6b, 0x6b, "m ib", "imul Gv,Ev,Ib"),
+   (0x6c, 0x6f, "", "ins/outs"),
+   (0x70, 0x7f, "jb jcc", "jcc Jb"),
+   (0x80, 0x80, "m ib", "grp1 Eb,Ib"),
+   (0x81, 0x81, "m iz", "grp1 Ev,Iz"),
+   (0x82, 0x82, "m ib i64", "grp1 Eb,Ib"),
+   (0x83, 0x83, "m ib", "grp1 Ev,Ib"),
+   (0x84, 0x87, "m", "test/xchg"),
+   (0x88, 0x8e, "m", "mov/lea"),
+   (0x8f, 0x8f, "m", "grp1a pop Ev / XOP"),
+   (0x90, 0x97, "o", "xchg / nop"),
+   (0x98, 0x99, "", "cbw/cwd"),
+   (0x9a, 0x9a, "ap i64 call", "callf Ap"),
+   (0x9b, 0x9f, "", "fwait/pushf/popf/sahf/lahf"),
+   (0xa0, 0xa3, "mo", "mov moffs"),
+   (0xa4, 0xa7, "", "movs/cmps"),
+   (0xa8, 0xa8, "ib", "test AL,Ib"),
+   (0xa9, 0xa9, "iz", "test rAX,Iz"),
+   (0xaa, 0xaf, "", "stos/lods/scas"),
+   (0xb0, 0xb7, "o ib", "mov r8,Ib"),
+   (0xb8, 0xbf, "o iv", "mov r,Iv"),
+   (0xc0, 0xc1, "m ib", "grp2 Ib"),
+   (0xc2, 0xc2, "iw ret", "ret Iw"),
+   (0xc3, 0xc3, "ret", "ret"),
+   (0xc4, 0xc5, "m i64", "les/lds / VEX"),
+   (0xc6, 0xc6, "m ib", "grp11 mov Eb,Ib / xabort"),
+   (0xc7, 0xc7, "m iz grp", "grp11 mov Ev,Iz / xbegin"),
+   (0xc8, 0xc8, "iwb", "enter"),
+   (0xc9, 0xc9, "", "leave"),
+   (0xca, 0xca, "iw jind", "retf Iw"),
+   (0xcb, 0xcb, "jind", "retf"),
+   (0xcc, 0xcc, "", "int3"),
+   (0xcd, 0xcd, "ib", "int Ib"),
+   (0xce, 0xce, "i64", "into"),
+   (0xcf, 0xcf, "jind", "iret"),
+   (0xd0, 0xd3, "m", "grp2"),
+   (0xd4, 0xd5, "ib i64", "aam/aad"),
+   (0xd6, 0xd6, "i64", "salc"),
+   (0xd7, 0xd7, "", "xlat"),
+   (0xd8, 0xdf, "m", "x87"),
+   (0xe0, 0xe3, "jb jcc", "loopcc/jrcxz"),
+   (0xe4, 0xe7, "ib", "in/out Ib"),
+   (0xe8, 0xe8, "jz call", "call Jz"),
+   (0xe9, 0xe9, "jz jmp", "jmp Jz"),
+   (0xea, 0xea, "ap i64 jind", "jmpf Ap"),
+   (0xeb, 0xeb, "jb jmp", "jmp Jb"),
+   (0xec, 0xef, "", "in/out dx"),
+   (0xf0, 0xf0, "pfx", "lock"),
+   (0xf1, 0xf1, "", "int1"),
+   (0xf2, 0xf3, "pfx", "repne/rep"),
+   (0xf4, 0xf5, "", "hlt/cmc"),
+   (0xf6, 0xf7, "m grp", "grp3 (test takes Ib/Iz)"),
+   (0xf8, 0xfd, "", "clc/stc/cli/sti/cld/std"),
+   (0xfe, 0xfe, "m", "grp4"),
+   (0xff, 0xff, "m grp", "grp5 (call/jmp Ev)")]
+
+#
+# two-byte opcode map (0f xx)
+#
+MAP_0F = [
+  (0x00, 0x03, "m", "grp6/grp7/lar/lsl"),
+  (0x04, 0x04, "inv", ""),
+  (0x05, 0x09, "", "syscall/clts/sysret/invd/wbinvd"),
+  (0x0a, 0x0a, "inv", ""),
+  (0x0b, 0x0b, "", "ud2"),
+  (0x0c, 0x0c, "inv", ""),
+  (0x0d, 0x0d, "m", "prefetch"),
+  (0x0e, 0x0e, "", "femms"),
+  (0x0f, 0x0f, "m ib", "3DNow! (the suffix is the imm8)"),
+  (0x10, 0x17, "m", "SSE mov"),
+  (0x18, 0x1f, "m", "hint nop / endbr / bnd"),
+  (0x20, 0x23, "mr", "mov cr/dr"),
+  (0x24, 0x27, "inv", ""),
+  (0x28, 0x2f, "m", "SSE"),
+  (0x30, 0x35, "", "wrmsr/rdtsc/rdmsr/rdpmc/sysenter/sysexit"),
+  (0x36, 0x36, "inv", ""),
+  (0x37, 0x37, "", "getsec"),
+  (0x38, 0x38, "", "3-byte escape 0f 38"),
+  (0x39, 0x39, "inv", ""),
+  (0x3a, 0x3a, "", "3-byte escape 0f 3a"),
+  (0x3b, 0x3f, "inv", ""),
+  (0x40, 0x4f, "m", "cmovcc"),
+  (0x50, 0x6f, "m", "SSE/MMX"),
+  (0x70, 0x73, "m ib", "pshuf / grp12-14"),
+  (0x74, 0x76, "m", "pcmpeq"),
+  (0x77, 0x77, "", "emms"),
+  (0x78, 0x78, "m grp", "vmread / extrq,insertq Ib,Ib"),
+  (0x79, 0x79, "m", "vmwrite / extrq,insertq"),
+  (0x7a, 0x7b, "inv", ""),
+  (0x7c, 0x7f, "m", "SSE/MMX"),
+  (0x80, 0x8f, "jz jcc", "jcc Jz"),
+  (0x90, 0x9f, "m", "setcc"),
+  (0xa0, 0xa2, "", "push fs/pop fs/cpuid"),
+  (0xa3, 0xa3, "m", "bt"),
+  (0xa4, 0xa4, "m ib", "shld Ib"),
+  (0xa5, 0xa5, "m", "shld cl"),
+  (0xa6, 0xa7, "inv", ""),
+  (0xa8, 0xaa, "", "push gs/pop gs/rsm"),
+  (0xab, 0xab, "m", "bts"),
+  (0xac, 0xac, "m ib", "shrd Ib"),
+  (0xad, 0xaf, "m", "shrd cl/grp15/imul"),
+  (0xb0, 0xb9, "m", "cmpxchg/lss/btr/lfs/lgs/movzx/popcnt/ud1"),
+  (0xba, 0xba, "m ib", "grp8 Ib"),
+  (0xbb, 0xc1, "m", "btc/bsf/bsr/movsx/xadd"),
+  (0xc2, 0xc2, "m ib", "cmpps"),
+  (0xc3, 0xc3, "m", "movnti"),
+  (0xc4, 0xc6, "m ib", "pinsrw/pextrw/shufps"),
+  (0xc7, 0xc7, "m", "grp9"),
+  (0xc8, 0xcf, "o", "bswap"),
+  (0xd0, 0xff, "m", "SSE/MMX / ud0")]
+
+
+#
+# VEX/EVEX map 1 (0f xx)
+#
+MAP_VEX_0F = [
+  (0x00, 0x6f, "m", ""),
+  (0x70, 0x73, "m ib", "vpshuf / grp12-14"),
+  (0x74, 0x76, "m", ""),
+  (0x77, 0x77, "", "vzeroupper/vzeroall"),
+  (0x78, 0xc1, "m", ""),
+  (0xc2, 0xc2, "m ib", "vcmpps"),
+  (0xc3, 0xc3, "m", ""),
+  (0xc4, 0xc6, "m ib", "vpinsrw/vpextrw/vshufps"),
+  (0xc7, 0xff, "m", "")]
+
+TABLES = [
+  ("instr_attr_1byte", MAP_1BYTE),
+  ("instr_attr_0f", MAP_0F),
+  ("instr_attr_vex_0f", MAP_VEX_0F),
+]
+
+#
+# The maps in which all the instructions have the same attributes
+#
+UNIFORM_MAPS = [
+  ("instr_attr_0f38", "m", "0f 38 (and VEX/EVEX map 2)"),
+  ("instr_attr_0f3a", "m ib", "0f 3a (and VEX/EVEX map 3)"),
+  ("instr_attr_evex_map5", "m", "EVEX map 5 (FP16)"),
+  ("instr_attr_evex_map6", "m", "EVEX map 6 (FP16)"),
+  ("instr_attr_xop8", "m ib", "XOP map 8"),
+  ("instr_attr_xop9", "m", "XOP map 9"),
+  ("instr_attr_xopa", "m id", "XOP map 10"),
+]
+
+def expand(name, spec):
+  entries = [None] * 0x100
+  for first, last, attrs, comment in spec:
+    for code in range(first, last + 1):
+      if entries[code] is not None:
+        sys.stderr.write("%s: duplicated: %02x\n" % (name, code))
+        sys.exit(1)
+      entries[code] = (attrs, comment)
+  for code in range(0x100):
+    if entries[code] is None:
+      sys.stderr.write("%s: missing: %02x\n" % (name, code))
+      sys.exit(1)
+  return entries
+
+def to_c_expr(attrs):
+  words = attrs.split()
+  if not words:
+    return "0"
+  return "|".join([ATTR_MAP[w] for w in words])
+
+def print_table(name, spec):
+  entries = expand(name, spec)
+  print("static const uint32_t %s[0x100] = {" % name)
+  prev_comment = None
+  for code in range(0x100):
+    attrs, comment = entries[code]
+    line = "\t/* %02x */ %s," % (code, to_c_expr(attrs))
+    if comment and comment != prev_comment:
+      line += " // " + comment
+    prev_comment = comment
+    print(line)
+  print("};")
+
+print("// Generated by gen_instr_table.py. DO NOT EDIT.")
+for name, spec in TABLES:
+  print()
+  print_table(name, spec)
+print()
+for name, attrs, comment in UNIFORM_MAPS:
+  print("// " + comment)
+  print("static const uint32_t %s = %s;" % (name, to_c_expr(attrs)))
@@ -6,12 +6,18 @@
 // --------------------------------------------------------------------------
 // public functions
 // --------------------------------------------------------------------------
-mapped_lib_info::mapped_lib_info(const char *path, unsigned long start_addr,
-                                 unsigned long length, bool is_exe)
+mapped_lib_info::mapped_lib_info(const char *path, const char *loader_name,
+                                 unsigned long start_addr,
+                                 unsigned long text_addr,
+                                 unsigned long text_length,
+                                 const string &build_id, bool is_exe)
 : m_is_exe(is_exe),
   m_path(path),
+  m_loader_name(loader_name),
   m_start_addr(start_addr),
-  m_length(length)
+  m_text_addr(text_addr),
+  m_text_length(text_length),
+  m_build_id(build_id)
 {
 	m_filename = utils::get_basename(path);
 }
@@ -26,11 +32,36 @@ const char *mapped_lib_info::get_filename(void) const
 	return m_filename.c_str();
 }
 
+const char *mapped_lib_info::get_loader_name(void) const
+{
+	return m_loader_name.c_str();
+}
+
 unsigned long mapped_lib_info::get_addr(void) const
 {
 	return m_start_addr;
 }
 
+unsigned long mapped_lib_info::get_text_addr(void) const
+{
+	return m_text_addr;
+}
+
+unsigned long mapped_lib_info::get_text_length(void) const
+{
+	return m_text_length;
+}
+
+bool mapped_lib_info::is_in_text(unsigned long addr) const
+{
+	return addr >= m_text_addr && addr - m_text_addr < m_text_length;
+}
+
+const string &mapped_lib_info::get_build_id(void) const
+{
+	return m_build_id;
+}
+
 bool mapped_lib_info::is_exe(void) const
 {
 	return m_is_exe;
@@ -8,17 +8,26 @@ using namespace std;
 class mapped_lib_info {
 	bool m_is_exe;
 	string m_path;
-	unsigned long m_start_addr;
+	string m_loader_name; // the name given to the loader
+	unsigned long m_start_addr; // load bias (the address of vaddr 0)
 
 	string m_filename;
-	unsigned long m_length;
+	unsigned long m_text_addr;
+	unsigned long m_text_length;
+	string m_build_id; // empty when the object has no build-id
 public:
-	mapped_lib_info(const char *path,
-	                unsigned long start_addr, unsigned long length,
-	                bool is_exe);
+	mapped_lib_info(const char *path, const char *loader_name,
+	                unsigned long start_addr,
+	                unsigned long text_addr, unsigned long text_length,
+	                const string &build_id, bool is_exe);
 	const char *get_path(void) const;
 	const char *get_filename(void) const;
+	const char *get_loader_name(void) const;
 	unsigned long get_addr(void) const;
+	unsigned long get_text_addr(void) const;
+	unsigned long get_text_length(void) const;
+	bool is_in_text(unsigned long addr) const;
+	const string &get_build_id(void) const;
 	bool is_exe(void) const;
 };
 
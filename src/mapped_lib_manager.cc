@@ -1,5 +1,8 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
 #include <vector>
 #include <string>
 using namespace std;
@@ -9,72 +12,163 @@ using namespace std;
 #include <unistd.h>
 
 #include "mapped_lib_manager.h"
+#include "elf_reader.h"
 #include "utils.h"
 
-#define NUM_SHARED_LIB_MAP_ARGS      6
-#define IDX_SHARED_LIB_MAP_ADDR_RAGE 0
-#define IDX_SHARED_LIB_MAP_PERM      1
-#define IDX_SHARED_LIB_MAP_PATH      5
-
-#define LEN_SHARED_LIB_MAP_PERM      4
-#define IDX_PERM_EXEC                2
-
 // --------------------------------------------------------------------------
 // private functions
 // --------------------------------------------------------------------------
-void mapped_lib_manager::parse_mapped_lib_line(const char *line)
+int mapped_lib_manager::update_cb(struct dl_phdr_info *info, size_t size,
+                                  void *data)
 {
-	// strip head spaces
-	vector<string> tokens = utils::split(line);
-	if (tokens.size() != NUM_SHARED_LIB_MAP_ARGS)
-		return;
+	mapped_lib_manager *obj = static_cast<mapped_lib_manager *>(data);
+
+	// The counters are the same for all objects, so they are checked
+	// only at the first one.
+	if (!obj->m_changed) {
+		size_t counters_end = offsetof(struct dl_phdr_info, dlpi_subs)
+		                      + sizeof(info->dlpi_subs);
+		if (size >= counters_end) {
+			if (info->dlpi_adds == obj->m_num_adds &&
+			    info->dlpi_subs == obj->m_num_subs)
+				return 1;
+			obj->m_num_adds = info->dlpi_adds;
+			obj->m_num_subs = info->dlpi_subs;
+		}
+		obj->m_changed = true;
+	}
 
-	// select path that starts from '/'
-	string &path = tokens[IDX_SHARED_LIB_MAP_PATH];
-	if (path.at(0) != '/')
-		return;
+	// the range of the executable segments
+	unsigned long text_begin = ULONG_MAX;
+	unsigned long text_end = 0;
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+		if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X))
+			continue;
+		text_begin = min(text_begin, (unsigned long)phdr.p_vaddr);
+		text_end = max(text_end,
+		               (unsigned long)(phdr.p_vaddr + phdr.p_memsz));
+	}
+	if (text_begin >= text_end)
+		return 0;
+
+	unsigned long text_addr = info->dlpi_addr + text_begin;
+	obj->m_found_text_addrs.insert(text_addr);
+	mapped_lib_info_addr_map_t &addr_map = obj->m_lib_info_addr_map;
+	mapped_lib_info_addr_map_itr it = addr_map.find(text_addr);
+	if (it != addr_map.end()) {
+		// Another object can be mapped at the address of an unloaded
+		// one between the updates.
+		if (obj->is_same_object(it->second, info))
+			return 0;
+		obj->remove_lib_info(it);
+	}
+	obj->add_lib_info(info, text_addr, text_end - text_begin);
+	return 0;
+}
 
-	// select permission that contains execution
-	string &perm = tokens[IDX_SHARED_LIB_MAP_PERM];
-	if (perm.size() < LEN_SHARED_LIB_MAP_PERM)
-		return;
-	if (perm[IDX_PERM_EXEC] != 'x')
-		return;
+bool mapped_lib_manager::is_same_object(const mapped_lib_info *lib_info,
+                                        struct dl_phdr_info *info)
+{
+	if (strcmp(lib_info->get_loader_name(), info->dlpi_name) != 0)
+		return false;
+	return lib_info->get_build_id() == get_build_id(info);
+}
 
-	// parse start address
-	unsigned long start_addr, end_addr;
-	string &addr_range = tokens[0];
-	int ret = sscanf(addr_range.c_str(), "%lx-%lx", &start_addr, &end_addr);
-	if (ret != 2)
-		return;
+string mapped_lib_manager::get_build_id(struct dl_phdr_info *info)
+{
+	// The note is read from the memory, so the file isn't opened.
+	string build_id;
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+		if (phdr.p_type != PT_NOTE)
+			continue;
+		const uint8_t *data =
+		  (const uint8_t *)(info->dlpi_addr + phdr.p_vaddr);
+		if (elf_reader::parse_build_id(data, phdr.p_memsz, build_id))
+			break;
+	}
+	return build_id;
+}
 
-	unsigned long length = end_addr - start_addr;
+void mapped_lib_manager::add_lib_info(struct dl_phdr_info *info,
+                                      unsigned long text_addr,
+                                      unsigned long text_length)
+{
+	// The name of the executable is empty. The objects without a path
+	// such as vDSO are skipped.
+	const char *name = info->dlpi_name;
+	bool is_exe = (name[0] == '\0');
+	string path;
+	if (is_exe)
+		path = m_exe_path;
+	else if (!strchr(name, '/'))
+		return;
+	else {
+		char real_path[PATH_MAX];
+		if (!realpath(name, real_path)) {
+			ROACH_ERR("Failed to get the real path: %s (%d)\n",
+			          name, errno);
+			return;
+		}
+		path = real_path;
+	}
 
-	// add to the maps
-	bool is_exe = (path == m_exe_path);
 	mapped_lib_info *lib_info
-	  = new mapped_lib_info(path.c_str(), start_addr, length, is_exe);
+	  = new mapped_lib_info(path.c_str(), name, info->dlpi_addr,
+	                        text_addr, text_length, get_build_id(info),
+	                        is_exe);
+	m_lib_info_addr_map[text_addr] = lib_info;
 
+	// The name given to the loader is also registered, because it can
+	// be a symbolic link to the real path.
 	m_lib_info_path_map[lib_info->get_path()] = lib_info;
 	m_lib_info_filename_map[lib_info->get_filename()] = lib_info;
+	if (!is_exe && path != name) {
+		if (utils::is_absolute_path(name))
+			m_lib_info_path_map[name] = lib_info;
+		m_lib_info_filename_map[utils::get_basename(name)] = lib_info;
+	}
+	if (m_loaded_libs)
+		m_loaded_libs->push_back(lib_info);
+	ROACH_DBG("mapped: %s: addr: %lx, text: %lx-%lx\n",
+	          lib_info->get_path(), lib_info->get_addr(),
+	          text_addr, text_addr + text_length);
 }
 
-void mapped_lib_manager::_parse_mapped_lib_line(const char *line, void *arg)
+void mapped_lib_manager::remove_unloaded(void)
 {
-	mapped_lib_manager *obj = static_cast<mapped_lib_manager *>(arg);
-	obj->parse_mapped_lib_line(line);
+	mapped_lib_info_addr_map_itr it = m_lib_info_addr_map.begin();
+	while (it != m_lib_info_addr_map.end()) {
+		if (m_found_text_addrs.count(it->first)) {
+			++it;
+			continue;
+		}
+		remove_lib_info(it++);
+	}
 }
 
-void mapped_lib_manager::parse_proc_maps(void)
+void mapped_lib_manager::remove_lib_info(mapped_lib_info_addr_map_itr it)
 {
-	static const char *map_file_path = "/proc/self/maps";
-	bool ret = utils::read_one_line_loop
-	                   (map_file_path,
-	                    mapped_lib_manager::_parse_mapped_lib_line, this);
-	if (!ret) {
-		ROACH_ERR("Failed to parse recipe file: %s (%d)\n",
-		          map_file_path, errno);
-		ROACH_ABORT();
+	mapped_lib_info *lib_info = it->second;
+	ROACH_DBG("unmapped: %s\n", lib_info->get_path());
+	if (m_unloaded_text_addrs)
+		m_unloaded_text_addrs->push_back(it->first);
+	erase_lib_info(m_lib_info_path_map, lib_info);
+	erase_lib_info(m_lib_info_filename_map, lib_info);
+	delete lib_info;
+	m_lib_info_addr_map.erase(it);
+}
+
+void mapped_lib_manager::erase_lib_info(mapped_lib_info_map_t &name_map,
+                                        const mapped_lib_info *lib_info)
+{
+	mapped_lib_info_map_itr it = name_map.begin();
+	while (it != name_map.end()) {
+		if (it->second == lib_info)
+			name_map.erase(it++);
+		else
+			++it;
 	}
 }
 
@@ -82,12 +176,24 @@ void mapped_lib_manager::parse_proc_maps(void)
 // public functions
 // --------------------------------------------------------------------------
 mapped_lib_manager::mapped_lib_manager()
+: m_num_adds(0),
+  m_num_subs(0),
+  m_changed(false),
+  m_unloaded_text_addrs(NULL),
+  m_loaded_libs(NULL)
 {
 	// get the executable path
 	m_exe_path = utils::get_self_exe_name();
 
-	// lookup mapped files
-	parse_proc_maps();
+	// lookup loaded objects
+	update();
+}
+
+mapped_lib_manager::~mapped_lib_manager()
+{
+	mapped_lib_info_addr_map_itr it = m_lib_info_addr_map.begin();
+	for (; it != m_lib_info_addr_map.end(); ++it)
+		delete it->second;
 }
 
 const mapped_lib_info *mapped_lib_manager::get_lib_info(const char *name)
@@ -105,9 +211,27 @@ const mapped_lib_info *mapped_lib_manager::get_lib_info(const char *name)
 	return it->second;
 }
 
-void mapped_lib_manager::update(void)
+void mapped_lib_manager::get_lib_infos(vector<const mapped_lib_info *> &libs)
+{
+	mapped_lib_info_addr_map_itr it = m_lib_info_addr_map.begin();
+	for (; it != m_lib_info_addr_map.end(); ++it)
+		libs.push_back(it->second);
+}
+
+void mapped_lib_manager::update(vector<unsigned long> *unloaded_text_addrs,
+                                vector<const mapped_lib_info *> *loaded_libs)
 {
-	m_lib_info_path_map.clear();
-	m_lib_info_filename_map.clear();
-	parse_proc_maps();
+	unsigned long long prev_num_subs = m_num_subs;
+	m_changed = false;
+	m_found_text_addrs.clear();
+	m_unloaded_text_addrs = unloaded_text_addrs;
+	m_loaded_libs = loaded_libs;
+	dl_iterate_phdr(update_cb, this);
+
+	// Unloaded objects are looked for only when the number of unloads
+	// is changed or unknown. All objects have been visited in that case.
+	if (m_changed && (m_num_subs != prev_num_subs || m_num_subs == 0))
+		remove_unloaded();
+	m_unloaded_text_addrs = NULL;
+	m_loaded_libs = NULL;
 }
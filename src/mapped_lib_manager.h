@@ -1,20 +1,57 @@
 #ifndef mapped_lib_manager_h
 #define mapped_lib_manager_h
 
+#include <set>
+#include <vector>
+#include <link.h>
 #include "mapped_lib_info.h"
 
+// the head address of the text and the library
+typedef map<unsigned long, mapped_lib_info *> mapped_lib_info_addr_map_t;
+typedef mapped_lib_info_addr_map_t::iterator mapped_lib_info_addr_map_itr;
+
+/**
+ * Tracker of the loaded objects (the executable and shared libraries).
+ *
+ * The objects are enumerated with dl_iterate_phdr(). The counters of the
+ * loads and the unloads given with it are compared with those at the last
+ * update, so update() does nothing when no object is added or removed and
+ * only the new objects are examined otherwise. The text of an object is
+ * the range of its executable PT_LOAD segments, whose head address
+ * identifies the object together with its name and build-id. An object
+ * found at the address of another one is handled as an unload and a load.
+ */
 class mapped_lib_manager {
 	string m_exe_path;
 	mapped_lib_info_map_t m_lib_info_path_map;
 	mapped_lib_info_map_t m_lib_info_filename_map;
+	mapped_lib_info_addr_map_t m_lib_info_addr_map;
+	unsigned long long m_num_adds;
+	unsigned long long m_num_subs;
+
+	// used only in update()
+	bool m_changed;
+	set<unsigned long> m_found_text_addrs;
+	vector<unsigned long> *m_unloaded_text_addrs;
+	vector<const mapped_lib_info *> *m_loaded_libs;
 
-	static void _parse_mapped_lib_line(const char *line, void *arg);
-	void parse_mapped_lib_line(const char *line);
-	void parse_proc_maps(void);
+	static int update_cb(struct dl_phdr_info *info, size_t size, void *data);
+	static string get_build_id(struct dl_phdr_info *info);
+	bool is_same_object(const mapped_lib_info *lib_info,
+	                    struct dl_phdr_info *info);
+	void add_lib_info(struct dl_phdr_info *info, unsigned long text_addr,
+	                  unsigned long text_length);
+	void remove_unloaded(void);
+	void remove_lib_info(mapped_lib_info_addr_map_itr it);
+	void erase_lib_info(mapped_lib_info_map_t &name_map,
+	                    const mapped_lib_info *lib_info);
 public:
 	mapped_lib_manager(void);
+	~mapped_lib_manager();
 	const mapped_lib_info *get_lib_info(const char *name);
-	void update(void);
+	void get_lib_infos(vector<const mapped_lib_info *> &libs);
+	void update(vector<unsigned long> *unloaded_text_addrs = NULL,
+	            vector<const mapped_lib_info *> *loaded_libs = NULL);
 };
 
 #endif
@@ -1,9 +1,12 @@
 #include <cstdio>
 #include <cstring>
 #include "opecode.h"
+#include <new>
 #include "opecode_relocator.h"
+#include "opecode_arena.h"
 #include "utils.h"
 #include "rip_relative_relocator.h"
+#include "rel_jump_relocator.h"
 
 #if defined(__x86_64__) || defined(__i386__)
 mod_rm::mod_rm(void)
@@ -32,27 +35,40 @@ immediate::immediate(void)
 {
 }
 
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+void *opecode::alloc_relocator(size_t size)
+{
+	// The relocator is freed with the opecode. So it is also in the
+	// arena when the opecode is.
+	if (m_arena)
+		return m_arena->alloc(size);
+	return ::operator new(size);
+}
+
 // --------------------------------------------------------------------------
 // public functions
 // --------------------------------------------------------------------------
 
-opecode::opecode(uint8_t *orig_addr)
+opecode::opecode(uint8_t *orig_addr, opecode_arena *arena)
 : m_original_addr(orig_addr),
   m_length(0),
-  m_code(NULL),
   m_prefix(0),
   m_rel_jump_type(REL_INVALID),
   m_rel_jump_value(0),
   m_relocator(NULL),
-  m_relocated_code_size(0)
+  m_relocated_code_size(0),
+  m_parse_error(false),
+  m_flow_type(FLOW_NEXT),
+  m_arena(arena)
 {
 }
 
 opecode::~opecode()
 {
-	if (m_code)
-		delete [] m_code;
-	if (m_relocator)
+	// An opecode in the arena is not destructed.
+	if (m_relocator && !m_arena)
 		delete m_relocator;
 }
 
@@ -76,7 +92,7 @@ int opecode::get_length(void) const
 	return m_length;
 }
 
-uint8_t *opecode::get_code(void) const
+const uint8_t *opecode::get_code(void) const
 {
 	return m_code;
 }
@@ -106,7 +122,8 @@ void opecode::set_disp(opecode_disp_t disp_type, uint32_t disp,
 #if __x86_64__
 	if (m_mod_rm.mod == 0 && m_mod_rm.r_m == 5) {
 		int offset = (int)(disp_orig_addr - m_original_addr);
-		m_relocator = new rip_relative_relocator(this, offset);
+		void *ptr = alloc_relocator(sizeof(rip_relative_relocator));
+		m_relocator = new (ptr) rip_relative_relocator(this, offset);
 	}
 #endif // __x86_64__
 
@@ -122,24 +139,50 @@ void opecode::set_immediate(opecode_imm_t imm_type, uint64_t imm)
 
 void opecode::set_rel_jump_addr(rel_jump_t rel_type, int32_t value)
 {
+	if (m_relocator)
+		ROACH_BUG("Relocator has already been set: %p\n", m_original_addr);
+	void *ptr = alloc_relocator(sizeof(rel_jump_relocator));
+	m_relocator = new (ptr) rel_jump_relocator(this);
 	m_rel_jump_type = rel_type;
 	m_rel_jump_value = value;
 }
 
-void opecode::copy_code(uint8_t *addr)
+rel_jump_t opecode::get_rel_jump_type(void) const
+{
+	return m_rel_jump_type;
+}
+
+unsigned long opecode::get_rel_jump_dest(void) const
+{
+	// The displacement is relative to the next instruction.
+	// NOTE: m_length must be fixed, i.e. the parse has finished.
+	unsigned long next_addr = (unsigned long)m_original_addr + m_length;
+	return next_addr + (long)m_rel_jump_value;
+}
+
+void opecode::set_flow_type(opecode_flow_t flow_type)
 {
-	if (m_length == 0)
-		ROACH_BUG("m_length: 0\n");
-	if (m_code)
-		delete [] m_code;
-	m_code = new uint8_t[m_length];
+	m_flow_type = flow_type;
+}
+
+opecode_flow_t opecode::get_flow_type(void) const
+{
+	return m_flow_type;
+}
+
+void opecode::copy_code(const uint8_t *addr)
+{
+	if (m_length == 0 || m_length > OPECODE_MAX_LENGTH)
+		ROACH_BUG("m_length: %d\n", m_length);
 	memcpy(m_code, addr, m_length);
 }
 
 opecode_relocator *opecode::get_relocator(void)
 {
-	if (!m_relocator)
-		m_relocator = new opecode_relocator(this);
+	if (!m_relocator) {
+		void *ptr = alloc_relocator(sizeof(opecode_relocator));
+		m_relocator = new (ptr) opecode_relocator(this);
+	}
 	return m_relocator;
 }
 
@@ -163,6 +206,16 @@ const immediate &opecode::get_immediate(void) const
 	return m_immediate;
 }
 
+void opecode::set_parse_error(void)
+{
+	m_parse_error = true;
+}
+
+bool opecode::has_parse_error(void) const
+{
+	return m_parse_error;
+}
+
 // --------------------------------------------------------------------------
 // private functions
 // --------------------------------------------------------------------------
@@ -2,14 +2,32 @@
 #define opecode_h
 
 #include <stdint.h>
+#include <stddef.h>
 
 #if defined(__x86_64__) || defined(__i386__)
 class opecode_relocator;
+class opecode_arena;
+
+#define OPECODE_MAX_LENGTH 15
 
 #define PREFIX_REX_B (1 << 1)
+#define PREFIX_REX_X (1 << 2)
+#define PREFIX_REX_R (1 << 3)
+#define PREFIX_OPERAND_SIZE (1 << 4) // 0x66
+#define PREFIX_ADDRESS_SIZE (1 << 5) // 0x67
+#define PREFIX_REP   (1 << 6)        // 0xf3
+#define PREFIX_REPNE (1 << 7)        // 0xf2
 #define PREFIX_REX_W (1 << 8)
+#define PREFIX_LOCK  (1 << 9)
+#define PREFIX_SEGMENT (1 << 10)     // 0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65
+#define PREFIX_VEX   (1 << 11)       // also set for EVEX and XOP
+#define PREFIX_EVEX  (1 << 12)
+#define PREFIX_XOP   (1 << 13)
 #define PREFIX_REX_WB (PREFIX_REX_W|PREFIX_REX_B)
 
+// NOTE: The REX bits are also set from the (inverted) bits in the VEX,
+//       EVEX and XOP prefixes.
+
 enum mod_type {
 	MOD_REG_UNKNOWN = -1,
 	MOD_REG_INDIRECT,
@@ -35,6 +53,7 @@ enum register_type {
 enum opecode_disp_t {
 	DISP_NONE,
 	DISP8,
+	DISP16,
 	DISP32,
 };
 
@@ -53,6 +72,16 @@ enum rel_jump_t {
 	REL32,
 };
 
+// How the instruction changes the control flow
+enum opecode_flow_t {
+	FLOW_NEXT,      // goes to the next instruction
+	FLOW_JUMP,      // unconditional jump
+	FLOW_COND_JUMP, // conditional jump (the next or the destination)
+	FLOW_CALL,
+	FLOW_RET,
+	FLOW_JUMP_INDIRECT, // jump to an address in a register or memory
+};
+
 struct mod_rm {
 	mod_type      mod;
 	register_type reg;
@@ -90,7 +119,7 @@ struct immediate {
 class opecode {
 	uint8_t *m_original_addr;
 	int      m_length;
-	uint8_t *m_code;
+	uint8_t  m_code[OPECODE_MAX_LENGTH];
 	int      m_prefix;
 	mod_rm   m_mod_rm;
 	sib      m_sib;
@@ -100,14 +129,19 @@ class opecode {
 	int32_t       m_rel_jump_value;
 	opecode_relocator *m_relocator;
 	int                m_relocated_code_size;
+	bool               m_parse_error;
+	opecode_flow_t     m_flow_type;
+	opecode_arena     *m_arena;
+
+	void *alloc_relocator(size_t size);
 public:
-	opecode(uint8_t *orig_addr);
+	opecode(uint8_t *orig_addr, opecode_arena *arena = NULL);
 	virtual ~opecode();
 
 	uint8_t *get_original_addr(void) const;
 	void inc_length(int length = 1);
 	int  get_length(void) const;
-	uint8_t *get_code(void) const;
+	const uint8_t *get_code(void) const;
 	void add_prefix(int prefix);
 	void set_mod_rm(mod_type mod, register_type reg, register_type r_m);
 	void set_sib_param(int ss, int index, int base);
@@ -115,12 +149,18 @@ public:
 	              uint8_t *disp_orig_addr);
 	void set_immediate(opecode_imm_t imm_type, uint64_t imm);
 	void set_rel_jump_addr(rel_jump_t rel_type, int32_t value);
-	void copy_code(uint8_t *addr);
+	rel_jump_t get_rel_jump_type(void) const;
+	unsigned long get_rel_jump_dest(void) const;
+	void set_flow_type(opecode_flow_t flow_type);
+	opecode_flow_t get_flow_type(void) const;
+	void copy_code(const uint8_t *addr);
 	opecode_relocator *get_relocator(void);
 	const mod_rm &get_mod_rm(void) const;
 	const sib &get_sib(void) const;
 	const disp &get_disp(void) const;
 	const immediate &get_immediate(void) const;
+	void set_parse_error(void);
+	bool has_parse_error(void) const;
 };
 
 #endif // defined(__x86_64__) || defined(__i386__)
@@ -0,0 +1,45 @@
+#include <cstdio>
+#include "opecode_arena.h"
+#include "utils.h"
+
+// The alignment of the returned memory
+static const size_t ALIGN_SIZE = sizeof(void *) * 2;
+
+const size_t opecode_arena::CHUNK_SIZE = 64 * 1024;
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+opecode_arena::opecode_arena(void)
+: m_curr(NULL),
+  m_remain(0),
+  m_allocated_size(0)
+{
+}
+
+opecode_arena::~opecode_arena()
+{
+	for (size_t i = 0; i < m_chunks.size(); i++)
+		delete [] m_chunks[i];
+}
+
+void *opecode_arena::alloc(size_t size)
+{
+	size = (size + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+	if (size > m_remain) {
+		size_t chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+		m_curr = new uint8_t[chunk_size];
+		m_remain = chunk_size;
+		m_chunks.push_back(m_curr);
+	}
+	void *ret = m_curr;
+	m_curr += size;
+	m_remain -= size;
+	m_allocated_size += size;
+	return ret;
+}
+
+size_t opecode_arena::get_allocated_size(void) const
+{
+	return m_allocated_size;
+}
@@ -0,0 +1,32 @@
+#ifndef opecode_arena_h
+#define opecode_arena_h
+
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A bump allocator for the decoded instructions and their relocators.
+ *
+ * They are only used while the probes are prepared, so the memory is
+ * not freed one by one but all at once when the arena is destroyed.
+ * This is not thread-safe. Each thread uses its own arena.
+ */
+class opecode_arena {
+	static const size_t CHUNK_SIZE;
+
+	vector<uint8_t *> m_chunks;
+	uint8_t *m_curr;
+	size_t   m_remain;
+	size_t   m_allocated_size;
+
+public:
+	opecode_arena(void);
+	virtual ~opecode_arena();
+	void *alloc(size_t size);
+	size_t get_allocated_size(void) const;
+};
+
+#endif
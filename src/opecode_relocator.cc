@@ -1,12 +1,14 @@
 #include <cstring>
 #include "opecode_relocator.h"
 #include "utils.h"
+#include "side_code_area_manager.h"
 
 // --------------------------------------------------------------------------
 // public functions
 // --------------------------------------------------------------------------
 opecode_relocator::opecode_relocator(opecode *op)
-: m_op(op)
+: m_op(op),
+  m_data_addr(NULL)
 {
 }
 
@@ -19,6 +21,19 @@ const opecode *opecode_relocator::get_opecode(void)
 	return m_op;
 }
 
+uint8_t *opecode_relocator::get_data_addr(void)
+{
+	if (m_data_addr == NULL)
+		ROACH_BUG("Data address has not been set: %p\n",
+		          m_op->get_original_addr());
+	return m_data_addr;
+}
+
+void opecode_relocator::set_data_addr(uint8_t *addr)
+{
+	m_data_addr = addr;
+}
+
 int opecode_relocator::get_max_code_length(void)
 {
 	return m_op->get_length();
@@ -34,10 +49,11 @@ int opecode_relocator::relocate(uint8_t *dest_addr)
 	int length = m_op->get_length();
 	if (length == 0)
 		ROACH_BUG("length: 0\n");
-	uint8_t *code = m_op->get_code();
+	const uint8_t *code = m_op->get_code();
 	if (code == NULL)
 		ROACH_BUG("code: NULL\n");
-	memcpy(dest_addr, code, length);
+	memcpy(side_code_area_manager::get_writable_addr(dest_addr), code,
+	       length);
 	return length;
 }
 
@@ -5,13 +5,16 @@
 
 class opecode_relocator {
 	const opecode *m_op;
+	uint8_t *m_data_addr;
 
 protected:
 	const opecode *get_opecode(void);
+	uint8_t *get_data_addr(void);
 
 public:
 	opecode_relocator(opecode *op);
 	virtual ~opecode_relocator();
+	void set_data_addr(uint8_t *addr);
 	virtual int get_max_code_length(void);
 	virtual int get_max_data_length(void);
 	virtual int relocate(uint8_t *addr);
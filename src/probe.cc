@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <queue>
 #include <list>
 using namespace std;
@@ -10,6 +11,7 @@ using namespace std;
 #include <unistd.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <fcntl.h>
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
@@ -22,6 +24,51 @@ using namespace std;
 #include "side_code_area_manager.h"
 #include "disassembler.h"
 #include "opecode_relocator.h"
+#include "rel_jump_relocator.h"
+#include "elf_reader.h"
+#include "symbol_pattern.h"
+#include "func_analyzer.h"
+#include "decode_cache.h"
+#include "func_cfg_cache.h"
+#include "thread_scratch.h"
+
+// The stubs for the shared bridge are aligned to the cache line.
+static const int SHARED_BRIDGE_STUB_ALIGN = 64;
+
+/**
+ * The parameters of a probe for the shared bridge. It is placed just after
+ * the call to the shared bridge in the stub of the probe, and the offsets
+ * of the members are used in _shared_bridge().
+ */
+struct shared_bridge_desc {
+	unsigned long bridge; // the address of the shared bridge
+	unsigned long post_probe_addr;
+	unsigned long priv_data;
+	unsigned long probe;
+};
+
+static bool is_shared_bridge_requested(void)
+{
+	const char *env = getenv("COCKROACH_SHARED_BRIDGE");
+	return env && atoi(env);
+}
+
+static bool is_shared_bridge_enabled(void)
+{
+	static bool shared_bridge_enabled = is_shared_bridge_requested();
+	return shared_bridge_enabled;
+}
+
+// The side code of each probe begins at a cache line and is packed
+// densely with the shared bridge.
+static size_t get_side_code_align(int *code_len)
+{
+	if (!is_shared_bridge_enabled())
+		return 1;
+	int align = SHARED_BRIDGE_STUB_ALIGN;
+	*code_len = (*code_len + align - 1) / align * align;
+	return align;
+}
 
 #ifdef __x86_64__
 
@@ -123,15 +170,6 @@ extern "C" void probe_ret_point(void);
 extern "C" void probe_call(void);
 extern "C" void bridge_end(void);
 
-void _resume_template(void)
-{
-	PSEUDO_PUSH("resume_begin:");
-	asm volatile("ret"); // use 'ret' instread of 'call'
-	asm volatile("resume_end:");
-}
-extern "C" void resume_begin(void);
-extern "C" void resume_end(void);
-
 #define OFFSET_BRIDGE(label) \
 utils::calc_func_distance(get_bridge_begin_addr(), label)
 
@@ -185,6 +223,50 @@ void _return_ret_probe_bridge(void)
 }
 extern "C" void return_ret_probe_bridge(void);
 
+void _shared_bridge(void)
+{
+	// NOTE: function is not template, it is actually used as it is.
+	// The stub of a probe calls here with the address of its
+	// shared_bridge_desc on the stack (see write_shared_bridge_call()).
+	asm volatile("shared_bridge:");
+	PUSH_ALL_REGS();
+
+	// replace the address of the descriptor with post_probe_addr
+	asm volatile("mov 0x80(%rsp),%rax");
+	asm volatile("mov 0x8(%rax),%rdi");
+	asm volatile("mov %rdi,0x80(%rsp)");
+
+	// private data and an argument for the probe
+	asm volatile("push 0x10(%rax)");
+	asm volatile("mov %rsp,%rdi");
+
+	// The probe is called with the stack aligned to 16B, because the
+	// target address isn't always the top of a function.
+	asm volatile("mov %rsp,%rbx");
+	asm volatile("and $-16,%rsp");
+	asm volatile("call *0x18(%rax)");
+	asm volatile("mov %rbx,%rsp");
+
+	// restore stack and registers
+	asm volatile("add $0x8,%rsp");
+	POP_ALL_REGS();
+	asm volatile("ret");
+}
+extern "C" void shared_bridge(void);
+
+//   ff 15 00 00 00 00     callq  *0x0(%rip)
+// The address of the shared bridge is the first member of the descriptor
+// placed just after this.
+static const int LEN_SHARED_BRIDGE_CALL = 6;
+
+static void write_shared_bridge_call(uint8_t *code)
+{
+	code = side_code_area_manager::get_writable_addr(code);
+	code[0] = 0xff;
+	code[1] = 0x15;
+	*((uint32_t *)(code + 2)) = 0;
+}
+
 static void set_pseudo_push_parameter(uint8_t *code_addr, unsigned long param)
 {
 	// We assume the pseudo push as the followin form.
@@ -197,6 +279,7 @@ static void set_pseudo_push_parameter(uint8_t *code_addr, unsigned long param)
 	//   c7 44 24 04 67 45 23 01   movl   $0x01234567,0x4(%rsp)
 	static const int OFFSET_ADDR_LSB32 = 7;
 	static const int OFFSET_ADDR_MSB32 = 15;
+	code_addr = side_code_area_manager::get_writable_addr(code_addr);
 	uint32_t param_lsb32 = param & 0xffffffff;
 	uint32_t param_msb32 = param >> 32;
 	uint32_t *code_addr_lsb32 = (uint32_t *)(code_addr + OFFSET_ADDR_LSB32);
@@ -205,6 +288,20 @@ static void set_pseudo_push_parameter(uint8_t *code_addr, unsigned long param)
 	*code_addr_msb32 = param_msb32;
 }
 
+// jmp *0x0(%rip) and the destination address just after it.
+// No register is changed.
+static const int LEN_ABS_JUMP = 14;
+
+static void write_abs_jump(uint8_t *code, unsigned long dest)
+{
+	//   ff 25 00 00 00 00     jmpq   *0x0(%rip)
+	//   xx xx xx xx xx xx xx xx (destination)
+	code[0] = 0xff;
+	code[1] = 0x25;
+	*((uint32_t *)(code + 2)) = 0;
+	*((uint64_t *)(code + 6)) = dest;
+}
+
 unsigned long cockroach_get_target_func_arg(probe_arg_t *arg, size_t nth_arg)
 {
 	if (nth_arg == 0) {
@@ -312,15 +409,6 @@ extern "C" void probe_ret_point(void);
 extern "C" void probe_call(void);
 extern "C" void bridge_end(void);
 
-void _resume_template(void)
-{
-	PSEUDO_PUSH("resume_begin:");
-	asm volatile("ret"); // use 'ret' instread of 'call'
-	asm volatile("resume_end:");
-}
-extern "C" void resume_begin(void);
-extern "C" void resume_end(void);
-
 #define OFFSET_BRIDGE(label) \
 utils::calc_func_distance(get_bridge_begin_addr(), label)
 
@@ -374,15 +462,75 @@ void _return_ret_probe_bridge(void)
 }
 extern "C" void return_ret_probe_bridge(void);
 
+void _shared_bridge(void)
+{
+	// NOTE: function is not template, it is actually used as it is.
+	// The stub of a probe calls here with the address of its
+	// shared_bridge_desc on the stack (see write_shared_bridge_call()).
+	asm volatile("shared_bridge:");
+	PUSH_ALL_REGS();
+
+	// replace the address of the descriptor with post_probe_addr
+	asm volatile("mov 0x20(%esp),%eax");
+	asm volatile("mov 0x4(%eax),%ecx");
+	asm volatile("mov %ecx,0x20(%esp)");
+
+	// private data and an argument for the probe
+	asm volatile("push 0x8(%eax)");
+	asm volatile("mov %esp,%ecx");
+
+	// The probe is called with the stack aligned to 16B, because the
+	// target address isn't always the top of a function.
+	asm volatile("mov %esp,%ebx");
+	asm volatile("and $-16,%esp");
+	asm volatile("sub $0xc,%esp");
+	asm volatile("push %ecx");
+	asm volatile("call *0xc(%eax)");
+	asm volatile("mov %ebx,%esp");
+
+	// restore stack and registers
+	asm volatile("add $0x4,%esp");
+	POP_ALL_REGS();
+	asm volatile("ret");
+}
+extern "C" void shared_bridge(void);
+
+//   ff 15 xx xx xx xx     call   *(descriptor)
+// The address of the shared bridge is the first member of the descriptor
+// placed just after this.
+static const int LEN_SHARED_BRIDGE_CALL = 6;
+
+static void write_shared_bridge_call(uint8_t *code)
+{
+	uint32_t desc = (uint32_t)(code + LEN_SHARED_BRIDGE_CALL);
+	code = side_code_area_manager::get_writable_addr(code);
+	code[0] = 0xff;
+	code[1] = 0x15;
+	*((uint32_t *)(code + 2)) = desc;
+}
+
 static void set_pseudo_push_parameter(uint8_t *code_addr, unsigned long param)
 {
 	// We assume the pseudo push as the followin form.
 	//   68 ef cd ab 89          push   $0x89abcdef
 	static const int OFFSET = 1;
+	code_addr = side_code_area_manager::get_writable_addr(code_addr);
 	uint32_t *code_addr32 = (uint32_t *)(code_addr + OFFSET);
 	*code_addr32 = param;
 }
 
+// push $dest; ret
+static const int LEN_ABS_JUMP = 6;
+
+static void write_abs_jump(uint8_t *code, unsigned long dest)
+{
+	//   68 xx xx xx xx        push   $dest
+	//   c3                    ret
+	code[0] = 0x68;
+	*((uint32_t *)(code + 1)) = dest;
+	code[5] = OPCODE_RET;
+}
+
 unsigned long cockroach_get_target_func_arg(probe_arg_t *arg, size_t nth_arg)
 {
 	if (nth_arg == 0) {
@@ -396,13 +544,21 @@ unsigned long cockroach_get_target_func_arg(probe_arg_t *arg, size_t nth_arg)
 
 #endif // __i386__
 
+probe_target_info::probe_target_info(void)
+: offset(0),
+  symbol_size(0),
+  func_offset(0),
+  func_size(0),
+  overwrite_length(0)
+{
+}
+
 // --------------------------------------------------------------------------
 // private functions
 // --------------------------------------------------------------------------
-void probe::change_page_permission(void *addr)
+void probe::change_page_permission(void *addr, int prot)
 {
 	int page_size = utils::get_page_size();
-	int prot =  PROT_READ | PROT_WRITE | PROT_EXEC;
 	if (mprotect(addr, page_size, prot) == -1) {
 		ROACH_ERR("Failed to mprotect: %p, %d, %x (%d)\n",
 		          addr, page_size, prot, errno);
@@ -410,25 +566,42 @@ void probe::change_page_permission(void *addr)
 	}
 }
 
-void probe::change_page_permission_all(void *addr, int len)
+void probe::change_page_permission_all(void *addr, int len, int prot)
 {
 	int page_size = utils::get_page_size();
 	unsigned long mask = ~(page_size - 1);
 	unsigned long addr_ul = (unsigned long)addr;
 	unsigned long addr_aligned = addr_ul & mask;
-	change_page_permission((void *)addr_aligned);
+	change_page_permission((void *)addr_aligned, prot);
 
 	int mod = addr_ul % page_size;
 	if (mod > page_size - len)
-		change_page_permission((void *)(addr_aligned + page_size));
+		change_page_permission((void *)(addr_aligned + page_size),
+		                       prot);
+}
+
+probe *probe::create_expanded_probe(const char *symbol, unsigned long offset,
+                                    unsigned long size)
+{
+	probe *a_probe = new probe(m_probe_type, m_install_type);
+	a_probe->set_target_address(m_target_lib_path.c_str(), offset,
+	                            m_overwrite_length);
+	a_probe->set_probe(m_probe_lib_path.c_str(), m_probe,
+	                   m_probe_init, m_probe_init_data);
+	a_probe->set_thread_filter(m_thread_filter);
+	a_probe->m_symbol_name = symbol;
+	a_probe->m_symbol_size = size;
+	a_probe->m_expanded_from_pattern = true;
+	a_probe->m_pattern_probe = this;
+	return a_probe;
 }
 
 #if defined(__x86_64__) || defined(__i386__)
 void probe::overwrite_jump_code(void *target_addr, void *jump_abs_addr,
-                                int copy_code_size)
+                                int copy_code_size, uint8_t *code_buf)
 {
-	change_page_permission_all(target_addr, copy_code_size);
-
+	// The code is made in the buffer and the relative address is
+	// calculated with the target address.
 	// calculate the count of nop, which should be filled
 	int idx;
 	int len_nops = copy_code_size - probe::get_overwrite_code_length();
@@ -437,14 +610,16 @@ void probe::overwrite_jump_code(void *target_addr, void *jump_abs_addr,
 		          copy_code_size, OPCODES_LEN_OVERWRITE_JUMP);
 		ROACH_ABORT();
 	}
-	uint8_t *code = reinterpret_cast<uint8_t*>(target_addr);
+	uint8_t *code = code_buf;
 
 	// fill jump instruction(s)
-	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP) {
+	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP ||
+	    m_install_type == INSTALL_TYPE_EXIT_ABS64_JUMP) {
 		code = overwrite_jump_abs64(code, jump_abs_addr,
 		                            copy_code_size);
-	} else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP) {
-		code = overwrite_jump_rel32(code, jump_abs_addr,
+	} else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP ||
+	           m_install_type == INSTALL_TYPE_EXIT_REL32_JUMP) {
+		code = overwrite_jump_rel32(code, target_addr, jump_abs_addr,
 		                            copy_code_size);
 	} else {
 		ROACH_BUG("Unknown m_install_type: %d\n", m_install_type);
@@ -455,10 +630,10 @@ void probe::overwrite_jump_code(void *target_addr, void *jump_abs_addr,
 		*code = OPCODE_NOP;
 }
 
-uint8_t *probe::overwrite_jump_rel32(uint8_t *code, void *jump_abs_addr,
-                                     int copy_code_size)
+uint8_t *probe::overwrite_jump_rel32(uint8_t *code, void *target_addr,
+                                     void *jump_abs_addr, int copy_code_size)
 {
-	int32_t rel_addr = get_rel_addr32_for_jump(code, jump_abs_addr);
+	int32_t rel_addr = get_rel_addr32_for_jump(target_addr, jump_abs_addr);
 
 	// fill jump instruction
 	*code = OPCODE_JMP_REL;
@@ -497,21 +672,101 @@ uint8_t *probe::overwrite_jump_abs64(uint8_t *code, void *jump_abs_addr,
 	return code;
 }
 
+void probe::write_patch(uint8_t *code, const uint8_t *new_code, int length,
+                        bool head_last)
+{
+	// The head (8 bytes that have the whole REL32 jump) is replaced
+	// with a locked write, which is atomic for the other threads if it
+	// doesn't cross a cache line. The rest isn't executed while the head
+	// is a REL32 jump, so it is written after the jump is put and before
+	// the jump is removed. In W^X mode the head is written with one
+	// pwrite() instead, which the kernel copies at once but not locked.
+	static const int CACHE_LINE_SIZE = 64;
+	int head_length = length;
+	if (head_length > (int)sizeof(uint64_t))
+		head_length = sizeof(uint64_t);
+	int tail_length = length - head_length;
+	if (head_last)
+		write_text(code + head_length, new_code + head_length,
+		           tail_length);
+	unsigned long line_offset = (unsigned long)code % CACHE_LINE_SIZE;
+	if (side_code_area_manager::is_wx_enabled())
+		write_text(code, new_code, head_length);
+	else if (line_offset + sizeof(uint64_t) >
+	         (unsigned long)CACHE_LINE_SIZE) {
+		ROACH_DBG("The head isn't written atomically: %p\n", code);
+		memcpy(code, new_code, head_length);
+	} else {
+		uint64_t *head = reinterpret_cast<uint64_t *>(code);
+		uint64_t curr, next;
+		do {
+			curr = *head;
+			next = curr;
+			memcpy(&next, new_code, head_length);
+		} while (!__sync_bool_compare_and_swap(head, curr, next));
+	}
+	if (!head_last)
+		write_text(code + head_length, new_code + head_length,
+		           tail_length);
+}
+
 label_func_t probe::get_bridge_begin_addr(void)
 {
+	// The side code for an exit restores RAX by itself before the
+	// relocated code is executed. See create_exit_side_code().
 	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP)
 		return bridge_begin;
-	else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP)
+	else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP ||
+	         m_install_type == INSTALL_TYPE_EXIT_ABS64_JUMP ||
+	         m_install_type == INSTALL_TYPE_EXIT_REL32_JUMP)
 		return bridge_begin_no_pop_ax;
 	ROACH_BUG("Unknown install type: %d\n", m_install_type);
 	return NULL;
 }
 
+int probe::get_bridge_length(void)
+{
+	if (!is_shared_bridge_enabled()) {
+		return utils::calc_func_distance(get_bridge_begin_addr(),
+		                                 bridge_end);
+	}
+	int length = LEN_SHARED_BRIDGE_CALL + sizeof(shared_bridge_desc);
+	if (get_bridge_begin_addr() == bridge_begin)
+		length++; // pop %rax
+	return length;
+}
+
+void probe::write_bridge(uint8_t *bridge)
+{
+	if (!is_shared_bridge_enabled()) {
+		label_func_t bridge_begin_addr = get_bridge_begin_addr();
+		memcpy(side_code_area_manager::get_writable_addr(bridge),
+		       (void *)bridge_begin_addr,
+		       utils::calc_func_distance(bridge_begin_addr,
+		                                 bridge_end));
+		return;
+	}
+	if (get_bridge_begin_addr() == bridge_begin)
+		*side_code_area_manager::get_writable_addr(bridge++) =
+		  OPCODE_POP_RAX;
+	write_shared_bridge_call(bridge);
+}
+
+shared_bridge_desc *probe::get_shared_bridge_desc(uint8_t *bridge)
+{
+	uint8_t *desc = bridge + get_bridge_length()
+	                - sizeof(shared_bridge_desc);
+	return reinterpret_cast<shared_bridge_desc *>(
+	  side_code_area_manager::get_writable_addr(desc));
+}
+
 int probe::get_overwrite_code_length(void)
 {
-	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP)
+	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP ||
+	    m_install_type == INSTALL_TYPE_EXIT_ABS64_JUMP)
 		return OPCODES_LEN_OVERWRITE_JUMP;
-	else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP)
+	else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP ||
+	         m_install_type == INSTALL_TYPE_EXIT_REL32_JUMP)
 		return LEN_OPCODE_JMP_REL32;
 	ROACH_BUG("Unknown install type: %d\n", m_install_type);
 	return -1;
@@ -522,9 +777,11 @@ int probe::get_overwrite_code_length(void)
 
 int probe::get_minimum_overwrite_length(void)
 {
-	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP)
+	if (m_install_type == INSTALL_TYPE_OVERWRITE_ABS64_JUMP ||
+	    m_install_type == INSTALL_TYPE_EXIT_ABS64_JUMP)
 		return OPCODES_LEN_OVERWRITE_JUMP;
-	else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP)
+	else if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP ||
+	         m_install_type == INSTALL_TYPE_EXIT_REL32_JUMP)
 		return LEN_OPCODE_JMP_REL32;
 	ROACH_BUG("Unknown install type: %d\n", m_install_type);
 	return -1;
@@ -536,12 +793,25 @@ int probe::get_minimum_overwrite_length(void)
 probe::probe(probe_type_t probe_type, install_type_t install_type)
 : m_probe_type(probe_type),
   m_install_type(install_type),
+  m_symbol_is_pattern(false),
+  m_expanded_from_pattern(false),
+  m_pattern_probe(NULL),
   m_offset_addr(0),
+  m_symbol_size(0),
+  m_func_offset(0),
+  m_func_size(0),
   m_overwrite_length(0),
   m_overwrite_length_auto_detect(false),
+  m_target_cached(false),
+  m_cached_overwrite_length(0),
+  m_target_addr(0),
+  m_side_code_area(NULL),
+  m_side_code_length(0),
   m_probe_init(NULL),
   m_probe(NULL),
-  m_probe_priv_data(NULL)
+  m_probe_init_data(NULL),
+  m_probe_priv_data(NULL),
+  m_thread_filter(NULL)
 {
 }
 
@@ -557,8 +827,22 @@ void probe::set_target_address(const char *target_lib_path, unsigned long addr,
 		m_overwrite_length_auto_detect = true;
 }
 
+void probe::set_target_symbol(const char *target_lib_path, const char *symbol,
+                              int overwrite_length)
+{
+	set_target_address(target_lib_path, 0, overwrite_length);
+	m_symbol_name = symbol;
+}
+
+void probe::set_target_pattern(const char *target_lib_path,
+                               const char *pattern, int overwrite_length)
+{
+	set_target_symbol(target_lib_path, pattern, overwrite_length);
+	m_symbol_is_pattern = true;
+}
+
 void probe::set_probe(const char *probe_lib_path, probe_func_t probe,
-                           probe_init_func_t probe_init)
+                      probe_init_func_t probe_init, void *probe_init_data)
 {
 	if (probe_lib_path)
 		m_probe_lib_path = probe_lib_path;
@@ -566,6 +850,22 @@ void probe::set_probe(const char *probe_lib_path, probe_func_t probe,
 		m_probe_lib_path.erase();
 	m_probe = probe;
 	m_probe_init = probe_init;
+	m_probe_init_data = probe_init_data;
+}
+
+void probe::set_thread_filter(thread_filter *filter)
+{
+	m_thread_filter = filter;
+}
+
+probe_type_t probe::get_probe_type(void) const
+{
+	return m_probe_type;
+}
+
+install_type_t probe::get_install_type(void) const
+{
+	return m_install_type;
 }
 
 const char *probe::get_target_lib_path(void)
@@ -573,17 +873,65 @@ const char *probe::get_target_lib_path(void)
 	return m_target_lib_path.c_str();
 }
 
+bool probe::is_target_pattern(void) const
+{
+	return m_symbol_is_pattern;
+}
+
+probe *probe::get_pattern_probe(void) const
+{
+	return m_pattern_probe;
+}
+
+const string &probe::get_cache_key(void)
+{
+	// The key is made from the recipe before the target is resolved,
+	// because the symbol name of an exit probe given by an offset is
+	// set at the resolution.
+	if (!m_cache_key.empty())
+		return m_cache_key;
+	char buf[64];
+	int overwrite_length =
+	  m_overwrite_length_auto_detect ? 0 : m_overwrite_length;
+	if (m_symbol_name.empty())
+		sprintf(buf, "%d %lx %d", m_install_type, m_offset_addr,
+		        overwrite_length);
+	else
+		sprintf(buf, "%d %d ", m_install_type, overwrite_length);
+	m_cache_key = buf;
+	if (!m_symbol_name.empty())
+		m_cache_key += m_symbol_name;
+	return m_cache_key;
+}
+
+void probe::get_target_info(probe_target_info *info) const
+{
+	info->symbol_name = m_symbol_name;
+	info->offset = m_offset_addr;
+	info->symbol_size = m_symbol_size;
+	info->func_offset = m_func_offset;
+	info->func_size = m_func_size;
+	info->overwrite_length = m_overwrite_length;
+}
+
+void probe::set_target_info(const probe_target_info &info)
+{
+	if (!info.symbol_name.empty())
+		m_symbol_name = info.symbol_name;
+	m_offset_addr = info.offset;
+	m_symbol_size = info.symbol_size;
+	m_func_offset = info.func_offset;
+	m_func_size = info.func_size;
+	m_cached_overwrite_length = info.overwrite_length;
+	m_target_cached = true;
+}
+
 #if defined(__x86_64__) || defined(__i386__)
 void probe::install(const mapped_lib_info *lib_info)
 {
-	ROACH_INFO("install: %s: func: %08lx, mapped addr: %016lx, "
-	           "overwrite len: %d, install: %d\n",
-	           lib_info->get_path(), m_offset_addr, lib_info->get_addr(),
-	           m_overwrite_length, m_install_type);
-	unsigned long target_addr = m_offset_addr;
-	if (!lib_info->is_exe())
-		target_addr += lib_info->get_addr();
-	install_core(target_addr);
+	if (!set_target_addr(lib_info))
+		return;
+	install_core(m_target_addr);
 }
 
 void probe::install(void *mapped_addr)
@@ -598,37 +946,181 @@ void probe::install(void *mapped_addr)
 
 void probe::install_core(unsigned long target_addr)
 {
-	void *target_addr_ptr = (void *)target_addr;
+	m_target_addr = target_addr;
+	if (!prepare())
+		return;
+	init();
+	commit();
+}
 
-	// detect overwrite length if needed
-	list<opecode *> relocated_opecode_list;
-	if (m_overwrite_length_auto_detect) {
-		uint8_t *code_ptr = (uint8_t *)target_addr;
-		int parsed_length = 0;
-		bool met_ret_code = false;
-		while (parsed_length < get_minimum_overwrite_length()) {
-			if (met_ret_code) {
-				ROACH_ERR("Met return code @ %d\n.",
-				          parsed_length);
-				ROACH_ABORT();
-			}
-
-			opecode *op = disassembler::parse(code_ptr);
-			parsed_length += op->get_length();
-			code_ptr += op->get_length();
-			relocated_opecode_list.push_back(op);
-
-			if (is_opecode_ret(op))
-				met_ret_code = true;
+void probe::expand_pattern(const mapped_lib_info *lib_info,
+                           probe_list_t &expanded_list)
+{
+	elf_reader *reader = elf_reader::get(lib_info->get_path());
+	if (!reader) {
+		ROACH_ERR("Failed to read: %s. The probes for %s are not "
+		          "installed.\n", lib_info->get_path(),
+		          m_symbol_name.c_str());
+		return;
+	}
+	symbol_pattern pattern(m_symbol_name);
+	if (pattern.has_error())
+		return;
+
+	elf_symbol_list_t sym_list;
+	reader->get_func_symbols(sym_list);
+	size_t num_matched = 0;
+	elf_symbol_list_itr sym = sym_list.begin();
+	for (; sym != sym_list.end(); ++sym) {
+		if (!pattern.match(sym->name))
+			continue;
+		// The jump instruction doesn't fit in the function.
+		if (sym->size < (unsigned long)get_minimum_overwrite_length())
+			continue;
+		expanded_list.push_back(
+		  create_expanded_probe(sym->name, sym->value, sym->size));
+		num_matched++;
+	}
+	ROACH_INFO("expanded: %s: %s -> %zd functions\n",
+	           lib_info->get_path(), m_symbol_name.c_str(), num_matched);
+}
+
+void probe::expand_cached(const mapped_lib_info *lib_info,
+                          const probe_target_info_list_t &target_list,
+                          probe_list_t &expanded_list)
+{
+	// The functions that could be probed last time. The symbols are
+	// not read.
+	for (size_t i = 0; i < target_list.size(); i++) {
+		const probe_target_info &info = target_list[i];
+		probe *a_probe = create_expanded_probe(info.symbol_name.c_str(),
+		                                       info.offset,
+		                                       info.symbol_size);
+		a_probe->set_target_info(info);
+		expanded_list.push_back(a_probe);
+	}
+	ROACH_INFO("expanded (cached): %s: %s -> %zd functions\n",
+	           lib_info->get_path(), m_symbol_name.c_str(),
+	           target_list.size());
+}
+
+bool probe::set_target_addr(const mapped_lib_info *lib_info)
+{
+	// The ELF file isn't read for a target given from the recipe cache.
+	if (!m_target_cached) {
+		if (!m_symbol_name.empty() && !resolve_symbol(lib_info))
+			return false;
+		if (is_exit_probe() && m_symbol_size == 0 &&
+		    !resolve_func_size(lib_info))
+			return false;
+		if (!is_exit_probe())
+			resolve_func_range(lib_info);
+	}
+	ROACH_INFO("install: %s: func: %08lx, mapped addr: %016lx, "
+	           "overwrite len: %d, install: %d\n",
+	           lib_info->get_path(), m_offset_addr, lib_info->get_addr(),
+	           m_overwrite_length, m_install_type);
+	// The load bias is 0 for the executable that is not PIE.
+	m_target_addr = m_offset_addr + lib_info->get_addr();
+	if (!lib_info->is_in_text(m_target_addr)) {
+		ROACH_ERR("Not in the text: %s: %08lx (text: %lx-%lx). The "
+		          "probe is not installed.\n",
+		          lib_info->get_path(), m_offset_addr,
+		          lib_info->get_text_addr(),
+		          lib_info->get_text_addr()
+		          + lib_info->get_text_length());
+		return false;
+	}
+	return true;
+}
+
+bool probe::parse_overwritten_code(list<opecode *> &opecode_list,
+                                   decode_context *ctx)
+{
+	uint8_t *code_ptr = (uint8_t *)m_target_addr;
+	int parsed_length = 0;
+	bool met_end_of_flow = false;
+	while (parsed_length < get_minimum_overwrite_length()) {
+		if (met_end_of_flow) {
+			ROACH_ERR("Met the end of the flow @ %d\n.",
+			          parsed_length);
+			if (m_expanded_from_pattern)
+				return false;
+			ROACH_ABORT();
 		}
-		m_overwrite_length = parsed_length;
+
+		// A function matched with a pattern is just skipped when
+		// it has an instruction that cannot be parsed.
+		opecode *op = ctx->cache->parse(code_ptr, ctx->arena,
+		                                !m_expanded_from_pattern);
+		if (!op) {
+			ROACH_INFO("Skip: %s: unsupported code: %p\n",
+			           m_symbol_name.c_str(), code_ptr);
+			return false;
+		}
+		parsed_length += op->get_length();
+		code_ptr += op->get_length();
+		opecode_list.push_back(op);
+
+		if (is_end_of_flow(op))
+			met_end_of_flow = true;
+	}
+
+	list<opecode *>::iterator it = opecode_list.begin();
+	for (; it != opecode_list.end(); ++it) {
+		bool is_last = (*it == opecode_list.back());
+		if (can_relocate(*it, parsed_length, is_last))
+			continue;
+		if (m_expanded_from_pattern)
+			return false;
+		ROACH_ABORT();
+	}
+	if (m_expanded_from_pattern &&
+	    (unsigned long)parsed_length > m_symbol_size) {
+		ROACH_INFO("Skip: %s: overwrite length: %d > size: %lu\n",
+		           m_symbol_name.c_str(), parsed_length, m_symbol_size);
+		return false;
+	}
+	m_overwrite_length = parsed_length;
+	return true;
+}
+
+bool probe::prepare(decode_context *ctx)
+{
+	// A probe prepared alone uses its own arena and cache.
+	if (!ctx) {
+		opecode_arena arena;
+		decode_cache cache;
+		decode_context local_ctx = {&arena, &cache};
+		return prepare(&local_ctx);
+	}
+	if (is_exit_probe())
+		return prepare_exit(ctx);
+
+	void *target_addr_ptr = (void *)m_target_addr;
+
+	// detect overwrite length if needed. The opecodes are in the arena
+	// and freed with it.
+	list<opecode *> relocated_opecode_list;
+	list<opecode *>::iterator op;
+	if (m_overwrite_length_auto_detect &&
+	    !parse_overwritten_code(relocated_opecode_list, ctx))
+		return false;
+
+	// A cached target passed the check with the same overwritten code.
+	bool branches_checked = m_target_cached &&
+	  m_overwrite_length == m_cached_overwrite_length;
+	if (!branches_checked && !check_branch_targets(ctx)) {
+		if (m_expanded_from_pattern)
+			return false;
+		ROACH_ABORT();
 	}
 
 	int relocated_code_length = 0;
 	int relocated_data_length = 0;
 	if (!relocated_opecode_list.empty()) {
 		opecode_relocator *relocator;
-		list<opecode *>::iterator op = relocated_opecode_list.begin();
+		op = relocated_opecode_list.begin();
 		for (; op != relocated_opecode_list.end(); ++op) {
 			relocator = (*op)->get_relocator();
 			relocated_code_length +=
@@ -640,100 +1132,560 @@ void probe::install_core(unsigned long target_addr)
 	else
 		relocated_code_length = m_overwrite_length;
 
-	// run the probe initializer that creates private data if needed.
-	probe_init_arg_t arg;
-	arg.target_addr = target_addr;
-	if (m_probe_init)
-		(*m_probe_init)(&arg);
-	m_probe_priv_data = arg.priv_data;
-
 	// --------------------------------------------------------------------
 	// [Side Code Area Layout]
 	// (0) restore rax that is used to jump to here
 	// (1) code to save registers
 	// (2) code to call probe
 	// (3) code to restore registers
-	// (4) original code
-	// (6) code to resume the original code
+	// (4) original code (relative addresses are relocated)
+	// (5) jump to resume the original code
+	// (6) data for the relocated code
 	// --------------------------------------------------------------------
 
 	// check if the patch for the same address has already been registered.
-	label_func_t bridge_begin_addr = get_bridge_begin_addr();
-	int bridge_length =
-	  utils::calc_func_distance(bridge_begin_addr, bridge_end);
-	static const int RET_BRIDGE_LENGTH =
-	  utils::calc_func_distance(resume_begin, resume_end);
+	int bridge_length = get_bridge_length();
 	int code_len = bridge_length
 	               + relocated_code_length + relocated_data_length
-	               + RET_BRIDGE_LENGTH;
+	               + rel_jump_relocator::MAX_JUMP_LENGTH;
+	size_t align = get_side_code_align(&code_len);
 	uint8_t *side_code_area = NULL;
 	if (m_install_type == INSTALL_TYPE_OVERWRITE_REL32_JUMP) {
 		unsigned long next_code_addr
-		  = target_addr + relocated_code_length;
+		  = m_target_addr + relocated_code_length;
 		side_code_area =
 		  side_code_area_manager::alloc_within_rel32(code_len,
-		                                             next_code_addr);
+		                                             next_code_addr,
+		                                             align);
 	} else
-		side_code_area = side_code_area_manager::alloc(code_len);
+		side_code_area = side_code_area_manager::alloc(code_len, align);
 	ROACH_DBG("side_code: %p\n", side_code_area);
 
-	// copy bridge code, orignal code and resume code
+	// copy bridge code and orignal code
 	uint8_t *side_code_ptr = side_code_area;
-	memcpy(side_code_ptr, (void *)bridge_begin_addr, bridge_length);
+	write_bridge(side_code_ptr);
 	side_code_ptr += bridge_length;
 
 	// code relocation or simple copy
 	if (!relocated_opecode_list.empty()) {
 		opecode_relocator *relocator;
-		list<opecode *>::iterator op = relocated_opecode_list.begin();
+		uint8_t *data_ptr = side_code_area + code_len
+		                    - relocated_data_length;
+		op = relocated_opecode_list.begin();
 		for (; op != relocated_opecode_list.end(); ++op) {
 			relocator = (*op)->get_relocator();
+			relocator->set_data_addr(data_ptr);
+			data_ptr += relocator->get_max_data_length();
 			side_code_ptr += relocator->relocate(side_code_ptr);
 		}
 	} else {
-		memcpy(side_code_ptr, target_addr_ptr, m_overwrite_length);
+		memcpy(side_code_area_manager::get_writable_addr(side_code_ptr),
+		       target_addr_ptr, m_overwrite_length);
 		side_code_ptr += relocated_code_length;
 	}
 
-	memcpy(side_code_ptr, (void *)resume_begin, RET_BRIDGE_LENGTH);
+	// Jump to the original path. The stack is not used, because the
+	// target code may have data below the stack pointer (red zone).
+	uint8_t *dest_addr = (uint8_t *)target_addr_ptr + m_overwrite_length;
+	rel_jump_relocator::write_jump(side_code_ptr, (unsigned long)dest_addr);
+
+	// By default, we set to execute the saved orignal code after the probe.
+	uint8_t *saved_orig_code = side_code_area + bridge_length;
+	set_bridge_parameters(side_code_area, saved_orig_code);
+
+	m_side_code_area = side_code_area;
+	m_side_code_length = code_len;
+	return true;
+}
+
+void probe::init(void)
+{
+	// run the probe initializer that creates private data if needed.
+	probe_init_arg_t arg;
+	arg.target_addr = m_target_addr;
+	arg.priv_data = m_probe_init_data;
+	if (m_probe_init) {
+		// The probe of the recipe line survives the reinstalls.
+		thread_scratch::begin_init(m_pattern_probe ? m_pattern_probe :
+		                                             this);
+		(*m_probe_init)(&arg);
+		thread_scratch::end_init();
+	}
+	m_probe_priv_data = arg.priv_data;
+
+	// set probe private address
+	void *bridge_priv_data = get_bridge_priv_data();
+	probe_patch_list_t patch_list;
+	get_patch_areas(patch_list);
+	for (size_t i = 0; i < patch_list.size(); i++) {
+		uint8_t *bridge = patch_list[i].bridge;
+		if (is_shared_bridge_enabled()) {
+			get_shared_bridge_desc(bridge)->priv_data =
+			  (unsigned long)bridge_priv_data;
+			continue;
+		}
+		uint8_t *side_code_ptr =
+		  bridge + OFFSET_BRIDGE(bridge_set_private_data);
+		set_pseudo_push_parameter(side_code_ptr,
+		                          (unsigned long)bridge_priv_data);
+	}
+}
+
+void probe::commit(bool page_writable)
+{
+	// overwrite jump code
+	probe_patch_list_t patch_list;
+	get_patch_areas(patch_list);
+	m_orig_code.clear();
+	for (size_t i = 0; i < patch_list.size(); i++) {
+		probe_patch &patch = patch_list[i];
+		void *target_addr_ptr = (void *)patch.addr;
+
+		// kept to uninstall the probe from the running code
+		const uint8_t *orig_code = (const uint8_t *)patch.addr;
+		m_orig_code.insert(m_orig_code.end(), orig_code,
+		                   orig_code + patch.length);
+		if (!page_writable && !side_code_area_manager::is_wx_enabled())
+			change_page_permission_all(target_addr_ptr,
+			                           patch.length,
+			                           PROT_READ | PROT_WRITE |
+			                           PROT_EXEC);
+		uint8_t code_buf[patch.length];
+		overwrite_jump_code(target_addr_ptr, patch.side_code,
+		                    patch.length, code_buf);
+		write_patch((uint8_t *)target_addr_ptr, code_buf,
+		            patch.length, false);
+	}
+}
+
+void probe::write_text(uint8_t *addr, const uint8_t *data, size_t len)
+{
+	if (!side_code_area_manager::is_wx_enabled()) {
+		memcpy(addr, data, len);
+		return;
+	}
+
+	// In W^X mode the target code is written through /proc/self/mem, so
+	// its pages stay executable (and never writable) while other threads
+	// and the installer itself keep running the code in them.
+	static int mem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
+	if (mem_fd == -1) {
+		ROACH_ERR("Failed to open /proc/self/mem (%d)\n", errno);
+		ROACH_ABORT();
+	}
+	while (len > 0) {
+		ssize_t ret = pwrite64(mem_fd, data, len,
+		                       (off64_t)(unsigned long)addr);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			ROACH_ERR("Failed to write the code: %p, %zd (%d)\n",
+			          addr, len, errno);
+			ROACH_ABORT();
+		}
+		addr += ret;
+		data += ret;
+		len -= ret;
+	}
+}
+
+unsigned long probe::get_target_addr(void) const
+{
+	return m_target_addr;
+}
+
+bool probe::is_exit_probe(void) const
+{
+	return m_install_type == INSTALL_TYPE_EXIT_ABS64_JUMP ||
+	       m_install_type == INSTALL_TYPE_EXIT_REL32_JUMP;
+}
+
+void probe::get_patch_areas(probe_patch_list_t &patch_list) const
+{
+	if (is_exit_probe()) {
+		patch_list.insert(patch_list.end(), m_exit_patches.begin(),
+		                  m_exit_patches.end());
+		return;
+	}
+	probe_patch patch;
+	patch.addr = m_target_addr;
+	patch.length = m_overwrite_length;
+	patch.side_code = m_side_code_area;
+	patch.side_code_length = m_side_code_length;
+	patch.bridge = m_side_code_area;
+	patch_list.push_back(patch);
+}
+
+void probe::release_side_code(void)
+{
+	// The target code has gone with the library, so it is not restored.
+	probe_patch_list_t patch_list;
+	get_patch_areas(patch_list);
+	for (size_t i = 0; i < patch_list.size(); i++) {
+		side_code_area_manager::release(patch_list[i].side_code,
+		                                patch_list[i].side_code_length);
+	}
+	m_side_code_area = NULL;
+	m_side_code_length = 0;
+	m_exit_patches.clear();
+	m_orig_code.clear();
+	m_target_addr = 0;
+	m_target_cached = false;
+	m_cached_overwrite_length = 0;
+}
+
+void probe::restore_code(void)
+{
+	// The side code is kept, because other threads may be running in
+	// it. A probe that hasn't been committed has nothing to restore.
+	if (m_orig_code.empty())
+		return;
+	probe_patch_list_t patch_list;
+	get_patch_areas(patch_list);
+	size_t pos = 0;
+	for (size_t i = 0; i < patch_list.size(); i++) {
+		probe_patch &patch = patch_list[i];
+		void *target_addr_ptr = (void *)patch.addr;
+		if (!side_code_area_manager::is_wx_enabled())
+			change_page_permission_all(target_addr_ptr,
+			                           patch.length,
+			                           PROT_READ | PROT_WRITE |
+			                           PROT_EXEC);
+		write_patch((uint8_t *)target_addr_ptr, &m_orig_code[pos],
+		            patch.length, true);
+		pos += patch.length;
+	}
+	m_orig_code.clear();
+	ROACH_INFO("restored: %s: %016lx (%zd patches)\n",
+	           m_symbol_name.c_str(), m_target_addr, patch_list.size());
+}
+
+bool probe::dry_run(const char *symbol, uint8_t *code, unsigned long size,
+                    decode_context *ctx)
+{
+	// The function is handled as one matched with a pattern, so the
+	// code that cannot be overwritten is reported without abort.
+	m_symbol_name = symbol;
+	m_symbol_size = size;
+	m_expanded_from_pattern = true;
+	m_offset_addr = 0;
+	m_func_offset = 0;
+	m_func_size = size;
+	m_build_id.clear();
+	m_target_addr = (unsigned long)code;
+	m_overwrite_length = 0;
+	m_overwrite_length_auto_detect = true;
+	if (size < (unsigned long)get_minimum_overwrite_length())
+		return false;
+
+	list<opecode *> opecode_list;
+	if (!parse_overwritten_code(opecode_list, ctx))
+		return false;
+	return check_branch_targets(ctx);
+}
+
+void probe::set_bridge_parameters(uint8_t *bridge, uint8_t *post_probe_addr)
+{
+	if (is_shared_bridge_enabled()) {
+		shared_bridge_desc *desc = get_shared_bridge_desc(bridge);
+		desc->bridge = (unsigned long)shared_bridge;
+		desc->post_probe_addr = (unsigned long)post_probe_addr;
+		desc->priv_data = 0;
+		desc->probe = (unsigned long)get_bridge_probe();
+		return;
+	}
 
 	// set the address to be executed after the probe is returned.
-	// By default, we set to execute the saved orignal code.
 	// The probe can changed the address by set probe_arg_t::probe_ret_addr.
-	side_code_ptr =
-	  side_code_area + OFFSET_BRIDGE(bridge_set_post_probe_addr);
-	uint8_t *saved_orig_code = side_code_area + OFFSET_BRIDGE(bridge_end);
-	set_pseudo_push_parameter(side_code_ptr, (unsigned long)saved_orig_code);
+	uint8_t *side_code_ptr =
+	  bridge + OFFSET_BRIDGE(bridge_set_post_probe_addr);
+	set_pseudo_push_parameter(side_code_ptr, (unsigned long)post_probe_addr);
 
 	// set probe return address
-	side_code_ptr = side_code_area + OFFSET_BRIDGE(probe_call_set_ret_addr);
-	uint8_t *ret_addr = side_code_area + OFFSET_BRIDGE(probe_ret_point);
+	side_code_ptr = bridge + OFFSET_BRIDGE(probe_call_set_ret_addr);
+	uint8_t *ret_addr = bridge + OFFSET_BRIDGE(probe_ret_point);
 	set_pseudo_push_parameter(side_code_ptr, (unsigned long)ret_addr);
 
-	// set probe private address
-	side_code_ptr = side_code_area + OFFSET_BRIDGE(bridge_set_private_data);
+	// set probe address
+	side_code_ptr = bridge + OFFSET_BRIDGE(probe_call_set_probe_addr);
 	set_pseudo_push_parameter(side_code_ptr,
-	                          (unsigned long)m_probe_priv_data);
+	                          (unsigned long)get_bridge_probe());
+}
 
-	// set probe address
-	side_code_ptr =
-	  side_code_area + OFFSET_BRIDGE(probe_call_set_probe_addr);
-	set_pseudo_push_parameter(side_code_ptr, (unsigned long)m_probe);
+probe_func_t probe::get_bridge_probe(void) const
+{
+	// The filter calls the probe only in the matched threads.
+	if (m_thread_filter)
+		return roach_thread_filter_probe;
+	return m_probe;
+}
 
-	// set address to the original path
-	side_code_ptr = side_code_area + bridge_length + relocated_code_length;
-	uint8_t *dest_addr = (uint8_t *)target_addr_ptr + m_overwrite_length;
-	set_pseudo_push_parameter(side_code_ptr, (unsigned long)dest_addr);
+void *probe::get_bridge_priv_data(void)
+{
+	if (!m_thread_filter)
+		return m_probe_priv_data;
+	m_thread_filter_data.filter = m_thread_filter;
+	m_thread_filter_data.probe = m_probe;
+	m_thread_filter_data.priv_data = m_probe_priv_data;
+	return &m_thread_filter_data;
+}
 
-	// overwrite jump code
-	overwrite_jump_code(target_addr_ptr, 
-	                    side_code_area, m_overwrite_length);
+bool probe::prepare_exit(decode_context *ctx)
+{
+	if (m_symbol_size == 0) {
+		ROACH_ERR("Unknown function size: %lx. Exit probes are not "
+		          "installed.\n", m_target_addr);
+		return false;
+	}
+	func_analyzer analyzer((uint8_t *)m_target_addr, m_symbol_size, ctx);
+	if (!analyzer.analyze())
+		return false;
+	if (analyzer.has_indirect_jump()) {
+		ROACH_ERR("Indirect jump in the function: %s (%lx). Exit "
+		          "probes are not installed.\n",
+		          m_symbol_name.c_str(), m_target_addr);
+		return false;
+	}
+
+	func_exit_site_list_t site_list;
+	if (!analyzer.find_exit_sites(get_minimum_overwrite_length(),
+	                              site_list)) {
+		ROACH_ERR("Exit probes are not installed: %s (%lx)\n",
+		          m_symbol_name.c_str(), m_target_addr);
+		return false;
+	}
+	m_exit_patches.clear();
+	for (size_t i = 0; i < site_list.size(); i++) {
+		if (!create_exit_side_code(analyzer, site_list[i]))
+			return false;
+	}
+	return true;
+}
+
+bool probe::create_exit_side_code(const func_analyzer &analyzer,
+                                  const func_exit_site &site)
+{
+	const opecode_vector_t &opecodes = analyzer.get_opecodes();
+	opecode *exit_op = opecodes[site.exit_idx];
+
+	// --------------------------------------------------------------------
+	// [Side Code Area Layout for an exit]
+	// (0) restore rax that is used to jump to here (ABS64 only)
+	// (1) overwritten code before the exit
+	// (2) code to save registers, call probe, and restore registers
+	// (3) the exit: 'ret' or a jump to the tail-called function
+	// (4) data for the relocated code
+	// --------------------------------------------------------------------
+	// The probe is called just before the exit. So RAX has the return
+	// value and the stack pointer is the same as that at the entry.
+	int head_length = 0;
+	if (m_install_type == INSTALL_TYPE_EXIT_ABS64_JUMP)
+		head_length = 1;
+
+	int relocated_code_length = 0;
+	int relocated_data_length = 0;
+	for (size_t i = site.first_idx; i < site.exit_idx; i++) {
+		opecode_relocator *relocator = opecodes[i]->get_relocator();
+		relocated_code_length += relocator->get_max_code_length();
+		relocated_data_length += relocator->get_max_data_length();
+	}
+
+	int bridge_length = get_bridge_length();
+	int exit_length = exit_op->get_length();
+	if (exit_op->get_flow_type() == FLOW_JUMP)
+		exit_length = LEN_ABS_JUMP;
+	int code_len = head_length + relocated_code_length
+	               + relocated_data_length + bridge_length + exit_length;
+	size_t align = get_side_code_align(&code_len);
+
+	unsigned long site_addr = (unsigned long)
+	  opecodes[site.first_idx]->get_original_addr();
+	uint8_t *side_code_area = NULL;
+	if (m_install_type == INSTALL_TYPE_EXIT_REL32_JUMP) {
+		side_code_area =
+		  side_code_area_manager::alloc_within_rel32(code_len,
+		                                             site_addr, align);
+	} else
+		side_code_area = side_code_area_manager::alloc(code_len, align);
+
+	uint8_t *side_code_ptr = side_code_area;
+	uint8_t *data_ptr = side_code_area + code_len - relocated_data_length;
+	if (head_length)
+		*side_code_area_manager::get_writable_addr(side_code_ptr++) =
+		  OPCODE_POP_RAX;
+	for (size_t i = site.first_idx; i < site.exit_idx; i++) {
+		opecode_relocator *relocator = opecodes[i]->get_relocator();
+		relocator->set_data_addr(data_ptr);
+		data_ptr += relocator->get_max_data_length();
+		side_code_ptr += relocator->relocate(side_code_ptr);
+	}
+
+	uint8_t *bridge = side_code_ptr;
+	write_bridge(bridge);
+	side_code_ptr += bridge_length;
+
+	uint8_t *exit_code = side_code_ptr;
+	uint8_t *writable_exit_code =
+	  side_code_area_manager::get_writable_addr(exit_code);
+	if (exit_op->get_flow_type() == FLOW_JUMP)
+		write_abs_jump(writable_exit_code,
+		               exit_op->get_rel_jump_dest());
+	else
+		memcpy(writable_exit_code, exit_op->get_code(), exit_length);
+	set_bridge_parameters(bridge, exit_code);
+
+	probe_patch patch;
+	patch.addr = site_addr;
+	patch.length = site.length;
+	patch.side_code = side_code_area;
+	patch.side_code_length = code_len;
+	patch.bridge = bridge;
+	m_exit_patches.push_back(patch);
+	ROACH_DBG("exit: %p -> side_code: %p (len: %d)\n",
+	          (void *)site_addr, side_code_area, site.length);
+	return true;
+}
+
+bool probe::resolve_symbol(const mapped_lib_info *lib_info)
+{
+	// The offset of the symbol is the same as that given with a hex
+	// number in a recipe. It is resolved only once because it never
+	// changes as long as the file is the same.
+	if (m_offset_addr)
+		return true;
+	elf_reader *reader = elf_reader::get(lib_info->get_path());
+	elf_symbol sym;
+	if (!reader || !reader->lookup_symbol(m_symbol_name.c_str(), &sym)) {
+		ROACH_ERR("Not found symbol: %s: %s. The probe is not installed.\n",
+		          lib_info->get_path(), m_symbol_name.c_str());
+		return false;
+	}
+	if (sym.value == 0) {
+		ROACH_ERR("Symbol has no address: %s: %s\n",
+		          lib_info->get_path(), m_symbol_name.c_str());
+		return false;
+	}
+	ROACH_DBG("resolved: %s: %s -> %08lx (size: %lu)\n",
+	          lib_info->get_path(), m_symbol_name.c_str(),
+	          sym.value, sym.size);
+	m_offset_addr = sym.value;
+	m_symbol_size = sym.size;
+	return true;
 }
-bool probe::is_opecode_ret(const opecode *ope) const
+
+bool probe::resolve_func_size(const mapped_lib_info *lib_info)
 {
-	if (ope->get_length() != 1)
+	// Exit probes need the end of the function.
+	elf_reader *reader = elf_reader::get(lib_info->get_path());
+	elf_symbol sym;
+	if (!reader || !reader->lookup_func_by_addr(m_offset_addr, &sym) ||
+	    sym.value != m_offset_addr) {
+		ROACH_ERR("Not found function at %lx: %s. Exit probes are "
+		          "not installed.\n", m_offset_addr,
+		          lib_info->get_path());
 		return false;
-	return *ope->get_code() == OPCODE_RET;
+	}
+	m_symbol_name = sym.name;
+	m_symbol_size = sym.size;
+	return true;
+}
+
+void probe::resolve_func_range(const mapped_lib_info *lib_info)
+{
+	// The branches in the function that has the target are checked
+	// before it is overwritten.
+	m_func_size = 0;
+	m_build_id.clear();
+	elf_reader *reader = elf_reader::get(lib_info->get_path());
+	if (!reader)
+		return;
+	if (m_symbol_size) {
+		m_func_offset = m_offset_addr;
+		m_func_size = m_symbol_size;
+	} else {
+		elf_symbol sym;
+		if (!reader->lookup_func_by_addr(m_offset_addr, &sym))
+			return;
+		m_func_offset = sym.value;
+		m_func_size = sym.size;
+	}
+	reader->get_build_id(m_build_id);
+}
+
+bool probe::check_branch_targets(decode_context *ctx)
+{
+	if (m_func_size == 0) {
+		ROACH_DBG("Unknown function: %lx. Branches are not checked.\n",
+		          m_target_addr);
+		return true;
+	}
+	unsigned long func_addr =
+	  m_target_addr - (m_offset_addr - m_func_offset);
+	func_cfg cfg;
+	func_cfg_cache::get(m_build_id, m_func_offset, (uint8_t *)func_addr,
+	                    m_func_size, ctx, &cfg);
+	if (!cfg.analyzed) {
+		ROACH_DBG("Failed to analyze: %lx. Branches are not checked.\n",
+		          func_addr);
+		return true;
+	}
+	if (cfg.has_indirect_jump) {
+		ROACH_DBG("Indirect jump in the function: %lx. Its "
+		          "destinations are not checked.\n", func_addr);
+	}
+
+	// A branch to the top of the overwritten code is fine. It jumps to
+	// the side code as the original code does.
+	unsigned long begin = m_target_addr - func_addr;
+	unsigned long end = begin + m_overwrite_length;
+	vector<unsigned long>::const_iterator it =
+	  upper_bound(cfg.branch_targets.begin(), cfg.branch_targets.end(),
+	              begin);
+	if (it == cfg.branch_targets.end() || *it >= end)
+		return true;
+	ROACH_ERR("Branch into the overwritten code: %s: %lx -> %lx\n",
+	          m_symbol_name.c_str(), m_target_addr, func_addr + *it);
+	return false;
+}
+
+bool probe::is_end_of_flow(const opecode *ope) const
+{
+	// The code after these may not be a part of the function.
+	opecode_flow_t flow_type = ope->get_flow_type();
+	return flow_type == FLOW_RET || flow_type == FLOW_JUMP ||
+	       flow_type == FLOW_JUMP_INDIRECT;
+}
+
+bool probe::can_relocate(const opecode *ope, int overwrite_length,
+                         bool is_last) const
+{
+	if (ope->get_rel_jump_type() == REL_INVALID)
+		return true;
+	if (ope->get_rel_jump_type() == REL16) {
+		ROACH_ERR("16bit relative jump is not supported: %s: %p\n",
+		          m_symbol_name.c_str(), ope->get_original_addr());
+		return false;
+	}
+
+	// The relocated call returns to the original code, which must not
+	// be overwritten.
+	if (ope->get_flow_type() == FLOW_CALL && !is_last) {
+		ROACH_ERR("Call must be the last of the overwritten code: "
+		          "%s: %p\n",
+		          m_symbol_name.c_str(), ope->get_original_addr());
+		return false;
+	}
+
+	// A jump to the top calls the probe again as the original code does.
+	// But the other part of the overwritten code is broken.
+	unsigned long dest = ope->get_rel_jump_dest();
+	if (dest > m_target_addr && dest < m_target_addr + overwrite_length) {
+		ROACH_ERR("Jump into the overwritten code: %s: %p -> %lx\n",
+		          m_symbol_name.c_str(), ope->get_original_addr(),
+		          dest);
+		return false;
+	}
+	return true;
 }
 
 #endif // defined(__x86_64__) || defined(__i386__)
@@ -824,14 +1776,15 @@ static uint8_t *create_ret_probe_bridge(void)
 
 	// copy return probe bridge code
 	uint8_t *side_code_ptr = side_code_area;
-	memcpy(side_code_ptr, (void *)ret_probe_bridge_begin,
-	       RET_PROBE_BRIDGE_LENGTH);
+	memcpy(side_code_area_manager::get_writable_addr(side_code_ptr),
+	       (void *)ret_probe_bridge_begin, RET_PROBE_BRIDGE_LENGTH);
 
 	// set the head address of this area (2nd arguemnt of dispatcher)
 #if __x86_64__
 	//   48 be ef cd ab 89 67 45 23 01 movabs $0x123456789abcdef,%rsi
 	side_code_ptr = 
 	  side_code_area + OFFSET_RET_BRIDGE(ret_probe_set_bridge_addr) + 2;
+	side_code_ptr = side_code_area_manager::get_writable_addr(side_code_ptr);
 	*((unsigned long *)side_code_ptr) = (unsigned long)side_code_area;
 #endif // __x86_64__
 #if __i386__
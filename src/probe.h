@@ -2,12 +2,15 @@
 #define probe_h
 
 #include <string>
+#include <list>
+#include <vector>
 using namespace std;
 
 #include <stdint.h>
 #include "cockroach-probe.h"
 #include "mapped_lib_info.h"
 #include "opecode.h"
+#include "thread_filter.h"
 
 typedef void (*label_func_t)(void);
 
@@ -24,12 +27,16 @@ typedef void (*label_func_t)(void);
 #define OPCODE_JMP_ABS_RAX_0 0xff
 #define OPCODE_JMP_ABS_RAX_1 0xe0
 #define OPCODE_JMP_REL    0xe9
+#define OPCODE_POP_RAX    0x58
 #endif // defined(__x86_64__) || define(__i386__)
 
 enum probe_type_t {
 	PROBE_TYPE_UNKNOWN,
 	PROBE_TYPE_BUILT_IN_TIME_MEASURE,
 	PROBE_TYPE_USER,
+	PROBE_TYPE_BUILT_IN_ARG_CAPTURE,
+	PROBE_TYPE_BUILT_IN_RET_VALUE,
+	PROBE_TYPE_BUILT_IN_STACK_CAPTURE,
 };
 
 enum install_type_t {
@@ -37,48 +44,164 @@ enum install_type_t {
 	INSTALL_TYPE_OVERWRITE_ABS64_JUMP,
 	INSTALL_TYPE_OVERWRITE_REL32_JUMP,
 	INSTALL_TYPE_REPLACE_JUMP_ADDR,
+	INSTALL_TYPE_EXIT_ABS64_JUMP,
+	INSTALL_TYPE_EXIT_REL32_JUMP,
 };
 
+// A patched site of the target code
+struct probe_patch {
+	unsigned long addr;
+	int           length;
+	uint8_t      *side_code;
+	int           side_code_length;
+	uint8_t      *bridge; // the bridge code in the side code
+};
+
+typedef vector<probe_patch> probe_patch_list_t;
+
+// The resolved target of a probe, which is kept in the recipe cache.
+struct probe_target_info {
+	string        symbol_name;
+	unsigned long offset;
+	unsigned long symbol_size;
+	unsigned long func_offset;
+	unsigned long func_size;
+	int           overwrite_length;
+
+	// constructor
+	probe_target_info(void);
+};
+
+typedef vector<probe_target_info> probe_target_info_list_t;
+
+struct func_exit_site;
+class func_analyzer;
+struct decode_context;
+struct shared_bridge_desc;
+
+class probe;
+typedef list<probe *> probe_list_t;
+typedef probe_list_t::iterator  probe_list_itr;
+typedef vector<probe *> probe_vector_t;
+typedef probe_vector_t::iterator probe_vector_itr;
+
 class probe {
 	probe_type_t m_probe_type;
 	install_type_t m_install_type;
 	string m_target_lib_path;
 	string m_symbol_name;
+	bool m_symbol_is_pattern;
+	bool m_expanded_from_pattern;
+	probe *m_pattern_probe; // the probe that has the pattern
 	unsigned long m_offset_addr;
+	unsigned long m_symbol_size;
+	unsigned long m_func_offset; // the function that has the target
+	unsigned long m_func_size;
+	string m_build_id;
 	int m_overwrite_length;
 	bool m_overwrite_length_auto_detect;
+	string m_cache_key;
+	bool m_target_cached; // the target is given from the recipe cache
+	int m_cached_overwrite_length;
+	unsigned long m_target_addr;
+	uint8_t *m_side_code_area;
+	int m_side_code_length;
+	probe_patch_list_t m_exit_patches;
+	vector<uint8_t> m_orig_code; // overwritten code of all the patches
 
 	string            m_probe_lib_path;
 	probe_init_func_t m_probe_init;
 	probe_func_t      m_probe;
+	void             *m_probe_init_data;
 	void             *m_probe_priv_data;
+	thread_filter    *m_thread_filter;
+	thread_filter_probe_data m_thread_filter_data;
 
 	// methods
 	label_func_t get_bridge_begin_addr();
-	void change_page_permission(void *addr);
-	void change_page_permission_all(void *addr, int len);
+	int get_bridge_length(void);
+	void write_bridge(uint8_t *bridge);
+	shared_bridge_desc *get_shared_bridge_desc(uint8_t *bridge);
+	void change_page_permission(void *addr, int prot);
+	void change_page_permission_all(void *addr, int len, int prot);
 	void overwrite_jump_code(void *intrude_addr, void *jump_abs_addr,
-	                         int copy_code_size);
+	                         int copy_code_size, uint8_t *code_buf);
 	uint8_t *overwrite_jump_abs64(uint8_t *code, void *jump_abs_addr,
 	                              int copy_code_size);
-	uint8_t *overwrite_jump_rel32(uint8_t *code, void *jump_abs_addr,
+	uint8_t *overwrite_jump_rel32(uint8_t *code, void *target_addr,
+	                              void *jump_abs_addr,
 	                              int copy_code_size);
+	void write_patch(uint8_t *code, const uint8_t *new_code, int length,
+	                 bool head_last);
 	int get_minimum_overwrite_length(void);
 	int get_overwrite_code_length(void);
 	void install_core(unsigned long target_addr);
-	bool is_opecode_ret(const opecode *ope) const;
+	bool parse_overwritten_code(list<opecode *> &opecode_list,
+	                            decode_context *ctx);
+	bool prepare_exit(decode_context *ctx);
+	bool create_exit_side_code(const func_analyzer &analyzer,
+	                           const func_exit_site &site);
+	void set_bridge_parameters(uint8_t *bridge, uint8_t *post_probe_addr);
+	probe_func_t get_bridge_probe(void) const;
+	void *get_bridge_priv_data(void);
+	bool is_end_of_flow(const opecode *ope) const;
+	bool can_relocate(const opecode *ope, int overwrite_length,
+	                  bool is_last) const;
 	int32_t get_rel_addr32_for_jump(void *curr, void *dest);
+	bool resolve_symbol(const mapped_lib_info *lib_info);
+	bool resolve_func_size(const mapped_lib_info *lib_info);
+	void resolve_func_range(const mapped_lib_info *lib_info);
+	bool check_branch_targets(decode_context *ctx);
+	probe *create_expanded_probe(const char *symbol, unsigned long offset,
+	                             unsigned long size);
 
 public:
 	probe(probe_type_t probe_type, install_type_t install_type);
 	void set_target_address(const char *target_lib_path, unsigned long addr,
 	                        int overwrite_length = 0);
+	void set_target_symbol(const char *target_lib_path, const char *symbol,
+	                       int overwrite_length = 0);
+	void set_target_pattern(const char *target_lib_path,
+	                        const char *pattern, int overwrite_length = 0);
 	void set_probe(const char *probe_lib_path, probe_func_t probe,
-	               probe_init_func_t probe_init = NULL);
+	               probe_init_func_t probe_init = NULL,
+	               void *probe_init_data = NULL);
+	void set_thread_filter(thread_filter *filter);
 
 	const char *get_target_lib_path(void);
+	probe_type_t get_probe_type(void) const;
+	install_type_t get_install_type(void) const;
+	bool is_target_pattern(void) const;
+	probe *get_pattern_probe(void) const;
+	const string &get_cache_key(void);
+	void get_target_info(probe_target_info *info) const;
+	void set_target_info(const probe_target_info &info);
 	void install(const mapped_lib_info *lib_info);
 	void install(void *mapped_addr = NULL);
+
+	// The following methods are the steps of install() in order.
+	// They are called separately by probe_installer to prepare
+	// many probes in parallel.
+	void expand_pattern(const mapped_lib_info *lib_info,
+	                    probe_list_t &expanded_list);
+	void expand_cached(const mapped_lib_info *lib_info,
+	                   const probe_target_info_list_t &target_list,
+	                   probe_list_t &expanded_list);
+	bool set_target_addr(const mapped_lib_info *lib_info);
+	bool prepare(decode_context *ctx = NULL);
+	void init(void);
+	void commit(bool page_writable = false);
+	static void write_text(uint8_t *addr, const uint8_t *data, size_t len);
+	unsigned long get_target_addr(void) const;
+	bool is_exit_probe(void) const;
+	void get_patch_areas(probe_patch_list_t &patch_list) const;
+	void release_side_code(void);
+	void restore_code(void);
+
+	// Check if the code of a function can be overwritten without
+	// installing the probe. The code may be in an ELF file image.
+	bool dry_run(const char *symbol, uint8_t *code, unsigned long size,
+	             decode_context *ctx);
 };
 
 #endif
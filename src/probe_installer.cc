@@ -0,0 +1,289 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <set>
+using namespace std;
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "utils.h"
+#include "probe_installer.h"
+#include "side_code_area_manager.h"
+
+// Threads are not worth creating for a few probes.
+static const size_t MIN_PROBES_PER_THREAD = 64;
+static const size_t MAX_INSTALL_THREADS = 16;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+void *probe_installer::prepare_worker(void *arg)
+{
+	probe_installer *obj = static_cast<probe_installer *>(arg);
+	opecode_arena arena;
+	decode_context ctx = {&arena, obj->m_decode_cache};
+	while (true) {
+		size_t idx = __sync_fetch_and_add(&obj->m_next_idx, 1);
+		if (idx >= obj->m_probes.size())
+			break;
+		obj->m_prepared[idx] = obj->m_probes[idx]->prepare(&ctx);
+	}
+	return NULL;
+}
+
+size_t probe_installer::get_num_threads(void) const
+{
+	size_t num_threads = 0;
+	const char *env = getenv("COCKROACH_INSTALL_THREADS");
+	if (!m_use_threads)
+		return 1;
+	if (env)
+		num_threads = atoi(env);
+	else {
+		long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = num_cpus > 0 ? num_cpus : 1;
+		if (num_threads > MAX_INSTALL_THREADS)
+			num_threads = MAX_INSTALL_THREADS;
+	}
+	size_t max_threads = m_probes.size() / MIN_PROBES_PER_THREAD;
+	if (num_threads > max_threads)
+		num_threads = max_threads;
+	return num_threads;
+}
+
+void probe_installer::prepare_all(void)
+{
+	m_next_idx = 0;
+	m_prepared.assign(m_probes.size(), false);
+	for (size_t i = 0; i < m_probes.size(); i++)
+		m_probe_index_map[m_probes[i]] = i;
+	m_decode_cache = new decode_cache();
+
+	// The calling thread also works. So no thread is created when
+	// num_threads is one or less.
+	vector<pthread_t> threads;
+	size_t num_threads = get_num_threads();
+	for (size_t i = 1; i < num_threads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, prepare_worker, this) != 0) {
+			ROACH_ERR("Failed to create a thread: %d\n", errno);
+			break;
+		}
+		threads.push_back(thread);
+	}
+	prepare_worker(this);
+	for (size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+	ROACH_DBG("prepared: %zd probes with %zd threads "
+	          "(decode cache: %zd hits, %zd misses)\n",
+	          m_probes.size(), threads.size() + 1,
+	          m_decode_cache->get_num_hits(),
+	          m_decode_cache->get_num_misses());
+	delete m_decode_cache;
+	m_decode_cache = NULL;
+}
+
+void probe_installer::make_pages_writable(void)
+{
+	unsigned long page_size = utils::get_page_size();
+	unsigned long mask = ~(page_size - 1);
+	page_range_list_t range_list;
+	for (size_t i = 0; i < m_probes.size(); i++) {
+		if (!m_prepared[i])
+			continue;
+		probe_patch_list_t patch_list;
+		m_probes[i]->get_patch_areas(patch_list);
+		for (size_t j = 0; j < patch_list.size(); j++) {
+			unsigned long addr = patch_list[j].addr;
+			int len = patch_list[j].length;
+			unsigned long begin = addr & mask;
+			unsigned long end =
+			  ((addr + len - 1) & mask) + page_size;
+			range_list.push_back(page_range_t(begin, end));
+		}
+	}
+	m_page_ranges.clear();
+
+	// The pages are kept as they are in W^X mode, because the code is
+	// written through /proc/self/mem. See probe::write_text().
+	if (range_list.empty() || side_code_area_manager::is_wx_enabled())
+		return;
+
+	// merge overlapped or adjoining ranges
+	sort(range_list.begin(), range_list.end());
+	page_range_list_t &merged_list = m_page_ranges;
+	merged_list.push_back(range_list[0]);
+	for (size_t i = 1; i < range_list.size(); i++) {
+		page_range_t &last = merged_list.back();
+		if (range_list[i].first <= last.second) {
+			if (range_list[i].second > last.second)
+				last.second = range_list[i].second;
+		} else
+			merged_list.push_back(range_list[i]);
+	}
+
+	change_page_permission(PROT_READ | PROT_WRITE | PROT_EXEC);
+}
+
+void probe_installer::change_page_permission(int prot)
+{
+	for (size_t i = 0; i < m_page_ranges.size(); i++) {
+		void *addr = (void *)m_page_ranges[i].first;
+		size_t len = m_page_ranges[i].second - m_page_ranges[i].first;
+		if (mprotect(addr, len, prot) == -1) {
+			ROACH_ERR("Failed to mprotect: %p, %zd, %x (%d)\n",
+			          addr, len, prot, errno);
+			ROACH_ABORT();
+		}
+	}
+}
+
+void probe_installer::commit_all(void)
+{
+	// Probe initializers are called here one by one, because they are
+	// not always thread-safe.
+	make_pages_writable();
+	for (size_t i = 0; i < m_probes.size(); i++) {
+		if (!m_prepared[i])
+			continue;
+		m_probes[i]->init();
+		m_probes[i]->commit(true);
+	}
+}
+
+bool probe_installer::get_prepared_target(probe *aprobe,
+                                          probe_target_info *info)
+{
+	map<probe *, size_t>::iterator it = m_probe_index_map.find(aprobe);
+	if (it == m_probe_index_map.end() || !m_prepared[it->second])
+		return false;
+	aprobe->get_target_info(info);
+	return true;
+}
+
+void probe_installer::store_cache(probe_list_t &probe_list,
+                                  const mapped_lib_info *lib_info,
+                                  recipe_cache_entry_map_t &entry_map)
+{
+	// The entries in the cache are updated with the probes given now.
+	// A probe that isn't prepared is not stored and it is handled
+	// without the cache next time. For a pattern, the functions that
+	// are prepared are stored.
+	probe_list_itr it = probe_list.begin();
+	for (; it != probe_list.end(); ++it) {
+		probe *aprobe = *it;
+		const string &key = aprobe->get_cache_key();
+		probe_target_info info;
+		if (!aprobe->is_target_pattern()) {
+			if (!get_prepared_target(aprobe, &info))
+				continue;
+			entry_map[key].assign(1, info);
+			continue;
+		}
+		probe_target_info_list_t &target_list = entry_map[key];
+		target_list.clear();
+		probe_list_t &expanded_list = m_expanded_map[aprobe];
+		probe_list_itr exp_it = expanded_list.begin();
+		for (; exp_it != expanded_list.end(); ++exp_it) {
+			if (get_prepared_target(*exp_it, &info))
+				target_list.push_back(info);
+		}
+	}
+	recipe_cache::store(lib_info->get_build_id(), entry_map);
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+probe_installer::probe_installer(bool use_threads)
+: m_next_idx(0),
+  m_decode_cache(NULL),
+  m_use_threads(use_threads)
+{
+}
+
+void probe_installer::add(probe *aprobe, const mapped_lib_info *lib_info)
+{
+	if (!aprobe->set_target_addr(lib_info))
+		return;
+	// An entry probe and exit probes can be installed in the same
+	// function, because they patch the different places.
+	unsigned long target_addr = aprobe->get_target_addr();
+	target_key_t key(target_addr, aprobe->is_exit_probe());
+	if (!m_target_key_set.insert(key).second) {
+		ROACH_ERR("Already installed a probe at %lx. Skipped.\n",
+		          target_addr);
+		return;
+	}
+	m_probes.push_back(aprobe);
+}
+
+void probe_installer::install(probe_list_t &probe_list,
+                              const mapped_lib_info *lib_info,
+                              probe_list_t &expanded_list)
+{
+	// The cache is used only for a library with the build-id, which
+	// tells the file is the same.
+	recipe_cache_entry_map_t entry_map;
+	bool use_cache = recipe_cache::is_enabled() &&
+	                 !lib_info->get_build_id().empty();
+	if (use_cache)
+		recipe_cache::lookup(lib_info->get_build_id(), entry_map);
+	bool cache_missed = false;
+
+	// Explicitly specified probes are added first so that they win
+	// over the ones expanded from a pattern for the same function.
+	probe_list_t pattern_list;
+	probe_list_itr it = probe_list.begin();
+	for (; it != probe_list.end(); ++it) {
+		if ((*it)->is_target_pattern()) {
+			pattern_list.push_back(*it);
+			continue;
+		}
+		if (use_cache) {
+			recipe_cache_entry_map_itr entry_it =
+			  entry_map.find((*it)->get_cache_key());
+			if (entry_it != entry_map.end() &&
+			    entry_it->second.size() == 1)
+				(*it)->set_target_info(entry_it->second[0]);
+			else
+				cache_missed = true;
+		}
+		add(*it, lib_info);
+	}
+	for (it = pattern_list.begin(); it != pattern_list.end(); ++it) {
+		probe_list_t &new_list = m_expanded_map[*it];
+		recipe_cache_entry_map_itr entry_it = entry_map.end();
+		if (use_cache)
+			entry_it = entry_map.find((*it)->get_cache_key());
+		if (entry_it != entry_map.end())
+			(*it)->expand_cached(lib_info, entry_it->second,
+			                     new_list);
+		else {
+			if (use_cache)
+				cache_missed = true;
+			(*it)->expand_pattern(lib_info, new_list);
+		}
+		probe_list_itr new_it = new_list.begin();
+		for (; new_it != new_list.end(); ++new_it)
+			add(*new_it, lib_info);
+	}
+
+	prepare_all();
+	commit_all();
+	if (cache_missed)
+		store_cache(probe_list, lib_info, entry_map);
+
+	map<probe *, probe_list_t>::iterator exp_it = m_expanded_map.begin();
+	for (; exp_it != m_expanded_map.end(); ++exp_it)
+		expanded_list.splice(expanded_list.end(), exp_it->second);
+	m_probes.clear();
+	m_prepared.clear();
+	m_probe_index_map.clear();
+	m_target_key_set.clear();
+	m_page_ranges.clear();
+	m_expanded_map.clear();
+}
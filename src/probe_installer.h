@@ -0,0 +1,70 @@
+#ifndef probe_installer_h
+#define probe_installer_h
+
+#include <vector>
+#include <set>
+using namespace std;
+
+#include "probe.h"
+#include "mapped_lib_info.h"
+#include "decode_cache.h"
+#include "recipe_cache.h"
+
+// target address and if the probe is for exits
+typedef pair<unsigned long, bool> target_key_t;
+
+// [begin, end) of successive pages
+typedef pair<unsigned long, unsigned long> page_range_t;
+typedef vector<page_range_t> page_range_list_t;
+
+/**
+ * Install probes of a library in the following steps.
+ *
+ * (1) expand: Probes with a symbol pattern are expanded to the probe of
+ *             each matched function.
+ * (2) prepare: The overwritten code is disassembled and the side code is
+ *              created. This is done in parallel by worker threads,
+ *              because it is the most expensive step when thousands of
+ *              functions are the targets. Decoded instructions are
+ *              cached and shared by the threads. Each thread allocates
+ *              opecodes in its own arena, which is freed at the end.
+ *              No thread is created when use_threads is false (ex. in a
+ *              signal handler).
+ * (3) commit: Probe initializers are called and the jump codes are
+ *             written. Page permissions are changed once per range of
+ *             successive pages. In W^X mode the permissions aren't
+ *             changed and the code is written through /proc/self/mem.
+ *
+ * When the recipe cache is enabled, the targets of the probes found in it
+ * are given from it instead of the ELF file in (1). The targets of the
+ * probes prepared in (2) are stored to it when some probes aren't found.
+ */
+class probe_installer {
+	vector<probe *> m_probes;
+	vector<int>     m_prepared;
+	map<probe *, size_t> m_probe_index_map; // probe and index in m_probes
+	volatile size_t m_next_idx;
+	set<target_key_t> m_target_key_set;
+	decode_cache    *m_decode_cache;
+	page_range_list_t m_page_ranges; // made writable for the commit
+	map<probe *, probe_list_t> m_expanded_map; // pattern and expanded
+	bool            m_use_threads;
+
+	static void *prepare_worker(void *arg);
+	void add(probe *aprobe, const mapped_lib_info *lib_info);
+	size_t get_num_threads(void) const;
+	void prepare_all(void);
+	void make_pages_writable(void);
+	void change_page_permission(int prot);
+	void commit_all(void);
+	bool get_prepared_target(probe *aprobe, probe_target_info *info);
+	void store_cache(probe_list_t &probe_list,
+	                 const mapped_lib_info *lib_info,
+	                 recipe_cache_entry_map_t &entry_map);
+public:
+	probe_installer(bool use_threads = true);
+	void install(probe_list_t &probe_list, const mapped_lib_info *lib_info,
+	             probe_list_t &expanded_list);
+};
+
+#endif
@@ -0,0 +1,381 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "utils.h"
+#include "recipe_cache.h"
+
+typedef map<string, uint32_t> string_offset_map_t;
+typedef string_offset_map_t::iterator string_offset_map_itr;
+
+//
+// static member
+//
+pthread_mutex_t recipe_cache::m_mutex = PTHREAD_MUTEX_INITIALIZER;
+bool recipe_cache::m_loaded = false;
+uint8_t *recipe_cache::m_image = NULL;
+size_t recipe_cache::m_image_size = 0;
+const recipe_cache_header *recipe_cache::m_header = NULL;
+const recipe_cache_lib *recipe_cache::m_libs = NULL;
+const recipe_cache_probe *recipe_cache::m_probes = NULL;
+const recipe_cache_target *recipe_cache::m_targets = NULL;
+const char *recipe_cache::m_strtab = NULL;
+
+static uint32_t add_string(string &strtab, string_offset_map_t &offset_map,
+                           const string &str)
+{
+	string_offset_map_itr it = offset_map.find(str);
+	if (it != offset_map.end())
+		return it->second;
+	uint32_t offset = strtab.size();
+	strtab.append(str.c_str(), str.size() + 1);
+	offset_map[str] = offset;
+	return offset;
+}
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+const char *recipe_cache::get_path(void)
+{
+	static const char *path = getenv("COCKROACH_RECIPE_CACHE");
+	return path;
+}
+
+bool recipe_cache::map_file(void)
+{
+	// The file doesn't exist at the first run.
+	int fd = open(get_path(), O_RDONLY);
+	if (fd == -1) {
+		ROACH_DBG("No recipe cache: %s (%d)\n", get_path(), errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		ROACH_ERR("Failed to stat: %s (%d)\n", get_path(), errno);
+		close(fd);
+		return false;
+	}
+	if ((size_t)st.st_size < sizeof(recipe_cache_header)) {
+		ROACH_ERR("Too small recipe cache: %s\n", get_path());
+		close(fd);
+		return false;
+	}
+	void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		ROACH_ERR("Failed to mmap: %s (%d)\n", get_path(), errno);
+		return false;
+	}
+	m_image = (uint8_t *)ptr;
+	m_image_size = st.st_size;
+	return true;
+}
+
+bool recipe_cache::validate(void)
+{
+	const recipe_cache_header *header =
+	  (const recipe_cache_header *)m_image;
+	if (memcmp(header->magic, RECIPE_CACHE_MAGIC,
+	           sizeof(RECIPE_CACHE_MAGIC)) != 0 ||
+	    header->version != RECIPE_CACHE_VERSION ||
+	    header->word_size != sizeof(long))
+		return false;
+
+	uint64_t size = sizeof(recipe_cache_header);
+	uint64_t libs_offset = size;
+	size += (uint64_t)header->num_libs * sizeof(recipe_cache_lib);
+	uint64_t probes_offset = size;
+	size += (uint64_t)header->num_probes * sizeof(recipe_cache_probe);
+	uint64_t targets_offset = size;
+	size += (uint64_t)header->num_targets * sizeof(recipe_cache_target);
+	uint64_t strtab_offset = size;
+	size += header->strtab_size;
+	if (size != m_image_size || header->strtab_size == 0 ||
+	    m_image[m_image_size - 1] != '\0')
+		return false;
+	m_header = header;
+	m_libs = (const recipe_cache_lib *)(m_image + libs_offset);
+	m_probes = (const recipe_cache_probe *)(m_image + probes_offset);
+	m_targets = (const recipe_cache_target *)(m_image + targets_offset);
+	m_strtab = (const char *)(m_image + strtab_offset);
+
+	// All the indexes are in the file.
+	uint32_t strtab_size = header->strtab_size;
+	for (uint32_t i = 0; i < header->num_libs; i++) {
+		const recipe_cache_lib &lib = m_libs[i];
+		if (lib.build_id >= strtab_size ||
+		    lib.first_probe > header->num_probes ||
+		    lib.num_probes > header->num_probes - lib.first_probe)
+			return false;
+	}
+	for (uint32_t i = 0; i < header->num_probes; i++) {
+		const recipe_cache_probe &probe = m_probes[i];
+		if (probe.key >= strtab_size ||
+		    probe.first_target > header->num_targets ||
+		    probe.num_targets >
+		      header->num_targets - probe.first_target)
+			return false;
+	}
+	for (uint32_t i = 0; i < header->num_targets; i++) {
+		if (m_targets[i].symbol_name >= strtab_size)
+			return false;
+	}
+	return true;
+}
+
+void recipe_cache::load(void)
+{
+	m_loaded = true;
+	if (!map_file())
+		return;
+	if (!validate()) {
+		ROACH_INFO("Recipe cache is ignored (broken or another "
+		           "version): %s\n", get_path());
+		unload();
+		m_loaded = true;
+	}
+}
+
+void recipe_cache::unload(void)
+{
+	if (m_image)
+		munmap(m_image, m_image_size);
+	m_loaded = false;
+	m_image = NULL;
+	m_image_size = 0;
+	m_header = NULL;
+	m_libs = NULL;
+	m_probes = NULL;
+	m_targets = NULL;
+	m_strtab = NULL;
+}
+
+const char *recipe_cache::get_string(uint32_t offset)
+{
+	return m_strtab + offset;
+}
+
+const recipe_cache_lib *recipe_cache::find_lib(const string &build_id)
+{
+	if (!m_header)
+		return NULL;
+	uint32_t low = 0;
+	uint32_t high = m_header->num_libs;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		int cmp = strcmp(get_string(m_libs[mid].build_id),
+		                 build_id.c_str());
+		if (cmp == 0)
+			return &m_libs[mid];
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return NULL;
+}
+
+void recipe_cache::read_lib(const recipe_cache_lib *lib,
+                            recipe_cache_entry_map_t &entry_map)
+{
+	for (uint32_t i = 0; i < lib->num_probes; i++) {
+		const recipe_cache_probe &probe =
+		  m_probes[lib->first_probe + i];
+		probe_target_info_list_t &target_list =
+		  entry_map[get_string(probe.key)];
+		target_list.resize(probe.num_targets);
+		for (uint32_t j = 0; j < probe.num_targets; j++) {
+			const recipe_cache_target &target =
+			  m_targets[probe.first_target + j];
+			probe_target_info &info = target_list[j];
+			info.symbol_name = get_string(target.symbol_name);
+			info.offset = target.offset;
+			info.symbol_size = target.symbol_size;
+			info.func_offset = target.func_offset;
+			info.func_size = target.func_size;
+			info.overwrite_length = target.overwrite_length;
+		}
+	}
+}
+
+bool recipe_cache::write_file(recipe_cache_lib_map_t &lib_map)
+{
+	string strtab;
+	string_offset_map_t offset_map;
+	vector<recipe_cache_lib> libs;
+	vector<recipe_cache_probe> probes;
+	vector<recipe_cache_target> targets;
+	recipe_cache_lib_map_itr lib_it = lib_map.begin();
+	for (; lib_it != lib_map.end(); ++lib_it) {
+		recipe_cache_entry_map_t &entry_map = lib_it->second;
+		recipe_cache_lib lib;
+		lib.build_id = add_string(strtab, offset_map, lib_it->first);
+		lib.first_probe = probes.size();
+		lib.num_probes = entry_map.size();
+		lib.reserved = 0;
+		libs.push_back(lib);
+
+		recipe_cache_entry_map_itr entry_it = entry_map.begin();
+		for (; entry_it != entry_map.end(); ++entry_it) {
+			probe_target_info_list_t &target_list =
+			  entry_it->second;
+			recipe_cache_probe probe;
+			probe.key = add_string(strtab, offset_map,
+			                       entry_it->first);
+			probe.first_target = targets.size();
+			probe.num_targets = target_list.size();
+			probe.reserved = 0;
+			probes.push_back(probe);
+			for (size_t i = 0; i < target_list.size(); i++) {
+				probe_target_info &info = target_list[i];
+				recipe_cache_target target;
+				target.offset = info.offset;
+				target.symbol_size = info.symbol_size;
+				target.func_offset = info.func_offset;
+				target.func_size = info.func_size;
+				target.symbol_name =
+				  add_string(strtab, offset_map,
+				             info.symbol_name);
+				target.overwrite_length =
+				  info.overwrite_length;
+				targets.push_back(target);
+			}
+		}
+	}
+
+	recipe_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECIPE_CACHE_MAGIC, sizeof(RECIPE_CACHE_MAGIC));
+	header.version = RECIPE_CACHE_VERSION;
+	header.word_size = sizeof(long);
+	header.num_libs = libs.size();
+	header.num_probes = probes.size();
+	header.num_targets = targets.size();
+	header.strtab_size = strtab.size();
+
+	// The file is replaced at once so that the readers see either of
+	// the old or the new one.
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", get_path(), getpid());
+	FILE *fp = fopen(tmp_path, "w");
+	if (!fp) {
+		ROACH_ERR("Failed to open: %s (%d)\n", tmp_path, errno);
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if (ok && !libs.empty())
+		ok = fwrite(&libs[0], sizeof(recipe_cache_lib),
+		            libs.size(), fp) == libs.size();
+	if (ok && !probes.empty())
+		ok = fwrite(&probes[0], sizeof(recipe_cache_probe),
+		            probes.size(), fp) == probes.size();
+	if (ok && !targets.empty())
+		ok = fwrite(&targets[0], sizeof(recipe_cache_target),
+		            targets.size(), fp) == targets.size();
+	if (ok && !strtab.empty())
+		ok = fwrite(strtab.c_str(), strtab.size(), 1, fp) == 1;
+	if (fclose(fp) != 0)
+		ok = false;
+	if (ok && rename(tmp_path, get_path()) == -1) {
+		ROACH_ERR("Failed to rename: %s -> %s (%d)\n",
+		          tmp_path, get_path(), errno);
+		ok = false;
+	}
+	if (!ok) {
+		ROACH_ERR("Failed to write the recipe cache: %s\n", tmp_path);
+		unlink(tmp_path);
+	}
+	return ok;
+}
+
+int recipe_cache::lock_file(void)
+{
+	// The cache file itself is replaced by rename(). So a separate lock
+	// file is used to serialize the updates among processes.
+	char lock_path[PATH_MAX];
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", get_path());
+	int fd = open(lock_path, O_RDWR|O_CREAT, 0644);
+	if (fd == -1) {
+		ROACH_ERR("Failed to open: %s (%d)\n", lock_path, errno);
+		return -1;
+	}
+	while (flock(fd, LOCK_EX) == -1) {
+		if (errno == EINTR)
+			continue;
+		ROACH_ERR("Failed to lock: %s (%d)\n", lock_path, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void recipe_cache::unlock_file(int fd)
+{
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+bool recipe_cache::is_enabled(void)
+{
+	return get_path() != NULL;
+}
+
+bool recipe_cache::lookup(const string &build_id,
+                          recipe_cache_entry_map_t &entry_map)
+{
+	pthread_mutex_lock(&m_mutex);
+	if (!m_loaded)
+		load();
+	const recipe_cache_lib *lib = find_lib(build_id);
+	if (lib)
+		read_lib(lib, entry_map);
+	pthread_mutex_unlock(&m_mutex);
+	return lib != NULL;
+}
+
+void recipe_cache::store(const string &build_id,
+                         const recipe_cache_entry_map_t &entry_map)
+{
+	// The file is read again, because another process may have added
+	// libraries or probes to it. The lock is held until the new file is
+	// in place not to lose the entries added by the others in the
+	// meantime. The given entries win over those in the file.
+	pthread_mutex_lock(&m_mutex);
+	int lock_fd = lock_file();
+	if (lock_fd == -1) {
+		pthread_mutex_unlock(&m_mutex);
+		return;
+	}
+	unload();
+	load();
+	recipe_cache_lib_map_t lib_map;
+	for (uint32_t i = 0; m_header && i < m_header->num_libs; i++) {
+		const char *lib_build_id = get_string(m_libs[i].build_id);
+		read_lib(&m_libs[i], lib_map[lib_build_id]);
+	}
+	recipe_cache_entry_map_t &merged_map = lib_map[build_id];
+	recipe_cache_entry_map_citr it = entry_map.begin();
+	for (; it != entry_map.end(); ++it)
+		merged_map[it->first] = it->second;
+	if (write_file(lib_map))
+		ROACH_DBG("stored: recipe cache: %s: %zd probes\n",
+		          build_id.c_str(), merged_map.size());
+	unload();
+	unlock_file(lock_fd);
+	pthread_mutex_unlock(&m_mutex);
+}
@@ -0,0 +1,107 @@
+#ifndef recipe_cache_h
+#define recipe_cache_h
+
+#include <string>
+#include <map>
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "probe.h"
+
+#define RECIPE_CACHE_MAGIC   "ROACHRC"
+#define RECIPE_CACHE_VERSION 1
+
+// The file begins with the header and is followed by the arrays of the
+// libraries, the probes, the targets and the string table in this order.
+// The strings are given with the offsets in the string table.
+struct recipe_cache_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t word_size;   // sizeof(long) of the writer
+	uint32_t num_libs;
+	uint32_t num_probes;
+	uint32_t num_targets;
+	uint32_t strtab_size;
+};
+
+// sorted by the build-id
+struct recipe_cache_lib {
+	uint32_t build_id;
+	uint32_t first_probe;
+	uint32_t num_probes;
+	uint32_t reserved;
+};
+
+// sorted by the key in a library
+struct recipe_cache_probe {
+	uint32_t key;         // probe::get_cache_key()
+	uint32_t first_target;
+	uint32_t num_targets; // expanded functions for a pattern
+	uint32_t reserved;
+};
+
+struct recipe_cache_target {
+	uint64_t offset;
+	uint64_t symbol_size;
+	uint64_t func_offset;
+	uint64_t func_size;
+	uint32_t symbol_name;
+	int32_t  overwrite_length;
+};
+
+// the key of a probe and its targets
+typedef map<string, probe_target_info_list_t> recipe_cache_entry_map_t;
+typedef recipe_cache_entry_map_t::iterator recipe_cache_entry_map_itr;
+typedef recipe_cache_entry_map_t::const_iterator recipe_cache_entry_map_citr;
+
+// the build-id and the entries of the library
+typedef map<string, recipe_cache_entry_map_t> recipe_cache_lib_map_t;
+typedef recipe_cache_lib_map_t::iterator recipe_cache_lib_map_itr;
+
+/**
+ * The file of the resolved probe targets keyed by the build-id of the
+ * library.
+ *
+ * The symbol lookup, the pattern expansion and the branch check of the
+ * function that need the ELF file are skipped for a probe found in the
+ * file. It is enabled with COCKROACH_RECIPE_CACHE=<path>. The file is
+ * mapped and looked up with binary searches. A library whose build-id
+ * isn't in the file (or a file that is broken or written by another
+ * version) is handled as usual and the results are added to the file,
+ * which is replaced with rename() so that other processes can read it at
+ * the same time.
+ */
+class recipe_cache {
+	static pthread_mutex_t m_mutex;
+	static bool m_loaded;
+	static uint8_t *m_image;
+	static size_t m_image_size;
+	static const recipe_cache_header *m_header;
+	static const recipe_cache_lib *m_libs;
+	static const recipe_cache_probe *m_probes;
+	static const recipe_cache_target *m_targets;
+	static const char *m_strtab;
+
+	static const char *get_path(void);
+	static bool map_file(void);
+	static bool validate(void);
+	static void load(void);
+	static void unload(void);
+	static const char *get_string(uint32_t offset);
+	static const recipe_cache_lib *find_lib(const string &build_id);
+	static void read_lib(const recipe_cache_lib *lib,
+	                     recipe_cache_entry_map_t &entry_map);
+	static bool write_file(recipe_cache_lib_map_t &lib_map);
+	static int lock_file(void);
+	static void unlock_file(int fd);
+public:
+	static bool is_enabled(void);
+	static bool lookup(const string &build_id,
+	                   recipe_cache_entry_map_t &entry_map);
+	static void store(const string &build_id,
+	                  const recipe_cache_entry_map_t &entry_map);
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <cstring>
+#include "rel_jump_relocator.h"
+#include "utils.h"
+#include "side_code_area_manager.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define OPCODE_JMP_REL8  0xeb
+#define OPCODE_JMP_REL32 0xe9
+#define LEN_JMP_REL32    5
+
+#ifdef __x86_64__
+// jmp *0x0(%rip) and the destination address just after it.
+#define LEN_JMP_ABS64    14
+
+// lea -0x8(%rsp),%rsp; movl $lsb32,(%rsp); movl $msb32,0x4(%rsp)
+// LEA is used instead of SUB so that the flags are not changed.
+#define LEN_PUSH_RET_ADDR 20
+
+const int rel_jump_relocator::MAX_JUMP_LENGTH = LEN_JMP_ABS64;
+#endif // __x86_64__
+
+#ifdef __i386__
+// push $ret_addr
+#define LEN_PUSH_RET_ADDR 5
+
+const int rel_jump_relocator::MAX_JUMP_LENGTH = LEN_JMP_REL32;
+#endif // __i386__
+
+static int get_rel_size(rel_jump_t rel_type)
+{
+	if (rel_type == REL8)
+		return 1;
+	if (rel_type == REL16)
+		return 2;
+	if (rel_type == REL32)
+		return 4;
+	ROACH_BUG("Unexpected rel. jump type: %d\n", rel_type);
+	return 0;
+}
+
+static bool fits_in_rel(long rel, int rel_size)
+{
+	if (rel_size == 1)
+		return rel >= -128 && rel <= 127;
+	if (rel_size == 2)
+		return rel >= -32768 && rel <= 32767;
+	return rel >= -2147483648L && rel <= 2147483647L;
+}
+
+static void write_rel(uint8_t *addr, long rel, int rel_size)
+{
+	if (rel_size == 1)
+		*((int8_t *)addr) = rel;
+	else if (rel_size == 2)
+		*((int16_t *)addr) = rel;
+	else
+		*((int32_t *)addr) = rel;
+}
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+int rel_jump_relocator::write_cond_jump(uint8_t *addr)
+{
+	const opecode *op = get_opecode();
+	int length = opecode_relocator::relocate(addr);
+	int rel_size = get_rel_size(op->get_rel_jump_type());
+	uint8_t *writable_addr = side_code_area_manager::get_writable_addr(addr);
+	uint8_t *rel_addr = writable_addr + length - rel_size;
+	long rel = op->get_rel_jump_dest() - (unsigned long)(addr + length);
+	if (fits_in_rel(rel, rel_size)) {
+		write_rel(rel_addr, rel, rel_size);
+		return length;
+	}
+
+	// The condition is kept and only the destination is changed to
+	// a jump that reaches the original destination.
+	//   jcc   1f
+	//   jmp   2f
+	//   1: jmp dest
+	//   2:
+	write_rel(rel_addr, 2, rel_size);
+	uint8_t *jump_addr = addr + length + 2;
+	int jump_length = write_jump(jump_addr, op->get_rel_jump_dest());
+	writable_addr[length] = OPCODE_JMP_REL8;
+	writable_addr[length + 1] = jump_length;
+	return length + 2 + jump_length;
+}
+
+int rel_jump_relocator::write_call(uint8_t *addr)
+{
+	const opecode *op = get_opecode();
+	unsigned long ret_addr =
+	  (unsigned long)op->get_original_addr() + op->get_length();
+	uint8_t *writable_addr = side_code_area_manager::get_writable_addr(addr);
+#ifdef __x86_64__
+	static const uint8_t push_code[LEN_PUSH_RET_ADDR] = {
+	  0x48, 0x8d, 0x64, 0x24, 0xf8,             // lea -0x8(%rsp),%rsp
+	  0xc7, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00, // movl $lsb32,(%rsp)
+	  0xc7, 0x44, 0x24, 0x04, 0x00, 0x00, 0x00, 0x00, // movl $msb32,0x4(%rsp)
+	};
+	memcpy(writable_addr, push_code, LEN_PUSH_RET_ADDR);
+	*((uint32_t *)(writable_addr + 8)) = ret_addr & 0xffffffff;
+	*((uint32_t *)(writable_addr + 16)) = ret_addr >> 32;
+#endif // __x86_64__
+#ifdef __i386__
+	writable_addr[0] = 0x68; // push $ret_addr
+	*((uint32_t *)(writable_addr + 1)) = ret_addr;
+#endif // __i386__
+	int jump_length = write_jump(addr + LEN_PUSH_RET_ADDR,
+	                             op->get_rel_jump_dest());
+	return LEN_PUSH_RET_ADDR + jump_length;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+int rel_jump_relocator::write_jump(uint8_t *code, unsigned long dest)
+{
+	long rel = dest - (unsigned long)(code + LEN_JMP_REL32);
+	code = side_code_area_manager::get_writable_addr(code);
+#ifdef __x86_64__
+	if (!fits_in_rel(rel, 4)) {
+		//   ff 25 00 00 00 00     jmpq   *0x0(%rip)
+		//   xx xx xx xx xx xx xx xx (destination)
+		code[0] = 0xff;
+		code[1] = 0x25;
+		*((uint32_t *)(code + 2)) = 0;
+		*((uint64_t *)(code + 6)) = dest;
+		return LEN_JMP_ABS64;
+	}
+#endif // __x86_64__
+	code[0] = OPCODE_JMP_REL32;
+	*((int32_t *)(code + 1)) = rel;
+	return LEN_JMP_REL32;
+}
+
+rel_jump_relocator::rel_jump_relocator(opecode *op)
+: opecode_relocator(op)
+{
+}
+
+rel_jump_relocator::~rel_jump_relocator()
+{
+}
+
+int rel_jump_relocator::get_max_code_length(void)
+{
+	const opecode *op = get_opecode();
+	opecode_flow_t flow_type = op->get_flow_type();
+	if (flow_type == FLOW_JUMP)
+		return MAX_JUMP_LENGTH;
+	if (flow_type == FLOW_CALL)
+		return LEN_PUSH_RET_ADDR + MAX_JUMP_LENGTH;
+	return op->get_length() + 2 + MAX_JUMP_LENGTH;
+}
+
+int rel_jump_relocator::relocate(uint8_t *addr)
+{
+	const opecode *op = get_opecode();
+	opecode_flow_t flow_type = op->get_flow_type();
+	if (flow_type == FLOW_JUMP)
+		return write_jump(addr, op->get_rel_jump_dest());
+	if (flow_type == FLOW_CALL)
+		return write_call(addr);
+	return write_cond_jump(addr);
+}
+
+#endif // defined(__x86_64__) || defined(__i386__)
@@ -0,0 +1,35 @@
+#ifndef rel_jump_relocator_h
+#define rel_jump_relocator_h
+
+#include "opecode_relocator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * Relocator for jumps and calls with a relative address (Jcc, JMP, CALL,
+ * LOOPcc, JrCXZ and XBEGIN).
+ *
+ * The relocated code goes to the same destination as the original one.
+ * The rel8 form and the rel32 form out of +/-2GB are rewritten with
+ * a jump that can reach the destination.
+ *
+ * A relocated CALL pushes the return address of the original code. So
+ * the call must be the last instruction of the relocated code.
+ */
+class rel_jump_relocator : public opecode_relocator {
+	int write_cond_jump(uint8_t *addr);
+	int write_call(uint8_t *addr);
+public:
+	static const int MAX_JUMP_LENGTH;
+	static int write_jump(uint8_t *code, unsigned long dest);
+
+	rel_jump_relocator(opecode *op);
+	~rel_jump_relocator();
+
+	// virtual function
+	int get_max_code_length(void);
+	int relocate(uint8_t *addr);
+};
+
+#endif // defined(__x86_64__) || defined(__i386__)
+#endif
@@ -0,0 +1,246 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "utils.h"
+#include "ret_value_probe.h"
+#include "cockroach-ret-value.h"
+#include "call_frame_stack.h"
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW 4
+#endif // CLOCK_MONOTONIC_RAW
+
+#ifdef __x86_64__
+#define RET_VALUE_REG(arg) ((arg)->rax)
+#endif // __x86_64__
+
+#ifdef __i386__
+#define RET_VALUE_REG(arg) ((arg)->eax)
+#endif // __i386__
+
+struct ret_value_data {
+	ret_value_table *table;
+	uint32_t mode;
+	uint32_t value_bits;
+};
+
+static int g_shm_fd = 0;
+static ret_value_shm_header *g_shm_header = NULL;
+static pthread_mutex_t g_shm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void open_shm_if_needed(void)
+{
+	pthread_mutex_lock(&g_shm_mutex);
+	if (g_shm_header) {
+		pthread_mutex_unlock(&g_shm_mutex);
+		return;
+	}
+	g_shm_header = cockroach_map_ret_value_shm(&g_shm_fd);
+	if (!g_shm_header) {
+		ROACH_ERR("Failed to map shm: %d\n", errno);
+		ROACH_ABORT();
+	}
+	int fmt_ver = g_shm_header->format_version;
+	if (fmt_ver != RET_VALUE_SHM_FORMAT_VERSION) {
+		ROACH_ERR("Format version unmatched: expected: %d, "
+		          "actual: %d\n", RET_VALUE_SHM_FORMAT_VERSION, fmt_ver);
+		ROACH_ABORT();
+	}
+	pthread_mutex_unlock(&g_shm_mutex);
+}
+
+static void init_bucket(ret_value_bucket *bucket, int64_t value)
+{
+	bucket->value = value;
+	bucket->count = 0;
+	bucket->sum_ns = 0;
+	bucket->min_ns = ~(uint64_t)0;
+	bucket->max_ns = 0;
+}
+
+static ret_value_table *alloc_table(unsigned long target_addr,
+                                    const ret_value_config *config)
+{
+	open_shm_if_needed();
+
+	if (cockroach_lock_ret_value_shm(g_shm_header) == -1) {
+		ROACH_ERR("Failed: cockroach_lock_ret_value_shm: %d\n", errno);
+		ROACH_ABORT();
+	}
+	uint32_t idx = g_shm_header->num_tables;
+	if (idx < g_shm_header->max_tables)
+		g_shm_header->num_tables++;
+	if (cockroach_unlock_ret_value_shm(g_shm_header) == -1) {
+		ROACH_ERR("Failed: cockroach_unlock_ret_value_shm: %d\n", errno);
+		ROACH_ABORT();
+	}
+	if (idx >= g_shm_header->max_tables) {
+		ROACH_ERR("No free table (max: %u). The return values of %lx "
+		          "are not recorded.\n",
+		          g_shm_header->max_tables, target_addr);
+		return NULL;
+	}
+
+	ret_value_table *table =
+	  cockroach_get_ret_value_table(g_shm_header, idx);
+	memset(table, 0, sizeof(ret_value_table));
+	table->target_addr = target_addr;
+	table->pid = getpid();
+	table->mode = config->mode;
+	table->value_bits = config->value_bits;
+	if (config->mode == RET_VALUE_MODE_CLASS) {
+		for (int i = 0; i < 3; i++) {
+			init_bucket(&table->buckets[i], i - 1);
+			table->buckets[i].state = RET_VALUE_BUCKET_USED;
+		}
+	}
+	init_bucket(&table->other, 0);
+	table->other.state = RET_VALUE_BUCKET_USED;
+	return table;
+}
+
+/**
+ * Find the bucket for the value. A free bucket is claimed by CAS, so the
+ * tables can be updated by many threads (and processes) without a lock.
+ * A bucket being claimed is skipped instead of waited for, because the
+ * claimer can be dead or interrupted by a signal handler on this thread.
+ * So a value can have more than one bucket, which the tool merges.
+ */
+static ret_value_bucket *find_value_bucket(ret_value_table *table,
+                                           int64_t value)
+{
+	uint64_t hash = (uint64_t)value * 0x9e3779b97f4a7c15ULL;
+	uint32_t start = (hash >> 32) % RET_VALUE_NUM_BUCKETS;
+	for (uint32_t i = 0; i < RET_VALUE_NUM_BUCKETS; i++) {
+		ret_value_bucket *bucket =
+		  &table->buckets[(start + i) % RET_VALUE_NUM_BUCKETS];
+		uint32_t state = bucket->state;
+		if (state == RET_VALUE_BUCKET_FREE &&
+		    __sync_bool_compare_and_swap(&bucket->state,
+		                                 RET_VALUE_BUCKET_FREE,
+		                                 RET_VALUE_BUCKET_CLAIMING)) {
+			init_bucket(bucket, value);
+			__sync_synchronize();
+			bucket->state = RET_VALUE_BUCKET_USED;
+			return bucket;
+		}
+		if (bucket->state != RET_VALUE_BUCKET_USED)
+			continue;
+		__sync_synchronize();
+		if (bucket->value == value)
+			return bucket;
+	}
+	return &table->other;
+}
+
+static void update_min(uint64_t *min_ns, uint64_t dt_ns)
+{
+	uint64_t curr = *min_ns;
+	while (dt_ns < curr) {
+		uint64_t prev = __sync_val_compare_and_swap(min_ns, curr, dt_ns);
+		if (prev == curr)
+			break;
+		curr = prev;
+	}
+}
+
+static void update_max(uint64_t *max_ns, uint64_t dt_ns)
+{
+	uint64_t curr = *max_ns;
+	while (dt_ns > curr) {
+		uint64_t prev = __sync_val_compare_and_swap(max_ns, curr, dt_ns);
+		if (prev == curr)
+			break;
+		curr = prev;
+	}
+}
+
+static void record_ret_value(ret_value_data *data, unsigned long ret_value,
+                             struct timespec *t0, struct timespec *t1)
+{
+	ret_value_table *table = data->table;
+	if (!table)
+		return;
+
+	int64_t value = (long)ret_value;
+	if (data->value_bits == 32)
+		value = (int32_t)ret_value;
+
+	ret_value_bucket *bucket;
+	if (data->mode == RET_VALUE_MODE_CLASS) {
+		int idx = (value > 0) - (value < 0) + 1;
+		bucket = &table->buckets[idx];
+	} else
+		bucket = find_value_bucket(table, value);
+
+	int64_t dt_ns = (t1->tv_sec - t0->tv_sec) * 1000000000LL +
+	                (t1->tv_nsec - t0->tv_nsec);
+	if (dt_ns < 0)
+		dt_ns = 0;
+	__sync_fetch_and_add(&bucket->count, 1);
+	__sync_fetch_and_add(&bucket->sum_ns, dt_ns);
+	update_min(&bucket->min_ns, dt_ns);
+	update_max(&bucket->max_ns, dt_ns);
+}
+
+static void roach_ret_value_ret_probe(probe_arg_t *arg)
+{
+	struct timespec t1;
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &t1) == -1) {
+		ROACH_ERR("Failed: clock_gettime: %d\n", errno);
+		return;
+	}
+	struct timespec t0;
+	if (!call_frame_stack::pop_ret(arg, &t0))
+		return;
+	ret_value_data *data = static_cast<ret_value_data *>(arg->priv_data);
+	record_ret_value(data, RET_VALUE_REG(arg), &t0, &t1);
+}
+
+extern "C"
+void roach_ret_value_probe_init(probe_init_arg_t *arg)
+{
+	const ret_value_config *config =
+	  static_cast<ret_value_config *>(arg->priv_data);
+	ret_value_data *data = new ret_value_data();
+	data->table = alloc_table(arg->target_addr, config);
+	data->mode = config->mode;
+	data->value_bits = config->value_bits;
+	arg->priv_data = data;
+}
+
+extern "C"
+void roach_ret_value_probe(probe_arg_t *arg)
+{
+	if (!call_frame_stack::push(arg))
+		return;
+	cockroach_set_return_probe(roach_ret_value_ret_probe, arg);
+}
+
+extern "C"
+void roach_ret_value_entry_probe(probe_arg_t *arg)
+{
+	call_frame_stack::push(arg);
+}
+
+extern "C"
+void roach_ret_value_exit_probe(probe_arg_t *arg)
+{
+	struct timespec t1;
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &t1) == -1) {
+		ROACH_ERR("Failed: clock_gettime: %d\n", errno);
+		return;
+	}
+	struct timespec t0;
+	if (!call_frame_stack::pop(arg, &t0))
+		return;
+	ret_value_data *data = static_cast<ret_value_data *>(arg->priv_data);
+	record_ret_value(data, RET_VALUE_REG(arg), &t0, &t1);
+}
@@ -0,0 +1,24 @@
+#ifndef ret_value_probe_h
+#define ret_value_probe_h
+
+#include "cockroach-probe.h"
+
+// Given to the probe initializer as the data of the probe
+struct ret_value_config {
+	uint32_t mode;       // RET_VALUE_MODE_*
+	uint32_t value_bits; // 32 or 64
+};
+
+extern "C"
+void roach_ret_value_probe_init(probe_init_arg_t *arg);
+
+extern "C"
+void roach_ret_value_probe(probe_arg_t *arg);
+
+extern "C"
+void roach_ret_value_entry_probe(probe_arg_t *arg);
+
+extern "C"
+void roach_ret_value_exit_probe(probe_arg_t *arg);
+
+#endif
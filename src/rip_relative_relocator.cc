@@ -1,12 +1,190 @@
+
 #ifdef __x86_64__
 
 #include <cstdio>
+#include <cstring>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
 #include "rip_relative_relocator.h"
 #include "utils.h"
+#include "side_code_area_manager.h"
+
+// lea -0x80(%rsp),%rsp and lea 0x80(%rsp),%rsp
+#define LEN_SKIP_RED_ZONE    5
+#define LEN_RESTORE_RED_ZONE 8
+
+// mov data(%rip),%scratch
+#define LEN_LOAD_ADDR        7
+
+#define LEN_SCRATCH_CODE \
+(LEN_SKIP_RED_ZONE + 1 + LEN_LOAD_ADDR + 1 + LEN_RESTORE_RED_ZONE)
+
+#define OPCODE_PUSH_REG 0x50
+#define OPCODE_POP_REG  0x58
+
+static int get_modrm_reg(const uint8_t *code, const decoded_instr &instr)
+{
+	int reg = (code[instr.modrm_offset] >> 3) & 0x07;
+	if (instr.prefix & PREFIX_REX_R)
+		reg += 8;
+	return reg;
+}
+
+// Return the register in VEX.vvvv, or -1 if the instruction has no VEX.
+static int get_vex_reg(const uint8_t *code, const decoded_instr &instr)
+{
+	if (instr.vex_offset < 0)
+		return -1;
+	const uint8_t *vex = code + instr.vex_offset;
+	uint8_t byte = (vex[0] == 0xc5) ? vex[1] : vex[2];
+	return (~byte >> 3) & 0x0f;
+}
 
+// The reg field of ModR/M is a part of the opcode (/digit).
+static bool is_opcode_extension(const decoded_instr &instr)
+{
+	if (instr.map != OPCODE_MAP_1BYTE || instr.vex_offset >= 0)
+		return false;
+	uint8_t opcode = instr.opcode;
+	return (opcode >= 0x80 && opcode <= 0x83) || opcode == 0x8f ||
+	       opcode == 0xc0 || opcode == 0xc1 ||
+	       opcode == 0xc6 || opcode == 0xc7 ||
+	       (opcode >= 0xd0 && opcode <= 0xd3) ||
+	       opcode == 0xf6 || opcode == 0xf7 ||
+	       opcode == 0xfe || opcode == 0xff;
+}
+
+// VEX.vvvv and the reg field are general purpose registers (BMI1/2).
+static bool has_vex_gpr_operands(const decoded_instr &instr)
+{
+	if (instr.vex_offset < 0)
+		return false;
+	if (instr.map == OPCODE_MAP_0F38)
+		return instr.opcode >= 0xf0 && instr.opcode <= 0xf7;
+	if (instr.map == OPCODE_MAP_0F3A)
+		return instr.opcode == 0xf0;
+	return false;
+}
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+int rip_relative_relocator::choose_scratch_register(const decoded_instr &instr)
+{
+	// RBX, RSI and RDI are not implicitly used by the instructions
+	// with a memory operand except CMPXCHG8B/16B (0f c7 /1) for RBX.
+	static const int candidates[] = {REG_BX, REG_SI, REG_DI};
+	static const int num_candidates =
+	  sizeof(candidates) / sizeof(candidates[0]);
+	const uint8_t *code = get_opecode()->get_original_addr();
+	int reg = get_modrm_reg(code, instr);
+	int vex_reg = get_vex_reg(code, instr);
+	bool cmpxchg8b = (instr.map == OPCODE_MAP_0F && instr.opcode == 0xc7);
+	for (int i = 0; i < num_candidates; i++) {
+		int candidate = candidates[i];
+		if (candidate == reg || candidate == vex_reg)
+			continue;
+		if (candidate == REG_BX && cmpxchg8b)
+			continue;
+		return candidate;
+	}
+	return -1;
+}
+
+bool rip_relative_relocator::can_use_scratch_register(
+  const decoded_instr &instr)
+{
+	const opecode *op = get_opecode();
+	if (op->get_flow_type() != FLOW_NEXT)
+		return false;
+
+	// The scratch register can't be used as a 64bit address with 0x67.
+	if (instr.prefix & PREFIX_ADDRESS_SIZE)
+		return false;
+
+	// The stack pointer is moved while the instruction is executed.
+	const uint8_t *code = op->get_original_addr();
+	int reg = get_modrm_reg(code, instr);
+	if (instr.map == OPCODE_MAP_1BYTE && instr.vex_offset < 0) {
+		// pop m64, push m64
+		if (instr.opcode == 0x8f)
+			return false;
+		if (instr.opcode == 0xff && reg == 6)
+			return false;
+	}
+	if (reg == REG_SP) {
+		if (instr.vex_offset < 0 && !is_opcode_extension(instr))
+			return false;
+		if (has_vex_gpr_operands(instr))
+			return false;
+	}
+	if (has_vex_gpr_operands(instr) && get_vex_reg(code, instr) == REG_SP)
+		return false;
+
+	return choose_scratch_register(instr) >= 0;
+}
+
+int rip_relative_relocator::relocate_with_scratch_register(
+  uint8_t *addr, const decoded_instr &instr)
+{
+	const opecode *op = get_opecode();
+	uint8_t *orig_addr = op->get_original_addr();
+	int scratch = choose_scratch_register(instr);
+
+	// The absolute address of the operand is put in the data area.
+	uint8_t *data = get_data_addr();
+	*((uint64_t *)side_code_area_manager::get_writable_addr(data)) =
+	  (uint64_t)orig_addr + instr.length + (int32_t)op->get_disp().value;
+
+	// The code is written through the writable view and the relative
+	// address is calculated with the executed address.
+	long write_offset =
+	  side_code_area_manager::get_writable_addr(addr) - addr;
+	uint8_t *ptr = addr + write_offset;
+	static const uint8_t skip_red_zone[LEN_SKIP_RED_ZONE] = {
+	  0x48, 0x8d, 0x64, 0x24, 0x80,             // lea -0x80(%rsp),%rsp
+	};
+	memcpy(ptr, skip_red_zone, LEN_SKIP_RED_ZONE);
+	ptr += LEN_SKIP_RED_ZONE;
+	*ptr++ = OPCODE_PUSH_REG + scratch;
+
+	// mov data(%rip),%scratch
+	ptr[0] = 0x48;
+	ptr[1] = 0x8b;
+	ptr[2] = (scratch << 3) | 0x05;
+	*((int32_t *)(ptr + 3)) = data - (ptr - write_offset + LEN_LOAD_ADDR);
+	ptr += LEN_LOAD_ADDR;
+
+	// The instruction without DISP32. Mod (00) is not changed and R/M
+	// is replaced with the scratch register. B of REX or VEX that
+	// extends R/M is cleared.
+	uint8_t *instr_top = ptr;
+	const uint8_t *code = op->get_code();
+	memcpy(ptr, code, instr.disp_offset);
+	ptr += instr.disp_offset;
+	int tail_offset = instr.disp_offset + instr.disp_size;
+	memcpy(ptr, code + tail_offset, instr.length - tail_offset);
+	ptr += instr.length - tail_offset;
+	uint8_t *modrm = instr_top + instr.modrm_offset;
+	*modrm = (*modrm & 0x38) | scratch;
+	if (instr.rex_offset >= 0)
+		instr_top[instr.rex_offset] &= ~0x01;
+	if (instr.vex_offset >= 0 && instr_top[instr.vex_offset] != 0xc5)
+		instr_top[instr.vex_offset + 1] |= 0x20; // inverted B
+
+	*ptr++ = OPCODE_POP_REG + scratch;
+	static const uint8_t restore_red_zone[LEN_RESTORE_RED_ZONE] = {
+	  0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00, // lea 0x80(%rsp),%rsp
+	};
+	memcpy(ptr, restore_red_zone, LEN_RESTORE_RED_ZONE);
+	ptr += LEN_RESTORE_RED_ZONE;
+	return ptr - write_offset - addr;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
 rip_relative_relocator::rip_relative_relocator(opecode *op, int offset)
 : opecode_relocator(op),
   m_disp_offset(offset)
@@ -20,28 +198,42 @@ rip_relative_relocator::~rip_relative_relocator()
 int rip_relative_relocator::relocate(uint8_t *addr)
 {
 	const opecode *op = get_opecode();
-	int64_t diff = (uint64_t)op->get_original_addr() - (uint64_t)addr; 
-	int64_t rel = op->get_disp().value + diff;
-	if (rel >  2147483647 || rel < -2147483648) {
-		ROACH_ERR("relative addr: %016x\n", rel);
-		ROACH_ABORT();
+	int64_t diff = (uint64_t)op->get_original_addr() - (uint64_t)addr;
+	int64_t rel = (int32_t)op->get_disp().value + diff;
+	if (rel > 2147483647 || rel < -2147483648) {
+		decoded_instr instr;
+		if (!disassembler::decode(op->get_original_addr(), &instr))
+			ROACH_BUG("Failed to decode: %p\n",
+			          op->get_original_addr());
+		if (!can_use_scratch_register(instr)) {
+			ROACH_ERR("Failed to relocate: %p, relative addr: "
+			          "%016" PRIx64 "\n",
+			          op->get_original_addr(), rel);
+			ROACH_ABORT();
+		}
+		return relocate_with_scratch_register(addr, instr);
 	}
 
 	// copy the original code
 	int length = opecode_relocator::relocate(addr);
 
 	// overwrite DISP
-	uint32_t *ptr = (uint32_t*)(addr + m_disp_offset);
+	uint8_t *writable_addr = side_code_area_manager::get_writable_addr(addr);
+	uint32_t *ptr = (uint32_t*)(writable_addr + m_disp_offset);
 	*ptr = rel;
 
 	return length;
 }
 
-/*
 int rip_relative_relocator::get_max_code_length(void)
 {
-	ROACH_BUG("Not implemented\n");
-	return 0;
-}*/
+	// The displacement (4B) is removed with the scratch register.
+	return get_opecode()->get_length() + LEN_SCRATCH_CODE - 4;
+}
+
+int rip_relative_relocator::get_max_data_length(void)
+{
+	return sizeof(uint64_t);
+}
 
 #endif // __x86_64__
@@ -3,19 +3,39 @@
 
 #ifdef __x86_64__
 #include "opecode_relocator.h"
+#include "disassembler.h"
 
+/**
+ * Relocator for an instruction with a RIP-relative memory operand.
+ *
+ * The displacement is adjusted when the relocated code can reach the
+ * original address with it. Otherwise (e.g. the side code for ABS64 is
+ * placed beyond +/-2GB) the operand is replaced with the indirection
+ * via a scratch register like the following.
+ *
+ *   lea  -0x80(%rsp),%rsp   (skip the red zone)
+ *   push %scratch
+ *   mov  data(%rip),%scratch  (the absolute address of the operand)
+ *   <the instruction with (%scratch) instead of disp(%rip)>
+ *   pop  %scratch
+ *   lea  0x80(%rsp),%rsp
+ */
 class rip_relative_relocator : public opecode_relocator {
 	int m_disp_offset; // offset of the DISP location from the opecode top
+
+	int choose_scratch_register(const decoded_instr &instr);
+	bool can_use_scratch_register(const decoded_instr &instr);
+	int relocate_with_scratch_register(uint8_t *addr,
+	                                   const decoded_instr &instr);
 public:
 	rip_relative_relocator(opecode *op, int offset);
 	~rip_relative_relocator();
 
 	// virtual function
 	int relocate(uint8_t *addr);
-	//int get_max_code_length(void);
+	int get_max_code_length(void);
+	int get_max_data_length(void);
 };
 
 #endif // __x86_64__
 #endif
-
-
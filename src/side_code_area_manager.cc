@@ -1,18 +1,44 @@
 #include <cstdio>
 #include <cstdlib>
-#include <fstream>
+#include <algorithm>
+#include <climits>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <errno.h>
 #include "utils.h"
 #include "side_code_area_manager.h"
+#include "address_space_map.h"
 
-static const unsigned long REGION_NOT_FOUND = 0;
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+static const unsigned long REGION_NOT_FOUND = address_space_map::NOT_FOUND;
 static const unsigned long REGION_START_ADDR = 0x10000;
 
-side_code_area::side_code_area(unsigned long _start_addr, unsigned long _length)
+// The side code for many probes is allocated in a region of this size.
+// Pages that are not used don't consume memory.
+static const size_t ARENA_SIZE = 0x1000000;
+
+// The released chunks are indexed by the size rounded down to this unit.
+static const size_t SIZE_CLASS_UNIT = 64;
+
+// A free region may be taken by the other thread between reading
+// /proc/self/maps and mmap().
+static const int MAX_MAP_RETRIES = 8;
+
+side_code_area::side_code_area(unsigned long _start_addr, unsigned long _length,
+                               long _write_offset)
 : start_addr(_start_addr),
   length(_length),
-  idx(0)
+  idx(0),
+  write_offset(_write_offset),
+  next(NULL)
 {
 }
 
@@ -31,7 +57,10 @@ bool cmp_side_code_area::operator()(const side_code_area *a,
 // static member
 //
 side_code_area *side_code_area_manager::m_curr_area = NULL;
+side_code_area *volatile side_code_area_manager::m_dual_area_list = NULL;
 pthread_mutex_t side_code_area_manager::m_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t side_code_area_manager::m_region_mutex
+  = PTHREAD_MUTEX_INITIALIZER;
 
 // ---------------------------------------------------------------------------
 // Public methods
@@ -42,87 +71,321 @@ side_code_area_set_t &side_code_area_manager::get_side_code_area_set(void)
 	return side_code_area_set;
 }
 
-uint8_t *side_code_area_manager::alloc(size_t size)
+side_code_chunk_map_t &side_code_area_manager::get_free_chunk_map(void)
 {
-	uint8_t *ret;
-	pthread_mutex_lock(&m_mutex);
-	if (m_curr_area && (m_curr_area->length - m_curr_area->idx >= size)) {
-		ret = m_curr_area->get_head_addr();
-		m_curr_area->idx += size;
-		pthread_mutex_unlock(&m_mutex);
+	static side_code_chunk_map_t free_chunk_map;
+	return free_chunk_map;
+}
+
+side_code_size_class_map_t &side_code_area_manager::get_size_class_map(void)
+{
+	static side_code_size_class_map_t size_class_map;
+	return size_class_map;
+}
+
+uint8_t *side_code_area_manager::alloc(size_t size, size_t align)
+{
+	uint8_t *ret = alloc_in_areas(size, 0, align);
+	if (ret)
 		return ret;
-	}
-	pthread_mutex_unlock(&m_mutex);
 
-	size_t region_size = utils::get_page_size();
-	return alloc_region(region_size, size);
+	// The other thread may have mapped a new region while waiting for
+	// the lock.
+	pthread_mutex_lock(&m_region_mutex);
+	ret = alloc_in_areas(size, 0, align);
+	if (!ret) {
+		ret = alloc_region(max(ARENA_SIZE, size), size);
+		if (!ret) {
+			ROACH_ERR("Failed to mmap: %d\n", errno);
+			ROACH_ABORT();
+		}
+	}
+	pthread_mutex_unlock(&m_region_mutex);
+	return ret;
 }
 
-#if defined(__x86_64__) || defined(__i386__)
-uint8_t *
-side_code_area_manager::alloc_within_rel32(size_t size, unsigned long ref_addr)
+void side_code_area_manager::release(uint8_t *addr, size_t size)
 {
-	// check if current buffer can be used
+	if (!addr || !size)
+		return;
+	unsigned long begin = reinterpret_cast<unsigned long>(addr);
+	unsigned long end = begin + size;
 	pthread_mutex_lock(&m_mutex);
-	if (m_curr_area && (m_curr_area->length - m_curr_area->idx >= size)) {
-		uint8_t *head_addr_ptr = m_curr_area->get_head_addr();
-		unsigned long head_addr =
-		  reinterpret_cast<unsigned long>(head_addr_ptr);
-		if (is_within_rel32(head_addr, ref_addr)) {
-			m_curr_area->idx += size;
-			pthread_mutex_unlock(&m_mutex);
-			return head_addr_ptr;
+	side_code_chunk_map_t &chunk_map = get_free_chunk_map();
+
+	// merge with the adjoining chunks
+	side_code_chunk_map_itr next = chunk_map.lower_bound(begin);
+	if (next != chunk_map.end() && next->first == end) {
+		end += next->second;
+		remove_free_chunk(next++);
+	}
+	if (next != chunk_map.begin()) {
+		side_code_chunk_map_itr prev = next;
+		--prev;
+		if (prev->first + prev->second == begin) {
+			begin = prev->first;
+			remove_free_chunk(prev);
 		}
 	}
+	add_free_chunk(begin, end - begin);
 	pthread_mutex_unlock(&m_mutex);
+}
+
+bool side_code_area_manager::is_wx_enabled(void)
+{
+	static bool wx_enabled = is_wx_requested();
+	return wx_enabled;
+}
+
+uint8_t *side_code_area_manager::get_writable_addr(uint8_t *addr)
+{
+	if (!is_wx_enabled())
+		return addr;
+
+	// The areas are never removed and a new one is published at the
+	// head of the list after it is filled. So no lock is taken, which
+	// also allows a call in a signal handler. The address not in the
+	// side code (e.g. a buffer of a test) is returned as it is.
+	unsigned long addr_ul = reinterpret_cast<unsigned long>(addr);
+	for (side_code_area *area = m_dual_area_list; area;
+	     area = area->next) {
+		if (addr_ul >= area->start_addr &&
+		    addr_ul < area->start_addr + area->length)
+			return addr + area->write_offset;
+	}
+	return addr;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+uint8_t *
+side_code_area_manager::alloc_within_rel32(size_t size, unsigned long ref_addr,
+                                           size_t align)
+{
+	// An arena reserved for a library is usually within +/-2GB of all
+	// the functions in it. So /proc/self/maps is read only when a new
+	// library is probed or the arena is exhausted.
+	uint8_t *ret = alloc_in_areas(size, ref_addr, align);
+	if (ret)
+		return ret;
+
+	// Two threads may find the same free region. MAP_FIXED_NOREPLACE
+	// doesn't destroy the region mapped by the other, but serializing
+	// them avoids the retry.
+	pthread_mutex_lock(&m_region_mutex);
+	ret = alloc_in_areas(size, ref_addr, align);
+	if (!ret)
+		ret = alloc_new_region_within_rel32(size, ref_addr);
+	pthread_mutex_unlock(&m_region_mutex);
+	return ret;
+}
+#endif // defined(__x86_64__) || defined(__i386__)
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+bool side_code_area_manager::is_wx_requested(void)
+{
+	const char *env = getenv("COCKROACH_SIDE_CODE_WX");
+	return env && atoi(env) != 0;
+}
 
-	// try to allocate region within +/-2G from 'addr'
-	static const char *fname = "/proc/self/maps";
-	ifstream ifs(fname);
-	if (!ifs) {
-		ROACH_ERR("Failed to open: %s", fname);
+bool side_code_area_manager::is_huge_page_requested(void)
+{
+	const char *env = getenv("COCKROACH_SIDE_CODE_HUGEPAGE");
+	return env && atoi(env) != 0;
+}
+
+uint8_t *side_code_area_manager::map_dual_views(size_t map_size,
+                                               void *request_addr,
+                                               long *write_offset)
+{
+	// The same pages of a memfd are mapped twice: the executable view
+	// and the writable one used only by cockroach.
+	int fd = syscall(SYS_memfd_create, "cockroach-side-code", MFD_CLOEXEC);
+	if (fd == -1) {
+		ROACH_ERR("Failed to create memfd: %d\n", errno);
 		ROACH_ABORT();
 	}
+	if (ftruncate(fd, map_size) == -1) {
+		ROACH_ERR("Failed to truncate memfd: %zd (%d)\n",
+		          map_size, errno);
+		ROACH_ABORT();
+	}
+	int flags = MAP_SHARED;
+	if (request_addr)
+		flags |= MAP_FIXED_NOREPLACE;
+	void *exec_ptr = mmap(request_addr, map_size, PROT_READ|PROT_EXEC,
+	                      flags, fd, 0);
+	if (exec_ptr == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	void *write_ptr = mmap(NULL, map_size, PROT_READ|PROT_WRITE,
+	                       MAP_SHARED, fd, 0);
+	close(fd);
+	if (write_ptr == MAP_FAILED) {
+		ROACH_ERR("Failed to mmap the writable view: %d\n", errno);
+		ROACH_ABORT();
+	}
+	address_space_map::add((unsigned long)write_ptr, map_size, false);
+	*write_offset = (uint8_t *)write_ptr - (uint8_t *)exec_ptr;
+	return (uint8_t *)exec_ptr;
+}
 
-	string line;
-	int page_size = utils::get_page_size();
-	unsigned long alloc_addr = REGION_NOT_FOUND;;
-	unsigned long prev_mem_region_end = REGION_START_ADDR;
-	unsigned long region_size = page_size;
-	while (getline(ifs, line)) {
-		unsigned long addr0, addr1;
-		if (!extract_address(line, addr0, addr1))
-			continue;
-		if (addr0 == prev_mem_region_end) {
-			prev_mem_region_end = addr1;
-			continue;
+uint8_t *side_code_area_manager::alloc_in_area(side_code_area *area,
+                                               size_t size,
+                                               unsigned long ref_addr,
+                                               size_t align)
+{
+	// The regions begin at a page boundary, so the padding is
+	// calculated from the index.
+	size_t padding = (align - area->idx % align) % align;
+	if (area->length - area->idx < padding + size)
+		return NULL;
+	unsigned long head_addr = area->start_addr + area->idx + padding;
+	if (ref_addr && (!is_within_rel32(head_addr, ref_addr) ||
+	                 !is_within_rel32(head_addr + size, ref_addr)))
+		return NULL;
+	area->idx += padding + size;
+	return reinterpret_cast<uint8_t *>(head_addr);
+}
+
+size_t side_code_area_manager::get_size_class(size_t size)
+{
+	return size / SIZE_CLASS_UNIT * SIZE_CLASS_UNIT;
+}
+
+void side_code_area_manager::add_free_chunk(unsigned long addr, size_t size)
+{
+	get_free_chunk_map()[addr] = size;
+	get_size_class_map()[get_size_class(size)].insert(addr);
+}
+
+void side_code_area_manager::remove_free_chunk(side_code_chunk_map_itr it)
+{
+	side_code_size_class_map_t &class_map = get_size_class_map();
+	side_code_size_class_map_itr class_it =
+	  class_map.find(get_size_class(it->second));
+	class_it->second.erase(it->first);
+	if (class_it->second.empty())
+		class_map.erase(class_it);
+	get_free_chunk_map().erase(it);
+}
+
+uint8_t *side_code_area_manager::alloc_in_free_chunks(size_t size,
+                                                      unsigned long ref_addr,
+                                                      size_t align)
+{
+	// The chunks in the classes below that of the size are too small.
+	side_code_chunk_map_t &chunk_map = get_free_chunk_map();
+	side_code_size_class_map_t &class_map = get_size_class_map();
+	side_code_size_class_map_itr class_it =
+	  class_map.lower_bound(get_size_class(size));
+	for (; class_it != class_map.end(); ++class_it) {
+		set<unsigned long>::iterator addr_it = class_it->second.begin();
+		for (; addr_it != class_it->second.end(); ++addr_it) {
+			side_code_chunk_map_itr it = chunk_map.find(*addr_it);
+			unsigned long chunk_addr = it->first;
+			size_t chunk_size = it->second;
+			size_t padding = (align - chunk_addr % align) % align;
+			if (chunk_size < padding + size)
+				continue;
+			unsigned long head_addr = chunk_addr + padding;
+			if (ref_addr &&
+			    (!is_within_rel32(head_addr, ref_addr) ||
+			     !is_within_rel32(head_addr + size, ref_addr)))
+				continue;
+
+			// The padding is left as a chunk.
+			remove_free_chunk(it);
+			if (padding)
+				add_free_chunk(chunk_addr, padding);
+			size_t rest = chunk_size - padding - size;
+			if (rest)
+				add_free_chunk(head_addr + size, rest);
+			return reinterpret_cast<uint8_t *>(head_addr);
 		}
-		alloc_addr = find_region_within_rel32(prev_mem_region_end,
-		                                      addr0, ref_addr,
-		                                      region_size);
+	}
+	return NULL;
+}
+
+uint8_t *side_code_area_manager::alloc_in_areas(size_t size,
+                                                unsigned long ref_addr,
+                                                size_t align)
+{
+	// The released chunks are reused first. Then the current area is
+	// tried, because successive probes are typically in the same
+	// library.
+	pthread_mutex_lock(&m_mutex);
+	uint8_t *ret = alloc_in_free_chunks(size, ref_addr, align);
+	if (!ret && m_curr_area)
+		ret = alloc_in_area(m_curr_area, size, ref_addr, align);
+	side_code_area_set_t &area_set = get_side_code_area_set();
+	side_code_area_set_itr it = area_set.begin();
+	for (; !ret && it != area_set.end(); ++it) {
+		if (*it == m_curr_area)
+			continue;
+		ret = alloc_in_area(*it, size, ref_addr, align);
+		if (ret)
+			m_curr_area = *it;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return ret;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+uint8_t *
+side_code_area_manager::alloc_new_region_within_rel32(size_t size,
+                                                      unsigned long ref_addr)
+{
+	// A large arena is reserved at first. When there is no such free
+	// region around the address, a region just for the size is used.
+	size_t min_region_size = get_page_boundary_ceil(size);
+	size_t region_size = max(ARENA_SIZE, min_region_size);
+	for (int i = 0; i < MAX_MAP_RETRIES; i++) {
+		unsigned long alloc_addr =
+		  find_free_region_within_rel32(ref_addr, region_size);
 		if (alloc_addr == REGION_NOT_FOUND) {
-			prev_mem_region_end = addr1;
+			if (region_size == min_region_size)
+				break;
+			region_size = max(region_size / 16, min_region_size);
 			continue;
 		}
-		break;
-	}
-	if (alloc_addr == REGION_NOT_FOUND) {
-		ROACH_ERR("Failed to find address to be allocated: %lx, %zd\n",
-		          ref_addr, size);
-		ROACH_ABORT();
+		uint8_t *new_addr = alloc_region(region_size, size,
+		                                 (void *)alloc_addr);
+		if (new_addr)
+			return new_addr;
+		// The region has been mapped by others after the map was
+		// read.
+		ROACH_DBG("Failed to mmap at %lx (%d). Retry.\n",
+		          alloc_addr, errno);
+		address_space_map::invalidate();
 	}
+	ROACH_ERR("Failed to find address to be allocated: %lx, %zd\n",
+	          ref_addr, size);
+	ROACH_ABORT();
+	return NULL;
+}
 
-	uint8_t *new_addr;
-	new_addr = alloc_region(region_size, size,
-	                        reinterpret_cast<uint8_t *>(alloc_addr));
-	return new_addr;
+unsigned long
+side_code_area_manager::find_free_region_within_rel32(unsigned long ref_addr,
+                                                      size_t region_size)
+{
+	// The whole region has to be within +/-2G from 'ref_addr'.
+	unsigned long page_size = utils::get_page_size();
+	unsigned long lower = REGION_START_ADDR;
+	if (ref_addr >= REGION_START_ADDR + 0x80000000UL)
+		lower = get_page_boundary_ceil(ref_addr - 0x80000000UL);
+	unsigned long upper = ULONG_MAX & ~(page_size - 1);
+	if (ref_addr < ULONG_MAX - 0x7fffffffUL)
+		upper = (ref_addr + 0x7fffffffUL) & ~(page_size - 1);
+	unsigned long near_addr = ref_addr & ~(page_size - 1);
+	return address_space_map::find_free_region(lower, upper, near_addr,
+	                                           region_size);
 }
-#endif // defined(__x86_64__) || defined(__i386__)
 
-// ---------------------------------------------------------------------------
-// Private methods
-// ---------------------------------------------------------------------------
-#if defined(__x86_64__) || defined(__i386__)
 bool
 side_code_area_manager::is_within_rel32(unsigned long addr,
                                         unsigned long ref_addr)
@@ -135,51 +398,8 @@ side_code_area_manager::is_within_rel32(unsigned long addr,
 		return (addr <= ref_addr + 0x7fffffffUL);
 }
 
-unsigned long
-side_code_area_manager::find_region_within_rel32(unsigned long addr0,
-                                                 unsigned long addr1,
-                                                 unsigned long ref_addr,
-                                                 size_t region_size)
-{
-	// check arguments
-	if (addr0 >= addr1)
-		ROACH_BUG("addr0: %lx >= addr1: %lx\n", addr0, addr1);
-
-	if (addr1 - addr0 < region_size)
-		return REGION_NOT_FOUND;
-
-	unsigned long mid_addr = 0;
-	if (addr1 < ref_addr) {
-		if (!is_within_rel32(addr1 - region_size, ref_addr))
-			return REGION_NOT_FOUND;
-		if (is_within_rel32(addr0, ref_addr))
-			return addr0;
-		// we allocate a relocation block at 1GB lower from
-		// the target code.
-		mid_addr = get_page_boundary_ceil(ref_addr - 0x40000000UL);
-		if (mid_addr + region_size <= addr1)
-			return mid_addr;
-	} else {
-		if (!is_within_rel32(addr0 + region_size, ref_addr))
-			return REGION_NOT_FOUND;
-		return addr0;
-	}
-
-	return REGION_NOT_FOUND;
-}
 #endif // defined(__x86_64__) || defined(__i386__)
 
-bool
-side_code_area_manager::extract_address(string &line,
-                                        unsigned long &addr0,
-                                        unsigned long &addr1)
-{
-	int num = sscanf(line.c_str(), "%lx-%lx", &addr0, &addr1);
-	if (num != 2)
-		return false;
-	return true;
-}
-
 unsigned long
 side_code_area_manager::get_page_boundary_ceil(unsigned long addr)
 {
@@ -193,24 +413,51 @@ uint8_t *side_code_area_manager::alloc_region(size_t region_size,
                                               size_t reserve_size,
                                               void *request_addr)
 {
-	int page_size = utils::get_page_size();
-	int map_size = (region_size + page_size - 1) / page_size;
-	map_size *= page_size;
-	int prot = PROT_EXEC|PROT_READ|PROT_WRITE;
-	void *ptr = mmap(request_addr, map_size, prot,
-	                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
-	// FIXME: mmap() with alloc_addr may fail if the other
-	//        thread allocates memory region we will allocate.
-	if (ptr == MAP_FAILED) {
-		ROACH_ERR("Failed to mmap: %d\n", errno);
-		ROACH_ABORT();
+	size_t map_size = get_page_boundary_ceil(region_size);
+	long write_offset = 0;
+	void *ptr;
+	if (is_wx_enabled()) {
+		ptr = map_dual_views(map_size, request_addr, &write_offset);
+		if (!ptr)
+			return NULL;
+	} else {
+		int prot = PROT_EXEC|PROT_READ|PROT_WRITE;
+		int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+		if (request_addr)
+			flags |= MAP_FIXED_NOREPLACE;
+		ptr = mmap(request_addr, map_size, prot, flags, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+	}
+
+	// The kernels older than 4.17 regard the address as a hint.
+	if (request_addr && ptr != request_addr) {
+		munmap(ptr, map_size);
+		if (write_offset)
+			munmap((uint8_t *)ptr + write_offset, map_size);
+		errno = EEXIST;
+		return NULL;
 	}
 
+	// It is only a hint. The region is used with normal pages when
+	// transparent huge pages are not available.
+	if (is_huge_page_requested() &&
+	    madvise(ptr, map_size, MADV_HUGEPAGE) == -1)
+		ROACH_DBG("Failed to madvise(MADV_HUGEPAGE): %p (%d)\n",
+		          ptr, errno);
+
 	unsigned long addr = reinterpret_cast<unsigned long>(ptr);
-	side_code_area *area = new side_code_area(addr, map_size);
+	address_space_map::add(addr, map_size);
+	side_code_area *area = new side_code_area(addr, map_size,
+	                                          write_offset);
 	pthread_mutex_lock(&m_mutex);
 	get_side_code_area_set().insert(area);
 	m_curr_area = area;
+	if (write_offset) {
+		area->next = m_dual_area_list;
+		__sync_synchronize();
+		m_dual_area_list = area;
+	}
 
 	uint8_t *ret = m_curr_area->get_head_addr();
 	m_curr_area->idx += reserve_size;
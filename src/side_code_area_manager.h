@@ -2,6 +2,7 @@
 #define side_code_area_manager_h
 
 #include <set>
+#include <map>
 using namespace std;
 
 #include <stdint.h>
@@ -11,8 +12,11 @@ struct side_code_area {
 	unsigned long start_addr;
 	unsigned long length;
 	unsigned long idx;
+	long write_offset; // from the executable view to the writable one
+	side_code_area *next; // in the list of the dual-mapped areas
 
-	side_code_area(unsigned long _start_addr, unsigned long _length);
+	side_code_area(unsigned long _start_addr, unsigned long _length,
+	               long _write_offset = 0);
 	uint8_t *get_head_addr(void);
 };
 
@@ -24,27 +28,74 @@ struct cmp_side_code_area
 typedef set<side_code_area *, cmp_side_code_area> side_code_area_set_t;
 typedef side_code_area_set_t::iterator side_code_area_set_itr;
 
+// the address and the size of a released chunk
+typedef map<unsigned long, size_t> side_code_chunk_map_t;
+typedef side_code_chunk_map_t::iterator side_code_chunk_map_itr;
+
+// the size class and the addresses of the released chunks in it
+typedef map<size_t, set<unsigned long> > side_code_size_class_map_t;
+typedef side_code_size_class_map_t::iterator side_code_size_class_map_itr;
+
+/**
+ * Allocator of the side code.
+ *
+ * When COCKROACH_SIDE_CODE_WX is 1, no page of the side code is writable
+ * and executable at once. It is a memfd mapped twice: an executable view
+ * and a writable one. The side code is written through the address
+ * returned by get_writable_addr(). It is called at every hit of a return
+ * probe, so the areas are also kept in a list that is only prepended to
+ * and is looked up without a lock.
+ *
+ * When COCKROACH_SIDE_CODE_HUGEPAGE is 1, transparent huge pages are
+ * requested for the regions to reduce iTLB misses.
+ *
+ * The side code released with release() (e.g. for the probes in an
+ * unloaded library) is reused by the following allocations. The released
+ * chunks are also indexed by the size rounded down to 64 bytes, so an
+ * allocation looks only at the chunks that can be large enough.
+ */
 class side_code_area_manager {
 	static pthread_mutex_t m_mutex;
+	static pthread_mutex_t m_region_mutex; // serializes mapping regions
 	static side_code_area_set_t &get_side_code_area_set(void);
+	static side_code_chunk_map_t &get_free_chunk_map(void);
+	static side_code_size_class_map_t &get_size_class_map(void);
 	static side_code_area *m_curr_area;
+	static side_code_area *volatile m_dual_area_list;
 
+	static bool is_wx_requested(void);
+	static uint8_t *map_dual_views(size_t map_size, void *request_addr,
+	                               long *write_offset);
+	static bool is_huge_page_requested(void);
+	static uint8_t *alloc_in_area(side_code_area *area, size_t size,
+	                              unsigned long ref_addr, size_t align);
+	static size_t get_size_class(size_t size);
+	static void add_free_chunk(unsigned long addr, size_t size);
+	static void remove_free_chunk(side_code_chunk_map_itr it);
+	static uint8_t *alloc_in_free_chunks(size_t size, unsigned long ref_addr,
+	                                     size_t align);
+	static uint8_t *alloc_in_areas(size_t size, unsigned long ref_addr = 0,
+	                               size_t align = 1);
 #if defined(__x86_64__) || defined(__i386__)
-	static bool is_within_rel32(unsigned long addr, unsigned long ref_addr);
+	static uint8_t *alloc_new_region_within_rel32(size_t size,
+	                                              unsigned long ref_addr);
 	static unsigned long
-	find_region_within_rel32(unsigned long addr0, unsigned long addr1,
-	                         unsigned long ref_addr, size_t region_size);
+	find_free_region_within_rel32(unsigned long ref_addr,
+	                              size_t region_size);
+	static bool is_within_rel32(unsigned long addr, unsigned long ref_addr);
 #endif // defined(__x86_64__) || defined(__i386__)
-	static bool extract_address(string &line,
-	                            unsigned long &addr0, unsigned long &addr1);
 	static unsigned long get_page_boundary_ceil(unsigned long addr);
 	static uint8_t *alloc_region(size_t region_size,
 	                             size_t reserve_size = 0,
 	                             void *request_addr = NULL);
 public:
-	static uint8_t *alloc(size_t size);
+	static bool is_wx_enabled(void);
+	static uint8_t *get_writable_addr(uint8_t *addr);
+	static uint8_t *alloc(size_t size, size_t align = 1);
+	static void release(uint8_t *addr, size_t size);
 #if defined(__x86_64__) || defined(__i386__)
-	static uint8_t *alloc_within_rel32(size_t size, unsigned long ref_addr);
+	static uint8_t *alloc_within_rel32(size_t size, unsigned long ref_addr,
+	                                   size_t align = 1);
 #endif // defined(__x86_64__) || defined(__i386__)
 };
 
@@ -0,0 +1,255 @@
+#include <cstring>
+using namespace std;
+
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "utils.h"
+#include "stack_capture.h"
+#include "cockroach-stack-capture.h"
+#include "data_on_shm.h"
+
+enum {
+	STACK_BOUNDS_UNKNOWN,
+	STACK_BOUNDS_RESOLVING,
+	STACK_BOUNDS_KNOWN,
+	STACK_BOUNDS_NONE,
+};
+
+struct stack_capture_data {
+	const stack_capture_config *config;
+	unsigned long target_addr;
+};
+
+struct lib_map_data {
+	stack_map_record_header header;
+	const char *path;
+};
+
+static __thread int g_stack_bounds_state = STACK_BOUNDS_UNKNOWN;
+static __thread unsigned long g_stack_low = 0;
+static __thread unsigned long g_stack_high = 0;
+
+static unsigned long get_frame_addr(probe_arg_t *arg)
+{
+#ifdef __x86_64__
+	return arg->rbp;
+#endif // __x86_64__
+#ifdef __i386__
+	return arg->ebp;
+#endif // __i386__
+}
+
+static void write_lib_map(size_t size, void *buf, void *priv)
+{
+	lib_map_data *data = static_cast<lib_map_data *>(priv);
+	memcpy(buf, &data->header, sizeof(data->header));
+	memcpy((uint8_t *)buf + sizeof(data->header), data->path,
+	       data->header.path_length);
+}
+
+//
+// static member
+//
+bool stack_capture::m_used = false;
+bool stack_capture::m_all_libs_recorded = false;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+bool stack_capture::get_stack_bounds(unsigned long *low, unsigned long *high)
+{
+	if (g_stack_bounds_state == STACK_BOUNDS_KNOWN) {
+		*low = g_stack_low;
+		*high = g_stack_high;
+		return true;
+	}
+	if (g_stack_bounds_state != STACK_BOUNDS_UNKNOWN)
+		return false;
+
+	// pthread_getattr_np() may call malloc() that can have a probe.
+	// The nested capture reads the frames without the bounds.
+	g_stack_bounds_state = STACK_BOUNDS_RESOLVING;
+	pthread_attr_t attr;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+		g_stack_bounds_state = STACK_BOUNDS_NONE;
+		return false;
+	}
+	void *stack_addr;
+	size_t stack_size;
+	int ret = pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		g_stack_bounds_state = STACK_BOUNDS_NONE;
+		return false;
+	}
+	g_stack_low = (unsigned long)stack_addr;
+	g_stack_high = g_stack_low + stack_size;
+	g_stack_bounds_state = STACK_BOUNDS_KNOWN;
+	*low = g_stack_low;
+	*high = g_stack_high;
+	return true;
+}
+
+void stack_capture::record_lib_map(const mapped_lib_info *lib_info)
+{
+	lib_map_data data;
+	data.path = lib_info->get_path();
+	data.header.addr = lib_info->get_addr();
+	data.header.text_addr = lib_info->get_text_addr();
+	data.header.text_length = lib_info->get_text_length();
+	data.header.pid = getpid();
+	data.header.path_length = strlen(data.path);
+	record_built_in_data_on_shm(COCKROACH_RECORD_ID_STACK_MAP,
+	                            sizeof(data.header) +
+	                              data.header.path_length,
+	                            write_lib_map, &data);
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+void stack_capture::set_used(void)
+{
+	m_used = true;
+}
+
+int stack_capture::walk(probe_arg_t *arg, unsigned long *addrs, int max_depth,
+                        uint16_t *flags)
+{
+	if (max_depth <= 0)
+		return 0;
+	int depth = 0;
+	addrs[depth++] = arg->func_ret_addr;
+
+	// The frames of the callers are above the return address.
+	unsigned long sp = (unsigned long)&arg->func_ret_addr;
+	unsigned long low, high;
+	bool in_stack = get_stack_bounds(&low, &high) &&
+	                sp >= low && sp < high;
+	unsigned long fp = get_frame_addr(arg);
+	while (true) {
+		if (fp <= sp || fp % sizeof(unsigned long) != 0)
+			break;
+		// the saved frame pointer and the return address
+		unsigned long frame[2];
+		if (in_stack) {
+			if (fp > high - sizeof(frame))
+				break;
+			memcpy(frame, (void *)fp, sizeof(frame));
+		} else if (utils::read_memory(fp, (uint8_t *)frame,
+		                              sizeof(frame)) != sizeof(frame)) {
+			*flags |= STACK_CAPTURE_FLAG_FAULT;
+			break;
+		}
+		if (frame[1] == 0)
+			break;
+		if (depth == max_depth) {
+			*flags |= STACK_CAPTURE_FLAG_TRUNCATED;
+			break;
+		}
+		addrs[depth++] = frame[1];
+		sp = fp;
+		fp = frame[0];
+	}
+	return depth;
+}
+
+size_t stack_capture::copy_raw(probe_arg_t *arg, uint8_t *buf, size_t size)
+{
+	unsigned long sp = (unsigned long)&arg->func_ret_addr;
+	unsigned long low, high;
+	if (!get_stack_bounds(&low, &high) || sp < low || sp >= high)
+		return utils::read_memory(sp, buf, size);
+	if (size > high - sp)
+		size = high - sp;
+	memcpy(buf, (void *)sp, size);
+	return size;
+}
+
+void stack_capture::record_lib_maps(mapped_lib_manager &lib_mgr,
+                                    const vector<const mapped_lib_info *> *libs)
+{
+	if (!m_used)
+		return;
+
+	// All the objects are recorded when the first stack capture probe
+	// is given and only the new ones after that.
+	vector<const mapped_lib_info *> all_libs;
+	if (!m_all_libs_recorded) {
+		lib_mgr.get_lib_infos(all_libs);
+		libs = &all_libs;
+		m_all_libs_recorded = true;
+	}
+	if (!libs)
+		return;
+	for (size_t i = 0; i < libs->size(); i++)
+		record_lib_map((*libs)[i]);
+}
+
+// --------------------------------------------------------------------------
+// probes
+// --------------------------------------------------------------------------
+extern "C"
+void roach_stack_capture_probe_init(probe_init_arg_t *arg)
+{
+	stack_capture_data *data = new stack_capture_data();
+	data->config = static_cast<stack_capture_config *>(arg->priv_data);
+	data->target_addr = arg->target_addr;
+	arg->priv_data = data;
+}
+
+// The bridge doesn't align the stack, while the copies of the records can be
+// done with SSE instructions.
+extern "C" __attribute__((force_align_arg_pointer))
+void roach_stack_capture_probe(probe_arg_t *arg)
+{
+	stack_capture_data *data =
+	  static_cast<stack_capture_data *>(arg->priv_data);
+	const stack_capture_config *config = data->config;
+	unsigned long addrs[STACK_CAPTURE_MAX_DEPTH];
+	stack_capture_record_header header;
+	header.flags = 0;
+	int depth = stack_capture::walk(arg, addrs, config->max_depth,
+	                                &header.flags);
+
+	// The raw stack is copied directly to the record.
+	size_t addrs_size = depth * sizeof(uint64_t);
+	size_t size = sizeof(header) + addrs_size + config->raw_size;
+	cockroach_record_handle_t handle;
+	uint8_t *ptr = (uint8_t *)
+	  reserve_built_in_records(COCKROACH_RECORD_ID_STACK_CAPTURE, size, 1,
+	                           &handle);
+	header.target_addr = data->target_addr;
+	header.stack_addr = (unsigned long)&arg->func_ret_addr;
+	header.frame_addr = get_frame_addr(arg);
+	header.pid = getpid();
+	header.tid = utils::get_tid();
+	header.depth = depth;
+	header.raw_size =
+	  stack_capture::copy_raw(arg, ptr + sizeof(header) + addrs_size,
+	                          config->raw_size);
+	memcpy(ptr, &header, sizeof(header));
+	for (int i = 0; i < depth; i++) {
+		uint64_t addr = addrs[i];
+		memcpy(ptr + sizeof(header) + i * sizeof(addr), &addr,
+		       sizeof(addr));
+	}
+	cockroach_commit_record(&handle);
+}
+
+// --------------------------------------------------------------------------
+// exported functions
+// --------------------------------------------------------------------------
+int cockroach_capture_stack(probe_arg_t *arg, unsigned long *addrs,
+                            int max_depth)
+{
+	uint16_t flags = 0;
+	return stack_capture::walk(arg, addrs, max_depth, &flags);
+}
+
+size_t cockroach_copy_stack(probe_arg_t *arg, void *buf, size_t size)
+{
+	return stack_capture::copy_raw(arg, (uint8_t *)buf, size);
+}
@@ -0,0 +1,52 @@
+#ifndef stack_capture_h
+#define stack_capture_h
+
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+
+#include "cockroach-probe.h"
+#include "mapped_lib_manager.h"
+
+// Given to the probe initializer as the data of the probe
+struct stack_capture_config {
+	uint32_t max_depth;
+	uint32_t raw_size;
+};
+
+/**
+ * Capture of the call stack at a probe.
+ *
+ * The return addresses are taken by walking the chain of the frame
+ * pointers from the probe. A frame is read directly when it is in the stack
+ * of the thread, whose range is cached in TLS. Otherwise (ex. the range is
+ * still unknown or the probe runs on an alternate signal stack) it is read
+ * with process_vm_readv(), so a broken chain doesn't cause a fault. The raw
+ * stack is copied in the same way for offline unwinding.
+ *
+ * The loaded objects are recorded as COCKROACH_RECORD_ID_STACK_MAP while
+ * the stack capture is used, so the tool can symbolize the addresses.
+ */
+class stack_capture {
+	static bool m_used;
+	static bool m_all_libs_recorded;
+
+	static bool get_stack_bounds(unsigned long *low, unsigned long *high);
+	static void record_lib_map(const mapped_lib_info *lib_info);
+public:
+	static void set_used(void);
+	static int walk(probe_arg_t *arg, unsigned long *addrs, int max_depth,
+	                uint16_t *flags);
+	static size_t copy_raw(probe_arg_t *arg, uint8_t *buf, size_t size);
+	static void record_lib_maps(mapped_lib_manager &lib_mgr,
+	                            const vector<const mapped_lib_info *> *libs);
+};
+
+extern "C"
+void roach_stack_capture_probe_init(probe_init_arg_t *arg);
+
+extern "C"
+void roach_stack_capture_probe(probe_arg_t *arg);
+
+#endif
@@ -0,0 +1,94 @@
+#include <cstdlib>
+using namespace std;
+
+#include <fnmatch.h>
+#include <cxxabi.h>
+
+#include "utils.h"
+#include "elf_reader.h"
+#include "symbol_pattern.h"
+
+static bool is_regex_pattern(const string &word)
+{
+	return word.size() >= 2 &&
+	       word[0] == '/' && word[word.size() - 1] == '/';
+}
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+bool symbol_pattern::match_core(const char *name) const
+{
+	if (m_is_regex)
+		return regexec(&m_regex, name, 0, NULL, 0) == 0;
+	return fnmatch(m_pattern.c_str(), name, 0) == 0;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+bool symbol_pattern::is_pattern(const string &word)
+{
+	if (is_regex_pattern(word))
+		return true;
+	return word.find_first_of("*?[") != string::npos;
+}
+
+symbol_pattern::symbol_pattern(const string &pattern)
+: m_is_regex(false),
+  m_use_demangled(false),
+  m_has_error(false)
+{
+	if (is_regex_pattern(pattern)) {
+		m_is_regex = true;
+		m_pattern = pattern.substr(1, pattern.size() - 2);
+	} else
+		m_pattern = pattern;
+	m_use_demangled = (m_pattern.find_first_of(":(") != string::npos);
+
+	if (!m_is_regex)
+		return;
+	int ret = regcomp(&m_regex, m_pattern.c_str(), REG_EXTENDED|REG_NOSUB);
+	if (ret != 0) {
+		char buf[256];
+		regerror(ret, &m_regex, buf, sizeof(buf));
+		ROACH_ERR("Failed to compile regex: %s: %s\n",
+		          m_pattern.c_str(), buf);
+		m_is_regex = false;
+		m_has_error = true;
+	}
+}
+
+symbol_pattern::~symbol_pattern()
+{
+	if (m_is_regex)
+		regfree(&m_regex);
+}
+
+bool symbol_pattern::has_error(void) const
+{
+	return m_has_error;
+}
+
+const char *symbol_pattern::get_pattern(void) const
+{
+	return m_pattern.c_str();
+}
+
+bool symbol_pattern::match(const char *name) const
+{
+	if (m_has_error)
+		return false;
+	if (!m_use_demangled)
+		return match_core(name);
+
+	if (name[0] != '_' || name[1] != 'Z')
+		return match_core(name);
+	int status;
+	char *demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (!demangled)
+		return false;
+	string key = elf_reader::strip_spaces(demangled);
+	free(demangled);
+	return match_core(key.c_str());
+}
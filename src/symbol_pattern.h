@@ -0,0 +1,35 @@
+#ifndef symbol_pattern_h
+#define symbol_pattern_h
+
+#include <string>
+using namespace std;
+
+#include <regex.h>
+
+/**
+ * Pattern of symbols written in a recipe instead of a single symbol.
+ *
+ * '/regex/' is a POSIX extended regular expression and a word that has
+ * '*', '?' or '[' is a glob. When the pattern contains ':' or '(', it is
+ * compared with the demangled name without spaces (ex. 'proxy::*'),
+ * otherwise with the symbol name in the file (ex. '_ZN5proxy*').
+ */
+class symbol_pattern {
+	string  m_pattern;
+	bool    m_is_regex;
+	bool    m_use_demangled;
+	bool    m_has_error;
+	regex_t m_regex;
+
+	bool match_core(const char *name) const;
+public:
+	static bool is_pattern(const string &word);
+
+	symbol_pattern(const string &pattern);
+	virtual ~symbol_pattern();
+	bool has_error(void) const;
+	const char *get_pattern(void) const;
+	bool match(const char *name) const;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "utils.h"
+#include "thread_filter.h"
+
+static const char *OPTION_THREAD_NAME = "THREAD_NAME=";
+static const char *OPTION_THREAD_ID = "THREAD_ID=";
+
+// The length of a thread name including '\0' (TASK_COMM_LEN)
+static const int THREAD_NAME_LEN = 16;
+
+enum {
+	FILTER_STATE_UNKNOWN,
+	FILTER_STATE_MATCHED,
+	FILTER_STATE_NOT_MATCHED,
+};
+
+struct thread_filter_cache {
+	uint32_t generation;
+	uint8_t  state[THREAD_FILTER_MAX];
+};
+
+static __thread thread_filter_cache g_cache;
+
+static bool has_prefix(const string &token, const char *prefix)
+{
+	return token.compare(0, strlen(prefix), prefix) == 0;
+}
+
+//
+// static member
+//
+pthread_mutex_t thread_filter::m_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// It begins from one, so the zero-cleared cache of a new thread is stale.
+volatile uint32_t thread_filter::m_generation = 1;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+thread_filter_map_t &thread_filter::get_filter_map(void)
+{
+	static thread_filter_map_t filter_map;
+	return filter_map;
+}
+
+thread_filter::thread_filter(int index)
+: m_index(index)
+{
+}
+
+bool thread_filter::add_option(const string &option)
+{
+	if (has_prefix(option, OPTION_THREAD_NAME)) {
+		string pattern = option.substr(strlen(OPTION_THREAD_NAME));
+		symbol_pattern *name_pattern = new symbol_pattern(pattern);
+		if (pattern.empty() || name_pattern->has_error()) {
+			delete name_pattern;
+			return false;
+		}
+		m_name_patterns.push_back(name_pattern);
+		return true;
+	}
+
+	vector<string> tids =
+	  utils::split(option.substr(strlen(OPTION_THREAD_ID)).c_str(), ',');
+	if (tids.empty())
+		return false;
+	for (size_t i = 0; i < tids.size(); i++) {
+		char *end;
+		long tid = strtol(tids[i].c_str(), &end, 10);
+		if (*end != '\0' || tid <= 0)
+			return false;
+		m_tids.insert(tid);
+	}
+	return true;
+}
+
+bool thread_filter::evaluate(void) const
+{
+	if (!m_tids.empty() && m_tids.count(utils::get_tid()))
+		return true;
+	if (m_name_patterns.empty())
+		return false;
+	char name[THREAD_NAME_LEN];
+	if (pthread_getname_np(pthread_self(), name, sizeof(name)) != 0)
+		return false;
+	for (size_t i = 0; i < m_name_patterns.size(); i++) {
+		if (m_name_patterns[i]->match(name))
+			return true;
+	}
+	return false;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+bool thread_filter::is_option(const string &token)
+{
+	return has_prefix(token, OPTION_THREAD_NAME) ||
+	       has_prefix(token, OPTION_THREAD_ID);
+}
+
+thread_filter *thread_filter::get(const vector<string> &options)
+{
+	string key;
+	for (size_t i = 0; i < options.size(); i++)
+		key += options[i] + " ";
+
+	pthread_mutex_lock(&m_mutex);
+	thread_filter_map_t &filter_map = get_filter_map();
+	thread_filter_map_itr it = filter_map.find(key);
+	if (it != filter_map.end()) {
+		pthread_mutex_unlock(&m_mutex);
+		return it->second;
+	}
+	if (filter_map.size() >= THREAD_FILTER_MAX) {
+		pthread_mutex_unlock(&m_mutex);
+		ROACH_ERR("Too many thread filters: %d\n", THREAD_FILTER_MAX);
+		return NULL;
+	}
+	thread_filter *filter = new thread_filter(filter_map.size());
+	for (size_t i = 0; i < options.size(); i++) {
+		if (!filter->add_option(options[i])) {
+			pthread_mutex_unlock(&m_mutex);
+			ROACH_ERR("Invalid thread filter: %s\n",
+			          options[i].c_str());
+			delete filter;
+			return NULL;
+		}
+	}
+	filter_map[key] = filter;
+	pthread_mutex_unlock(&m_mutex);
+	return filter;
+}
+
+void thread_filter::invalidate(void)
+{
+	__sync_fetch_and_add(&m_generation, 1);
+}
+
+bool thread_filter::match(void) const
+{
+	uint32_t generation = m_generation;
+	if (g_cache.generation != generation) {
+		memset(g_cache.state, FILTER_STATE_UNKNOWN,
+		       sizeof(g_cache.state));
+		g_cache.generation = generation;
+	}
+	uint8_t state = g_cache.state[m_index];
+	if (state == FILTER_STATE_UNKNOWN) {
+		state = evaluate() ? FILTER_STATE_MATCHED :
+		                     FILTER_STATE_NOT_MATCHED;
+		g_cache.state[m_index] = state;
+	}
+	return state == FILTER_STATE_MATCHED;
+}
+
+//
+// thread_filter_probe_data
+//
+thread_filter_probe_data::thread_filter_probe_data(void)
+: filter(NULL),
+  probe(NULL),
+  priv_data(NULL)
+{
+}
+
+// The stack is realigned, because the name is matched with regexec() and
+// the bridge of each probe doesn't align it.
+extern "C" __attribute__((force_align_arg_pointer))
+void roach_thread_filter_probe(probe_arg_t *arg)
+{
+	// The probe sees its own private data as usual.
+	thread_filter_probe_data *data =
+	  static_cast<thread_filter_probe_data *>(arg->priv_data);
+	if (!data->filter->match())
+		return;
+	arg->priv_data = data->priv_data;
+	(*data->probe)(arg);
+}
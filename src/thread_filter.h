@@ -0,0 +1,68 @@
+#ifndef thread_filter_h
+#define thread_filter_h
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+using namespace std;
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "cockroach-probe.h"
+#include "symbol_pattern.h"
+
+#define THREAD_FILTER_MAX 64
+
+class thread_filter;
+typedef map<string, thread_filter *> thread_filter_map_t;
+typedef thread_filter_map_t::iterator thread_filter_map_itr;
+
+// given to the bridge instead of the private data of the filtered probe
+struct thread_filter_probe_data {
+	thread_filter *filter;
+	probe_func_t   probe;
+	void          *priv_data;
+
+	// constructor
+	thread_filter_probe_data(void);
+};
+
+/**
+ * The threads in which a probe runs.
+ *
+ * It is given with THREAD_NAME=<pattern> (a glob or /regex/ compared with
+ * the name of the thread) and THREAD_ID=<tid>[,<tid>...] in a line of the
+ * recipe. A thread matches when its name matches one of the patterns or
+ * its TID is one of the given ones.
+ *
+ * The result is cached in TLS per thread and per filter, so a thread reads
+ * its name only once. The caches of all threads are cleared when a thread
+ * is renamed with pthread_setname_np(). The lines with the same options
+ * share a filter.
+ */
+class thread_filter {
+	vector<symbol_pattern *> m_name_patterns;
+	set<pid_t> m_tids;
+	int m_index; // in the cache of each thread
+
+	static pthread_mutex_t m_mutex;
+	static volatile uint32_t m_generation;
+
+	static thread_filter_map_t &get_filter_map(void);
+	thread_filter(int index);
+	bool add_option(const string &option);
+	bool evaluate(void) const;
+public:
+	static bool is_option(const string &token);
+	static thread_filter *get(const vector<string> &options);
+	static void invalidate(void);
+	bool match(void) const;
+};
+
+extern "C"
+void roach_thread_filter_probe(probe_arg_t *arg);
+
+#endif
@@ -0,0 +1,189 @@
+#include <cstring>
+using namespace std;
+
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "cockroach-probe.h"
+#include "utils.h"
+#include "thread_scratch.h"
+
+static const uint32_t CACHE_LINE_SIZE = 64;
+static const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+// at the top of each chunk of the arena
+struct arena_chunk {
+	arena_chunk *next;
+};
+
+// The header occupies the first cache line of the chunk.
+static const size_t ARENA_CHUNK_HEADER_SIZE = CACHE_LINE_SIZE;
+
+static __thread void *g_areas[THREAD_SCRATCH_MAX_SLOTS];
+static __thread arena_chunk *g_chunks = NULL;
+static __thread uint8_t *g_arena_ptr = NULL;
+static __thread uint8_t *g_arena_end = NULL;
+
+// the probe being initialized in the thread
+static __thread bool g_in_init = false;
+static __thread const void *g_init_owner;
+static __thread uint32_t g_num_init_allocs;
+
+//
+// static member
+//
+pthread_mutex_t thread_scratch::m_mutex = PTHREAD_MUTEX_INITIALIZER;
+volatile uint32_t thread_scratch::m_num_slots = 0;
+uint32_t thread_scratch::m_slot_sizes[THREAD_SCRATCH_MAX_SLOTS];
+pthread_key_t thread_scratch::m_key;
+pthread_once_t thread_scratch::m_key_once = PTHREAD_ONCE_INIT;
+scratch_slot_map_t thread_scratch::m_slot_map;
+
+// --------------------------------------------------------------------------
+// private functions
+// --------------------------------------------------------------------------
+void thread_scratch::create_key(void)
+{
+	if (pthread_key_create(&m_key, release_arena) != 0)
+		ROACH_ERR("Failed: pthread_key_create\n");
+}
+
+void thread_scratch::release_arena(void *chunks)
+{
+	// A probe called later in the exiting thread gets a new arena.
+	arena_chunk *chunk = (arena_chunk *)chunks;
+	while (chunk) {
+		arena_chunk *next = chunk->next;
+		if (munmap(chunk, ARENA_CHUNK_SIZE) == -1)
+			ROACH_ERR("Failed: munmap: %d\n", errno);
+		chunk = next;
+	}
+	memset(g_areas, 0, sizeof(g_areas));
+	g_chunks = NULL;
+	g_arena_ptr = NULL;
+	g_arena_end = NULL;
+}
+
+uint8_t *thread_scratch::alloc_chunk(void)
+{
+	void *ptr = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		ROACH_ERR("Failed to mmap: %d\n", errno);
+		return NULL;
+	}
+	arena_chunk *chunk = (arena_chunk *)ptr;
+	chunk->next = g_chunks;
+	g_chunks = chunk;
+	pthread_once(&m_key_once, create_key);
+	pthread_setspecific(m_key, g_chunks);
+	return (uint8_t *)ptr;
+}
+
+void *thread_scratch::alloc_area(uint32_t slot)
+{
+	uint32_t size = m_slot_sizes[slot];
+	if (g_arena_ptr + size > g_arena_end) {
+		// The rest of the current chunk is wasted.
+		uint8_t *chunk = alloc_chunk();
+		if (!chunk)
+			return NULL;
+		g_arena_ptr = chunk + ARENA_CHUNK_HEADER_SIZE;
+		g_arena_end = chunk + ARENA_CHUNK_SIZE;
+	}
+	void *area = g_arena_ptr;
+	g_arena_ptr += size;
+	g_areas[slot] = area;
+	return area;
+}
+
+int thread_scratch::add_slot(uint32_t size)
+{
+	// called with m_mutex held
+	uint32_t slot = m_num_slots;
+	if (slot >= THREAD_SCRATCH_MAX_SLOTS) {
+		ROACH_ERR("Too many scratch slots: %d\n",
+		          THREAD_SCRATCH_MAX_SLOTS);
+		return -1;
+	}
+	m_slot_sizes[slot] = size;
+	__sync_synchronize();
+	m_num_slots = slot + 1;
+	return slot;
+}
+
+// --------------------------------------------------------------------------
+// public functions
+// --------------------------------------------------------------------------
+void thread_scratch::begin_init(const void *owner)
+{
+	g_in_init = true;
+	g_init_owner = owner;
+	g_num_init_allocs = 0;
+}
+
+void thread_scratch::end_init(void)
+{
+	g_in_init = false;
+}
+
+int thread_scratch::alloc_slot(size_t size)
+{
+	if (size == 0 || size > THREAD_SCRATCH_MAX_SIZE) {
+		ROACH_ERR("Invalid scratch size: %zd (max: %d)\n",
+		          size, THREAD_SCRATCH_MAX_SIZE);
+		return -1;
+	}
+	// The size is rounded up so that each area has its own cache lines.
+	uint32_t rounded_size =
+	  (size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+	pthread_mutex_lock(&m_mutex);
+	if (!g_in_init) {
+		int slot = add_slot(rounded_size);
+		pthread_mutex_unlock(&m_mutex);
+		return slot;
+	}
+	scratch_slot_key_t key(g_init_owner, g_num_init_allocs++);
+	scratch_slot_map_itr it = m_slot_map.find(key);
+	if (it != m_slot_map.end()) {
+		int slot = it->second;
+		pthread_mutex_unlock(&m_mutex);
+		if (rounded_size > m_slot_sizes[slot]) {
+			ROACH_ERR("Scratch size changed: slot: %d, %zd\n",
+			          slot, size);
+			return -1;
+		}
+		return slot;
+	}
+	int slot = add_slot(rounded_size);
+	if (slot != -1)
+		m_slot_map[key] = slot;
+	pthread_mutex_unlock(&m_mutex);
+	return slot;
+}
+
+void *thread_scratch::get(int slot)
+{
+	if (slot < 0 || (uint32_t)slot >= m_num_slots) {
+		ROACH_ERR("Invalid scratch slot: %d\n", slot);
+		return NULL;
+	}
+	void *area = g_areas[slot];
+	if (area)
+		return area;
+	return alloc_area(slot);
+}
+
+// --------------------------------------------------------------------------
+// exported functions
+// --------------------------------------------------------------------------
+int cockroach_alloc_thread_scratch(size_t size)
+{
+	return thread_scratch::alloc_slot(size);
+}
+
+void *cockroach_get_thread_scratch(int slot)
+{
+	return thread_scratch::get(slot);
+}
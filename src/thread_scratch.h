@@ -0,0 +1,56 @@
+#ifndef thread_scratch_h
+#define thread_scratch_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <map>
+using namespace std;
+
+#define THREAD_SCRATCH_MAX_SLOTS 256
+#define THREAD_SCRATCH_MAX_SIZE  4096
+
+// the probe of the recipe line and the order of the allocation in its
+// initializer
+typedef pair<const void *, uint32_t> scratch_slot_key_t;
+typedef map<scratch_slot_key_t, int> scratch_slot_map_t;
+typedef scratch_slot_map_t::iterator scratch_slot_map_itr;
+
+/**
+ * Per-thread scratch areas of the user probes.
+ *
+ * A slot is allocated with the size of the area (typically in the init
+ * probe) and the area of the slot is allocated for each thread when the
+ * thread accesses it first. The areas are carved from a thread-local arena
+ * of mmap()ed chunks. They are aligned to the cache line and zero-filled,
+ * so a probe can keep counters and timestamps without locks and without
+ * false sharing. malloc() is not used, because a probe may be installed in
+ * it. The chunks are released when the thread exits.
+ *
+ * The initializer runs again for each function a pattern is expanded to
+ * and at each reinstall (ex. after dlclose() and dlopen()). So the slots
+ * allocated in it are keyed by the probe of the recipe line (the pattern
+ * probe for an expanded one) and the order of the allocation, and the
+ * same slots are returned again.
+ */
+class thread_scratch {
+	static pthread_mutex_t m_mutex;
+	static volatile uint32_t m_num_slots;
+	static uint32_t m_slot_sizes[THREAD_SCRATCH_MAX_SLOTS];
+	static pthread_key_t m_key;
+	static pthread_once_t m_key_once;
+	static scratch_slot_map_t m_slot_map;
+
+	static void create_key(void);
+	static void release_arena(void *chunks);
+	static uint8_t *alloc_chunk(void);
+	static void *alloc_area(uint32_t slot);
+	static int add_slot(uint32_t size);
+public:
+	static void begin_init(const void *owner);
+	static void end_init(void);
+	static int alloc_slot(size_t size);
+	static void *get(int slot);
+};
+
+#endif
@@ -14,6 +14,7 @@ using namespace std;
 #include "utils.h"
 #include "time_measure_probe.h"
 #include "cockroach-time-measure.h"
+#include "call_frame_stack.h"
 
 #ifndef CLOCK_MONOTONIC_RAW
 #define CLOCK_MONOTONIC_RAW 4
@@ -161,6 +162,17 @@ static double calc_diff_time(timespec *tv0, timespec *tv1)
 	return t1 - t0;
 }
 
+static void record_measured_time(time_measure_data *priv, double dt,
+                                 unsigned long func_ret_addr)
+{
+	measured_time_shm_slot *slot = get_shm_data_slot();
+	slot->dt = dt;
+	slot->target_addr = priv->target_addr;
+	slot->func_ret_addr = func_ret_addr;
+	slot->pid = priv->pid;
+	slot->tid = utils::get_tid();
+}
+
 static void roach_time_measure_ret_probe(probe_arg_t *arg)
 {
 	time_measure_data *priv =
@@ -171,12 +183,7 @@ static void roach_time_measure_ret_probe(probe_arg_t *arg)
 		return;
 	}
 	double dt = calc_diff_time(&priv->t0, &t1);
-	measured_time_shm_slot *slot = get_shm_data_slot();
-	slot->dt = dt;
-	slot->target_addr = priv->target_addr;
-	slot->func_ret_addr = priv->func_ret_addr;
-	slot->pid = priv->pid;
-	slot->tid = utils::get_tid();
+	record_measured_time(priv, dt, priv->func_ret_addr);
 }
 
 extern "C"
@@ -201,3 +208,27 @@ void roach_time_measure_probe(probe_arg_t *arg)
 	cockroach_set_return_probe(roach_time_measure_ret_probe, arg);
 }
 
+
+extern "C"
+void roach_time_measure_entry_probe(probe_arg_t *arg)
+{
+	call_frame_stack::push(arg);
+}
+
+extern "C"
+void roach_time_measure_exit_probe(probe_arg_t *arg)
+{
+	struct timespec t1;
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &t1) == -1) {
+		ROACH_ERR("Failed: clock_gettime: %d\n", errno);
+		return;
+	}
+	struct timespec t0;
+	if (!call_frame_stack::pop(arg, &t0))
+		return;
+
+	time_measure_data *priv =
+	   static_cast<time_measure_data*>(arg->priv_data);
+	double dt = calc_diff_time(&t0, &t1);
+	record_measured_time(priv, dt, arg->func_ret_addr);
+}
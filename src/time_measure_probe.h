@@ -12,4 +12,10 @@ void roach_time_measure_probe(probe_arg_t *arg);
 extern "C"
 void roach_time_mesure_ret_probe(probe_arg_t *arg);
 
+extern "C"
+void roach_time_measure_entry_probe(probe_arg_t *arg);
+
+extern "C"
+void roach_time_measure_exit_probe(probe_arg_t *arg);
+
 #endif
@@ -5,6 +5,7 @@ using namespace std;
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h> 
+#include <sys/uio.h>
 #include <syscall.h>
 #include <dlfcn.h>
 #include <errno.h>
@@ -155,3 +156,39 @@ string utils::get_self_exe_name(void)
 	}
 	return string(buf, len);
 }
+
+size_t utils::read_memory(unsigned long addr, uint8_t *buf, size_t size)
+{
+	// process_vm_readv() stops at the remote iovec that has a bad address.
+	// So the remote iovecs are split at page boundaries.
+	static const int MAX_READ_IOVECS = 16;
+	struct iovec remote_iov[MAX_READ_IOVECS];
+	unsigned long page_size = get_page_size();
+	size_t total = 0;
+	while (total < size) {
+		int num_iov = 0;
+		unsigned long top = addr + total;
+		unsigned long curr = top;
+		unsigned long end = addr + size;
+		while (curr < end && num_iov < MAX_READ_IOVECS) {
+			unsigned long next = (curr & ~(page_size - 1)) + page_size;
+			if (next > end || next < curr)
+				next = end;
+			remote_iov[num_iov].iov_base = (void *)curr;
+			remote_iov[num_iov].iov_len = next - curr;
+			num_iov++;
+			curr = next;
+		}
+		struct iovec local_iov;
+		local_iov.iov_base = buf + total;
+		local_iov.iov_len = curr - top;
+		ssize_t ret = process_vm_readv(getpid(), &local_iov, 1,
+		                               remote_iov, num_iov, 0);
+		if (ret <= 0)
+			break;
+		total += ret;
+		if ((size_t)ret != local_iov.iov_len)
+			break;
+	}
+	return total;
+}
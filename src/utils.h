@@ -6,6 +6,7 @@
 using namespace std;
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #define ROACH_ABORT() utils::abort()
 
@@ -45,6 +46,16 @@ public:
 	static void abort(void);
 	static pid_t get_tid(void);
 	static string get_self_exe_name(void);
+
+	/**
+	 * Read the memory of this process without a fault even if the
+	 * address is invalid. The page that cannot be read and the rest are
+	 * not copied.
+	 *
+	 * @return The number of bytes copied from the top.
+	 */
+	static size_t read_memory(unsigned long addr, uint8_t *buf,
+	                          size_t size);
 };
 
 #endif
@@ -39,6 +39,8 @@ def make_measure_time():
                           target_module=implicitdlopener)
     make_measure_time_one("T", "REL32", "implicit_open_target_2x",
                           target_module=implicitopentarget)
+    make_measure_time_one("T", "REL32", "implicit_dlopener_ctor_4x",
+                          target_module=implicitdlopener)
 
 def make_user_prbe_one(probe_type, install_type, func_name, user_probe_func,
                        save_instr="", user_probe_module="user_probe.so",
@@ -68,6 +70,91 @@ def make_user_probe():
     make_user_prbe_one("P", "REL32", "sum_up_to", "data_recorder",
                        user_probe_init_func="data_recorder_init")
 
+def make_user_probe_symbol_one(probe_type, install_type, func_name,
+                               user_probe_func, save_instr="",
+                               user_probe_module="user_probe.so",
+                               user_probe_init_func="",
+                               target_module="libtargets.so.0.0.0",
+                               options=[]):
+  print "# " + func_name
+  print probe_type + " " + install_type + " " + target_module + " " + \
+        func_name + " " + save_instr + " " + user_probe_module + " " + \
+        user_probe_func + " " + user_probe_init_func + " " + \
+        " ".join(options)
+
+def make_user_probe_symbol():
+    make_user_probe_symbol_one("P", "REL32", "func1", "user_probe")
+    make_user_probe_symbol_one("P", "REL32", "func1b", "user_probe", "6")
+    make_user_probe_symbol_one("P", "REL32", "sum_up_to", "data_recorder",
+                               user_probe_init_func="data_recorder_init")
+
+def make_user_probe_pattern():
+    make_user_probe_symbol_one("P", "REL32", "func1*", "user_probe")
+    make_user_probe_symbol_one("P", "REL32", "/^sum_up_.o$/", "data_recorder",
+                               user_probe_init_func="data_recorder_init")
+
+def make_user_probe_reserve():
+    make_user_probe_symbol_one("P", "REL32", "sum_up_to",
+                               "data_recorder_in_place",
+                               user_probe_init_func="data_recorder_init")
+
+def make_user_probe_reserve_batch():
+    make_user_probe_symbol_one("P", "REL32", "sum_up_to",
+                               "data_recorder_batch",
+                               user_probe_init_func="data_recorder_init")
+
+def make_user_probe_exit():
+    make_user_probe_symbol_one("P", "EXIT_REL32", "func1", "user_probe")
+    make_user_probe_symbol_one("P", "EXIT_REL32", "sum_up_to",
+                               "ret_value_recorder")
+
+def make_user_probe_thread_name():
+    make_user_probe_symbol_one("P", "REL32", "sum_up_to", "data_recorder",
+                               user_probe_init_func="data_recorder_init",
+                               options=["THREAD_NAME=nomatch-*",
+                                        "THREAD_NAME=/^target-exe$/"])
+
+def make_user_probe_thread_name_nomatch():
+    make_user_probe_symbol_one("P", "REL32", "sum_up_to", "data_recorder",
+                               user_probe_init_func="data_recorder_init",
+                               options=["THREAD_NAME=nomatch-*"])
+
+def make_user_probe_abs64():
+    make_user_probe_symbol_one("P", "ABS64", "sum_up_to", "data_recorder",
+                               user_probe_init_func="data_recorder_init")
+
+def make_arg_capture_one(install_type, func_name, specs,
+                         target_module="libtargets.so.0.0.0"):
+  print "# " + func_name
+  print "A " + install_type + " " + target_module + " " + func_name + " " + \
+        " ".join(specs)
+
+def make_arg_capture():
+    make_arg_capture_one("REL32", "sum_up_to", ["i:1"])
+    make_arg_capture_one("REL32", "sum_pair", ["s:1:16", "s:1:3", "m:2:4:4"])
+
+def make_arg_capture_fault():
+    make_arg_capture_one("REL32", "sum_up_to", ["m:1:0:8"])
+
+def make_ret_value_one(install_type, func_name, mode,
+                       target_module="libtargets.so.0.0.0"):
+  print "# " + func_name
+  print "R " + install_type + " " + target_module + " " + func_name + " " + \
+        mode
+
+def make_ret_value():
+    make_ret_value_one("REL32", "sum_up_to", "VALUE32")
+    make_ret_value_one("EXIT_REL32", "func1", "CLASS32")
+
+def make_stack_capture_one(install_type, func_name, options,
+                           target_module="libtargets.so.0.0.0"):
+  print "# " + func_name
+  print "S " + install_type + " " + target_module + " " + func_name + " " + \
+        " ".join(options)
+
+def make_stack_capture():
+    make_stack_capture_one("REL32", "sum_up_to", ["DEPTH=8", "RAW=64"])
+
 def make_measure_time_target_exe():
   global target_program
   print "TARGET_EXE " + target_program
@@ -94,6 +181,18 @@ def make_measure_time_no_target_exe_abs():
 
 command_map = {
   "measure-time":make_measure_time, "user-probe":make_user_probe,
+  "user-probe-symbol":make_user_probe_symbol,
+  "user-probe-pattern":make_user_probe_pattern,
+  "user-probe-exit":make_user_probe_exit,
+  "user-probe-reserve":make_user_probe_reserve,
+  "user-probe-reserve-batch":make_user_probe_reserve_batch,
+  "user-probe-thread-name":make_user_probe_thread_name,
+  "user-probe-thread-name-nomatch":make_user_probe_thread_name_nomatch,
+  "user-probe-abs64":make_user_probe_abs64,
+  "arg-capture":make_arg_capture,
+  "arg-capture-fault":make_arg_capture_fault,
+  "ret-value":make_ret_value,
+  "stack-capture":make_stack_capture,
   "measure-time-target-exe":make_measure_time_target_exe,
   "measure-time-no-target-exe":make_measure_time_no_target_exe,
   "measure-time-target-exe-abs":make_measure_time_target_exe_abs,
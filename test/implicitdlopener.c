@@ -22,3 +22,28 @@ int implicit_dlopener_3x(int a)
 	return 3 * a;
 }
 #endif // __i386__
+
+#ifdef __x86_64__
+int implicit_dlopener_ctor_4x(int a)
+{
+	asm volatile("push %rax");
+	asm volatile("pop %rax");
+	return 4 * a;
+}
+#endif // __x86_64__
+
+#ifdef __i386__
+int implicit_dlopener_ctor_4x(int a)
+{
+	asm volatile("push %eax");
+	asm volatile("pop %eax");
+	return 4 * a;
+}
+#endif // __i386__
+
+// A probe for the function called here is installed before this runs.
+__attribute__((constructor))
+static void implicit_dlopener_ctor(void)
+{
+	implicit_dlopener_ctor_4x(1);
+}
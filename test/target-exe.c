@@ -34,6 +34,47 @@ int cmd_sum(int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
+int cmd_sum_pair(int argc, char *argv[])
+{
+	if (argc < 5) {
+		fprintf(stderr,
+		        "[%s] Number of arg.(%d) must be greater than 5.\n",
+		        __func__, argc);
+		return EXIT_FAILURE;
+	}
+	struct target_pair pair;
+	pair.a = atoi(argv[3]);
+	pair.b = atoi(argv[4]);
+	printf("%d", sum_pair(argv[2], &pair));
+	return EXIT_SUCCESS;
+}
+
+int cmd_sum_reload(int argc, char *argv[], int expect_ok)
+{
+	// sum_up_to() is called before and after the recipe is reloaded.
+	if (argc < 4) {
+		fprintf(stderr,
+		        "[%s] Number of arg.(%d) must be greater than 4.\n",
+		        __func__, argc);
+		return EXIT_FAILURE;
+	}
+	int num = atoi(argv[2]);
+	printf("%d", sum_up_to(num));
+	fflush(stdout);
+
+	char cmd[1024];
+	snprintf(cmd, sizeof(cmd),
+	         "../src/cockroach-control-tool reload %d %s >&2",
+	         getpid(), argv[3]);
+	unsetenv("LD_PRELOAD");
+	if ((system(cmd) == 0) != expect_ok) {
+		fprintf(stderr, "Unexpected result of reload: %s\n", cmd);
+		return EXIT_FAILURE;
+	}
+	printf("%d", sum_up_to(num));
+	return EXIT_SUCCESS;
+}
+
 int cmd_dlopen_local(int num)
 {
 	const char *targetlib = "libimplicitdlopener.so";
@@ -56,6 +97,27 @@ int cmd_dlopen_local(int num)
 	return EXIT_SUCCESS;
 }
 
+int cmd_dlopen_reopen(int num)
+{
+	// The library is unloaded and loaded again.
+	int i;
+	for (i = 0; i < 2; i++) {
+		void *handle = dlopen("libimplicitdlopener.so", RTLD_LAZY);
+		if (!handle) {
+			fprintf(stderr, "failed to dlopen: %s\n", dlerror());
+			return EXIT_FAILURE;
+		}
+		int (*func)(int a) = dlsym(handle, "implicit_dlopener_3x");
+		if (!func) {
+			fprintf(stderr, "failed to dlsym: %s\n", dlerror());
+			return EXIT_FAILURE;
+		}
+		printf("%d", (*func)(num));
+		dlclose(handle);
+	}
+	return EXIT_SUCCESS;
+}
+
 int cmd_dlopen_extlib(int num)
 {
 	const char *targetlib = "libimplicitdlopener.so";
@@ -146,8 +208,16 @@ int main(int argc, char *argv[])
 	}
 	else if (strcmp(first_arg, "sum") == 0)
 		ret = cmd_sum(argc, argv);
+	else if (strcmp(first_arg, "sum_pair") == 0)
+		ret = cmd_sum_pair(argc, argv);
+	else if (strcmp(first_arg, "sum_reload") == 0)
+		ret = cmd_sum_reload(argc, argv, 1);
+	else if (strcmp(first_arg, "sum_reload_rejected") == 0)
+		ret = cmd_sum_reload(argc, argv, 0);
 	else if (strcmp(first_arg, "implicit_dlopener_3x") == 0)
 		ret = cmd_dlopen_local(2);
+	else if (strcmp(first_arg, "implicit_dlopener_3x_reopen") == 0)
+		ret = cmd_dlopen_reopen(2);
 	else if (strcmp(first_arg, "implicit_open_target_2x") == 0)
 		ret = cmd_dlopen_extlib(2);
 	else if (strcmp(first_arg, "sleep") == 0)
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "targets.h"
 
 int sum_up_to(int num)
 {
@@ -32,3 +33,9 @@ int func2(int a, int b)
 	return (a + b) * (a + a) * a / b;
 }
 
+
+// test for argument capture probe
+int sum_pair(const char *label, const struct target_pair *pair)
+{
+	return pair->a + pair->b;
+}
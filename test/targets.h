@@ -7,4 +7,10 @@ int func1a(int a, int b);
 int func1b(int a, int b);
 int func2(int a, int b);
 
+struct target_pair {
+	int a;
+	int b;
+};
+int sum_pair(const char *label, const struct target_pair *pair);
+
 #endif
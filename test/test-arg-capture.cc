@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <cppcutter.h>
+#include <glib.h>
+
+#include "testutil.h"
+#include "cockroach-probe.h"
+#include "cockroach-arg-capture.h"
+
+namespace test_arg_capture {
+
+static const char *default_recipe_file = "fixtures/test-arg-capture.recipe";
+static const char *recipe_file = NULL;
+
+struct captured_item {
+	arg_capture_item_header header;
+	string data;
+};
+
+void setup(void)
+{
+	recipe_file = default_recipe_file;
+	testutil::reset_record_data();
+}
+
+void teardown(void)
+{
+}
+
+static void
+get_captured_items(record_data_tool_output &tool_out,
+                   vector<captured_item> &items)
+{
+	cppcut_assert_equal((uint32_t)COCKROACH_RECORD_ID_ARG_CAPTURE,
+	                    tool_out.id);
+	arg_capture_record_header header;
+	cppcut_assert_equal(true, tool_out.size >= sizeof(header));
+	memcpy(&header, tool_out.data, sizeof(header));
+
+	uint8_t *ptr = tool_out.data + sizeof(header);
+	for (uint32_t i = 0; i < header.num_items; i++) {
+		captured_item item;
+		memcpy(&item.header, ptr, sizeof(item.header));
+		ptr += sizeof(item.header);
+		item.data.assign((const char *)ptr, item.header.size);
+		ptr += item.header.size;
+		items.push_back(item);
+	}
+	cppcut_assert_equal(tool_out.size, (size_t)(ptr - tool_out.data));
+}
+
+static void
+assert_capture(const char *arg, const char *expected_stdout,
+               vector<captured_item> &items)
+{
+	exec_command_info exec_info;
+	testutil::run_target_exe(recipe_file, arg, &exec_info);
+	cut_assert_equal_string(expected_stdout, exec_info.stdout_str.c_str());
+
+	list<record_data_tool_output> tool_output_list;
+	testutil::assert_get_record_data(tool_output_list);
+	cppcut_assert_equal((size_t)1, tool_output_list.size());
+	get_captured_items(tool_output_list.front(), items);
+}
+
+//
+// Tests
+//
+void test_capture_int(void)
+{
+	vector<captured_item> items;
+	assert_capture("sum 5 1", "15", items);
+	cppcut_assert_equal((size_t)1, items.size());
+	cppcut_assert_equal((uint8_t)ARG_CAPTURE_TYPE_INT, items[0].header.type);
+	cppcut_assert_equal((uint8_t)1, items[0].header.nth_arg);
+
+	uint64_t value;
+	cppcut_assert_equal(sizeof(value), items[0].data.size());
+	memcpy(&value, items[0].data.data(), sizeof(value));
+	cppcut_assert_equal((uint64_t)5, value);
+}
+
+void test_capture_string_and_memory(void)
+{
+	vector<captured_item> items;
+	assert_capture("sum_pair label 3 4", "7", items);
+	cppcut_assert_equal((size_t)3, items.size());
+
+	// s:1:16
+	cppcut_assert_equal((uint8_t)ARG_CAPTURE_TYPE_STR, items[0].header.type);
+	cppcut_assert_equal(string("label"), items[0].data);
+
+	// s:1:3 (truncated)
+	cppcut_assert_equal(string("lab"), items[1].data);
+
+	// m:2:4:4 (pair->b)
+	cppcut_assert_equal((uint8_t)ARG_CAPTURE_TYPE_MEM, items[2].header.type);
+	cppcut_assert_equal(4, items[2].header.offset);
+	int b;
+	cppcut_assert_equal(sizeof(b), items[2].data.size());
+	memcpy(&b, items[2].data.data(), sizeof(b));
+	cppcut_assert_equal(4, b);
+}
+
+void test_capture_fault(void)
+{
+	// The first argument of sum_up_to() is not a pointer.
+	vector<captured_item> items;
+	recipe_file = "fixtures/test-arg-capture-fault.recipe";
+	assert_capture("sum 5 1", "15", items);
+	cppcut_assert_equal((size_t)1, items.size());
+	cppcut_assert_equal((uint8_t)ARG_CAPTURE_FLAG_FAULT,
+	                    items[0].header.flags);
+	cppcut_assert_equal((uint32_t)0, items[0].header.size);
+}
+
+}
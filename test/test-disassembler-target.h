@@ -9,6 +9,22 @@ void target_mov_Ev_Iz(void);
 void target_mov_Gv_Ev(void);
 void target_pop_rAX_r8(void);
 void target_pop_rBP_r13(void);
+void target_jcc_Jb(void);
+void target_jmp_Jb(void);
+void target_jmp_Jb_dest(void);
+void target_ret(void);
+void target_endbr(void);
+void target_sub_Ev_Iz(void);
+void target_vex_vmovdqu(void);
+void target_0f38_pshufb(void);
+void target_0f3a_palignr(void);
+void target_evex_vmovups(void);
+void target_jmp_indirect(void);
+void target_rip_relative(void);
+void target_branch_into_head(void);
+void target_branch_into_head_end(void);
+void target_cond_tail_call(void);
+void target_cond_tail_call_end(void);
 
 #ifdef __cplusplus
 }
@@ -1,8 +1,13 @@
 #include <cstdio>
 #include <cppcutter.h>
+#include <sys/mman.h>
 
 #include "test-disassembler-target.h"
 #include "disassembler.h"
+#include "opecode_relocator.h"
+#include "decode_cache.h"
+#include "func_cfg_cache.h"
+#include "func_analyzer.h"
 
 namespace test_disassember {
 
@@ -32,6 +37,38 @@ static void _assert_opecode(
 #define assert_opecode(OPE, LEN, MOD_TYPE, REG, ...) \
 cut_trace(_assert_opecode(OPE, LEN, MOD_TYPE, REG, ##__VA_ARGS__))
 
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Follow the relative jumps and the 'jmp *0x0(%rip)' from the relocated
+ * code and return the final destination.
+ */
+static unsigned long follow_jump(uint8_t *code)
+{
+	while (true) {
+		opecode *op = disassembler::parse(code);
+		opecode_flow_t flow_type = op->get_flow_type();
+		unsigned long dest = 0;
+		if (flow_type == FLOW_JUMP)
+			dest = op->get_rel_jump_dest();
+		else if (flow_type == FLOW_JUMP_INDIRECT && code[1] == 0x25)
+			dest = *((unsigned long *)(code + 6));
+		delete op;
+		if (dest == 0)
+			return (unsigned long)code;
+		code = (uint8_t *)dest;
+	}
+}
+
+static uint8_t *relocate(uint8_t *target)
+{
+	g_ope = disassembler::parse(target);
+	opecode_relocator *relocator = g_ope->get_relocator();
+	uint8_t *code = new uint8_t[relocator->get_max_code_length()];
+	relocator->relocate(code);
+	return code;
+}
+#endif // defined(__x86_64__) || defined(__i386__)
+
 // ---------------------------------------------------------------------------
 // Test code
 // ---------------------------------------------------------------------------
@@ -90,6 +127,253 @@ void test_mov_pop_rBP_r8(void)
 	assert_opecode(g_ope, 1, MOD_REG_NONE, REG_BP);
 }
 
+void test_jcc_Jb(void)
+{
+	g_ope = disassembler::parse((uint8_t *)target_jcc_Jb);
+
+	// jle    +2
+	// 7e 02
+	cppcut_assert_equal(2, g_ope->get_length());
+	cppcut_assert_equal(REL8, g_ope->get_rel_jump_type());
+	cppcut_assert_equal(FLOW_COND_JUMP, g_ope->get_flow_type());
+	cppcut_assert_equal((unsigned long)target_jcc_Jb + 4,
+	                    g_ope->get_rel_jump_dest());
+}
+
+void test_jmp_Jb(void)
+{
+	g_ope = disassembler::parse((uint8_t *)target_jmp_Jb);
+
+	// jmp    target_jmp_Jb_dest
+	cppcut_assert_equal(FLOW_JUMP, g_ope->get_flow_type());
+	cppcut_assert_equal((unsigned long)target_jmp_Jb_dest,
+	                    g_ope->get_rel_jump_dest());
+}
+
+void test_relocate_jcc_Jb(void)
+{
+	// The taken path of the relocated code goes to the original destination
+	uint8_t *code = relocate((uint8_t *)target_jcc_Jb);
+	opecode *op = disassembler::parse(code);
+	cppcut_assert_equal(FLOW_COND_JUMP, op->get_flow_type());
+	unsigned long dest = follow_jump((uint8_t *)op->get_rel_jump_dest());
+	delete op;
+	delete [] code;
+	cppcut_assert_equal((unsigned long)target_jcc_Jb + 4, dest);
+}
+
+void test_relocate_jmp_Jb(void)
+{
+	uint8_t *code = relocate((uint8_t *)target_jmp_Jb);
+	unsigned long dest = follow_jump(code);
+	delete [] code;
+	cppcut_assert_equal((unsigned long)target_jmp_Jb_dest, dest);
+}
+
+void test_ret(void)
+{
+	g_ope = disassembler::parse((uint8_t *)target_ret);
+	cppcut_assert_equal(1, g_ope->get_length());
+	cppcut_assert_equal(FLOW_RET, g_ope->get_flow_type());
+}
+
+void test_endbr(void)
+{
+	// [x86_64] endbr64: f3 0f 1e fa
+	// [i386]   endbr32: f3 0f 1e fb
+	g_ope = disassembler::parse((uint8_t *)target_endbr);
+	cppcut_assert_equal(4, g_ope->get_length());
+	cppcut_assert_equal(FLOW_NEXT, g_ope->get_flow_type());
+}
+
+void test_sub_Ev_Iz(void)
+{
+	// [x86_64] sub $0x1000,%rsp: 48 81 ec 00 10 00 00
+	// [i386]   sub $0x1000,%esp: 81 ec 00 10 00 00
+	g_ope = disassembler::parse((uint8_t *)target_sub_Ev_Iz);
+	cppcut_assert_equal(MOD_REG_DIRECT, g_ope->get_mod_rm().mod);
+	cppcut_assert_equal(REG_BP, g_ope->get_mod_rm().reg); // /5: sub
+	cppcut_assert_equal(REG_SP, g_ope->get_mod_rm().r_m);
+	cppcut_assert_equal(IMM32, g_ope->get_immediate().type);
+	cppcut_assert_equal((uint64_t)0x1000, g_ope->get_immediate().value);
+#if __x86_64__
+	cppcut_assert_equal(7, g_ope->get_length());
+#endif
+#if __i386__
+	cppcut_assert_equal(6, g_ope->get_length());
+#endif
+}
+
+void test_decode(void)
+{
+	decoded_instr instr;
+	uint8_t *code = (uint8_t *)target_sub_Ev_Iz;
+	cppcut_assert_equal(true, disassembler::decode(code, &instr));
+	cppcut_assert_equal(OPCODE_MAP_1BYTE, instr.map);
+	cppcut_assert_equal((uint8_t)0x81, instr.opcode);
+#if __x86_64__
+	int prefix_len = 1;
+	cppcut_assert_equal(PREFIX_REX_W, instr.prefix);
+#endif
+#if __i386__
+	int prefix_len = 0;
+	cppcut_assert_equal(0, instr.prefix);
+#endif
+	cppcut_assert_equal(prefix_len + 1, instr.modrm_offset);
+	cppcut_assert_equal(-1, instr.sib_offset);
+	cppcut_assert_equal(0, instr.disp_size);
+	cppcut_assert_equal(prefix_len + 2, instr.imm_offset);
+	cppcut_assert_equal(4, instr.imm_size);
+}
+
+void test_vex_vmovdqu(void)
+{
+	// vmovdqu 0x20(%rdi),%ymm0: c5 fe 6f 47 20
+	g_ope = disassembler::parse((uint8_t *)target_vex_vmovdqu);
+	cppcut_assert_equal(5, g_ope->get_length());
+	cppcut_assert_equal(MOD_REG_INDIRECT_DISP8, g_ope->get_mod_rm().mod);
+	cppcut_assert_equal(REG_DI, g_ope->get_mod_rm().r_m);
+	cppcut_assert_equal((uint32_t)0x20, g_ope->get_disp().value);
+}
+
+void test_0f38_pshufb(void)
+{
+	// pshufb %xmm1,%xmm2: 66 0f 38 00 d1
+	g_ope = disassembler::parse((uint8_t *)target_0f38_pshufb);
+	cppcut_assert_equal(5, g_ope->get_length());
+	cppcut_assert_equal(IMM_INVALID, g_ope->get_immediate().type);
+}
+
+void test_0f3a_palignr(void)
+{
+	// palignr $0x3,%xmm1,%xmm2: 66 0f 3a 0f d1 03
+	g_ope = disassembler::parse((uint8_t *)target_0f3a_palignr);
+	cppcut_assert_equal(6, g_ope->get_length());
+	cppcut_assert_equal(IMM8, g_ope->get_immediate().type);
+	cppcut_assert_equal((uint64_t)0x3, g_ope->get_immediate().value);
+}
+
+void test_evex_vmovups(void)
+{
+	// vmovups 0x40(%rdi),%zmm1: 62 f1 7c 48 10 4f 01
+	g_ope = disassembler::parse((uint8_t *)target_evex_vmovups);
+	cppcut_assert_equal(7, g_ope->get_length());
+	cppcut_assert_equal(DISP8, g_ope->get_disp().type);
+}
+
+void test_jmp_indirect(void)
+{
+	g_ope = disassembler::parse((uint8_t *)target_jmp_indirect);
+	cppcut_assert_equal(2, g_ope->get_length());
+	cppcut_assert_equal(FLOW_JUMP_INDIRECT, g_ope->get_flow_type());
+	cppcut_assert_equal(REL_INVALID, g_ope->get_rel_jump_type());
+}
+
+void test_decode_cache(void)
+{
+	opecode_arena arena;
+	decode_cache cache;
+	uint8_t *code = (uint8_t *)target_sub_Ev_Iz;
+	opecode *op1 = cache.parse(code, &arena);
+	opecode *op2 = cache.parse(code, &arena);
+	cppcut_assert_equal((size_t)1, cache.get_num_hits());
+	cppcut_assert_equal((size_t)1, cache.get_num_misses());
+	cppcut_assert_not_equal(op1, op2);
+	cppcut_assert_equal(op1->get_length(), op2->get_length());
+	cppcut_assert_equal(code, op2->get_original_addr());
+	cut_assert_equal_memory(code, op2->get_length(),
+	                        op2->get_code(), op2->get_length());
+	cppcut_assert_equal(true, arena.get_allocated_size() > 0);
+
+	// An undecodable instruction is also cached.
+	static uint8_t bad_code[] = {0x0f, 0x04, 0x90, 0x90};
+	cut_assert_null(cache.parse(bad_code, &arena, false));
+	cut_assert_null(cache.parse(bad_code, &arena, false));
+	cppcut_assert_equal((size_t)2, cache.get_num_hits());
+}
+
+void test_func_cfg_branch_into_head(void)
+{
+	// xor %eax,%eax; 1: inc %eax; cmp $0x10,%eax; jl 1b; ret
+	opecode_arena arena;
+	decode_cache cache;
+	decode_context ctx = {&arena, &cache};
+	uint8_t *func = (uint8_t *)target_branch_into_head;
+	size_t size = (uint8_t *)target_branch_into_head_end - func;
+	func_cfg cfg;
+	func_cfg_cache::get("", 0, func, size, &ctx, &cfg);
+	cppcut_assert_equal(true, cfg.analyzed);
+	cppcut_assert_equal(false, cfg.has_indirect_jump);
+	cppcut_assert_equal((size_t)1, cfg.branch_targets.size());
+	cppcut_assert_equal((unsigned long)2, cfg.branch_targets[0]);
+}
+
+void test_exit_cond_tail_call(void)
+{
+	// xor %eax,%eax; test; jne (outside); mov $0x1,%eax; ret
+	opecode_arena arena;
+	decode_cache cache;
+	decode_context ctx = {&arena, &cache};
+	uint8_t *func = (uint8_t *)target_cond_tail_call;
+	size_t size = (uint8_t *)target_cond_tail_call_end - func;
+	func_analyzer analyzer(func, size, &ctx);
+	cppcut_assert_equal(true, analyzer.analyze());
+	cppcut_assert_equal(true, analyzer.has_cond_tail_call());
+	func_exit_site_list_t site_list;
+	cppcut_assert_equal(false, analyzer.find_exit_sites(5, site_list));
+}
+
+#if __x86_64__
+void test_rip_relative(void)
+{
+	// mov 0x100(%rip),%rax: 48 8b 05 00 01 00 00
+	g_ope = disassembler::parse((uint8_t *)target_rip_relative);
+	cppcut_assert_equal(7, g_ope->get_length());
+	cppcut_assert_equal(MOD_REG_INDIRECT, g_ope->get_mod_rm().mod);
+	cppcut_assert_equal(REG_BP, g_ope->get_mod_rm().r_m);
+	cppcut_assert_equal(DISP32, g_ope->get_disp().type);
+	cppcut_assert_equal((uint32_t)0x100, g_ope->get_disp().value);
+}
+
+void test_relocate_rip_relative_far(void)
+{
+	// The relocated code beyond +/-2GB reads the operand address from
+	// the data area with a scratch register.
+	static const size_t size = 0x1000;
+	unsigned long hint = ((unsigned long)target_rip_relative & ~0xfffUL)
+	                     + (1UL << 36);
+	uint8_t *buf = (uint8_t *)mmap((void *)hint, size,
+	                               PROT_READ|PROT_WRITE,
+	                               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	cut_assert_not_equal(MAP_FAILED, buf);
+	if ((unsigned long)buf != hint) {
+		munmap(buf, size);
+		cut_omit("Failed to map the buffer at %lx", hint);
+	}
+
+	g_ope = disassembler::parse((uint8_t *)target_rip_relative);
+	opecode_relocator *relocator = g_ope->get_relocator();
+	uint8_t *data = buf + size - relocator->get_max_data_length();
+	relocator->set_data_addr(data);
+	int length = relocator->relocate(buf);
+	cppcut_assert_equal(relocator->get_max_code_length(), length);
+	cppcut_assert_equal((unsigned long)target_rip_relative + 7 + 0x100,
+	                    *((unsigned long *)data));
+
+	// lea -0x80(%rsp),%rsp; push %rbx; mov data(%rip),%rbx
+	// mov (%rbx),%rax: 48 8b 03
+	opecode *op = disassembler::parse(buf + 13);
+	int op_length = op->get_length();
+	mod_type mod = op->get_mod_rm().mod;
+	register_type r_m = op->get_mod_rm().r_m;
+	delete op;
+	munmap(buf, size);
+	cppcut_assert_equal(3, op_length);
+	cppcut_assert_equal(MOD_REG_INDIRECT, mod);
+	cppcut_assert_equal(REG_BX, r_m);
+}
+#endif // __x86_64__
+
 #endif // defined(__x86_64__) || defined(__i386__)
 
 } // namespace test_disassember
@@ -23,6 +23,8 @@ void setup(void)
 
 void teardown(void)
 {
+	unsetenv("COCKROACH_SIDE_CODE_WX");
+	unsetenv("COCKROACH_DLOPEN_PRE_INIT");
 }
 
 static void assert_func_base(const char *arg, const char *expected_stdout,
@@ -98,6 +100,13 @@ void test_call_many_times(void)
 	assert_exec_sum_and_chk(num_call);
 }
 
+// The return probe bridge is rewritten on each call via the writable view.
+void test_side_code_wx(void)
+{
+	setenv("COCKROACH_SIDE_CODE_WX", "1", 1);
+	assert_exec_sum_and_chk(3);
+}
+
 // target_exe
 void test_target_exe(void)
 {
@@ -136,4 +145,25 @@ void test_dlopen_extlib(void)
 	assert_func("implicit_open_target_2x", "4");
 }
 
+// The probe is installed again after dlclose() and dlopen().
+void test_dlopen_after_dlclose(void)
+{
+	exec_command_info exec_info;
+	assert_func_base("implicit_dlopener_3x_reopen", "66", &exec_info);
+	target_probe_info probe_info(exec_info.child_pid, g_recipe_file,
+	                             "implicit_dlopener_3x");
+	testutil::assert_measured_time(2, &probe_info);
+}
+
+// The probe is active while the constructor of the library runs.
+void test_dlopen_constructor(void)
+{
+	setenv("COCKROACH_DLOPEN_PRE_INIT", "1", 1);
+	exec_command_info exec_info;
+	assert_func_base("implicit_dlopener_3x", "6", &exec_info);
+	target_probe_info probe_info(exec_info.child_pid, g_recipe_file,
+	                             "implicit_dlopener_ctor_4x");
+	testutil::assert_measured_time(1, &probe_info);
+}
+
 }
@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <cppcutter.h>
+#include <glib.h>
+
+#include <boost/algorithm/string.hpp>
+using namespace boost;
+
+#include "testutil.h"
+
+namespace test_ret_value {
+
+static const char *recipe_file = "fixtures/test-ret-value.recipe";
+
+void setup(void)
+{
+	testutil::reset_ret_value();
+}
+
+void teardown(void)
+{
+}
+
+static void assert_run(const char *arg, const char *expected_stdout)
+{
+	exec_command_info exec_info;
+	testutil::run_target_exe(recipe_file, arg, &exec_info);
+	cut_assert_equal_string(expected_stdout, exec_info.stdout_str.c_str());
+}
+
+static void
+_assert_ret_value_list(const char *expected_label, int expected_count)
+{
+	static const int NUM_RET_VALUE_TOKENS = 7;
+	static const int IDX_LABEL = 2;
+	static const int IDX_COUNT = 3;
+
+	exec_command_info exec_info;
+	testutil::exec_ret_value_tool("list", &exec_info);
+	string lines = exec_info.stdout_str;
+	trim(lines);
+	vector<string> tokens;
+	split(tokens, lines, is_any_of(" "), token_compress_on);
+	cppcut_assert_equal(NUM_RET_VALUE_TOKENS, (int)tokens.size());
+	cut_assert_equal_string(expected_label, tokens[IDX_LABEL].c_str());
+	cppcut_assert_equal(expected_count, atoi(tokens[IDX_COUNT].c_str()));
+}
+#define assert_ret_value_list(L,C) cut_trace(_assert_ret_value_list(L,C))
+
+//
+// Tests
+//
+void test_value(void)
+{
+	// installed at the entry and hooks the return address
+	assert_run("sum 5 3", "151515");
+	assert_ret_value_list("15", 3);
+}
+
+void test_class_at_exit(void)
+{
+	assert_run("func1", "3");
+	assert_ret_value_list("pos", 1);
+}
+
+}
@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <cppcutter.h>
+#include <glib.h>
+
+#include "testutil.h"
+#include "cockroach-probe.h"
+#include "cockroach-stack-capture.h"
+
+namespace test_stack_capture {
+
+static const char *default_recipe_file = "fixtures/test-stack-capture.recipe";
+static const char *recipe_file = NULL;
+
+struct captured_stack {
+	stack_capture_record_header header;
+	vector<uint64_t> addrs;
+	string raw;
+};
+
+void setup(void)
+{
+	recipe_file = default_recipe_file;
+	testutil::reset_record_data();
+}
+
+void teardown(void)
+{
+}
+
+static void
+get_captured_stack(record_data_tool_output &tool_out, captured_stack &stack)
+{
+	stack_capture_record_header &header = stack.header;
+	cppcut_assert_equal(true, tool_out.size >= sizeof(header));
+	memcpy(&header, tool_out.data, sizeof(header));
+
+	uint8_t *ptr = tool_out.data + sizeof(header);
+	stack.addrs.resize(header.depth);
+	memcpy(&stack.addrs[0], ptr, header.depth * sizeof(uint64_t));
+	ptr += header.depth * sizeof(uint64_t);
+	stack.raw.assign((const char *)ptr, header.raw_size);
+	ptr += header.raw_size;
+	cppcut_assert_equal(tool_out.size, (size_t)(ptr - tool_out.data));
+}
+
+static void
+assert_capture(const char *arg, const char *expected_stdout,
+               vector<captured_stack> &stacks, size_t *num_maps)
+{
+	exec_command_info exec_info;
+	testutil::run_target_exe(recipe_file, arg, &exec_info);
+	cut_assert_equal_string(expected_stdout, exec_info.stdout_str.c_str());
+
+	list<record_data_tool_output> tool_output_list;
+	testutil::assert_get_record_data(tool_output_list);
+	*num_maps = 0;
+	list<record_data_tool_output>::iterator it = tool_output_list.begin();
+	for (; it != tool_output_list.end(); ++it) {
+		if (it->id == COCKROACH_RECORD_ID_STACK_MAP) {
+			(*num_maps)++;
+			continue;
+		}
+		cppcut_assert_equal((uint32_t)COCKROACH_RECORD_ID_STACK_CAPTURE,
+		                    it->id);
+		captured_stack stack;
+		get_captured_stack(*it, stack);
+		stacks.push_back(stack);
+	}
+}
+
+//
+// Tests
+//
+void test_capture_stack(void)
+{
+	vector<captured_stack> stacks;
+	size_t num_maps;
+	assert_capture("sum 5 1", "15", stacks, &num_maps);
+	cppcut_assert_equal((size_t)1, stacks.size());
+	cppcut_assert_equal(true, num_maps > 0);
+
+	// The raw stack begins with the return address of the target.
+	captured_stack &stack = stacks[0];
+	cppcut_assert_equal(true, stack.header.depth >= 1);
+	cppcut_assert_equal((uint32_t)64, stack.header.raw_size);
+	unsigned long ret_addr;
+	memcpy(&ret_addr, stack.raw.data(), sizeof(ret_addr));
+	cppcut_assert_equal((unsigned long)stack.addrs[0], ret_addr);
+}
+
+void test_symbolize_stacks(void)
+{
+	vector<captured_stack> stacks;
+	size_t num_maps;
+	assert_capture("sum 5 3", "151515", stacks, &num_maps);
+	cppcut_assert_equal((size_t)3, stacks.size());
+
+	// The same stack is counted up.
+	exec_command_info exec_info;
+	testutil::exec_record_data_tool("stacks", &exec_info);
+	const string &out = exec_info.stdout_str;
+	cut_assert(out.find("count: 3\n") != string::npos);
+	cut_assert(out.find("sum_up_to+0x0 (libtargets.so") != string::npos);
+	cut_assert(out.find("<- main+0x") != string::npos);
+}
+
+}
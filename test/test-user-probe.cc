@@ -1,6 +1,8 @@
 #include <cstdio>
 #include <cppcutter.h>
 #include <glib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <boost/format.hpp>
 using namespace boost;
@@ -10,14 +12,23 @@ using namespace boost;
 
 namespace test_user_probe {
 
-static const char *recipe_file = "fixtures/test-user-probe.recipe";
+static const char *default_recipe_file = "fixtures/test-user-probe.recipe";
+static const char *recipe_file = NULL;
+static const char *recipe_cache_file = "test-user-probe-recipe.cache";
+static const char *reload_recipe_file = "test-user-probe-reload.recipe";
 
 void setup(void)
 {
+	recipe_file = default_recipe_file;
 }
 
 void teardown(void)
 {
+	unsetenv("COCKROACH_SHARED_BRIDGE");
+	unsetenv("COCKROACH_RECIPE_CACHE");
+	unsetenv("COCKROACH_RELOAD_INTERVAL_MS");
+	unlink(recipe_cache_file);
+	unlink(reload_recipe_file);
 }
 
 static void
@@ -34,7 +45,9 @@ static void assert_func(const char *arg, const char *expected_stdout)
 	assert_func_base(arg, expected_stdout, &exec_info);
 }
 
-static void assert_exec_data_record(size_t num_call = 1)
+static void assert_exec_data_record(size_t num_call = 1,
+                                    unsigned long expected_arg0 = 5,
+                                    size_t records_per_call = 1)
 {
 	// exec
 	const unsigned long arg_num = 5;
@@ -48,7 +61,8 @@ static void assert_exec_data_record(size_t num_call = 1)
 	// check the output
 	list<record_data_tool_output> tool_output_list;
 	testutil::assert_get_record_data(tool_output_list);
-	cppcut_assert_equal(num_call, tool_output_list.size());
+	cppcut_assert_equal(num_call * records_per_call,
+	                    tool_output_list.size());
 
 	list<record_data_tool_output>::iterator it = tool_output_list.begin();
 	for (; it != tool_output_list.end(); ++it) {
@@ -56,7 +70,7 @@ static void assert_exec_data_record(size_t num_call = 1)
 		cppcut_assert_equal(sizeof(user_record_t), tool_out.size);
 		user_record_t *record
 		  = reinterpret_cast<user_record_t *>(tool_out.data);
-		cppcut_assert_equal(arg_num, record->arg0);
+		cppcut_assert_equal(expected_arg0, record->arg0);
 	}
 }
 
@@ -84,6 +98,170 @@ void test_data_record(void)
 	assert_exec_data_record();
 }
 
+// The number of calls is kept in the per-thread scratch area.
+void test_data_record_call_times(void)
+{
+	testutil::reset_record_data();
+	assert_exec_data_record(3);
+
+	list<record_data_tool_output> tool_output_list;
+	testutil::assert_get_record_data(tool_output_list);
+	int call_times = 0;
+	list<record_data_tool_output>::iterator it = tool_output_list.begin();
+	for (; it != tool_output_list.end(); ++it, call_times++) {
+		user_record_t *record
+		  = reinterpret_cast<user_record_t *>(it->data);
+		cppcut_assert_equal(call_times, record->call_times);
+	}
+}
+
+void test_user_probe_symbol(void)
+{
+	recipe_file = "fixtures/test-user-probe-symbol.recipe";
+	assert_func("func1", "3");
+}
+
+void test_data_record_symbol(void)
+{
+	recipe_file = "fixtures/test-user-probe-symbol.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record();
+}
+
+void test_data_record_reserve(void)
+{
+	recipe_file = "fixtures/test-user-probe-reserve.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record();
+}
+
+void test_data_record_reserve_batch(void)
+{
+	recipe_file = "fixtures/test-user-probe-reserve-batch.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record(2, 5, DATA_RECORDER_BATCH_SIZE);
+}
+
+void test_user_probe_pattern(void)
+{
+	recipe_file = "fixtures/test-user-probe-pattern.recipe";
+	assert_func("func1", "3");
+}
+
+void test_data_record_regex_pattern(void)
+{
+	recipe_file = "fixtures/test-user-probe-pattern.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record();
+}
+
+void test_exit_probe(void)
+{
+	recipe_file = "fixtures/test-user-probe-exit.recipe";
+	assert_func("func1", "3");
+}
+
+void test_exit_probe_ret_value(void)
+{
+	// sum_up_to(5) returns 15
+	recipe_file = "fixtures/test-user-probe-exit.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record(1, 15);
+}
+
+void test_shared_bridge(void)
+{
+	setenv("COCKROACH_SHARED_BRIDGE", "1", 1);
+	testutil::reset_record_data();
+	assert_exec_data_record();
+}
+
+void test_shared_bridge_exit_probe(void)
+{
+	setenv("COCKROACH_SHARED_BRIDGE", "1", 1);
+	recipe_file = "fixtures/test-user-probe-exit.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record(1, 15);
+}
+
+// The targets are resolved at the first run and are given from the cache
+// at the second run. The file is replaced only when a probe isn't found
+// in it, so it is the same file after the second run.
+void test_recipe_cache_pattern(void)
+{
+	recipe_file = "fixtures/test-user-probe-pattern.recipe";
+	unlink(recipe_cache_file);
+	setenv("COCKROACH_RECIPE_CACHE", recipe_cache_file, 1);
+	testutil::reset_record_data();
+	assert_exec_data_record();
+	struct stat first_stat;
+	cppcut_assert_equal(0, stat(recipe_cache_file, &first_stat));
+	testutil::reset_record_data();
+	assert_exec_data_record();
+	struct stat second_stat;
+	cppcut_assert_equal(0, stat(recipe_cache_file, &second_stat));
+	cppcut_assert_equal(first_stat.st_ino, second_stat.st_ino);
+}
+
+// The probe is removed by the recipe without probes while the target runs,
+// so only the first call is recorded.
+void test_reload_recipe(void)
+{
+	FILE *fp = fopen(reload_recipe_file, "w");
+	cut_assert(fp);
+	fputs("# no probes\n", fp);
+	fclose(fp);
+	setenv("COCKROACH_RELOAD_INTERVAL_MS", "10", 1);
+	testutil::reset_record_data();
+	exec_command_info exec_info;
+	string arg = (format("sum_reload 5 %s") % reload_recipe_file).str();
+	assert_func_base(arg.c_str(), "1515", &exec_info);
+
+	list<record_data_tool_output> tool_output_list;
+	testutil::assert_get_record_data(tool_output_list);
+	cppcut_assert_equal((size_t)1, tool_output_list.size());
+}
+
+// The ABS64 jump isn't removed while the target runs, so the new recipe is
+// rejected and both calls are recorded.
+void test_reload_recipe_abs64(void)
+{
+	recipe_file = "fixtures/test-user-probe-abs64.recipe";
+	FILE *fp = fopen(reload_recipe_file, "w");
+	cut_assert(fp);
+	fputs("# no probes\n", fp);
+	fclose(fp);
+	setenv("COCKROACH_RELOAD_INTERVAL_MS", "10", 1);
+	testutil::reset_record_data();
+	exec_command_info exec_info;
+	string arg = (format("sum_reload_rejected 5 %s") %
+	              reload_recipe_file).str();
+	assert_func_base(arg.c_str(), "1515", &exec_info);
+
+	list<record_data_tool_output> tool_output_list;
+	testutil::assert_get_record_data(tool_output_list);
+	cppcut_assert_equal((size_t)2, tool_output_list.size());
+}
+
+// The name of the main thread matches either of THREAD_NAME options.
+void test_thread_name_filter(void)
+{
+	recipe_file = "fixtures/test-user-probe-thread-name.recipe";
+	testutil::reset_record_data();
+	assert_exec_data_record();
+}
+
+void test_thread_name_filter_nomatch(void)
+{
+	recipe_file = "fixtures/test-user-probe-thread-name-nomatch.recipe";
+	testutil::reset_record_data();
+	assert_func("sum 5 1", "15");
+
+	list<record_data_tool_output> tool_output_list;
+	testutil::assert_get_record_data(tool_output_list);
+	cppcut_assert_equal((size_t)0, tool_output_list.size());
+}
+
 void test_data_record_many_times(void)
 {
 	int shm_window_sz = 1024*1024;
@@ -350,6 +350,22 @@ void testutil::reset_record_data(void)
 	exec_record_data_tool("reset", &exec_info);
 }
 
+void
+testutil::exec_ret_value_tool(const char *arg, exec_command_info *exec_info)
+{
+	const gchar *cmd = "../src/cockroach-ret-value-tool";
+	const char *argv[] = {cmd, arg, NULL};
+	exec_info->argv = argv;
+	exec_info->save_stdout = true;
+	exec_command(exec_info);
+}
+
+void testutil::reset_ret_value(void)
+{
+	exec_command_info exec_info;
+	exec_ret_value_tool("reset", &exec_info);
+}
+
 string testutil::get_exit_info(int status)
 {
 	ostringstream ss;
@@ -77,6 +77,9 @@ public:
 	static void exec_record_data_tool(const char *arg,
 	                                  exec_command_info *exec_info);
 	static void reset_record_data(void);
+	static void exec_ret_value_tool(const char *arg,
+	                                exec_command_info *exec_info);
+	static void reset_ret_value(void);
 	static string get_exit_info(int status);
 	static const string &get_signal_name(int signo);
 };
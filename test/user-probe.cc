@@ -18,9 +18,14 @@ void data_recorder_init(probe_init_arg_t *arg)
 {
 	user_data *priv = new user_data();
 	priv->id = USER_DATA_ID;
-	priv->call_times = 0;
+	priv->scratch = cockroach_alloc_thread_scratch(sizeof(int));
 	arg->priv_data = priv;
+}
 
+static int count_call(user_data *priv)
+{
+	int *call_times = (int *)cockroach_get_thread_scratch(priv->scratch);
+	return (*call_times)++;
 }
 
 extern "C"
@@ -28,8 +33,53 @@ void data_recorder(probe_arg_t *arg)
 {
 	user_data *priv = (user_data *)arg->priv_data;
 	user_record_t record;
-	record.call_times = priv->call_times++;
+	record.call_times = count_call(priv);
 	record.arg0 = cockroach_get_target_func_arg(arg, 1);
 	cockroach_record_data_on_shm(priv->id, sizeof(user_record_t), &record);
 }
 
+// writes the record in place
+extern "C"
+void data_recorder_in_place(probe_arg_t *arg)
+{
+	user_data *priv = (user_data *)arg->priv_data;
+	cockroach_record_handle_t handle;
+	user_record_t *record = (user_record_t *)
+	  cockroach_reserve_record(priv->id, sizeof(user_record_t), &handle);
+	record->call_times = count_call(priv);
+	record->arg0 = cockroach_get_target_func_arg(arg, 1);
+	cockroach_commit_record(&handle);
+}
+
+// writes DATA_RECORDER_BATCH_SIZE records at once
+extern "C"
+void data_recorder_batch(probe_arg_t *arg)
+{
+	user_data *priv = (user_data *)arg->priv_data;
+	cockroach_record_handle_t handle;
+	cockroach_reserve_records(priv->id, sizeof(user_record_t),
+	                          DATA_RECORDER_BATCH_SIZE, &handle);
+	for (int i = 0; i < DATA_RECORDER_BATCH_SIZE; i++) {
+		user_record_t *record = (user_record_t *)
+		  cockroach_get_reserved_record(&handle, i);
+		record->call_times = count_call(priv);
+		record->arg0 = cockroach_get_target_func_arg(arg, 1);
+	}
+	cockroach_commit_record(&handle);
+}
+
+extern "C"
+void ret_value_recorder(probe_arg_t *arg)
+{
+	// installed at the exits of the target function
+	user_record_t record;
+	record.call_times = 0;
+#ifdef __x86_64__
+	record.arg0 = arg->rax;
+#endif // __x86_64__
+#ifdef __i386__
+	record.arg0 = arg->eax;
+#endif // __i386__
+	cockroach_record_data_on_shm(USER_DATA_ID, sizeof(user_record_t),
+	                             &record);
+}
@@ -1,9 +1,11 @@
 #ifndef user_probe_h
 #define user_probe_h
 
+#define DATA_RECORDER_BATCH_SIZE 3
+
 struct user_data {
 	int id;
-	int call_times;
+	int scratch; // the number of calls in each thread
 };
 
 struct user_record_t {